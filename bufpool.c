@@ -0,0 +1,136 @@
+/*****************************************************************************
+ *  Written by Chris Dunlap <cdunlap@llnl.gov>.
+ *  Copyright (C) 2007-2013 Lawrence Livermore National Security, LLC.
+ *  Copyright (C) 2001-2007 The Regents of the University of California.
+ *  UCRL-CODE-2002-009.
+ *
+ *  This file is part of ConMan: The Console Manager.
+ *  For details, see <http://conman.googlecode.com/>.
+ *
+ *  ConMan is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  ConMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with ConMan.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ *  Refer to "bufpool.h" for documentation on public functions.
+ *****************************************************************************/
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "bufpool.h"
+#include "wrapper.h"
+
+
+/*  Number of power-of-two size classes from BUFPOOL_MIN_SIZE
+ *    to BUFPOOL_MAX_SIZE (ie, 1K through 1M).
+ */
+#define BUFPOOL_NUM_CLASSES     11
+
+typedef struct bufpool_node {
+    struct bufpool_node *next;          /* next free buf in this size class  */
+} bufpool_node_t;
+
+
+static bufpool_node_t * bufpool_free_lists[BUFPOOL_NUM_CLASSES];
+static pthread_mutex_t bufpool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static int bufpool_class(int size);
+
+
+int bufpool_size(int len)
+{
+    int size;
+
+    if (len > BUFPOOL_MAX_SIZE) {
+        return(-1);
+    }
+    for (size = BUFPOOL_MIN_SIZE; size < len; size <<= 1) {
+        ;
+    }
+    return(size);
+}
+
+
+void * bufpool_alloc(int size)
+{
+/*  Free buffers of each size class are kept on a singly-linked list
+ *    threaded through the buffers themselves.  When a class's list is empty,
+ *    a new slab is allocated and carved up into buffers of that class.
+ */
+    int i;
+    int n;
+    unsigned char *slab;
+    bufpool_node_t *p;
+
+    i = bufpool_class(size);
+
+    x_pthread_mutex_lock(&bufpool_lock);
+
+    if (!bufpool_free_lists[i]) {
+        n = (size < BUFPOOL_SLAB_SIZE) ? (BUFPOOL_SLAB_SIZE / size) : 1;
+        if ((slab = malloc(n * size))) {
+            while (n-- > 0) {
+                p = (bufpool_node_t *) (slab + (n * size));
+                p->next = bufpool_free_lists[i];
+                bufpool_free_lists[i] = p;
+            }
+        }
+    }
+    if ((p = bufpool_free_lists[i])) {
+        bufpool_free_lists[i] = p->next;
+    }
+    x_pthread_mutex_unlock(&bufpool_lock);
+
+    return(p);
+}
+
+
+void bufpool_free(void *buf, int size)
+{
+    int i;
+    bufpool_node_t *p;
+
+    if (!buf) {
+        return;
+    }
+    i = bufpool_class(size);
+    p = buf;
+
+    x_pthread_mutex_lock(&bufpool_lock);
+    p->next = bufpool_free_lists[i];
+    bufpool_free_lists[i] = p;
+    x_pthread_mutex_unlock(&bufpool_lock);
+
+    return;
+}
+
+
+static int bufpool_class(int size)
+{
+/*  Returns the index of the free list for buffers of (size) bytes.
+ */
+    int i;
+
+    assert(size == bufpool_size(size));
+
+    for (i = 0; (BUFPOOL_MIN_SIZE << i) < size; i++) {
+        ;
+    }
+    assert(i < BUFPOOL_NUM_CLASSES);
+    return(i);
+}
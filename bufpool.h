@@ -0,0 +1,64 @@
+/*****************************************************************************
+ *  Written by Chris Dunlap <cdunlap@llnl.gov>.
+ *  Copyright (C) 2007-2013 Lawrence Livermore National Security, LLC.
+ *  Copyright (C) 2001-2007 The Regents of the University of California.
+ *  UCRL-CODE-2002-009.
+ *
+ *  This file is part of ConMan: The Console Manager.
+ *  For details, see <http://conman.googlecode.com/>.
+ *
+ *  ConMan is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  ConMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with ConMan.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#ifndef _BUFPOOL_H
+#define _BUFPOOL_H
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+/*  Buffers are allocated in power-of-two size classes
+ *    between BUFPOOL_MIN_SIZE and BUFPOOL_MAX_SIZE bytes (inclusive).
+ *  Classes smaller than BUFPOOL_SLAB_SIZE are carved out of slabs of
+ *    that size; larger classes are allocated one buffer at a time.
+ */
+#define BUFPOOL_MIN_SIZE        1024
+#define BUFPOOL_MAX_SIZE        (1024 * 1024)
+#define BUFPOOL_SLAB_SIZE       (64 * 1024)
+
+
+int bufpool_size(int len);
+/*
+ *  Returns the size of the smallest buffer class that can hold (len) bytes,
+ *    or -1 if (len) exceeds BUFPOOL_MAX_SIZE.
+ */
+
+void * bufpool_alloc(int size);
+/*
+ *  Allocates a buffer of (size) bytes from the pool, where (size) is
+ *    a buffer class returned by bufpool_size().
+ *  Returns a ptr to the buffer, or NULL if insufficient memory is available.
+ *  Note that buffers are not zero'd.
+ */
+
+void bufpool_free(void *buf, int size);
+/*
+ *  Returns the buffer (buf) of (size) bytes to the pool for reuse.
+ *  Note that the memory backing the pool is never released.
+ */
+
+
+#endif /* !_BUFPOOL_H */
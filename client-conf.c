@@ -30,6 +30,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -46,6 +47,8 @@
 
 
 static void read_consoles_from_file(List consoles, char *file);
+static time_t parse_time(const char *str);
+static off_t parse_size(const char *str);
 static void display_client_help(client_conf_t *conf);
 
 
@@ -161,7 +164,7 @@ void process_client_cmd_line(int argc, char *argv[], client_conf_t *conf)
         conf->prog = create_string(argv[0]);
 
     opterr = 0;
-    while ((c = getopt(argc, argv, "bd:e:fF:hjl:LmqQrvV")) != -1) {
+    while ((c = getopt(argc, argv, "bd:e:fF:hjl:LmMqQrR:t:vV")) != -1) {
         switch(c) {
         case 'b':
             conf->req->enableBroadcast = 1;
@@ -206,6 +209,10 @@ void process_client_cmd_line(int argc, char *argv[], client_conf_t *conf)
         case 'm':
             conf->req->command = CONMAN_CMD_MONITOR;
             break;
+        case 'M':
+            conf->req->command = CONMAN_CMD_MONITOR;
+            conf->req->enableMux = 1;
+            break;
         case 'q':
             conf->req->command = CONMAN_CMD_QUERY;
             break;
@@ -215,6 +222,19 @@ void process_client_cmd_line(int argc, char *argv[], client_conf_t *conf)
         case 'r':
             conf->req->enableRegex = 1;
             break;
+        case 'R':
+            if ((conf->req->replayLen = parse_size(optarg)) <= 0)
+                log_err(0, "CMDLINE: invalid replay size \"%s\"", optarg);
+            break;
+        case 't':
+            conf->req->command = CONMAN_CMD_LOG;
+            if ((p = strchr(optarg, ',')))
+                *p++ = '\0';
+            if ((conf->req->tStart = parse_time(optarg)) < 0)
+                log_err(0, "CMDLINE: invalid start time \"%s\"", optarg);
+            if (p && ((conf->req->tStop = parse_time(p)) < 0))
+                log_err(0, "CMDLINE: invalid stop time \"%s\"", p);
+            break;
         case 'v':
             conf->enableVerbose = 1;
             break;
@@ -230,13 +250,28 @@ void process_client_cmd_line(int argc, char *argv[], client_conf_t *conf)
         }
     }
 
+    /*  A multiplexed session is only used by the client for monitoring.
+     */
+    if (conf->req->command != CONMAN_CMD_MONITOR) {
+        conf->req->enableMux = 0;
+    }
     /*  Disable those options not used in R/O mode.
      */
-    if (conf->req->command == CONMAN_CMD_MONITOR) {
+    if ((conf->req->command == CONMAN_CMD_MONITOR)
+      || (conf->req->command == CONMAN_CMD_LOG)) {
         conf->req->enableBroadcast = 0;
         conf->req->enableForce = 0;
         conf->req->enableJoin = 0;
     }
+    /*  A R/W session favors the latency of echoing each keystroke,
+     *    whereas a R/O session favors the throughput of console output.
+     */
+    if (conf->req->command == CONMAN_CMD_CONNECT) {
+        conf->req->enableInteractive = 1;
+    }
+    else if (conf->req->command == CONMAN_CMD_MONITOR) {
+        conf->req->enableBulk = 1;
+    }
 
     for (i=optind; i<argc; i++) {
 
@@ -311,6 +346,99 @@ static void read_consoles_from_file(List consoles, char *file)
 }
 
 
+static time_t parse_time(const char *str)
+{
+/*  Parses 'str' for a time of the form "[YYYY-MM-DD ]HH:MM[:SS]" in local
+ *    time (defaulting to the current date), or "@SECONDS" since the epoch.
+ *  Returns the time, or -1 on error.
+ */
+    struct tm tm;
+    time_t t;
+    long l;
+    char *p;
+    int n;
+    int year, mon, mday;
+
+    if (*str == '@') {
+        errno = 0;
+        l = strtol(str + 1, &p, 10);
+        if ((p == str + 1) || (*p != '\0') || (errno != 0) || (l < 0))
+            return(-1);
+        return((time_t) l);
+    }
+    t = 0;
+    get_localtime(&t, &tm);
+    tm.tm_sec = 0;
+
+    n = 0;
+    if ((sscanf(str, "%4d-%2d-%2d %n", &year, &mon, &mday, &n) == 3)
+      && (n > 0)) {
+        tm.tm_year = year - 1900;
+        tm.tm_mon = mon - 1;
+        tm.tm_mday = mday;
+        str += n;
+    }
+    n = 0;
+    if ((sscanf(str, "%2d:%2d%n", &tm.tm_hour, &tm.tm_min, &n) != 2)
+      || (n == 0))
+        return(-1);
+    str += n;
+    if (*str == ':') {
+        n = 0;
+        if ((sscanf(str, ":%2d%n", &tm.tm_sec, &n) != 1) || (n == 0))
+            return(-1);
+        str += n;
+    }
+    if ((*str != '\0')
+      || (tm.tm_mon < 0) || (tm.tm_mon > 11)
+      || (tm.tm_mday < 1) || (tm.tm_mday > 31)
+      || (tm.tm_hour < 0) || (tm.tm_hour > 23)
+      || (tm.tm_min < 0) || (tm.tm_min > 59)
+      || (tm.tm_sec < 0) || (tm.tm_sec > 60))
+        return(-1);
+    tm.tm_isdst = -1;
+    return(mktime(&tm));
+}
+
+
+static off_t parse_size(const char *str)
+{
+/*  Parses 'str' for a size in bytes, optionally qualified by a 'k', 'm',
+ *    or 'g' suffix for kilobytes, megabytes, or gigabytes.
+ *  Returns the size, or -1 on error.
+ */
+    long long n;
+    char *p;
+    int shift;
+
+    errno = 0;
+    n = strtoll(str, &p, 10);
+    if ((p == str) || (errno != 0) || (n <= 0))
+        return(-1);
+    switch (tolower((int) *p)) {
+    case '\0':
+        shift = 0;
+        break;
+    case 'k':
+        shift = 10;
+        break;
+    case 'm':
+        shift = 20;
+        break;
+    case 'g':
+        shift = 30;
+        break;
+    default:
+        return(-1);
+    }
+    if ((shift > 0) && (*++p != '\0'))
+        return(-1);
+    if (n > (LLONG_MAX >> shift))
+        return(-1);
+    return((off_t) (n << shift));
+}
+
+
 static void display_client_help(client_conf_t *conf)
 {
     char esc[3];
@@ -330,9 +458,12 @@ static void display_client_help(client_conf_t *conf)
     printf("  -l FILE   Log connection output to file.\n");
     printf("  -L        Display license information.\n");
     printf("  -m        Monitor connection (read-only).\n");
+    printf("  -M        Monitor multiple consoles over one connection.\n");
     printf("  -q        Query server about specified console(s).\n");
     printf("  -Q        Be quiet and suppress informational messages.\n");
     printf("  -r        Match console names via regex instead of globbing.\n");
+    printf("  -R SIZE   Replay SIZE bytes of console log on connect.\n");
+    printf("  -t TIMES  Retrieve console log between START[,STOP] times.\n");
     printf("  -v        Be verbose.\n");
     printf("  -V        Display version information.\n");
     printf("\n");
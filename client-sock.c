@@ -30,6 +30,8 @@
 #include <errno.h>
 #include <sys/types.h>                  /* include before in.h for bsd */
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,10 +44,32 @@
 #include "util-file.h"
 #include "util-net.h"
 #include "util-str.h"
-
-
-static void parse_rsp_ok(Lex l, client_conf_t *conf);
+#include "util.h"
+
+
+typedef struct mux_display {            /* MULTIPLEXED SESSION DISPLAY:      */
+    client_conf_t  *conf;               /*  client configuration             */
+    int             fd;                 /*  fd to which output is written    */
+    char          **names;              /*  ary of console names by stream   */
+    int             numNames;           /*  num of names in ary              */
+    uint32_t       *grants;             /*  ary of credit to grant by stream */
+    int            *ids;                /*  ary of ids with credit to grant  */
+    int             numIds;             /*  num of ids in ary                */
+    uint32_t        lastId;             /*  stream id of last output         */
+    int             isMidLine;          /*  true if last output not at EOL   */
+    int             len;                /*  num bytes of output in buf       */
+    char            buf[MAX_BUF_SIZE];  /*  buf of output to be written      */
+} mux_display_t;
+
+
+static int recv_rsp_line(client_conf_t *conf, char *buf, int buflen);
+static int parse_rsp_ok(Lex l, client_conf_t *conf);
 static void parse_rsp_err(Lex l, client_conf_t *conf);
+static void write_consoles(client_conf_t *conf, int fd, char *buf, int len);
+static void display_mux_frame(mux_display_t *md, int type, uint32_t id,
+    const unsigned char *src, int len);
+static void put_mux_output(mux_display_t *md, const char *src, int len);
+static void send_mux_grants(mux_display_t *md);
 
 
 int connect_to_server(client_conf_t *conf)
@@ -54,6 +78,7 @@ int connect_to_server(client_conf_t *conf)
     struct sockaddr_in saddr;
     char buf[MAX_LINE];
     char *p;
+    const int on = 1;
 
     assert(conf->req->host != NULL);
     assert(conf->req->port > 0);
@@ -61,6 +86,15 @@ int connect_to_server(client_conf_t *conf)
     if ((sd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
         log_err(errno, "Unable to create socket");
 
+    /*  Keystrokes are sent as they are typed in an interactive session.
+     */
+    if (conf->req->enableInteractive) {
+        if (setsockopt(sd, IPPROTO_TCP, TCP_NODELAY,
+                (const void *) &on, sizeof(on)) < 0) {
+            log_err(errno, "Unable to set NODELAY socket option");
+        }
+    }
+
     memset(&saddr, 0, sizeof(saddr));
     saddr.sin_family = AF_INET;
     saddr.sin_port = htons(conf->req->port);
@@ -98,6 +132,7 @@ int send_greeting(client_conf_t *conf)
 {
     char buf[MAX_SOCK_LINE] = "";       /* init buf for appending with NUL */
     int n;
+    int gotMux;
 
     assert(conf->req->sd >= 0);
     assert(conf->req->user != NULL);
@@ -110,6 +145,11 @@ int send_greeting(client_conf_t *conf)
         n = append_format_string(buf, sizeof(buf), " %s='%s'",
             proto_strs[LEX_UNTOK(CONMAN_TOK_TTY)], lex_encode(conf->req->tty));
     }
+    if (conf->req->enableMux) {
+        n = append_format_string(buf, sizeof(buf), " %s=%s",
+            proto_strs[LEX_UNTOK(CONMAN_TOK_OPTION)],
+            proto_strs[LEX_UNTOK(CONMAN_TOK_MUX)]);
+    }
 
     n = append_format_string(buf, sizeof(buf), "\n");
 
@@ -128,6 +168,12 @@ int send_greeting(client_conf_t *conf)
         return(-1);
     }
 
+    /*  A multiplexed session is only enabled if the server acknowledges it
+     *    in its response (cf, parse_rsp_ok).
+     */
+    gotMux = conf->req->enableMux;
+    conf->req->enableMux = 0;
+
     if (recv_rsp(conf) < 0) {
         if (conf->errnum == CONMAN_ERR_AUTHENTICATE) {
             /*
@@ -140,6 +186,13 @@ int send_greeting(client_conf_t *conf)
         }
         return(-1);
     }
+    if (gotMux && !conf->req->enableMux) {
+        conf->errnum = CONMAN_ERR_LOCAL;
+        conf->errmsg = create_format_string(
+            "Server <%s:%d> does not support multiplexed sessions",
+            conf->req->host, conf->req->port);
+        return(-1);
+    }
     return(0);
 }
 
@@ -163,6 +216,9 @@ int send_req(client_conf_t *conf)
     case CONMAN_CMD_CONNECT:
         cmd = proto_strs[LEX_UNTOK(CONMAN_TOK_CONNECT)];
         break;
+    case CONMAN_CMD_LOG:
+        cmd = proto_strs[LEX_UNTOK(CONMAN_TOK_LOG)];
+        break;
     default:
         log_err(0, "INTERNAL: Invalid command=%d", conf->req->command);
         break;
@@ -170,6 +226,13 @@ int send_req(client_conf_t *conf)
 
     n = append_format_string(buf, sizeof(buf), "%s", cmd);
 
+    /*  Always accept a response spanning multiple lines since
+     *    a request may match more consoles than fit within one line.
+     */
+    n = append_format_string(buf, sizeof(buf), " %s=%s",
+        proto_strs[LEX_UNTOK(CONMAN_TOK_OPTION)],
+        proto_strs[LEX_UNTOK(CONMAN_TOK_MORE)]);
+
     if (conf->req->enableQuiet) {
         n = append_format_string(buf, sizeof(buf), " %s=%s",
             proto_strs[LEX_UNTOK(CONMAN_TOK_OPTION)],
@@ -180,6 +243,16 @@ int send_req(client_conf_t *conf)
             proto_strs[LEX_UNTOK(CONMAN_TOK_OPTION)],
             proto_strs[LEX_UNTOK(CONMAN_TOK_REGEX)]);
     }
+    if (conf->req->enableBulk) {
+        n = append_format_string(buf, sizeof(buf), " %s=%s",
+            proto_strs[LEX_UNTOK(CONMAN_TOK_OPTION)],
+            proto_strs[LEX_UNTOK(CONMAN_TOK_BULK)]);
+    }
+    if (conf->req->enableInteractive) {
+        n = append_format_string(buf, sizeof(buf), " %s=%s",
+            proto_strs[LEX_UNTOK(CONMAN_TOK_OPTION)],
+            proto_strs[LEX_UNTOK(CONMAN_TOK_INTERACTIVE)]);
+    }
     if (conf->req->command == CONMAN_CMD_CONNECT) {
         if (conf->req->enableForce) {
             n = append_format_string(buf, sizeof(buf), " %s=%s",
@@ -198,6 +271,24 @@ int send_req(client_conf_t *conf)
         }
     }
 
+    if ((conf->req->replayLen > 0)
+      && ((conf->req->command == CONMAN_CMD_CONNECT)
+        || (conf->req->command == CONMAN_CMD_MONITOR))) {
+        n = append_format_string(buf, sizeof(buf), " %s=%lld",
+            proto_strs[LEX_UNTOK(CONMAN_TOK_REPLAY)],
+            (long long) conf->req->replayLen);
+    }
+    if (conf->req->command == CONMAN_CMD_LOG) {
+        n = append_format_string(buf, sizeof(buf), " %s=%ld",
+            proto_strs[LEX_UNTOK(CONMAN_TOK_START)],
+            (long) conf->req->tStart);
+        if (conf->req->tStop > 0) {
+            n = append_format_string(buf, sizeof(buf), " %s=%ld",
+                proto_strs[LEX_UNTOK(CONMAN_TOK_STOP)],
+                (long) conf->req->tStop);
+        }
+    }
+
     /*  Empty the consoles list here because it will be filled in
      *    with the actual console names in recv_rsp().
      */
@@ -223,10 +314,11 @@ int send_req(client_conf_t *conf)
         return(-1);
     }
 
-    /*  For QUERY commands, the write-half of the socket
+    /*  For QUERY and LOG commands, the write-half of the socket
      *    connection can be closed once the request is sent.
      */
-    if (conf->req->command == CONMAN_CMD_QUERY) {
+    if ((conf->req->command == CONMAN_CMD_QUERY)
+      || (conf->req->command == CONMAN_CMD_LOG)) {
         if (shutdown(conf->req->sd, SHUT_WR) < 0) {
             conf->errnum = CONMAN_ERR_LOCAL;
             conf->errmsg = create_format_string(
@@ -242,14 +334,60 @@ int send_req(client_conf_t *conf)
 int recv_rsp(client_conf_t *conf)
 {
     char buf[MAX_SOCK_LINE];
-    int n;
     Lex l;
-    int done = 0;
+    int done;
+    int gotMore;
     int tok;
 
     assert(conf->req->sd >= 0);
 
-    if ((n = read_line(conf->req->sd, buf, sizeof(buf))) < 0) {
+    /*  An OK response may span multiple lines, each but the last
+     *    ending with a MORE token.
+     */
+    do {
+        if (recv_rsp_line(conf, buf, sizeof(buf)) < 0)
+            return(-1);
+        done = 0;
+        gotMore = 0;
+        l = lex_create(buf, proto_strs);
+        while (!done) {
+            tok = lex_next(l);
+            switch(tok) {
+            case CONMAN_TOK_OK:         /* OK, so ignore rest of line */
+                gotMore = parse_rsp_ok(l, conf);
+                done = 1;
+                break;
+            case CONMAN_TOK_ERROR:
+                parse_rsp_err(l, conf);
+                done = -1;
+                break;
+            case LEX_EOF:
+            case LEX_EOL:
+                done = -1;
+                break;
+            default:                    /* ignore unrecognized tokens */
+                break;
+            }
+        }
+        lex_destroy(l);
+    } while ((done == 1) && gotMore);
+
+    if (done == 1)
+        return(0);
+    if (conf->errnum == CONMAN_ERR_NONE) {
+        conf->errnum = CONMAN_ERR_LOCAL;
+        conf->errmsg = create_format_string("Received invalid reponse from"
+            " <%s:%d>", conf->req->host, conf->req->port);
+    }
+    return(-1);
+}
+
+
+static int recv_rsp_line(client_conf_t *conf, char *buf, int buflen)
+{
+    int n;
+
+    if ((n = read_sock_line(conf->req->sd, buf, buflen)) < 0) {
         conf->errnum = CONMAN_ERR_LOCAL;
         conf->errmsg = create_format_string("Unable to read response"
             " from <%s:%d>:\n  %s (blocked by TCP-Wrappers?)",
@@ -262,44 +400,15 @@ int recv_rsp(client_conf_t *conf)
             conf->req->host, conf->req->port);
         return(-1);
     }
-
-    l = lex_create(buf, proto_strs);
-    while (!done) {
-        tok = lex_next(l);
-        switch(tok) {
-        case CONMAN_TOK_OK:             /* OK, so ignore rest of line */
-            parse_rsp_ok(l, conf);
-            done = 1;
-            break;
-        case CONMAN_TOK_ERROR:
-            parse_rsp_err(l, conf);
-            done = -1;
-            break;
-        case LEX_EOF:
-        case LEX_EOL:
-            done = -1;
-            break;
-        default:                        /* ignore unrecognized tokens */
-            break;
-        }
-    }
-    lex_destroy(l);
-
-    if (done == 1)
-        return(0);
-    if (conf->errnum == CONMAN_ERR_NONE) {
-        conf->errnum = CONMAN_ERR_LOCAL;
-        conf->errmsg = create_format_string("Received invalid reponse from"
-            " <%s:%d>", conf->req->host, conf->req->port);
-    }
-    return(-1);
+    return(0);
 }
 
 
-static void parse_rsp_ok(Lex l, client_conf_t *conf)
+static int parse_rsp_ok(Lex l, client_conf_t *conf)
 {
     int tok;
     int done = 0;
+    int gotMore = 0;
     char *str;
 
     while (!done) {
@@ -315,8 +424,13 @@ static void parse_rsp_ok(Lex l, client_conf_t *conf)
             if (lex_next(l) == '=') {
                 if (lex_next(l) == CONMAN_TOK_RESET)
                     conf->req->enableReset = 1;
+                else if (lex_prev(l) == CONMAN_TOK_MUX)
+                    conf->req->enableMux = 1;
             }
             break;
+        case CONMAN_TOK_MORE:
+            gotMore = 1;
+            break;
         case LEX_EOF:
         case LEX_EOL:
             done = 1;
@@ -325,7 +439,7 @@ static void parse_rsp_ok(Lex l, client_conf_t *conf)
             break;                      /* ignore unrecognized tokens */
         }
     }
-    return;
+    return(gotMore);
 }
 
 
@@ -432,20 +546,235 @@ void display_consoles(client_conf_t *conf, int fd)
 {
     ListIterator i;
     char *p;
-    char buf[MAX_LINE];
+    char buf[MAX_BUF_SIZE];
+    int len = 0;
     int n;
 
+    /*  Console names are batched into buf to write many per write_n().
+     */
     i = list_iterator_create(conf->req->consoles);
     while ((p = list_next(i))) {
-        n = snprintf(buf, sizeof(buf), "%s\n", p);
-        if (n < 0 || n >= sizeof(buf))
+        n = strlen(p) + 1;
+        if (n >= MAX_LINE)
             log_err(0, "Got console list buffer overrun");
-        if (write_n(fd, buf, n) < 0)
-            log_err(errno, "Unable to write to fd=%d", fd);
-        if (conf->logd >= 0)
-            if (write_n(conf->logd, buf, n) < 0)
-                log_err(errno, "Unable to write to \"%s\"", conf->log);
+        if (len + n > sizeof(buf)) {
+            write_consoles(conf, fd, buf, len);
+            len = 0;
+        }
+        memcpy(buf + len, p, n - 1);
+        buf[len + n - 1] = '\n';
+        len += n;
     }
     list_iterator_destroy(i);
+    if (len > 0)
+        write_consoles(conf, fd, buf, len);
+    return;
+}
+
+
+static void write_consoles(client_conf_t *conf, int fd, char *buf, int len)
+{
+    if (write_n(fd, buf, len) < 0)
+        log_err(errno, "Unable to write to fd=%d", fd);
+    if (conf->logd >= 0)
+        if (write_n(conf->logd, buf, len) < 0)
+            log_err(errno, "Unable to write to \"%s\"", conf->log);
+    return;
+}
+
+
+void display_mux_data(client_conf_t *conf, int fd)
+{
+/*  Displays the console output of a multiplexed session on (fd), prefixing
+ *    each line with the name of its console.  Frames may span several reads,
+ *    so the state of the frame being read is kept across them.
+ *  Once the output from each read has been written out, credit for the
+ *    console data it contained is granted back to each stream via FLOW
+ *    frames.  Thus, a stream is not sent more data than can be displayed.
+ */
+    mux_display_t md;
+    ListIterator i;
+    char *p;
+    unsigned char buf[MAX_BUF_SIZE];
+    unsigned char hdr[CONMAN_MUX_HDR_LEN];
+    unsigned char *q;
+    int hdrLen = 0;
+    int type = 0;
+    uint32_t id = CONMAN_MUX_ID_NONE;
+    int left = 0;
+    int n, m;
+
+    assert(fd >= 0);
+
+    if (conf->req->sd < 0)
+        return;
+
+    memset(&md, 0, sizeof(md));
+    md.conf = conf;
+    md.fd = fd;
+    md.lastId = CONMAN_MUX_ID_NONE;
+    n = MAX(list_count(conf->req->consoles), 1);
+    if (!(md.names = malloc(n * sizeof(char *))))
+        out_of_memory();
+    if (!(md.grants = malloc(n * sizeof(uint32_t))))
+        out_of_memory();
+    if (!(md.ids = malloc(n * sizeof(int))))
+        out_of_memory();
+    i = list_iterator_create(conf->req->consoles);
+    while ((p = list_next(i))) {
+        md.grants[md.numNames] = 0;
+        md.names[md.numNames++] = p;
+    }
+    list_iterator_destroy(i);
+
+    for (;;) {
+        n = read(conf->req->sd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            log_err(errno, "Unable to read from <%s:%d>",
+                conf->req->host, conf->req->port);
+        }
+        if (n == 0)
+            break;
+        q = buf;
+        while (n > 0) {
+            if (hdrLen < CONMAN_MUX_HDR_LEN) {
+                m = MIN(n, CONMAN_MUX_HDR_LEN - hdrLen);
+                memcpy(hdr + hdrLen, q, m);
+                hdrLen += m;
+                q += m;
+                n -= m;
+                if (hdrLen < CONMAN_MUX_HDR_LEN)
+                    break;
+                unpack_mux_hdr(hdr, &type, &id, &left);
+            }
+            m = MIN(n, left);
+            display_mux_frame(&md, type, id, q, m);
+            q += m;
+            n -= m;
+            left -= m;
+            if (left == 0)
+                hdrLen = 0;
+        }
+        if (md.len > 0) {
+            write_consoles(conf, fd, md.buf, md.len);
+            md.len = 0;
+        }
+        send_mux_grants(&md);
+    }
+    if (md.isMidLine)
+        put_mux_output(&md, "\n", 1);
+    if (md.len > 0)
+        write_consoles(conf, fd, md.buf, md.len);
+
+    free(md.names);
+    free(md.grants);
+    free(md.ids);
+    return;
+}
+
+
+static void display_mux_frame(mux_display_t *md, int type, uint32_t id,
+    const unsigned char *src, int len)
+{
+/*  Displays the buffer (src) of length (len) from a frame of the given
+ *    (type) for stream (id).  A line of output from one stream interrupted
+ *    by that of another is continued on a new line.  Carriage-returns are
+ *    discarded, and frames other than DATA and NOTICE are ignored.
+ */
+    const char *name;
+    int k;
+
+    if ((type != CONMAN_MUX_DATA) && (type != CONMAN_MUX_NOTICE))
+        return;
+
+    if ((type == CONMAN_MUX_DATA) && (id < (uint32_t) md->numNames)) {
+        if (md->grants[id] == 0)
+            md->ids[md->numIds++] = id;
+        md->grants[id] += len;
+    }
+    name = (id < (uint32_t) md->numNames) ? md->names[id] : "conman";
+
+    for (k = 0; k < len; k++) {
+        if (md->isMidLine && (id != md->lastId)) {
+            put_mux_output(md, "\n", 1);
+            md->isMidLine = 0;
+        }
+        md->lastId = id;
+        if (src[k] == '\r')
+            continue;
+        if (src[k] == '\n') {
+            put_mux_output(md, "\n", 1);
+            md->isMidLine = 0;
+            continue;
+        }
+        if (!md->isMidLine) {
+            put_mux_output(md, name, strlen(name));
+            put_mux_output(md, ": ", 2);
+            md->isMidLine = 1;
+        }
+        put_mux_output(md, (const char *) &src[k], 1);
+    }
+    return;
+}
+
+
+static void put_mux_output(mux_display_t *md, const char *src, int len)
+{
+/*  Appends the buffer (src) of length (len) to the output buffer,
+ *    writing it out whenever it fills.
+ */
+    int m;
+
+    while (len > 0) {
+        if (md->len == sizeof(md->buf)) {
+            write_consoles(md->conf, md->fd, md->buf, md->len);
+            md->len = 0;
+        }
+        m = MIN(len, (int) sizeof(md->buf) - md->len);
+        memcpy(md->buf + md->len, src, m);
+        md->len += m;
+        src += m;
+        len -= m;
+    }
+    return;
+}
+
+
+static void send_mux_grants(mux_display_t *md)
+{
+/*  Sends FLOW frames granting each stream credit for the console data
+ *    displayed since the last grant.
+ */
+    unsigned char buf[MAX_BUF_SIZE];
+    unsigned char *p;
+    uint32_t n;
+    int len = 0;
+    int k;
+
+    for (k = 0; k < md->numIds; k++) {
+        if (len + CONMAN_MUX_HDR_LEN + 4 > sizeof(buf)) {
+            if (write_n(md->conf->req->sd, buf, len) < 0)
+                log_err(errno, "Unable to write to <%s:%d>",
+                    md->conf->req->host, md->conf->req->port);
+            len = 0;
+        }
+        p = buf + len;
+        n = md->grants[md->ids[k]];
+        pack_mux_hdr(p, CONMAN_MUX_FLOW, md->ids[k], 4);
+        p[CONMAN_MUX_HDR_LEN + 0] = (n >> 24) & 0xFF;
+        p[CONMAN_MUX_HDR_LEN + 1] = (n >> 16) & 0xFF;
+        p[CONMAN_MUX_HDR_LEN + 2] = (n >> 8) & 0xFF;
+        p[CONMAN_MUX_HDR_LEN + 3] = n & 0xFF;
+        len += CONMAN_MUX_HDR_LEN + 4;
+        md->grants[md->ids[k]] = 0;
+    }
+    md->numIds = 0;
+    if (len > 0) {
+        if (write_n(md->conf->req->sd, buf, len) < 0)
+            log_err(errno, "Unable to write to <%s:%d>",
+                md->conf->req->host, md->conf->req->port);
+    }
     return;
 }
@@ -78,6 +78,8 @@ void display_data(client_conf_t *conf, int fd);
 
 void display_consoles(client_conf_t *conf, int fd);
 
+void display_mux_data(client_conf_t *conf, int fd);
+
 
 /******************\
 **  client-tty.c  **
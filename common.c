@@ -28,6 +28,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <termios.h>
 #include <unistd.h>
@@ -57,21 +58,30 @@ char *proto_strs[] = {
  *  These must be sorted in a case-insensitive manner.
  */
     "BROADCAST",
+    "BULK",
     "CODE",
     "CONNECT",
     "CONSOLE",
     "ERROR",
     "FORCE",
     "HELLO",
+    "INTERACTIVE",
     "JOIN",
+    "LOG",
     "MESSAGE",
     "MONITOR",
+    "MORE",
+    "MUX",
     "OK",
     "OPTION",
     "QUERY",
     "QUIET",
     "REGEX",
+    "REPLAY",
     "RESET",
+    "SEQ",
+    "START",
+    "STOP",
     "TTY",
     "USER",
     NULL
@@ -94,14 +104,22 @@ req_t * create_req(void)
     req->ip = NULL;
     req->port = 0;
     req->consoles = list_create((ListDelF) destroy_string);
+    req->tStart = 0;
+    req->tStop = 0;
+    req->replayLen = 0;
     req->command = CONMAN_CMD_NONE;
     req->enableBroadcast = 0;
+    req->enableBulk = 0;
     req->enableEcho = 0;
     req->enableForce = 0;
+    req->enableInteractive = 0;
     req->enableJoin = 0;
+    req->enableMore = 0;
+    req->enableMux = 0;
     req->enableQuiet = 0;
     req->enableRegex = 0;
     req->enableReset = 0;
+    req->enableSeq = 0;
     return(req);
 }
 
@@ -214,3 +232,73 @@ void get_tty_raw(struct termios *tty, int fd)
     tty->c_cc[VTIME] = 0;
     return;
 }
+
+
+void pack_mux_hdr(unsigned char *p, int type, uint32_t id, int len)
+{
+/*  Packs the header of a multiplexed session frame of the given (type)
+ *    for stream (id) with a payload of (len) bytes into the buffer (p)
+ *    of at least CONMAN_MUX_HDR_LEN bytes.
+ */
+    assert(p != NULL);
+    assert((len >= 0) && (len <= CONMAN_MUX_MAX_LEN));
+
+    p[0] = (unsigned char) type;
+    p[1] = 0;
+    p[2] = (unsigned char) ((len >> 8) & 0xFF);
+    p[3] = (unsigned char) (len & 0xFF);
+    p[4] = (unsigned char) ((id >> 24) & 0xFF);
+    p[5] = (unsigned char) ((id >> 16) & 0xFF);
+    p[6] = (unsigned char) ((id >> 8) & 0xFF);
+    p[7] = (unsigned char) (id & 0xFF);
+    return;
+}
+
+
+void unpack_mux_hdr(const unsigned char *p, int *type, uint32_t *id,
+    int *len)
+{
+/*  Unpacks the header of a multiplexed session frame from the buffer (p),
+ *    setting its (*type), stream (*id), and payload length (*len).
+ */
+    assert(p != NULL);
+
+    *type = p[0];
+    *len = (p[2] << 8) | p[3];
+    *id = ((uint32_t) p[4] << 24) | ((uint32_t) p[5] << 16)
+        | ((uint32_t) p[6] << 8) | (uint32_t) p[7];
+    return;
+}
+
+
+void pack_mux_uint64(unsigned char *p, uint64_t x)
+{
+/*  Packs the 64-bit value (x) into the buffer (p) of at least 8 bytes
+ *    in network byte order (eg, the sequence number of a RECORD frame).
+ */
+    int i;
+
+    assert(p != NULL);
+
+    for (i = 7; i >= 0; i--) {
+        p[i] = (unsigned char) (x & 0xFF);
+        x >>= 8;
+    }
+    return;
+}
+
+
+uint64_t unpack_mux_uint64(const unsigned char *p)
+{
+/*  Unpacks a 64-bit value in network byte order from the buffer (p).
+ */
+    uint64_t x = 0;
+    int i;
+
+    assert(p != NULL);
+
+    for (i = 0; i < 8; i++) {
+        x = (x << 8) | p[i];
+    }
+    return(x);
+}
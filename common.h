@@ -25,7 +25,10 @@
 #ifndef _COMMON_H
 #define _COMMON_H
 
+#include <sys/types.h>
+#include <stdint.h>                     /* for uint32_t                      */
 #include <termios.h>
+#include <time.h>
 #include "lex.h"
 #include "list.h"
 
@@ -84,6 +87,26 @@
 #define ESC_CHAR_RESET          'R'
 #define ESC_CHAR_SUSPEND        'Z'
 
+/*  Frame defs for multiplexed sessions (cf, pack_mux_hdr).
+ *  Each frame consists of a fixed-length header followed by its payload.
+ *    The header holds the frame type (1 byte), a reserved byte, the payload
+ *    length (2 bytes), and the stream id (4 bytes) in network byte order.
+ *    A stream id is the index of its console within the OK response.
+ */
+#define CONMAN_MUX_HDR_LEN      8
+#define CONMAN_MUX_MAX_LEN      65535
+#define CONMAN_MUX_ID_NONE      0xFFFFFFFF
+
+/*  The payload of a RECORD frame starts with the 8-byte sequence number of
+ *    its first byte of console output followed by the 8-byte time (in secs
+ *    since the epoch, or 0 if unknown) at which that output was read.
+ *    The payload of a SEEK frame holds the 8-byte epoch of the daemon's
+ *    sequence numbers followed by an 8-byte sequence number.
+ *    A sequence number counts the bytes output by a console since the
+ *    daemon (identified by its epoch) was started.
+ */
+#define CONMAN_MUX_SEQ_LEN      16
+
 /*  Version string information
  */
 #ifndef NDEBUG
@@ -110,21 +133,29 @@
 #  define FEATURE_TCP_WRAPPERS ""
 #endif /* WITH_TCP_WRAPPERS */
 
+#if WITH_ZLIB
+#  define FEATURE_ZLIB " ZLIB"
+#else
+#  define FEATURE_ZLIB ""
+#endif /* WITH_ZLIB */
+
 #define CLIENT_FEATURES \
     (FEATURE_DEBUG FEATURE_DMALLOC)
 #define SERVER_FEATURES \
-    (FEATURE_DEBUG FEATURE_DMALLOC FEATURE_FREEIPMI FEATURE_TCP_WRAPPERS)
+    (FEATURE_DEBUG FEATURE_DMALLOC FEATURE_FREEIPMI FEATURE_TCP_WRAPPERS \
+     FEATURE_ZLIB)
 
 #if ! HAVE_SOCKLEN_T
 typedef int socklen_t;                  /* socklen_t is uint32_t in Posix.1g */
 #endif /* !HAVE_SOCKLEN_T */
 
 
-typedef enum cmd_type {                 /* ConMan command (2 bits)           */
+typedef enum cmd_type {                 /* ConMan command (3 bits)           */
     CONMAN_CMD_NONE,
     CONMAN_CMD_CONNECT,
     CONMAN_CMD_MONITOR,
-    CONMAN_CMD_QUERY
+    CONMAN_CMD_QUERY,
+    CONMAN_CMD_LOG
 } cmd_t;
 
 typedef struct request {
@@ -136,14 +167,22 @@ typedef struct request {
     char     *ip;                       /* queried remote ip addr string     */
     int       port;                     /* remote port number                */
     List      consoles;                 /* list of consoles affected by cmd  */
-    unsigned  command:2;                /* ConMan command to perform (cmd_t) */
+    time_t    tStart;                   /* start of LOG cmd time range       */
+    time_t    tStop;                    /* end of LOG cmd time range (or 0)  */
+    off_t     replayLen;                /* bytes of console log to replay    */
+    unsigned  command:3;                /* ConMan command to perform (cmd_t) */
     unsigned  enableBroadcast:1;        /* true if b-casting to >1 consoles  */
+    unsigned  enableBulk:1;             /* true if coalescing output writes  */
     unsigned  enableEcho:1;             /* true if echoing standard input    */
     unsigned  enableForce:1;            /* true if forcing console conn      */
+    unsigned  enableInteractive:1;      /* true if flushing output writes    */
     unsigned  enableJoin:1;             /* true if joining console conn      */
+    unsigned  enableMore:1;             /* true if rsp may span many lines   */
+    unsigned  enableMux:1;              /* true if session is multiplexed    */
     unsigned  enableQuiet:1;            /* true if suppressing info messages */
     unsigned  enableRegex:1;            /* true if regex console matching    */
     unsigned  enableReset:1;            /* true if server supports reset cmd */
+    unsigned  enableSeq:1;              /* true if sending seq'd mux records */
 } req_t;
 
 
@@ -155,7 +194,17 @@ enum err_type {
     CONMAN_ERR_AUTHENTICATE,
     CONMAN_ERR_NO_CONSOLES,
     CONMAN_ERR_TOO_MANY_CONSOLES,
-    CONMAN_ERR_BUSY_CONSOLES
+    CONMAN_ERR_BUSY_CONSOLES,
+    CONMAN_ERR_NO_LOGFILE
+};
+
+enum mux_frame_type {                   /* multiplexed session frame type    */
+    CONMAN_MUX_DATA = 1,                /*  console data                     */
+    CONMAN_MUX_NOTICE,                  /*  informational message            */
+    CONMAN_MUX_STATE,                   /*  stream opened (name) or closed   */
+    CONMAN_MUX_FLOW,                    /*  credit grant (4-byte count)      */
+    CONMAN_MUX_RECORD,                  /*  console data w/ seq & timestamp  */
+    CONMAN_MUX_SEEK                     /*  stream position (epoch & seq)    */
 };
 
 enum proto_toks {
@@ -163,21 +212,30 @@ enum proto_toks {
  *  Keep enums in sync w/ common.c:proto_strs[].
  */
     CONMAN_TOK_BROADCAST = LEX_TOK_OFFSET,
+    CONMAN_TOK_BULK,
     CONMAN_TOK_CODE,
     CONMAN_TOK_CONNECT,
     CONMAN_TOK_CONSOLE,
     CONMAN_TOK_ERROR,
     CONMAN_TOK_FORCE,
     CONMAN_TOK_HELLO,
+    CONMAN_TOK_INTERACTIVE,
     CONMAN_TOK_JOIN,
+    CONMAN_TOK_LOG,
     CONMAN_TOK_MESSAGE,
     CONMAN_TOK_MONITOR,
+    CONMAN_TOK_MORE,
+    CONMAN_TOK_MUX,
     CONMAN_TOK_OK,
     CONMAN_TOK_OPTION,
     CONMAN_TOK_QUERY,
     CONMAN_TOK_QUIET,
     CONMAN_TOK_REGEX,
+    CONMAN_TOK_REPLAY,
     CONMAN_TOK_RESET,
+    CONMAN_TOK_SEQ,
+    CONMAN_TOK_START,
+    CONMAN_TOK_STOP,
     CONMAN_TOK_TTY,
     CONMAN_TOK_USER
 };
@@ -201,5 +259,14 @@ void set_tty_mode(struct termios *tty, int fd);
 
 void get_tty_raw(struct termios *tty, int fd);
 
+void pack_mux_hdr(unsigned char *p, int type, uint32_t id, int len);
+
+void unpack_mux_hdr(const unsigned char *p, int *type, uint32_t *id,
+    int *len);
+
+void pack_mux_uint64(unsigned char *p, uint64_t x);
+
+uint64_t unpack_mux_uint64(const unsigned char *p);
+
 
 #endif /* !_COMMON_H */
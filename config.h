@@ -0,0 +1,191 @@
+/* config.h.  Generated from config.h.in by configure.  */
+/* config.h.in.  Generated from configure.ac by autoheader.  */
+
+/* Define if building universal (internal helper macro) */
+/* #undef AC_APPLE_UNIVERSAL_BUILD */
+
+/* Define if your <stdbool.h> header file generates an error directive. */
+/* #undef BROKEN_STDBOOL */
+
+/* Define the default configuration file of the ConMan daemon */
+#define CONMAN_CONF "/usr/local/etc/conman.conf"
+
+/* Define the default host name or IP address of the ConMan daemon */
+#define CONMAN_HOST "127.0.0.1"
+
+/* Define the default port number of the ConMan daemon */
+#define CONMAN_PORT "7890"
+
+/* Define the build date. */
+#define DATE "2011-04-21"
+
+/* Define to 1 if you have the `inet_aton' function. */
+#define HAVE_INET_ATON 1
+
+/* Define to 1 if you have the `inet_ntop' function. */
+#define HAVE_INET_NTOP 1
+
+/* Define to 1 if you have the `inet_pton' function. */
+#define HAVE_INET_PTON 1
+
+/* Define to 1 if you have the <inttypes.h> header file. */
+#define HAVE_INTTYPES_H 1
+
+/* Define to 1 if you have the <ipmiconsole.h> header file. */
+/* #undef HAVE_IPMICONSOLE_H */
+
+/* Define to 1 if you have the `ipmiconsole' library (-lipmiconsole). */
+/* #undef HAVE_LIBIPMICONSOLE */
+
+/* Define to 1 if you have the `nsl' library (-lnsl). */
+/* #undef HAVE_LIBNSL */
+
+/* Define to 1 if you have the `socket' library (-lsocket). */
+/* #undef HAVE_LIBSOCKET */
+
+/* Define to 1 if you have the <linux/io_uring.h> header file. */
+#define HAVE_LINUX_IO_URING_H 1
+
+/* Define to 1 if you have the `localtime_r' function. */
+#define HAVE_LOCALTIME_R 1
+
+/* Define to 1 if you have the <memory.h> header file. */
+#define HAVE_MEMORY_H 1
+
+/* Define to 1 if you have the <paths.h> header file. */
+#define HAVE_PATHS_H 1
+
+/* Define to 1 if the system has the type `socklen_t'. */
+#define HAVE_SOCKLEN_T 1
+
+/* Define to 1 if you have the <stdint.h> header file. */
+#define HAVE_STDINT_H 1
+
+/* Define to 1 if you have the <stdlib.h> header file. */
+#define HAVE_STDLIB_H 1
+
+/* Define to 1 if you have the `strcasecmp' function. */
+#define HAVE_STRCASECMP 1
+
+/* Define to 1 if you have the <strings.h> header file. */
+#define HAVE_STRINGS_H 1
+
+/* Define to 1 if you have the <string.h> header file. */
+#define HAVE_STRING_H 1
+
+/* Define to 1 if you have the `strlcat' function. */
+/* #undef HAVE_STRLCAT */
+
+/* Define to 1 if you have the `strlcpy' function. */
+/* #undef HAVE_STRLCPY */
+
+/* Define to 1 if you have the `strncasecmp' function. */
+#define HAVE_STRNCASECMP 1
+
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#define HAVE_SYS_EPOLL_H 1
+
+/* Define to 1 if you have the <sys/eventfd.h> header file. */
+#define HAVE_SYS_EVENTFD_H 1
+
+/* Define to 1 if you have the <sys/inotify.h> header file. */
+#define HAVE_SYS_INOTIFY_H 1
+
+/* Define to 1 if you have the <sys/signalfd.h> header file. */
+#define HAVE_SYS_SIGNALFD_H 1
+
+/* Define to 1 if you have the <sys/stat.h> header file. */
+#define HAVE_SYS_STAT_H 1
+
+/* Define to 1 if you have the <sys/types.h> header file. */
+#define HAVE_SYS_TYPES_H 1
+
+/* Define to 1 if you have the `toint' function. */
+/* #undef HAVE_TOINT */
+
+/* Define to 1 if you have the <unistd.h> header file. */
+#define HAVE_UNISTD_H 1
+
+/* Define the canonical host CPU type. */
+#define HOST_CPU "x86_64"
+
+/* Define the canonical host OS type. */
+#define HOST_OS "linux-gnu"
+
+/* Define the canonical host vendor type. */
+#define HOST_VENDOR "unknown"
+
+/* Define if you are building a production release. */
+#define NDEBUG 1
+
+/* Define to the address where bug reports for this package should be sent. */
+#define PACKAGE_BUGREPORT ""
+
+/* Define to the full name of this package. */
+#define PACKAGE_NAME ""
+
+/* Define to the full name and version of this package. */
+#define PACKAGE_STRING ""
+
+/* Define to the one symbol short name of this package. */
+#define PACKAGE_TARNAME ""
+
+/* Define to the home page for this package. */
+#define PACKAGE_URL ""
+
+/* Define to the version of this package. */
+#define PACKAGE_VERSION ""
+
+/* Define the project's name. */
+#define PROJECT "conman"
+
+/* Define to 1 if you have the ANSI C header files. */
+#define STDC_HEADERS 1
+
+/* Define the project's version. */
+#define VERSION "0.2.7"
+
+/* Define if using the debug malloc library. */
+/* #undef WITH_DMALLOC */
+
+/* Define if using FreeIPMI's libipmiconsole. */
+/* #undef WITH_FREEIPMI */
+
+/* Define to 1 if using Pthreads. */
+#define WITH_PTHREADS 1
+
+/* Define if using TCP Wrappers. */
+/* #undef WITH_TCP_WRAPPERS */
+
+/* Define if using zlib. */
+#define WITH_ZLIB 1
+
+/* Define WORDS_BIGENDIAN to 1 if your processor stores words with the most
+   significant byte first (like Motorola and SPARC, unlike Intel). */
+#if defined AC_APPLE_UNIVERSAL_BUILD
+# if defined __BIG_ENDIAN__
+#  define WORDS_BIGENDIAN 1
+# endif
+#else
+# ifndef WORDS_BIGENDIAN
+/* #  undef WORDS_BIGENDIAN */
+# endif
+#endif
+
+/* Define to 1 if you plan to link against multithreaded code. */
+#define _REENTRANT 1
+
+/* Define to 1 if you plan to link against multithreaded code. */
+#define _THREAD_SAFE 1
+
+#ifdef WITH_DMALLOC
+#  include <stdlib.h>
+#  include <dmalloc.h>
+#endif /* WITH_DMALLOC */
+
+
+
+/* Override default out_of_memory() macro definition. */
+#include "log.h"
+#define out_of_memory() (log_err(0, "Out of memory"), (void *) NULL)
+
@@ -181,8 +181,6 @@ void log_msg(int priority, const char *format, ...)
 static void log_aux(int errnum, int priority, char *msgbuf, int msgbuflen,
     const char *format, va_list vargs)
 {
-    time_t t;
-    struct tm tm;
     const char *prefix;
     char buf[MAX_LINE];                 /* buf starting with timestamp       */
     char *pbuf;                         /* buf starting with priority string */
@@ -194,9 +192,7 @@ static void log_aux(int errnum, int priority, char *msgbuf, int msgbuflen,
     p = sbuf = pbuf = buf;
     len = sizeof(buf) - 1;              /* reserve char for terminating '\n' */
 
-    t = 0;
-    get_localtime(&t, &tm);
-    n = strftime(p, len, "%Y-%m-%d %H:%M:%S ", &tm);
+    n = write_time_string(0, p, len);
     if (n == 0) {
         *p = '\0';
         len = 0;
@@ -36,29 +36,38 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <syslog.h>
 #include <unistd.h>
+#include "bufpool.h"
 #include "common.h"
 #include "lex.h"
 #include "list.h"
 #include "log.h"
 #include "server.h"
 #include "tpoll.h"
+#include "uring.h"
 #include "util-file.h"
 #include "util-str.h"
+#include "wrapper.h"
 
 
 enum server_conf_toks {
 /*
  *  Keep enums in sync w/ server_conf_strs[].
  */
-    SERVER_CONF_CONSOLE = LEX_TOK_OFFSET,
+    SERVER_CONF_BUFSIZE = LEX_TOK_OFFSET,
+    SERVER_CONF_CLIENTTHREADS,
+    SERVER_CONF_CONSOLE,
     SERVER_CONF_COREDUMP,
     SERVER_CONF_COREDUMPDIR,
     SERVER_CONF_DEV,
+    SERVER_CONF_EXEC,
     SERVER_CONF_EXECPATH,
     SERVER_CONF_GLOBAL,
+    SERVER_CONF_HOLDOFF,
+    SERVER_CONF_IOTHREADS,
 #if WITH_FREEIPMI
     SERVER_CONF_IPMIOPTS,
 #endif /* WITH_FREEIPMI */
@@ -67,19 +76,25 @@ enum server_conf_toks {
     SERVER_CONF_LOGDIR,
     SERVER_CONF_LOGFILE,
     SERVER_CONF_LOGOPTS,
+    SERVER_CONF_LOGTHREADS,
     SERVER_CONF_LOOPBACK,
+    SERVER_CONF_MATCH,
     SERVER_CONF_NAME,
     SERVER_CONF_NOFILE,
+    SERVER_CONF_NOTIFY,
     SERVER_CONF_OFF,
     SERVER_CONF_ON,
     SERVER_CONF_PIDFILE,
     SERVER_CONF_PORT,
+    SERVER_CONF_REGEX,
     SERVER_CONF_RESETCMD,
+    SERVER_CONF_SCROLLBACK,
     SERVER_CONF_SEROPTS,
     SERVER_CONF_SERVER,
     SERVER_CONF_SYSLOG,
     SERVER_CONF_TCPWRAPPERS,
-    SERVER_CONF_TIMESTAMP
+    SERVER_CONF_TIMESTAMP,
+    SERVER_CONF_TRIGGER
 };
 
 static char *server_conf_strs[] = {
@@ -87,12 +102,17 @@ static char *server_conf_strs[] = {
  *  Keep strings in sync w/ server_conf_toks enum.
  *  These must be sorted in a case-insensitive manner.
  */
+    "BUFSIZE",
+    "CLIENTTHREADS",
     "CONSOLE",
     "COREDUMP",
     "COREDUMPDIR",
     "DEV",
+    "EXEC",
     "EXECPATH",
     "GLOBAL",
+    "HOLDOFF",
+    "IOTHREADS",
 #if WITH_FREEIPMI
     "IPMIOPTS",
 #endif /* WITH_FREEIPMI */
@@ -101,19 +121,25 @@ static char *server_conf_strs[] = {
     "LOGDIR",
     "LOGFILE",
     "LOGOPTS",
+    "LOGTHREADS",
     "LOOPBACK",
+    "MATCH",
     "NAME",
     "NOFILE",
+    "NOTIFY",
     "OFF",
     "ON",
     "PIDFILE",
     "PORT",
+    "REGEX",
     "RESETCMD",
+    "SCROLLBACK",
     "SEROPTS",
     "SERVER",
     "SYSLOG",
     "TCPWRAPPERS",
     "TIMESTAMP",
+    "TRIGGER",
     NULL
 };
 
@@ -176,6 +202,8 @@ typedef struct console_strs {
 #if WITH_FREEIPMI
     char *iopts;
 #endif /* WITH_FREEIPMI */
+    int   bufsize;
+    int   scrollback;
 } console_strs_t;
 
 
@@ -186,16 +214,20 @@ static int process_console(server_conf_t *conf, console_strs_t *con_p,
     char *errbuf, int errbuflen);
 static void parse_global_directive(server_conf_t *conf, Lex l);
 static void parse_server_directive(server_conf_t *conf, Lex l);
+static void parse_trigger_directive(server_conf_t *conf, Lex l);
 static int read_pidfile(const char *pidfile);
 static int write_pidfile(const char *pidfile);
 static int lookup_syslog_priority(const char *priority);
 static int lookup_syslog_facility(const char *facility);
+static io_shard_t * create_io_shard(server_conf_t *conf, int id);
+static void destroy_io_shard(io_shard_t *shard);
 
 
 server_conf_t * create_server_conf(void)
 {
     server_conf_t *conf;
     char buf[PATH_MAX];
+    struct timeval tv;
 
     if (!(conf = malloc(sizeof(server_conf_t)))) {
         out_of_memory();
@@ -216,6 +248,16 @@ server_conf_t * create_server_conf(void)
     conf->throwSignal = -1;
     conf->tStampMinutes = 0;
     conf->tStampNext = 0;
+    /*
+     *  The epoch identifies the sequence numbers of console output assigned
+     *    by this instance of the daemon (cf, get_console_output), so a
+     *    client resuming from a sequence number can tell whether the daemon
+     *    has since been restarted.  It is the start time in microseconds.
+     */
+    if (gettimeofday(&tv, NULL) < 0) {
+        log_err(errno, "gettimeofday() failed");
+    }
+    conf->seqEpoch = ((uint64_t) tv.tv_sec * 1000000) + tv.tv_usec;
     /*
      *  The conf file's fd must be saved and kept open in order to hold an
      *    fcntl-style lock.  This lock is used to ensure only one instance
@@ -242,17 +284,57 @@ server_conf_t * create_server_conf(void)
     conf->port = 0;
     conf->ld = -1;
     conf->objs = list_create((ListDelF) destroy_obj);
-    if (!(conf->tp = tpoll_create(0))) {
-        log_err(0, "Unable to create object for multiplexing I/O");
+    conf->idleRings = list_create(NULL);
+    memset(&conf->consoles, 0, sizeof(conf->consoles));
+    memset(&conf->queryCache, 0, sizeof(conf->queryCache));
+    x_pthread_mutex_init(&conf->queryCache.lock, NULL);
+    x_pthread_rwlock_init(&conf->objsLock, NULL);
+    /*
+     *  Shard 0 is always present and is muxed by the main thread.
+     *    Its tpoll obj is the conf's tpoll obj.  Additional shards are
+     *    created by process_config() once IOTHREADS has been parsed.
+     */
+    conf->numIoThreads = 1;
+    conf->numReconfigs = 0;
+    if (!(conf->shards = malloc(sizeof(io_shard_t *)))) {
+        out_of_memory();
     }
+    conf->shards[0] = create_io_shard(conf, 0);
+    conf->tp = conf->shards[0]->tp;
+    conf->numClientThreads = DEFAULT_CLIENT_THREADS;
+    conf->clientTids = NULL;
+    conf->clientSds = NULL;
+    conf->clientQueue = list_create((ListDelF) free);
+    x_pthread_mutex_init(&conf->clientQueueLock, NULL);
+    x_pthread_cond_init(&conf->clientQueueCond, NULL);
+    conf->gotClientDone = 0;
+    conf->numLogThreads = DEFAULT_LOG_THREADS;
+    conf->logTids = NULL;
+    conf->logQueue = list_create(NULL);
+    x_pthread_mutex_init(&conf->logQueueLock, NULL);
+    x_pthread_cond_init(&conf->logQueueCond, NULL);
+    conf->gotLogDone = 0;
+    conf->numIndexLogs = 0;
+    conf->numAgedLogs = 0;
+    conf->globalBufSize = MAX_BUF_SIZE;
+    conf->globalScrollback = DEFAULT_SCROLLBACK_SIZE;
     conf->globalLogName = NULL;
     conf->globalLogOpts.enableSanitize = DEFAULT_LOGOPT_SANITIZE;
     conf->globalLogOpts.enableTimestamp = DEFAULT_LOGOPT_TIMESTAMP;
+    conf->globalLogOpts.timestampFormat = DEFAULT_LOGOPT_TIMESTAMP_FMT;
+    conf->globalLogOpts.enableCompress = DEFAULT_LOGOPT_COMPRESS;
+    conf->globalLogOpts.enableIndex = DEFAULT_LOGOPT_INDEX;
+    conf->globalLogOpts.rotateKeep = DEFAULT_LOGOPT_ROTATE_KEEP;
+    conf->globalLogOpts.rotateMinutes = DEFAULT_LOGOPT_ROTATE_AGE;
+    conf->globalLogOpts.rotateSize = DEFAULT_LOGOPT_ROTATE_SIZE;
     conf->globalLogOpts.enableLock = DEFAULT_LOGOPT_LOCK;
     conf->globalSerOpts.bps = DEFAULT_SEROPT_BPS;
     conf->globalSerOpts.databits = DEFAULT_SEROPT_DATABITS;
     conf->globalSerOpts.parity = DEFAULT_SEROPT_PARITY;
     conf->globalSerOpts.stopbits = DEFAULT_SEROPT_STOPBITS;
+    conf->triggers = list_create((ListDelF) destroy_trigger);
+    conf->trigSet = NULL;
+    conf->resolver = NULL;
 
 #if WITH_FREEIPMI
     if (init_ipmi_opts(&conf->globalIpmiOpts) < 0) {
@@ -284,6 +366,8 @@ server_conf_t * create_server_conf(void)
 
 void destroy_server_conf(server_conf_t *conf)
 {
+    int i;
+
     if (!conf) {
         return;
     }
@@ -307,12 +391,41 @@ void destroy_server_conf(server_conf_t *conf)
         }
         conf->ld = -1;
     }
+    /*  The objs must be destroyed before the shards
+     *    since closing an obj clears its fd from its shard's tpoll set.
+     */
+    if (conf->idleRings) {
+        list_destroy(conf->idleRings);
+    }
     if (conf->objs) {
         list_destroy(conf->objs);
     }
-    if (conf->tp) {
-        tpoll_destroy(conf->tp);
+    destroy_query_cache(conf);
+    destroy_console_index(conf);
+    if (conf->shards) {
+        for (i = 0; i < conf->numIoThreads; i++) {
+            destroy_io_shard(conf->shards[i]);
+        }
+        free(conf->shards);
+    }
+    conf->tp = NULL;
+    /*  The trigger set must be destroyed before its list of triggers.
+     */
+    destroy_trigger_set(conf->trigSet);
+    if (conf->triggers) {
+        list_destroy(conf->triggers);
+    }
+    if (conf->clientQueue) {
+        list_destroy(conf->clientQueue);
+    }
+    x_pthread_mutex_destroy(&conf->clientQueueLock);
+    x_pthread_cond_destroy(&conf->clientQueueCond);
+    if (conf->logQueue) {
+        list_destroy(conf->logQueue);
     }
+    x_pthread_mutex_destroy(&conf->logQueueLock);
+    x_pthread_cond_destroy(&conf->logQueueCond);
+    x_pthread_rwlock_destroy(&conf->objsLock);
     destroy_string(conf->confFileName);
     destroy_string(conf->coreDumpDir);
     destroy_string(conf->cwd);
@@ -452,6 +565,9 @@ void process_config(server_conf_t *conf)
         case SERVER_CONF_SERVER:
             parse_server_directive(conf, l);
             break;
+        case SERVER_CONF_TRIGGER:
+            parse_trigger_directive(conf, l);
+            break;
         case LEX_EOL:
             break;
         case LEX_ERR:
@@ -483,6 +599,20 @@ void process_config(server_conf_t *conf)
             conf->logFmtName = create_string(conf->logFileName);
         }
     }
+    sort_console_index(conf);
+
+    if (!list_is_empty(conf->triggers)) {
+        conf->trigSet = create_trigger_set(conf->triggers);
+    }
+    if (conf->numIoThreads > 1) {
+        if (!(conf->shards = realloc(conf->shards,
+                conf->numIoThreads * sizeof(io_shard_t *)))) {
+            out_of_memory();
+        }
+        for (n = 1; n < conf->numIoThreads; n++) {
+            conf->shards[n] = create_io_shard(conf, n);
+        }
+    }
     if (conf->pidFileName) {
         if (write_pidfile(conf->pidFileName) < 0) {
             free(conf->pidFileName);
@@ -594,16 +724,19 @@ static void parse_console_directive(server_conf_t *conf, Lex l)
 {
 /*  CONSOLE NAME="<str>" DEV="<file>" \
  *    [LOG="<file>"] [LOGOPTS="<str>"] [SEROPTS="<str>"] [IPMIOPTS="<str>"]
+ *    [BUFSIZE=<int>] [SCROLLBACK=<int>]
  *  Note: IPMIOPTS is only available if WITH_FREEIPMI is defined.
  */
     char *directive;                    /* name of directive being parsed */
     int line;                           /* line # where directive begins */
     int tok;
+    int n;
     int done = 0;
     char err[MAX_LINE] = "";
     console_strs_t con;
 
     memset(&con, 0, sizeof(con));
+    con.scrollback = -1;
 
     directive = server_conf_strs[LEX_UNTOK(lex_prev(l))];
     line = lex_line(l);
@@ -612,6 +745,48 @@ static void parse_console_directive(server_conf_t *conf, Lex l)
         tok = lex_next(l);
         switch(tok) {
 
+        case SERVER_CONF_BUFSIZE:
+            if (lex_next(l) != '=') {
+                snprintf(err, sizeof(err), "expected '=' after %s keyword",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if (lex_next(l) != LEX_INT) {
+                snprintf(err, sizeof(err), "expected INTEGER for %s value",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if (((n = atoi(lex_text(l))) < BUFPOOL_MIN_SIZE)
+                    || (n > BUFPOOL_MAX_SIZE)) {
+                snprintf(err, sizeof(err),
+                    "invalid %s value %d (must be %d-%d)",
+                    server_conf_strs[LEX_UNTOK(tok)], n,
+                    BUFPOOL_MIN_SIZE, BUFPOOL_MAX_SIZE);
+            }
+            else {
+                con.bufsize = bufpool_size(n);
+            }
+            break;
+
+        case SERVER_CONF_SCROLLBACK:
+            if (lex_next(l) != '=') {
+                snprintf(err, sizeof(err), "expected '=' after %s keyword",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if (lex_next(l) != LEX_INT) {
+                snprintf(err, sizeof(err), "expected INTEGER for %s value",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if (((n = atoi(lex_text(l))) < 0)
+                    || (n > SCROLLBACK_MAX_SIZE)) {
+                snprintf(err, sizeof(err),
+                    "invalid %s value %d (must be 0-%d)",
+                    server_conf_strs[LEX_UNTOK(tok)], n,
+                    SCROLLBACK_MAX_SIZE);
+            }
+            else {
+                con.scrollback = n;
+            }
+            break;
+
         case SERVER_CONF_NAME:
             if (lex_next(l) != '=') {
                 snprintf(err, sizeof(err), "expected '=' after %s keyword",
@@ -767,6 +942,7 @@ static int process_console(server_conf_t *conf, console_strs_t *con_p,
     char        *q;
     char         quote;
     int          rc;
+    int          n;
     char         buf[MAX_LINE];
     char        *arg0;
     char        *host = NULL;
@@ -899,6 +1075,20 @@ static int process_console(server_conf_t *conf, console_strs_t *con_p,
             con_p->name, arg0);
         goto err;
     }
+    /*  The console's buffer size also applies to its logfile
+     *    since the logfile receives all of the console's output.
+     *  Neither buffer has been allocated yet (cf, write_obj_data).
+     */
+    console->bufSize = (con_p->bufsize > 0)
+        ? con_p->bufsize : conf->globalBufSize;
+
+    /*  The scrollback's chunks are not allocated until the console
+     *    first writes into them (cf, write_scrollback_data).
+     */
+    n = (con_p->scrollback >= 0) ? con_p->scrollback : conf->globalScrollback;
+    console->scrollback.numChunks =
+        (n + SCROLLBACK_CHUNK_SIZE - 1) / SCROLLBACK_CHUNK_SIZE;
+
     if ((con_p->log && con_p->log[ 0 ] != '\0')
             || (!con_p->log && conf->globalLogName)) {
         if (con_p->log) {
@@ -921,6 +1111,7 @@ static int process_console(server_conf_t *conf, console_strs_t *con_p,
                 conf, buf, console, &logopts, errbuf, errbuflen))) {
             goto err;
         }
+        logfile->bufSize = console->bufSize;
         link_objs(console, logfile);
     }
     list_destroy(args);
@@ -939,6 +1130,7 @@ static void parse_global_directive(server_conf_t *conf, Lex l)
 {
     char *directive;                    /* name of directive being parsed */
     int tok;
+    int n;
     int done = 0;
     char err[MAX_LINE] = "";
 
@@ -948,6 +1140,48 @@ static void parse_global_directive(server_conf_t *conf, Lex l)
         tok = lex_next(l);
         switch(tok) {
 
+        case SERVER_CONF_BUFSIZE:
+            if (lex_next(l) != '=') {
+                snprintf(err, sizeof(err), "expected '=' after %s keyword",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if (lex_next(l) != LEX_INT) {
+                snprintf(err, sizeof(err), "expected INTEGER for %s value",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if (((n = atoi(lex_text(l))) < BUFPOOL_MIN_SIZE)
+                    || (n > BUFPOOL_MAX_SIZE)) {
+                snprintf(err, sizeof(err),
+                    "invalid %s value %d (must be %d-%d)",
+                    server_conf_strs[LEX_UNTOK(tok)], n,
+                    BUFPOOL_MIN_SIZE, BUFPOOL_MAX_SIZE);
+            }
+            else {
+                conf->globalBufSize = bufpool_size(n);
+            }
+            break;
+
+        case SERVER_CONF_SCROLLBACK:
+            if (lex_next(l) != '=') {
+                snprintf(err, sizeof(err), "expected '=' after %s keyword",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if (lex_next(l) != LEX_INT) {
+                snprintf(err, sizeof(err), "expected INTEGER for %s value",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if (((n = atoi(lex_text(l))) < 0)
+                    || (n > SCROLLBACK_MAX_SIZE)) {
+                snprintf(err, sizeof(err),
+                    "invalid %s value %d (must be 0-%d)",
+                    server_conf_strs[LEX_UNTOK(tok)], n,
+                    SCROLLBACK_MAX_SIZE);
+            }
+            else {
+                conf->globalScrollback = n;
+            }
+            break;
+
         case SERVER_CONF_LOG:
             if (lex_next(l) != '=') {
                 snprintf(err, sizeof(err), "expected '=' after %s keyword",
@@ -1076,6 +1310,24 @@ static void parse_server_directive(server_conf_t *conf, Lex l)
         tok = lex_next(l);
         switch(tok) {
 
+        case SERVER_CONF_CLIENTTHREADS:
+            if (lex_next(l) != '=') {
+                snprintf(err, sizeof(err), "expected '=' after %s keyword",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if (lex_next(l) != LEX_INT) {
+                snprintf(err, sizeof(err), "expected INTEGER for %s value",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if ((n = atoi(lex_text(l))) <= 0) {
+                snprintf(err, sizeof(err), "invalid %s value %d",
+                    server_conf_strs[LEX_UNTOK(tok)], n);
+            }
+            else {
+                conf->numClientThreads = n;
+            }
+            break;
+
         case SERVER_CONF_COREDUMP:
             if (lex_next(l) != '=') {
                 snprintf(err, sizeof(err), "expected '=' after %s keyword",
@@ -1153,6 +1405,24 @@ static void parse_server_directive(server_conf_t *conf, Lex l)
             }
             break;
 
+        case SERVER_CONF_IOTHREADS:
+            if (lex_next(l) != '=') {
+                snprintf(err, sizeof(err), "expected '=' after %s keyword",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if (lex_next(l) != LEX_INT) {
+                snprintf(err, sizeof(err), "expected INTEGER for %s value",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if ((n = atoi(lex_text(l))) <= 0) {
+                snprintf(err, sizeof(err), "invalid %s value %d",
+                    server_conf_strs[LEX_UNTOK(tok)], n);
+            }
+            else {
+                conf->numIoThreads = n;
+            }
+            break;
+
         case SERVER_CONF_KEEPALIVE:
             if (lex_next(l) != '=') {
                 snprintf(err, sizeof(err), "expected '=' after %s keyword",
@@ -1225,6 +1495,24 @@ static void parse_server_directive(server_conf_t *conf, Lex l)
             }
             break;
 
+        case SERVER_CONF_LOGTHREADS:
+            if (lex_next(l) != '=') {
+                snprintf(err, sizeof(err), "expected '=' after %s keyword",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if (lex_next(l) != LEX_INT) {
+                snprintf(err, sizeof(err), "expected INTEGER for %s value",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if ((n = atoi(lex_text(l))) <= 0) {
+                snprintf(err, sizeof(err), "invalid %s value %d",
+                    server_conf_strs[LEX_UNTOK(tok)], n);
+            }
+            else {
+                conf->numLogThreads = n;
+            }
+            break;
+
         case SERVER_CONF_LOOPBACK:
             if (lex_next(l) != '=') {
                 snprintf(err, sizeof(err), "expected '=' after %s keyword",
@@ -1437,6 +1725,152 @@ static void parse_server_directive(server_conf_t *conf, Lex l)
 }
 
 
+static void parse_trigger_directive(server_conf_t *conf, Lex l)
+{
+/*  TRIGGER [NAME="<str>"] MATCH="<str>" | REGEX="<str>" \
+ *    [LOG=(ON|OFF)] [NOTIFY="<file>"] [EXEC="<str>"] [HOLDOFF=<int>]
+ */
+    char *directive;
+    int tok;
+    int n;
+    int done = 0;
+    char err[MAX_LINE] = "";
+    char *name = NULL;
+    char *match = NULL;
+    char *regex = NULL;
+    char *cmd = NULL;
+    char *notify = NULL;
+    int holdoff = TRIGGER_HOLDOFF;
+    int enableLog = 0;
+    trigger_t *trig;
+
+    directive = server_conf_strs[LEX_UNTOK(lex_prev(l))];
+
+    while (!done && !*err) {
+        tok = lex_next(l);
+        switch(tok) {
+
+        case SERVER_CONF_NAME:
+        case SERVER_CONF_MATCH:
+        case SERVER_CONF_REGEX:
+        case SERVER_CONF_EXEC:
+            if (lex_next(l) != '=') {
+                snprintf(err, sizeof(err), "expected '=' after %s keyword",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if ((lex_next(l) != LEX_STR)
+                    || is_empty_string(lex_text(l))) {
+                snprintf(err, sizeof(err), "expected STRING for %s value",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if (tok == SERVER_CONF_NAME) {
+                replace_string(&name, lex_text(l));
+            }
+            else if (tok == SERVER_CONF_MATCH) {
+                replace_string(&match, lex_text(l));
+            }
+            else if (tok == SERVER_CONF_REGEX) {
+                replace_string(&regex, lex_text(l));
+            }
+            else {
+                replace_string(&cmd, lex_text(l));
+            }
+            break;
+
+        case SERVER_CONF_NOTIFY:
+            if (lex_next(l) != '=') {
+                snprintf(err, sizeof(err), "expected '=' after %s keyword",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if ((lex_next(l) != LEX_STR)
+                    || is_empty_string(lex_text(l))) {
+                snprintf(err, sizeof(err), "expected STRING for %s value",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if (lex_text(l)[0] != '/') {
+                destroy_string(notify);
+                notify = create_format_string("%s/%s",
+                    conf->cwd, lex_text(l));
+            }
+            else {
+                replace_string(&notify, lex_text(l));
+            }
+            break;
+
+        case SERVER_CONF_LOG:
+            if (lex_next(l) != '=') {
+                snprintf(err, sizeof(err), "expected '=' after %s keyword",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if (lex_next(l) == SERVER_CONF_ON) {
+                enableLog = 1;
+            }
+            else if (lex_prev(l) == SERVER_CONF_OFF) {
+                enableLog = 0;
+            }
+            else {
+                snprintf(err, sizeof(err), "expected ON or OFF for %s value",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            break;
+
+        case SERVER_CONF_HOLDOFF:
+            if (lex_next(l) != '=') {
+                snprintf(err, sizeof(err), "expected '=' after %s keyword",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if (lex_next(l) != LEX_INT) {
+                snprintf(err, sizeof(err), "expected INTEGER for %s value",
+                    server_conf_strs[LEX_UNTOK(tok)]);
+            }
+            else if ((n = atoi(lex_text(l))) < 0) {
+                snprintf(err, sizeof(err), "invalid %s value %d",
+                    server_conf_strs[LEX_UNTOK(tok)], n);
+            }
+            else {
+                holdoff = n;
+            }
+            break;
+
+        case LEX_EOF:
+        case LEX_EOL:
+            done = 1;
+            break;
+
+        case LEX_ERR:
+            snprintf(err, sizeof(err), "unmatched quote");
+            break;
+
+        default:
+            snprintf(err, sizeof(err), "unrecognized token '%s'", lex_text(l));
+            break;
+        }
+    }
+    if (!*err) {
+        if (!match && !regex) {
+            snprintf(err, sizeof(err), "incomplete %s directive", directive);
+        }
+        else if ((trig = create_trigger(name, match, regex, cmd, notify,
+                holdoff, enableLog, err, sizeof(err)))) {
+            list_append(conf->triggers, trig);
+        }
+    }
+    if (*err) {
+        log_msg(LOG_ERR, "CONFIG[%s:%d]: %s",
+            conf->confFileName, lex_line(l), err);
+        while (lex_prev(l) != LEX_EOL && lex_prev(l) != LEX_EOF) {
+            (void) lex_next(l);
+        }
+    }
+    destroy_string(name);
+    destroy_string(match);
+    destroy_string(regex);
+    destroy_string(cmd);
+    destroy_string(notify);
+    return;
+}
+
+
 static int read_pidfile(const char *pidfile)
 {
 /*  Reads the PID from the specified pidfile.
@@ -1569,3 +2003,62 @@ static int lookup_syslog_facility(const char *facility)
     }
     return(-1);
 }
+
+
+static io_shard_t * create_io_shard(server_conf_t *conf, int id)
+{
+/*  Creates the I/O shard (id) with its own tpoll obj and objs list.
+ *  The objs list only holds refs to objs in the master conf->objs list.
+ *  If io_uring is available, the reads & writes of ready fds are batched
+ *    into a single system call; o/w, read() & write() are used directly.
+ */
+    io_shard_t *shard;
+
+    if (!(shard = malloc(sizeof(io_shard_t)))) {
+        out_of_memory();
+    }
+    shard->conf = conf;
+    if (!(shard->tp = tpoll_create(0))) {
+        log_err(0, "Unable to create object for multiplexing I/O");
+    }
+    if ((shard->ur = uring_create(IO_BATCH_SIZE, MAX_READ_SIZE))) {
+        if (!(shard->ops = malloc(IO_BATCH_SIZE * sizeof(io_op_t)))) {
+            out_of_memory();
+        }
+    }
+    else {
+        DPRINTF((5, "Unable to create io_uring for shard %d: %s\n",
+            id, strerror(errno)));
+        shard->ops = NULL;
+    }
+    shard->numOps = 0;
+    shard->objs = list_create(NULL);
+    shard->fdObjs = NULL;
+    shard->numFdObjs = 0;
+    x_pthread_mutex_init(&shard->fdLock, NULL);
+    shard->id = id;
+    shard->numReconfigs = 0;
+    return(shard);
+}
+
+
+static void destroy_io_shard(io_shard_t *shard)
+{
+    if (!shard) {
+        return;
+    }
+    if (shard->objs) {
+        list_destroy(shard->objs);
+    }
+    if (shard->tp) {
+        tpoll_destroy(shard->tp);
+    }
+    if (shard->ur) {
+        uring_destroy(shard->ur);
+    }
+    free(shard->ops);
+    free(shard->fdObjs);
+    x_pthread_mutex_destroy(&shard->fdLock);
+    free(shard);
+    return;
+}
@@ -27,11 +27,14 @@
 #endif /* HAVE_CONFIG_H */
 
 #include <arpa/telnet.h>
+#include <sys/types.h>
 #include <assert.h>
 #include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "common.h"
 #include "list.h"
 #include "log.h"
@@ -47,6 +50,8 @@ static void perform_console_writer_linkage(obj_t *client);
 static void perform_log_replay(obj_t *client);
 static void perform_quiet_toggle(obj_t *client);
 static void perform_reset(obj_t *client);
+static void reset_console(obj_t *console);
+static void kill_console_reset(pid_t *arg);
 static void perform_suspend(obj_t *client);
 
 
@@ -256,22 +261,10 @@ static void perform_console_writer_linkage(obj_t *client)
 static void perform_log_replay(obj_t *client)
 {
 /*  Kinda like TiVo's Instant Replay.  :)
- *  Replays the last bytes from the console logfile (if present) associated
+ *  Replays the last bytes of output from the console associated
  *    with this client (in either a R/O or R/W session, but not a B/C session).
- *
- *  The maximum amount of data that can be written into an object's
- *    circular-buffer via write_obj_data() is (MAX_BUF_SIZE - 1) bytes.
- *    But writing this much data may likely overwrite data in the buffer that
- *    has not been flushed to the object's file descriptor via write_to_obj().
- *    Therefore, it is recommended (CONMAN_REPLAY_LEN <= MAX_BUF_SIZE / 2).
  */
     obj_t *console;
-    obj_t *logfile;
-    unsigned char buf[MAX_BUF_SIZE - 1];
-    unsigned char *ptr = buf;
-    int len = sizeof(buf);
-    unsigned char *p;
-    int n, m;
 
     assert(is_client_obj(client));
 
@@ -285,78 +278,46 @@ static void perform_log_replay(obj_t *client)
     assert(list_count(client->writers) == 1);
     console = list_peek(client->writers);
     assert(is_console_obj(console));
-    logfile = get_console_logfile_obj(console);
-
-    if (!logfile) {
-        n = snprintf((char *) ptr, len,
-            "%sConsole [%s] is not being logged -- cannot replay%s",
-            CONMAN_MSG_PREFIX, console->name, CONMAN_MSG_SUFFIX);
-        if ((n < 0) || (n >= len)) {
-            log_msg(LOG_WARNING,
-                "Insufficient buffer to write message to console %s log",
-                console->name);
-            return;
-        }
-        ptr += n;
-    }
-    else {
-        assert(is_logfile_obj(logfile));
-        n = snprintf((char *) ptr, len, "%sBegin log replay of console [%s]%s",
-            CONMAN_MSG_PREFIX, console->name, CONMAN_MSG_SUFFIX);
-        if ((n < 0) || (n >= len) || (sizeof(buf) <= 2*n - 2)) {
-            log_msg(LOG_WARNING,
-                "Insufficient buffer to replay console %s log for %s",
-                console->name, client->name);
-            return;
-        }
-        ptr += n;
-        /*
-         *  Since we now know the length of the "begin" message, reserve
-         *    space in 'buf' for the "end" message by doubling its length.
-         */
-        len -= 2*n - 2;
+    replay_console_log(client, console);
+    return;
+}
 
-        x_pthread_mutex_lock(&logfile->bufLock);
 
-        /*  Compute the number of bytes to replay.
-         *  If the console's circular-buffer has not yet wrapped around,
-         *    don't wrap back into uncharted buffer territory.
-         */
-        if (!logfile->gotBufWrap)
-            n = MIN(CONMAN_REPLAY_LEN, logfile->bufInPtr - logfile->buf);
-        else
-            n = MIN(CONMAN_REPLAY_LEN, MAX_BUF_SIZE - 1);
-        n = MIN(n, len);
-
-        p = logfile->bufInPtr - n;
-        if (p >= logfile->buf) {        /* no wrap needed */
-            memcpy(ptr, p, n);
-            ptr += n;
-        }
-        else {                          /* wrap backwards */
-            m = logfile->buf - p;
-            p = &logfile->buf[MAX_BUF_SIZE] - m;
-            memcpy(ptr, p, m);
-            ptr += m;
-            n -= m;
-            memcpy(ptr, logfile->buf, n);
-            ptr += n;
-        }
+void replay_console_log(obj_t *client, obj_t *console)
+{
+/*  Replays the last bytes of output from the (console) to the (client).
+ *  The replay length is that requested by the client (cf, REPLAY), or else
+ *    the whole of the console's scrollback (or CONMAN_REPLAY_LEN bytes if
+ *    the scrollback is empty).  If this exceeds what the scrollback holds,
+ *    the console's logfile is replayed from disk instead (if possible).
+ *  A replay already in progress is left to finish.
+ */
+    off_t held;
+    off_t len;
+    char buf[MAX_LINE];
 
-        x_pthread_mutex_unlock(&logfile->bufLock);
+    assert(is_client_obj(client));
+    assert(is_console_obj(console));
 
-        /*  Must recompute 'len' since we already subtracted space reserved
-         *    for this string.  We could get away with just sprintf() here.
-         */
-        len = &buf[sizeof(buf)] - ptr;
-        n = snprintf((char *) ptr, len, "%sEnd log replay of console [%s]%s",
-            CONMAN_MSG_PREFIX, console->name, CONMAN_MSG_SUFFIX);
-        assert((n >= 0) && (n < len));
-        ptr += n;
-    }
+    if (client->aux.client.gotReplay)
+        return;
 
-    DPRINTF((5, "Performing log replay on console [%s].\n", console->name));
-    write_obj_data(client, buf, ptr - buf, 0);
+    held = get_scrollback_len(console);
+    if (client->aux.client.req->replayLen > 0)
+        len = client->aux.client.req->replayLen;
+    else
+        len = (held > 0) ? held : CONMAN_REPLAY_LEN;
+
+    if ((len > held) && (open_log_replay(client, console, len) == 0))
+        return;
+    if (open_scrollback_replay(client, console, len) == 0)
+        return;
+
+    snprintf(buf, sizeof(buf),
+        "%sConsole [%s] has no output to replay%s",
+        CONMAN_MSG_PREFIX, console->name, CONMAN_MSG_SUFFIX);
+    strcpy(&buf[sizeof(buf) - 3], "\r\n");
+    write_obj_data(client, buf, strlen(buf), 0);
     return;
 }
 
@@ -395,10 +356,10 @@ static void perform_reset(obj_t *client)
 {
 /*  Resets all consoles for which this client has write-access.
  *
- *  Actually, this routine cannot perform the reset command because
- *    the command string is stored within the server_conf struct.
- *    Therefore, this routine sets a reset flag for each affected
- *    console.  And mux_io() will do the dirty deed when we return.
+ *  Actually, this routine does not perform the reset command itself since
+ *    a console may be muxed by a different shard than the client.
+ *    Therefore, this routine sets a reset flag for each affected console
+ *    and schedules reset_console() to be dispatched by the console's shard.
  */
     ListIterator i;
     obj_t *console;
@@ -416,6 +377,14 @@ static void perform_reset(obj_t *client)
         if (console->gotReset)          /* prior reset not yet processed */
             continue;
         console->gotReset = 1;
+        if (tpoll_timeout_relative(console->shard->tp,
+                (callback_f) reset_console, console, 0) < 0) {
+            log_msg(LOG_ERR,
+                "Unable to create timer for resetting console [%s]",
+                console->name);
+            console->gotReset = 0;
+            continue;
+        }
         log_msg(LOG_NOTICE, "Console [%s] reset by <%s@%s>", console->name,
             client->aux.client.req->user, client->aux.client.req->host);
         snprintf(buf, sizeof(buf),
@@ -432,6 +401,105 @@ static void perform_reset(obj_t *client)
 }
 
 
+static void reset_console(obj_t *console)
+{
+/*  Resets the 'console' obj by performing the server's ResetCmd in a subshell.
+ *  This routine is dispatched as a timer callback by the console's shard.
+ */
+    const char *cmd;
+    char buf[MAX_LINE];
+    pid_t pid;
+    pid_t *arg;
+
+    assert(is_console_obj(console));
+    assert(console->gotReset);
+
+    cmd = console->shard->conf->resetCmd;
+    assert(cmd != NULL);
+
+    console->gotReset = 0;
+
+    if (format_obj_string(buf, sizeof(buf), console, cmd) < 0) {
+        log_msg(LOG_NOTICE, "Unable to reset console [%s]: command too long",
+            console->name);
+        return;
+    }
+    if ((pid = fork()) < 0) {
+        log_msg(LOG_NOTICE, "Unable to reset console [%s]: %s",
+            console->name, strerror(errno));
+        return;
+    }
+    else if (pid == 0) {
+        unblock_signals();
+        setpgid(pid, 0);
+        close(STDIN_FILENO);            /* ignore errors on close() */
+        close(STDOUT_FILENO);
+        close(STDERR_FILENO);
+        execl("/bin/sh", "sh", "-c", buf, (char *) NULL);
+        _exit(127);                     /* execl() error */
+    }
+    /*  Both parent and child call setpgid() to make the child a process
+     *    group leader.  One of these calls is redundant, but by doing
+     *    both we avoid a race condition.  (cf. APUE 9.4 p244)
+     */
+    setpgid(pid, 0);
+
+    /*  FIXME: Have perform_reset() store the client info instead of a bool
+     *    for gotReset.  Then remove the notify_objs msg from perform_reset()
+     *    and replace it with the following:
+     */
+    log_msg(LOG_INFO, "Reset console [%s] (pid %d)", console->name, pid);
+#if 0
+    snprintf(buf, sizeof(buf), "%sConsole [%s] reset (pid %d)%s",
+        CONMAN_MSG_PREFIX, console->name, (int) pid, CONMAN_MSG_SUFFIX);
+    strcpy(&buf[sizeof(buf) - 3], "\r\n");
+    notify_console_objs(console, buf);
+#endif
+
+    /*  Set a timer to ensure the reset cmd does not exceed its time limit.
+     *  The callback function's arg must be allocated on the heap since
+     *    local vars on the stack will be lost once this routine returns.
+     */
+    if (!(arg = malloc(sizeof *arg))) {
+        out_of_memory();
+    }
+    *arg = pid;
+
+    if (tpoll_timeout_relative (console->shard->tp,
+            (callback_f) kill_console_reset, arg,
+            RESET_CMD_TIMEOUT * 1000) < 0) {
+        log_msg(LOG_ERR,
+            "Unable to create timer for resetting console [%s]",
+            console->name);
+    }
+    return;
+}
+
+
+static void kill_console_reset(pid_t *arg)
+{
+/*  Terminates the "ResetCmd" process associated with 'arg' if it has
+ *    exceeded its time limit.
+ *  Memory allocated to 'arg' will be free()'d by this routine.
+ */
+    pid_t pid;
+
+    assert(arg != NULL);
+    pid = *arg;
+    assert(pid > 0);
+    free(arg);
+
+    if (kill(pid, 0) < 0) {             /* process is no longer running */
+        return;
+    }
+    if (kill(-pid, SIGKILL) == 0) {     /* kill entire process group */
+        log_msg(LOG_NOTICE, "ResetCmd process pid=%d exceeded %ds time limit",
+            (int) pid, RESET_CMD_TIMEOUT);
+    }
+    return;
+}
+
+
 static void perform_suspend(obj_t *client)
 {
 /*  Toggles whether output to the client is suspended/resumed.
@@ -444,6 +512,7 @@ static void perform_suspend(obj_t *client)
     assert(is_client_obj(client));
 
     gotSuspend = client->aux.client.gotSuspend ^= 1;
+    set_obj_events(client);
     /*
      *  FIXME: Do check_console_state() here looking for downed telnets.
      *    Should it check the state of all readers & writers?
@@ -70,13 +70,13 @@ static int process_ipmi_opt_workaround(
 static int parse_key(char *dst, const char *src, size_t dstlen);
 static void disconnect_ipmi_obj(obj_t *ipmi);
 static int connect_ipmi_obj(obj_t *ipmi);
+static void retry_ipmi_obj(obj_t *ipmi);
 static int initiate_ipmi_connect(obj_t *ipmi);
 static int create_ipmi_ctx(obj_t *ipmi);
 static int complete_ipmi_connect(obj_t *ipmi);
 static void fail_ipmi_connect(obj_t *ipmi);
 static void reset_ipmi_delay(obj_t *ipmi);
 
-extern tpoll_t tp_global;               /* defined in server.c */
 static int is_ipmi_engine_started = 0;
 
 
@@ -783,10 +783,11 @@ static void disconnect_ipmi_obj(obj_t *ipmi)
     x_pthread_mutex_lock(&ipmi->aux.ipmi.mutex);
 
     if (ipmi->aux.ipmi.timer >= 0) {
-        (void) tpoll_timeout_cancel(tp_global, ipmi->aux.ipmi.timer);
+        (void) tpoll_timeout_cancel(ipmi->shard->tp, ipmi->aux.ipmi.timer);
         ipmi->aux.ipmi.timer = -1;
     }
     if (ipmi->fd >= 0) {
+        unregister_obj_fd(ipmi);
         if (close(ipmi->fd) < 0) {
             log_msg(LOG_ERR,
                 "Unable to close connection to <%s> for console [%s]: %s",
@@ -833,7 +834,7 @@ static int connect_ipmi_obj(obj_t *ipmi)
     if (ipmi->aux.ipmi.state != CONMAN_IPMI_UP) {
 
         if (ipmi->aux.ipmi.timer >= 0) {
-            (void) tpoll_timeout_cancel(tp_global, ipmi->aux.ipmi.timer);
+            (void) tpoll_timeout_cancel(ipmi->shard->tp, ipmi->aux.ipmi.timer);
             ipmi->aux.ipmi.timer = -1;
         }
         if (ipmi->aux.ipmi.state == CONMAN_IPMI_DOWN) {
@@ -855,6 +856,22 @@ static int connect_ipmi_obj(obj_t *ipmi)
 }
 
 
+static void retry_ipmi_obj(obj_t *ipmi)
+{
+/*  Retries establishing a connection with the specified (ipmi) obj.
+ *  This routine is only invoked by a timer or the ipmiconsole engine thread,
+ *    neither of which hold the objsLock.  So it is held for reading here
+ *    while notifying linked objs.
+ */
+    pthread_rwlock_t *lockp = &ipmi->shard->conf->objsLock;
+
+    x_pthread_rwlock_rdlock(lockp);
+    (void) connect_ipmi_obj(ipmi);
+    x_pthread_rwlock_unlock(lockp);
+    return;
+}
+
+
 static int initiate_ipmi_connect(obj_t *ipmi)
 {
 /*  Initiates an IPMI connection attempt.
@@ -873,7 +890,7 @@ static int initiate_ipmi_connect(obj_t *ipmi)
         ipmi->aux.ipmi.host, ipmi->name));
 
     rc = ipmiconsole_engine_submit(ipmi->aux.ipmi.ctx,
-        (Ipmiconsole_callback) connect_ipmi_obj, ipmi);
+        (Ipmiconsole_callback) retry_ipmi_obj, ipmi);
     if (rc < 0) {
         return(-1);
     }
@@ -886,8 +903,8 @@ static int initiate_ipmi_connect(obj_t *ipmi)
      *    connect_ipmi_obj().
      */
     assert(ipmi->aux.ipmi.timer == -1);
-    ipmi->aux.ipmi.timer = tpoll_timeout_relative(tp_global,
-        (callback_f) connect_ipmi_obj, ipmi,
+    ipmi->aux.ipmi.timer = tpoll_timeout_relative(ipmi->shard->tp,
+        (callback_f) retry_ipmi_obj, ipmi,
         IPMI_CONNECT_TIMEOUT * 1000);
 
     return(0);
@@ -965,13 +982,18 @@ static int complete_ipmi_connect(obj_t *ipmi)
     ipmi->gotEOF = 0;
     ipmi->aux.ipmi.state = CONMAN_IPMI_UP;
 
+    /*  Register the new fd with the obj's shard.  This is thread-safe since
+     *    this is invoked from the ipmiconsole engine's callback thread.
+     */
+    register_obj_fd(ipmi);
+
     /*  Require the connection to be up for a minimum length of time
      *    before resetting the reconnect delay back to the minimum.
      *  Any existing timer should have already been cancelled at the start of
      *    connect_ipmi_obj().
      */
     assert(ipmi->aux.ipmi.timer == -1);
-    ipmi->aux.ipmi.timer = tpoll_timeout_relative(tp_global,
+    ipmi->aux.ipmi.timer = tpoll_timeout_relative(ipmi->shard->tp,
         (callback_f) reset_ipmi_delay, ipmi, IPMI_MIN_TIMEOUT * 1000);
 
     /*  Notify linked objs when transitioning into an UP state.
@@ -1012,8 +1034,8 @@ static void fail_ipmi_connect(obj_t *ipmi)
     DPRINTF((15, "Reconnect attempt to <%s> via IPMI for [%s] in %ds.\n",
         ipmi->aux.ipmi.host, ipmi->name, ipmi->aux.ipmi.delay));
     assert(ipmi->aux.ipmi.timer == -1);
-    ipmi->aux.ipmi.timer = tpoll_timeout_relative(tp_global,
-        (callback_f) connect_ipmi_obj, ipmi,
+    ipmi->aux.ipmi.timer = tpoll_timeout_relative(ipmi->shard->tp,
+        (callback_f) retry_ipmi_obj, ipmi,
         ipmi->aux.ipmi.delay * 1000);
 
     /*  Update timer delay via exponential backoff.
@@ -27,18 +27,70 @@
 #endif /* HAVE_CONFIG_H */
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif /* __SSE2__ */
 #include "common.h"
+#include "list.h"
 #include "log.h"
 #include "server.h"
 #include "util-file.h"
 #include "util-str.h"
+#include "util.h"
+#include "wrapper.h"
+
+
+static long long parse_logfile_limit(const char *str, int isSize);
+
+static int scan_log_data(const unsigned char *src, int len, int isSanitized);
+
+static void * write_logfiles(server_conf_t *conf);
+
+static int write_logfile(obj_t *logfile);
+
+static int is_logfile_rotation_due(obj_t *logfile);
+
+static void rotate_logfile(obj_t *logfile);
+
+static void shift_rotated_logfiles(const char *name, const char *suffix,
+    int keep);
+
+static void queue_expired_logfiles(server_conf_t *conf);
+
+static void create_logfile_index(obj_t *logfile);
+
+static void open_logfile_index(obj_t *logfile, int flags);
+
+static int finish_logfile_frame(obj_t *logfile);
+
+static int search_logfile_index(int fd, off_t size, time_t t, off_t *posPtr);
+
+static int find_logfile_index_line(int fd, off_t pos, off_t *linePtr);
+
+static int read_logfile_index_entry(int fd, off_t pos, logidx_entry_t *e,
+    off_t *nextPtr);
+
+static int read_logfile_index_prev(int fd, off_t pos, logidx_entry_t *e);
+
+#if WITH_ZLIB
+static int inflate_logfile_range(int fd, off_t offset, off_t length, int sd);
+static void create_logfile_zip(obj_t *logfile);
+static void destroy_logfile_zip(obj_t *logfile);
+static int write_zip_logfile(obj_t *logfile);
+static int deflate_logfile(obj_t *logfile, const void *src, int len,
+    int flush);
+#endif /* WITH_ZLIB */
 
 
 int parse_logfile_opts(logopt_t *opts, const char *str,
@@ -46,7 +98,10 @@ int parse_logfile_opts(logopt_t *opts, const char *str,
 {
 /*  Parses 'str' for logfile device options 'opts'.
  *    The 'opts' struct should be initialized to a default value.
- *    The 'str' string is of the form "(sanitize|nosanitize)".
+ *    The 'str' string is of the form "(lock|nolock),(sanitize|nosanitize),
+ *    (timestamp[=(sec|ms|us|mono)]|notimestamp),(compress=gzip|nocompress),
+ *    (index|noindex),maxsize=<int>[k|m|g],maxage=<int>[m|h|d],keep=<int>,
+ *    norotate".
  *  Returns 0 and updates the 'opts' struct on success; o/w, returns -1
  *    (writing an error message into 'errbuf' if defined).
  */
@@ -54,6 +109,7 @@ int parse_logfile_opts(logopt_t *opts, const char *str,
     char buf[MAX_LINE];
     const char * const separators = " \t\n.,;";
     char *tok;
+    long long n;
 
     assert(opts != NULL);
 
@@ -86,10 +142,86 @@ int parse_logfile_opts(logopt_t *opts, const char *str,
             optsTmp.enableSanitize = 1;
         else if (!strcasecmp(tok, "nosanitize"))
             optsTmp.enableSanitize = 0;
-        else if (!strcasecmp(tok, "timestamp"))
+        else if (!strcasecmp(tok, "timestamp")) {
+            optsTmp.enableTimestamp = 1;
+            optsTmp.timestampFormat = TIME_FMT_SEC;
+        }
+        else if (!strncasecmp(tok, "timestamp=", 10)) {
             optsTmp.enableTimestamp = 1;
+            if (!strcasecmp(tok + 10, "sec"))
+                optsTmp.timestampFormat = TIME_FMT_SEC;
+            else if (!strcasecmp(tok + 10, "ms"))
+                optsTmp.timestampFormat = TIME_FMT_MSEC;
+            else if (!strcasecmp(tok + 10, "us"))
+                optsTmp.timestampFormat = TIME_FMT_USEC;
+            else if (!strcasecmp(tok + 10, "mono"))
+                optsTmp.timestampFormat = TIME_FMT_MONO;
+            else {
+                if ((errbuf != NULL) && (errlen > 0))
+                    snprintf(errbuf, errlen,
+                        "invalid timestamp format \"%s\"", tok + 10);
+                return(-1);
+            }
+        }
         else if (!strcasecmp(tok, "notimestamp"))
             optsTmp.enableTimestamp = 0;
+        else if (!strncasecmp(tok, "compress=", 9)) {
+#if WITH_ZLIB
+            if (!strcasecmp(tok + 9, "gzip"))
+                optsTmp.enableCompress = 1;
+            else {
+                if ((errbuf != NULL) && (errlen > 0))
+                    snprintf(errbuf, errlen,
+                        "unsupported compression \"%s\"", tok + 9);
+                return(-1);
+            }
+#else  /* !WITH_ZLIB */
+            if ((errbuf != NULL) && (errlen > 0))
+                snprintf(errbuf, errlen,
+                    "compression not supported (requires zlib)");
+            return(-1);
+#endif /* !WITH_ZLIB */
+        }
+        else if (!strcasecmp(tok, "nocompress"))
+            optsTmp.enableCompress = 0;
+        else if (!strcasecmp(tok, "index"))
+            optsTmp.enableIndex = 1;
+        else if (!strcasecmp(tok, "noindex"))
+            optsTmp.enableIndex = 0;
+        else if (!strncasecmp(tok, "maxsize=", 8)) {
+            n = parse_logfile_limit(tok + 8, 1);
+            if ((n < 0) || ((off_t) n != n)) {
+                if ((errbuf != NULL) && (errlen > 0))
+                    snprintf(errbuf, errlen,
+                        "invalid maxsize value \"%s\"", tok + 8);
+                return(-1);
+            }
+            optsTmp.rotateSize = n;
+        }
+        else if (!strncasecmp(tok, "maxage=", 7)) {
+            n = parse_logfile_limit(tok + 7, 0);
+            if ((n < 0) || (n > INT_MAX / 60)) {
+                if ((errbuf != NULL) && (errlen > 0))
+                    snprintf(errbuf, errlen,
+                        "invalid maxage value \"%s\"", tok + 7);
+                return(-1);
+            }
+            optsTmp.rotateMinutes = n;
+        }
+        else if (!strncasecmp(tok, "keep=", 5)) {
+            n = parse_logfile_limit(tok + 5, -1);
+            if ((n < 0) || (n > LOG_ROTATE_MAX_KEEP)) {
+                if ((errbuf != NULL) && (errlen > 0))
+                    snprintf(errbuf, errlen,
+                        "invalid keep value \"%s\"", tok + 5);
+                return(-1);
+            }
+            optsTmp.rotateKeep = n;
+        }
+        else if (!strcasecmp(tok, "norotate")) {
+            optsTmp.rotateSize = 0;
+            optsTmp.rotateMinutes = 0;
+        }
         else {
             log_msg(LOG_WARNING, "ignoring unrecognized token '%s'", tok);
         }
@@ -153,9 +285,31 @@ obj_t * create_logfile_obj(server_conf_t *conf, char *name,
     logfile = create_obj(conf, name, -1, CONMAN_OBJ_LOGFILE);
     logfile->aux.logfile.console = console;
     logfile->aux.logfile.lineState = CONMAN_LOG_LINE_INIT;
+    logfile->aux.logfile.writeState = CONMAN_LOG_WRITE_IDLE;
+    logfile->aux.logfile.gotReopen = 0;
+    logfile->aux.logfile.gotStall = 0;
+    logfile->aux.logfile.gotBacklog = 0;
+    logfile->aux.logfile.idx = NULL;
+    logfile->aux.logfile.zip = NULL;
+    logfile->aux.logfile.rotateTime = 0;
     logfile->aux.logfile.opts = *opts;
     logfile->aux.logfile.gotTruncate = !!conf->enableZeroLogs;
 
+    if (logfile->aux.logfile.opts.enableIndex
+            || logfile->aux.logfile.opts.enableCompress) {
+        create_logfile_index(logfile);
+        conf->numIndexLogs++;
+    }
+#if WITH_ZLIB
+    if (logfile->aux.logfile.opts.enableCompress) {
+        create_logfile_zip(logfile);
+    }
+#endif /* WITH_ZLIB */
+
+    if (logfile->aux.logfile.opts.rotateMinutes > 0) {
+        conf->numAgedLogs++;
+    }
+
     if (logfile->aux.logfile.opts.enableSanitize
             || logfile->aux.logfile.opts.enableTimestamp) {
         logfile->aux.logfile.gotProcessing = 1;
@@ -230,6 +384,12 @@ int open_logfile_obj(obj_t *logfile)
     assert(logfile->aux.logfile.console != NULL);
     assert(logfile->aux.logfile.console->name != NULL);
 
+    /*  Finish the frame in progress before the file is closed.
+     */
+    if (logfile->aux.logfile.idx && (logfile->fd >= 0)) {
+        (void) finish_logfile_frame(logfile);
+    }
+
     if (logfile->fd >= 0) {
         if (close(logfile->fd) < 0)     /* log err and continue */
             log_msg(LOG_WARNING, "Unable to close logfile \"%s\": %s",
@@ -251,8 +411,13 @@ int open_logfile_obj(obj_t *logfile)
             logfile->fd = -1;
             return(-1);
         }
+        /*  The name is replaced while holding the logQueueLock
+         *    since it may be copied by the LOG cmd (cf, server-sock.c).
+         */
+        x_pthread_mutex_lock(&logfile->shard->conf->logQueueLock);
         free(logfile->name);
         logfile->name = create_string(buf);
+        x_pthread_mutex_unlock(&logfile->shard->conf->logQueueLock);
     }
     /*  Create intermediate directories.
      */
@@ -282,6 +447,30 @@ int open_logfile_obj(obj_t *logfile)
     set_fd_nonblocking(logfile->fd);    /* redundant, just playing it safe */
     set_fd_closed_on_exec(logfile->fd);
 
+    if (logfile->aux.logfile.idx) {
+        open_logfile_index(logfile, flags);
+    }
+
+    /*  Schedule the first age-based rotation.  To avoid rotating every
+     *    logfile at once, it is brought forward by up to 1/LOG_ROTATE_STAGGER
+     *    of the rotation interval based on the console name; subsequent
+     *    rotations then remain staggered by this offset.
+     */
+    if ((logfile->aux.logfile.opts.rotateMinutes > 0)
+            && (logfile->aux.logfile.rotateTime == 0)) {
+
+        int secs = logfile->aux.logfile.opts.rotateMinutes * 60;
+        unsigned int hash = 0;
+        const unsigned char *p;
+
+        p = (const unsigned char *) logfile->aux.logfile.console->name;
+        while (*p) {
+            hash = (hash * 31) + *p++;
+        }
+        logfile->aux.logfile.rotateTime = time(NULL) + secs
+            - (hash % ((secs / LOG_ROTATE_STAGGER) + 1));
+    }
+
     now = create_long_time_string(0);
     msg = create_format_string("%sConsole [%s] log opened at %s%s",
         CONMAN_MSG_PREFIX, logfile->aux.logfile.console->name, now,
@@ -354,12 +543,15 @@ int write_log_data(obj_t *log, const void *src, int len)
  *    after each newline.
  *  Returns the number of bytes written into the logfile obj's buffer.
  */
-    const int minbuf = 25;              /* cr/lf + timestamp + meta/char */
+    const int minbuf =                  /* cr/lf + timestamp + meta/char */
+        2 + (MAX_TIME_STRING_LEN + 1) + 2;
     unsigned char buf[MAX_BUF_SIZE - 1];
     const unsigned char *p;
     unsigned char *q;
     const unsigned char * const qLast = buf + sizeof(buf);
+    const int fmt = log->aux.logfile.opts.timestampFormat;
     int n = 0;
+    int m;
 
     assert(is_logfile_obj(log));
     assert(sizeof(buf) >= minbuf);
@@ -374,6 +566,25 @@ int write_log_data(obj_t *log, const void *src, int len)
         len, log->aux.logfile.console->name, log->name));
 
     for (p=src, q=buf; len>0; p++, len--) {
+        /*
+         *  Within a line, a run of characters needing no processing
+         *    is copied in bulk.  The character ending the run (if any)
+         *    is then processed below.  Since the internal buffer is
+         *    flushed once less than 'minbuf' bytes remain, 'm' is >= 0.
+         */
+        if (log->aux.logfile.lineState == CONMAN_LOG_LINE_DATA) {
+            m = scan_log_data(p, MIN(len, (qLast - q) - minbuf),
+                log->aux.logfile.opts.enableSanitize);
+            if (m > 0) {
+                memcpy(q, p, m);
+                q += m;
+                p += m;
+                len -= m;
+                if (len == 0) {
+                    break;
+                }
+            }
+        }
         /*
          *  A newline state machine is used to properly sanitize CR/LF line
          *    terminations.  This is responsible for coalescing multiple CRs,
@@ -387,7 +598,7 @@ int write_log_data(obj_t *log, const void *src, int len)
             }
             else if (log->aux.logfile.lineState == CONMAN_LOG_LINE_INIT) {
                 if (log->aux.logfile.opts.enableTimestamp)
-                    q += write_time_string(0, (char *) q, qLast - q);
+                    q += write_fmt_time_string(fmt, (char *) q, qLast - q);
                 log->aux.logfile.lineState = CONMAN_LOG_LINE_CR;
             }
             else {
@@ -398,7 +609,7 @@ int write_log_data(obj_t *log, const void *src, int len)
             if (  (log->aux.logfile.lineState == CONMAN_LOG_LINE_INIT)
                || (log->aux.logfile.lineState == CONMAN_LOG_LINE_LF) ) {
                 if (log->aux.logfile.opts.enableTimestamp)
-                    q += write_time_string(0, (char *) q, qLast - q);
+                    q += write_fmt_time_string(fmt, (char *) q, qLast - q);
             }
             *q++ = '\r';
             *q++ = '\n';
@@ -416,7 +627,7 @@ int write_log_data(obj_t *log, const void *src, int len)
             }
             if (log->aux.logfile.lineState != CONMAN_LOG_LINE_DATA) {
                 if (log->aux.logfile.opts.enableTimestamp)
-                    q += write_time_string(0, (char *) q, qLast - q);
+                    q += write_fmt_time_string(fmt, (char *) q, qLast - q);
             }
             log->aux.logfile.lineState = CONMAN_LOG_LINE_DATA;
 
@@ -454,3 +665,1266 @@ int write_log_data(obj_t *log, const void *src, int len)
     n += write_obj_data(log, buf, q - buf, 0);
     return(n);
 }
+
+
+void start_logfile_writers(server_conf_t *conf)
+{
+/*  Creates the pool of threads writing logfile data out to disk.
+ *  The threads are created with the signals handled by the main thread
+ *    blocked (cf, create_signal_blocked_thread).
+ */
+    int n;
+    int rc;
+
+    assert(conf->numLogThreads > 0);
+
+    if (!(conf->logTids = malloc(conf->numLogThreads * sizeof(pthread_t)))) {
+        out_of_memory();
+    }
+    for (n = 0; n < conf->numLogThreads; n++) {
+        if ((rc = create_signal_blocked_thread(&conf->logTids[n],
+          (PthreadFunc) write_logfiles, conf)) != 0) {
+            log_err(rc, "Unable to create logfile writer thread");
+        }
+    }
+    DPRINTF((5, "Started %d logfile writer threads.\n", conf->numLogThreads));
+    return;
+}
+
+
+void stop_logfile_writers(server_conf_t *conf)
+{
+/*  Waits for the logfile writer threads to exit
+ *    once they have flushed the logfiles queued for writing.
+ */
+    int n;
+    int rc;
+
+    if (!conf->logTids) {
+        return;
+    }
+    x_pthread_mutex_lock(&conf->logQueueLock);
+    conf->gotLogDone = 1;
+    x_pthread_cond_broadcast(&conf->logQueueCond);
+    x_pthread_mutex_unlock(&conf->logQueueLock);
+
+    for (n = 0; n < conf->numLogThreads; n++) {
+        if ((rc = pthread_join(conf->logTids[n], NULL)) != 0) {
+            log_msg(LOG_WARNING, "Unable to join logfile writer %d: %s",
+                n, strerror(rc));
+        }
+    }
+    free(conf->logTids);
+    conf->logTids = NULL;
+
+    /*  Finish the frames in progress now that the writers have exited.
+     */
+    if (conf->numIndexLogs > 0) {
+
+        ListIterator i;
+        obj_t *logfile;
+
+        i = list_iterator_create(conf->objs);
+        while ((logfile = list_next(i))) {
+            if (is_logfile_obj(logfile) && logfile->aux.logfile.idx
+                    && (logfile->fd >= 0)) {
+                (void) finish_logfile_frame(logfile);
+            }
+        }
+        list_iterator_destroy(i);
+    }
+
+    return;
+}
+
+
+void queue_logfile_write(obj_t *logfile, int gotReopen)
+{
+/*  Queues the 'logfile' obj for its buffered data to be written out by the
+ *    logfile writer threads.  If 'gotReopen' is true, the file is (re)opened
+ *    beforehand.  A logfile that is already queued or being written is not
+ *    queued again; but if being written, it is requeued afterwards as long
+ *    as data remains in its buffer (cf, write_logfiles).
+ *  The caller must not hold the logfile's bufLock.
+ */
+    server_conf_t *conf = logfile->shard->conf;
+
+    assert(is_logfile_obj(logfile));
+
+    x_pthread_mutex_lock(&conf->logQueueLock);
+    if (gotReopen) {
+        logfile->aux.logfile.gotReopen = 1;
+    }
+    if (logfile->aux.logfile.writeState == CONMAN_LOG_WRITE_IDLE) {
+        logfile->aux.logfile.writeState = CONMAN_LOG_WRITE_QUEUED;
+        list_enqueue(conf->logQueue, logfile);
+        x_pthread_cond_signal(&conf->logQueueCond);
+    }
+    x_pthread_mutex_unlock(&conf->logQueueLock);
+    return;
+}
+
+
+int is_logfile_backlogged(obj_t *console)
+{
+/*  Returns true if reading from the 'console' should be deferred until the
+ *    logfile writer threads have made room in its logfile's buffer;
+ *    o/w, returns false.
+ *  Without this, a burst of console output could be read faster than the
+ *    writer threads are scheduled to write it out, thereby overwriting
+ *    the logfile's buffer.  But if the last write to the logfile stalled,
+ *    reads are not deferred since the storage cannot be relied upon to
+ *    keep up; the data overwritten in the logfile's buffer is reported
+ *    instead.  The console's shard is woken once the logfile is written.
+ *  Reads are deferred once the logfile's buffer lacks the space to hold
+ *    the data from another read, taking into account that sanitizing and
+ *    timestamping typically grow this data by no more than half.  Since
+ *    reads are only deferred while data is pending, a buffer smaller than
+ *    this alternates between reading and writing.
+ */
+    obj_t *logfile;
+    server_conf_t *conf;
+    int avail;
+    int need;
+    int isBacklogged = 0;
+
+    if (!(logfile = get_console_logfile_obj(console)) || (logfile->fd < 0)) {
+        return(0);
+    }
+    conf = logfile->shard->conf;
+    if (!conf->logTids) {
+        return(0);
+    }
+    x_pthread_mutex_lock(&conf->logQueueLock);
+    if (!logfile->aux.logfile.gotStall) {
+        x_pthread_mutex_lock(&logfile->bufLock);
+        if (logfile->buf && (logfile->bufInPtr != logfile->bufOutPtr)) {
+            if (logfile->bufOutPtr > logfile->bufInPtr) {
+                avail = logfile->bufOutPtr - logfile->bufInPtr - 1;
+            }
+            else {
+                avail = logfile->bufSize - 1
+                    - (logfile->bufInPtr - logfile->bufOutPtr);
+            }
+            need = MAX_READ_SIZE;
+            if (logfile->aux.logfile.gotProcessing) {
+                need += MAX_READ_SIZE / 2;
+            }
+            isBacklogged = (avail < need);
+        }
+        x_pthread_mutex_unlock(&logfile->bufLock);
+    }
+    if (isBacklogged) {
+        logfile->aux.logfile.gotBacklog = 1;
+    }
+    x_pthread_mutex_unlock(&conf->logQueueLock);
+    return(isBacklogged);
+}
+
+
+static int scan_log_data(const unsigned char *src, int len, int isSanitized)
+{
+/*  Scans the buffer (src) of length (len) for the first character that
+ *    write_log_data() must process while within a line: a CR or LF, or
+ *    (if 'isSanitized') a control character, DEL, or 8-bit character.
+ *  Returns the number of characters preceding it (ie, those which can be
+ *    copied verbatim), or (len) if no such character is found.
+ *
+ *  Characters are tested 16 at a time if SSE2 is available at compile-time
+ *    (as it always is on x86-64), and a word at a time otherwise.
+ */
+    const unsigned char *p = src;
+    const unsigned char * const pLast = src + len;
+
+#if defined(__SSE2__)
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i sp = _mm_set1_epi8(0x20);
+    const __m128i del = _mm_set1_epi8(0x7F);
+    __m128i v;
+    int mask;
+
+    while (pLast - p >= 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+        /*
+         *  As signed chars, 8-bit characters are less than a space.
+         */
+        if (isSanitized) {
+            mask = _mm_movemask_epi8(_mm_or_si128(
+                _mm_cmplt_epi8(v, sp), _mm_cmpeq_epi8(v, del)));
+        }
+        else {
+            mask = _mm_movemask_epi8(_mm_or_si128(
+                _mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        }
+        if (mask != 0) {
+            return((p - src) + ffs(mask) - 1);
+        }
+        p += 16;
+    }
+#else  /* !__SSE2__ */
+    const unsigned long ones = ~0UL / 0xFF;
+    const unsigned long highs = ones * 0x80;
+    unsigned long w;
+    unsigned long x;
+
+    /*  The usual bit-twiddling hacks for finding a zero byte within a word:
+     *    a byte of (x - ones) & ~x has its high bit set if the byte of x is
+     *    zero (or, for the first such byte, less than the subtrahend).
+     */
+    while (pLast - p >= (int) sizeof(w)) {
+        memcpy(&w, p, sizeof(w));
+        if (isSanitized) {
+            x = ((w - (ones * 0x20)) | w | ((w ^ (ones * 0x7F)) - ones))
+                & highs;
+        }
+        else {
+            x = (((w ^ (ones * '\r')) - ones) & ~(w ^ (ones * '\r')))
+              | (((w ^ (ones * '\n')) - ones) & ~(w ^ (ones * '\n')));
+            x &= highs;
+        }
+        if (x != 0) {
+            break;
+        }
+        p += sizeof(w);
+    }
+#endif /* !__SSE2__ */
+
+    for (; p < pLast; p++) {
+        if (isSanitized ? ((*p < 0x20) || (*p >= 0x7F))
+                        : ((*p == '\r') || (*p == '\n'))) {
+            break;
+        }
+    }
+    return(p - src);
+}
+
+
+static void * write_logfiles(server_conf_t *conf)
+{
+/*  Thread entry point for writing queued logfile data out to disk.
+ *
+ *  Since a write to a regular file blocks regardless of O_NONBLOCK, these
+ *    writes are performed here rather than by the I/O threads; a stalled
+ *    filesystem (eg, NFS) then only delays the logfiles, not the consoles
+ *    and clients.  Console output accumulates in each logfile's buffer in
+ *    the meantime (bounded by its BUFSIZE) and is coalesced into a single
+ *    writev() once the logfile is dequeued.  Data overwritten while the
+ *    write is stalled is reported by write_obj_data(), and a write taking
+ *    longer than LOG_STALL_MSECS is reported here.
+ *  A logfile is only written by one thread at a time, and its fd is only
+ *    opened and closed by that thread (or by the main thread before
+ *    the writers are started).  Logfiles are likewise rotated here
+ *    so the renames and unlinks do not stall the I/O threads.
+ */
+    obj_t *logfile;
+    int gotReopen;
+    int gotData;
+    int gotBacklog;
+    struct timeval t0, t1;
+    long ms;
+    int gotScan;
+    time_t tScan;
+    struct timespec ts;
+    int rc;
+
+    DPRINTF((5, "Started logfile writer thread.\n"));
+
+    gotScan = (conf->numIndexLogs > 0) || (conf->numAgedLogs > 0);
+    tScan = time(NULL) + LOG_SCAN_SECS;
+
+    x_pthread_mutex_lock(&conf->logQueueLock);
+    for (;;) {
+        /*  Logfiles that are due for rotation by age (or whose compressed
+         *    frame has expired) may have since gone quiet.  These are checked
+         *    for every LOG_SCAN_SECS regardless of other logfile activity.
+         */
+        if (gotScan && (time(NULL) >= tScan)) {
+            x_pthread_mutex_unlock(&conf->logQueueLock);
+            queue_expired_logfiles(conf);
+            x_pthread_mutex_lock(&conf->logQueueLock);
+            tScan = time(NULL) + LOG_SCAN_SECS;
+        }
+        while (list_is_empty(conf->logQueue) && !conf->gotLogDone) {
+            if (gotScan) {
+                ts.tv_sec = tScan;
+                ts.tv_nsec = 0;
+                rc = pthread_cond_timedwait(&conf->logQueueCond,
+                    &conf->logQueueLock, &ts);
+                if (rc == ETIMEDOUT) {
+                    break;
+                }
+                else if (rc != 0) {
+                    log_err(rc, "pthread_cond_timedwait() failed");
+                }
+                continue;
+            }
+            x_pthread_cond_wait(&conf->logQueueCond, &conf->logQueueLock);
+        }
+        if (list_is_empty(conf->logQueue) && !conf->gotLogDone) {
+            continue;
+        }
+        if (!(logfile = list_dequeue(conf->logQueue))) {
+            break;
+        }
+        logfile->aux.logfile.writeState = CONMAN_LOG_WRITE_BUSY;
+        gotReopen = logfile->aux.logfile.gotReopen;
+        logfile->aux.logfile.gotReopen = 0;
+        x_pthread_mutex_unlock(&conf->logQueueLock);
+
+        if (gotReopen) {
+            open_logfile_obj(logfile);
+        }
+        if (logfile->fd >= 0) {
+            gettimeofday(&t0, NULL);
+            (void) write_logfile(logfile);
+            gettimeofday(&t1, NULL);
+            ms = ((t1.tv_sec - t0.tv_sec) * 1000)
+                + ((t1.tv_usec - t0.tv_usec) / 1000);
+            if (ms >= LOG_STALL_MSECS) {
+                if (!logfile->aux.logfile.gotStall) {
+                    log_msg(LOG_WARNING,
+                        "Logfile \"%s\" stalled for %ld ms on write",
+                        logfile->name, ms);
+                }
+                logfile->aux.logfile.gotStall = 1;
+            }
+            else if (logfile->aux.logfile.gotStall) {
+                log_msg(LOG_NOTICE, "Logfile \"%s\" is no longer stalled",
+                    logfile->name);
+                logfile->aux.logfile.gotStall = 0;
+            }
+            if ((logfile->fd >= 0) && is_logfile_rotation_due(logfile)) {
+                rotate_logfile(logfile);
+            }
+        }
+        /*  The logfile is requeued if data was written into its buffer while
+         *    it was being written (or if more remains than was written).
+         *  This check is made while holding the logQueueLock so data written
+         *    afterwards is guaranteed to be queued by queue_logfile_write().
+         */
+        x_pthread_mutex_lock(&conf->logQueueLock);
+        x_pthread_mutex_lock(&logfile->bufLock);
+        gotData = (logfile->fd >= 0)
+            && (logfile->bufInPtr != logfile->bufOutPtr);
+        x_pthread_mutex_unlock(&logfile->bufLock);
+
+        gotBacklog = logfile->aux.logfile.gotBacklog;
+        logfile->aux.logfile.gotBacklog = 0;
+
+        if (gotData || logfile->aux.logfile.gotReopen) {
+            logfile->aux.logfile.writeState = CONMAN_LOG_WRITE_QUEUED;
+            list_enqueue(conf->logQueue, logfile);
+        }
+        else {
+            logfile->aux.logfile.writeState = CONMAN_LOG_WRITE_IDLE;
+        }
+        /*  Resume reading from the console once its backlog has drained.
+         *    The logQueueLock is released beforehand since set_obj_events()
+         *    checks the backlog via is_logfile_backlogged().
+         */
+        if (gotBacklog) {
+            x_pthread_mutex_unlock(&conf->logQueueLock);
+            set_obj_events(logfile->aux.logfile.console);
+            x_pthread_mutex_lock(&conf->logQueueLock);
+        }
+    }
+    x_pthread_mutex_unlock(&conf->logQueueLock);
+    return(NULL);
+}
+
+
+static int write_logfile(obj_t *logfile)
+{
+/*  Writes data from the logfile's circular-buffer out to the file,
+ *    compressing and indexing it if enabled.
+ *  Returns 0 on success, or -1 if the obj is ready to be destroyed.
+ */
+    logidx_t *idx = logfile->aux.logfile.idx;
+    time_t now;
+    off_t len;
+    int rc;
+
+#if WITH_ZLIB
+    if (logfile->aux.logfile.zip) {
+        return(write_zip_logfile(logfile));
+    }
+#endif /* WITH_ZLIB */
+
+    if (!idx) {
+        return(write_to_obj(logfile));
+    }
+    /*  Since the logfile is opened for appending, the file offset following
+     *    the write is the new length of the file.
+     */
+    now = time(NULL);
+    rc = write_to_obj(logfile);
+    if (logfile->fd < 0) {
+        return(rc);
+    }
+    if ((len = lseek(logfile->fd, 0, SEEK_CUR)) > idx->fileLen) {
+        if (!idx->gotFrame) {
+            idx->frameOffset = idx->fileLen;
+            idx->frameRawLen = 0;
+            idx->frameTime = now;
+            idx->gotFrame = 1;
+        }
+        idx->frameRawLen += len - idx->fileLen;
+        idx->fileLen = len;
+    }
+    if (idx->gotFrame && ((idx->frameRawLen >= LOG_FRAME_SIZE)
+            || (now - idx->frameTime >= LOG_FRAME_SECS))) {
+        (void) finish_logfile_frame(logfile);
+    }
+    return(rc);
+}
+
+
+static long long parse_logfile_limit(const char *str, int isSize)
+{
+/*  Parses 'str' for a logfile rotation limit.  If 'isSize' is positive,
+ *    this is a size of the form "<int>[k|m|g]" in bytes; if zero, an age
+ *    of the form "<int>[m|h|d]" in minutes; o/w, a plain integer.
+ *  Returns the non-negative limit, or -1 on error.
+ */
+    char *end;
+    long long n;
+    long long mult = 1;
+
+    if (!isdigit((int) *str)) {
+        return(-1);
+    }
+    errno = 0;
+    n = strtoll(str, &end, 10);
+    if (errno != 0) {
+        return(-1);
+    }
+    if (*end == '\0') {
+        return(n);
+    }
+    if ((isSize < 0) || (end[1] != '\0')) {
+        return(-1);
+    }
+    switch (tolower((int) *end)) {
+    case 'k':
+        mult = (isSize) ? 1024LL : -1;
+        break;
+    case 'm':
+        mult = (isSize) ? 1024LL * 1024 : 1;
+        break;
+    case 'g':
+        mult = (isSize) ? 1024LL * 1024 * 1024 : -1;
+        break;
+    case 'h':
+        mult = (isSize) ? -1 : 60;
+        break;
+    case 'd':
+        mult = (isSize) ? -1 : 60 * 24;
+        break;
+    default:
+        mult = -1;
+        break;
+    }
+    if ((mult < 0) || (n > LLONG_MAX / mult)) {
+        return(-1);
+    }
+    return(n * mult);
+}
+
+
+static int is_logfile_rotation_due(obj_t *logfile)
+{
+/*  Returns true if the open 'logfile' obj has reached its maximum age or
+ *    size; o/w, returns false.
+ */
+    const logopt_t *opts = &logfile->aux.logfile.opts;
+    struct stat st;
+
+    assert(logfile->fd >= 0);
+
+    if ((opts->rotateMinutes > 0)
+            && (time(NULL) >= logfile->aux.logfile.rotateTime)) {
+        return(1);
+    }
+    if (opts->rotateSize > 0) {
+        if (logfile->aux.logfile.idx) {
+            return(logfile->aux.logfile.idx->fileLen >= opts->rotateSize);
+        }
+        if ((fstat(logfile->fd, &st) == 0)
+                && (st.st_size >= opts->rotateSize)) {
+            return(1);
+        }
+    }
+    return(0);
+}
+
+
+static void rotate_logfile(obj_t *logfile)
+{
+/*  Rotates the 'logfile' obj.  The previously-rotated logfiles are renamed
+ *    with the next numeric suffix (the oldest being replaced once 'keep' are
+ *    retained), the logfile is renamed with the ".1" suffix, and a new
+ *    logfile is then opened in its place.
+ *  The logfile is renamed while still open so data remaining in its buffer
+ *    (or in its current frame) ends up in the rotated file.
+ */
+    int keep = logfile->aux.logfile.opts.rotateKeep;
+
+    assert(logfile->fd >= 0);
+
+    shift_rotated_logfiles(logfile->name, "", keep);
+    if (logfile->aux.logfile.idx) {
+        shift_rotated_logfiles(logfile->name, LOG_INDEX_SUFFIX, keep);
+    }
+
+    if (logfile->aux.logfile.opts.rotateMinutes > 0) {
+        logfile->aux.logfile.rotateTime = time(NULL)
+            + (logfile->aux.logfile.opts.rotateMinutes * 60);
+    }
+    log_msg(LOG_INFO, "Console [%s] log rotated",
+        logfile->aux.logfile.console->name);
+
+    (void) open_logfile_obj(logfile);
+    return;
+}
+
+
+static void shift_rotated_logfiles(const char *name, const char *suffix,
+    int keep)
+{
+/*  Renames each "<name>.<k><suffix>" to "<name>.<k+1><suffix>" for k from
+ *    'keep'-1 down to 1, and then "<name><suffix>" to "<name>.1<suffix>".
+ *    If 'keep' is 0, "<name><suffix>" is removed instead.
+ *  Missing files are skipped; other errors are logged and otherwise ignored.
+ */
+    char src[PATH_MAX];
+    char dst[PATH_MAX];
+    int k;
+    int n;
+
+    if (keep <= 0) {
+        if ((snprintf(src, sizeof(src), "%s%s", name, suffix)
+                < sizeof(src)) && (unlink(src) < 0) && (errno != ENOENT)) {
+            log_msg(LOG_WARNING, "Unable to remove logfile \"%s\": %s",
+                src, strerror(errno));
+        }
+        return;
+    }
+    for (k = keep - 1; k >= 0; k--) {
+        if (k == 0) {
+            n = snprintf(src, sizeof(src), "%s%s", name, suffix);
+        }
+        else {
+            n = snprintf(src, sizeof(src), "%s.%d%s", name, k, suffix);
+        }
+        if ((n >= sizeof(src)) || (snprintf(dst, sizeof(dst), "%s.%d%s",
+                name, k + 1, suffix) >= sizeof(dst))) {
+            log_msg(LOG_WARNING,
+                "Unable to rotate logfile \"%s\": exceeded buffer", name);
+            return;
+        }
+        if ((rename(src, dst) < 0) && (errno != ENOENT)) {
+            log_msg(LOG_WARNING, "Unable to rename logfile \"%s\": %s",
+                src, strerror(errno));
+        }
+    }
+    return;
+}
+
+
+static void queue_expired_logfiles(server_conf_t *conf)
+{
+/*  Queues each logfile that is due for rotation by age, or whose current
+ *    indexed frame was started at least LOG_FRAME_SECS seconds ago, so
+ *    its writer will rotate the logfile or finish the frame.
+ *  This state is read without the logfile being dequeued;
+ *    a stale value merely delays or repeats the logfile being queued.
+ */
+    ListIterator i;
+    obj_t *logfile;
+    time_t now;
+    int isExpired;
+
+    now = time(NULL);
+    x_pthread_rwlock_rdlock(&conf->objsLock);
+    i = list_iterator_create(conf->objs);
+    while ((logfile = list_next(i))) {
+        if (!is_logfile_obj(logfile)) {
+            continue;
+        }
+        isExpired = (logfile->aux.logfile.opts.rotateMinutes > 0)
+            && (now >= logfile->aux.logfile.rotateTime);
+        if (logfile->aux.logfile.idx
+                && logfile->aux.logfile.idx->gotFrame
+                && (now - logfile->aux.logfile.idx->frameTime
+                    >= LOG_FRAME_SECS)) {
+            isExpired = 1;
+        }
+        if (isExpired) {
+            queue_logfile_write(logfile, 0);
+        }
+    }
+    list_iterator_destroy(i);
+    x_pthread_rwlock_unlock(&conf->objsLock);
+    return;
+}
+
+
+/*  An indexed logfile is written as a sequence of "frames".  A frame is
+ *    finished once it holds LOG_FRAME_SIZE bytes of (uncompressed) data or
+ *    LOG_FRAME_SECS seconds after it was started, whichever comes first.
+ *  As each frame is finished, a line "<offset> <length> <rawlength> <time>"
+ *    is appended to the index sidecar (ie, the logfile's name followed by
+ *    LOG_INDEX_SUFFIX), where <offset> and <length> are the frame's location
+ *    within the logfile, <rawlength> is its uncompressed length, and <time>
+ *    is the time (in seconds since the epoch) at which it was started.
+ *    Since these lines are appended in time order, the frames holding a
+ *    given time range can be found by a binary search of the index.
+ *  A compressed logfile is always indexed.  Each of its frames is a gzip
+ *    member that can be decompressed independently of the others; the
+ *    concatenation is itself a valid gzip file (eg, for zcat).  Data not
+ *    yet written out in a finished frame is only held in the deflate stream,
+ *    so at most one frame is lost if the daemon crashes.
+ *  The index state is only accessed by the logfile writer thread writing
+ *    the logfile (or by the main thread before the writers are started and
+ *    after they have exited).
+ */
+
+static void create_logfile_index(obj_t *logfile)
+{
+/*  Creates the index state for the 'logfile' obj.
+ */
+    logidx_t *idx;
+
+    if (!(idx = malloc(sizeof(logidx_t)))) {
+        out_of_memory();
+    }
+    memset(idx, 0, sizeof(*idx));
+    idx->fd = -1;
+    idx->gotFrame = 0;
+    logfile->aux.logfile.idx = idx;
+    return;
+}
+
+
+void destroy_logfile_index(obj_t *logfile)
+{
+/*  Destroys the index state (and compression state) of the 'logfile' obj.
+ */
+    logidx_t *idx = logfile->aux.logfile.idx;
+
+    assert(idx != NULL);
+
+#if WITH_ZLIB
+    if (logfile->aux.logfile.zip) {
+        destroy_logfile_zip(logfile);
+    }
+#endif /* WITH_ZLIB */
+
+    if ((idx->fd >= 0) && (close(idx->fd) < 0)) {
+        log_msg(LOG_WARNING, "Unable to close logfile index for \"%s\": %s",
+            logfile->name, strerror(errno));
+    }
+    free(idx);
+    logfile->aux.logfile.idx = NULL;
+    return;
+}
+
+
+static void open_logfile_index(obj_t *logfile, int flags)
+{
+/*  Prepares the index state of the 'logfile' obj after it has been
+ *    (re)opened with the open() 'flags', (re)opening its index sidecar.
+ *  A missing index is not fatal since the logfile can still be read as
+ *    a whole; a warning is logged instead.
+ */
+    logidx_t *idx = logfile->aux.logfile.idx;
+    char name[PATH_MAX];
+    off_t len;
+
+    assert(idx != NULL);
+    assert(logfile->fd >= 0);
+
+    /*  Discard any frame left unfinished by the file being shut down.
+     */
+    if (idx->gotFrame) {
+#if WITH_ZLIB
+        if (logfile->aux.logfile.zip) {
+            (void) deflateReset(&logfile->aux.logfile.zip->z);
+        }
+#endif /* WITH_ZLIB */
+        idx->gotFrame = 0;
+    }
+    if ((len = lseek(logfile->fd, 0, SEEK_END)) < 0) {
+        len = 0;
+    }
+    idx->fileLen = len;
+
+    if (idx->fd >= 0) {
+        (void) close(idx->fd);
+        idx->fd = -1;
+    }
+    if ((snprintf(name, sizeof(name), "%s%s", logfile->name,
+            LOG_INDEX_SUFFIX) >= sizeof(name))) {
+        log_msg(LOG_WARNING,
+            "Unable to open logfile index for \"%s\": exceeded buffer",
+            logfile->name);
+        return;
+    }
+    if ((idx->fd = open(name, flags, S_IRUSR | S_IWUSR)) < 0) {
+        log_msg(LOG_WARNING, "Unable to open logfile index \"%s\": %s",
+            name, strerror(errno));
+        return;
+    }
+    set_fd_closed_on_exec(idx->fd);
+    return;
+}
+
+
+static int finish_logfile_frame(obj_t *logfile)
+{
+/*  Finishes the logfile's current frame (if any), writing out the remaining
+ *    compressed data and appending the frame to the index sidecar.
+ *  Returns 0 on success, or -1 on error (in which case the logfile has been
+ *    shut down in the same manner as a failed write_to_obj()).
+ */
+    logidx_t *idx = logfile->aux.logfile.idx;
+    char buf[MAX_LINE];
+    int n;
+
+    assert(logfile->fd >= 0);
+
+    if (!idx->gotFrame) {
+        return(0);
+    }
+    idx->gotFrame = 0;
+
+#if WITH_ZLIB
+    if (logfile->aux.logfile.zip) {
+
+        logzip_t *zip = logfile->aux.logfile.zip;
+
+        if (deflate_logfile(logfile, NULL, 0, Z_FINISH) < 0) {
+            n = errno;
+            (void) deflateReset(&zip->z);
+            errno = n;
+            (void) end_write_to_obj(logfile, NULL, -1);
+            return(-1);
+        }
+        (void) deflateReset(&zip->z);
+    }
+#endif /* WITH_ZLIB */
+
+    DPRINTF((10, "Finished %llu-byte frame at offset %lld in \"%s\".\n",
+        (unsigned long long) idx->frameRawLen,
+        (long long) idx->frameOffset, logfile->name));
+
+    if (idx->fd >= 0) {
+        n = snprintf(buf, sizeof(buf), "%lld %lld %llu %ld\n",
+            (long long) idx->frameOffset,
+            (long long) (idx->fileLen - idx->frameOffset),
+            (unsigned long long) idx->frameRawLen, (long) idx->frameTime);
+        if (write_n(idx->fd, buf, n) < 0) {
+            log_msg(LOG_WARNING,
+                "Unable to write logfile index for \"%s\": %s",
+                logfile->name, strerror(errno));
+            (void) close(idx->fd);
+            idx->fd = -1;
+        }
+    }
+    return(0);
+}
+
+
+int find_logfile_range(const char *name, time_t t0, time_t t1,
+    off_t *offsetPtr, off_t *lengthPtr)
+{
+/*  Finds the range of the logfile 'name' holding the data written between
+ *    times 't0' and 't1' (inclusive) by searching its index sidecar; if 't1'
+ *    is 0, the range extends to the end of the logfile.  Since the index
+ *    only records when each frame was started, the range begins with the
+ *    frame started at or before 't0' and ends with the last frame started
+ *    at or before 't1' (or with the data not yet indexed).
+ *  Returns 0 and sets the starting offset (offsetPtr) and length (lengthPtr)
+ *    of the range on success; o/w, returns -1 with errno set.
+ */
+    char idxName[PATH_MAX];
+    struct stat st;
+    logidx_entry_t e;
+    off_t end;
+    off_t pos;
+    int fd;
+    int errnum;
+
+    assert(name != NULL);
+    assert(offsetPtr != NULL);
+    assert(lengthPtr != NULL);
+
+    if (snprintf(idxName, sizeof(idxName), "%s%s", name, LOG_INDEX_SUFFIX)
+            >= sizeof(idxName)) {
+        errno = ENAMETOOLONG;
+        return(-1);
+    }
+    if ((fd = open(idxName, O_RDONLY)) < 0) {
+        return(-1);
+    }
+    if (fstat(fd, &st) < 0) {
+        goto err;
+    }
+    /*  The range begins with the frame preceding the first one started after
+     *    't0', and ends where the first frame started after 't1' begins.
+     */
+    *offsetPtr = 0;
+    if (search_logfile_index(fd, st.st_size, t0, &pos) < 0) {
+        goto err;
+    }
+    if ((pos > 0) && (read_logfile_index_prev(fd, pos, &e) == 0)) {
+        *offsetPtr = e.offset;
+    }
+    end = -1;
+    if (t1 > 0) {
+        if (search_logfile_index(fd, st.st_size, t1, &pos) < 0) {
+            goto err;
+        }
+        if (read_logfile_index_entry(fd, pos, &e, NULL) == 0) {
+            end = e.offset;
+        }
+    }
+    (void) close(fd);
+
+    if (end < 0) {
+        if (stat(name, &st) < 0) {
+            return(-1);
+        }
+        end = st.st_size;
+    }
+    *lengthPtr = (end > *offsetPtr) ? end - *offsetPtr : 0;
+
+    DPRINTF((10, "Found range [%lld,+%lld) of \"%s\" for times %ld-%ld.\n",
+        (long long) *offsetPtr, (long long) *lengthPtr, name,
+        (long) t0, (long) t1));
+    return(0);
+
+err:
+    errnum = errno;
+    (void) close(fd);
+    errno = errnum;
+    return(-1);
+}
+
+
+static int search_logfile_index(int fd, off_t size, time_t t, off_t *posPtr)
+{
+/*  Performs a binary search of the index sidecar 'fd' of length 'size' for
+ *    the first entry of a frame started after time 't'.
+ *  Since entries vary in length, each probe at 'mid' skips ahead to the
+ *    first entry starting at or after 'mid'.  As long as the entries before
+ *    'lo' were started at or before 't' and the entries at or after 'hi'
+ *    were started after 't', the search converges on that entry's offset.
+ *  Returns 0 and sets (posPtr) to the offset of the entry (or 'size' if no
+ *    frame was started after 't') on success; o/w, returns -1 on error.
+ */
+    logidx_entry_t e;
+    off_t lo = 0;
+    off_t hi = size;
+    off_t mid;
+    off_t pos;
+    off_t next;
+    int rc;
+
+    while (lo < hi) {
+        mid = lo + ((hi - lo) / 2);
+        if (mid == lo) {
+            pos = lo;
+        }
+        else if ((rc = find_logfile_index_line(fd, mid - 1, &pos)) < 0) {
+            return(-1);
+        }
+        else if (rc == 0) {
+            pos = size;
+        }
+        if ((pos >= hi)
+                || ((rc = read_logfile_index_entry(fd, pos, &e, &next)) > 0)
+                || ((rc == 0) && (e.time > t))) {
+            hi = mid;
+        }
+        else if (rc < 0) {
+            return(-1);
+        }
+        else {
+            lo = next;
+        }
+    }
+    *posPtr = lo;
+    return(0);
+}
+
+
+static int find_logfile_index_line(int fd, off_t pos, off_t *linePtr)
+{
+/*  Finds the start of the first entry in the index sidecar 'fd' following
+ *    the offset 'pos' (ie, following the first newline at or after 'pos').
+ *  Returns 1 and sets (linePtr) to the entry's offset if found, 0 if the
+ *    end of the index was reached, or -1 on error.
+ */
+    char buf[MAX_LINE];
+    char *p;
+    ssize_t n;
+
+    for (;;) {
+        if ((n = pread(fd, buf, sizeof(buf), pos)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return(-1);
+        }
+        if (n == 0) {
+            return(0);
+        }
+        if ((p = memchr(buf, '\n', n))) {
+            *linePtr = pos + (p - buf) + 1;
+            return(1);
+        }
+        pos += n;
+    }
+}
+
+
+static int read_logfile_index_entry(int fd, off_t pos, logidx_entry_t *e,
+    off_t *nextPtr)
+{
+/*  Reads the entry at offset 'pos' in the index sidecar 'fd' into 'e',
+ *    setting (nextPtr) to the offset of the following entry if non-NULL.
+ *  Returns 0 on success, 1 if there is no (complete) entry at 'pos',
+ *    or -1 on error.
+ */
+    char buf[MAX_LINE];
+    char *p;
+    ssize_t n;
+    long long offset, length;
+    unsigned long long rawLength;
+    long t;
+
+    do {
+        n = pread(fd, buf, sizeof(buf) - 1, pos);
+    } while ((n < 0) && (errno == EINTR));
+
+    if (n < 0) {
+        return(-1);
+    }
+    buf[n] = '\0';
+    if (!(p = strchr(buf, '\n'))) {
+        return(1);
+    }
+    *p = '\0';
+    if (sscanf(buf, "%lld %lld %llu %ld", &offset, &length, &rawLength, &t)
+            != 4) {
+        return(1);
+    }
+    e->offset = offset;
+    e->length = length;
+    e->rawLength = rawLength;
+    e->time = t;
+    if (nextPtr) {
+        *nextPtr = pos + (p - buf) + 1;
+    }
+    return(0);
+}
+
+
+static int read_logfile_index_prev(int fd, off_t pos, logidx_entry_t *e)
+{
+/*  Reads the entry preceding the entry at offset 'pos'
+ *    in the index sidecar 'fd' into 'e'.
+ *  Returns 0 on success, 1 if there is no such entry, or -1 on error.
+ */
+    char buf[MAX_LINE];
+    off_t start;
+    ssize_t n;
+    char *p;
+
+    if (pos <= 0) {
+        return(1);
+    }
+    start = (pos > sizeof(buf)) ? pos - sizeof(buf) : 0;
+
+    do {
+        n = pread(fd, buf, pos - start, start);
+    } while ((n < 0) && (errno == EINTR));
+
+    if (n < 0) {
+        return(-1);
+    }
+    if ((n != pos - start) || (buf[n - 1] != '\n')) {
+        return(1);
+    }
+    /*  Search backwards for the newline terminating the entry before that.
+     */
+    for (p = buf + n - 2; (p >= buf) && (*p != '\n'); p--) {
+        ;
+    }
+    if ((p < buf) && (start > 0)) {
+        return(1);
+    }
+    return(read_logfile_index_entry(fd, start + (p + 1 - buf), e, NULL));
+}
+
+
+int send_logfile_range(const char *name, off_t offset, off_t length,
+    int isCompressed, int sd)
+{
+/*  Sends the range of 'length' bytes at 'offset' in the logfile 'name'
+ *    to the socket 'sd'.  If 'isCompressed', the range consists of whole
+ *    gzip frames which are decompressed as they are sent.
+ *  Returns 0 on success, or -1 on error with errno set.
+ */
+    char buf[MAX_BUF_SIZE];
+    ssize_t n;
+    int fd;
+    int rc = 0;
+    int errnum = 0;
+
+    if ((fd = open(name, O_RDONLY)) < 0) {
+        return(-1);
+    }
+    set_fd_closed_on_exec(fd);
+
+#if WITH_ZLIB
+    if (isCompressed) {
+        rc = inflate_logfile_range(fd, offset, length, sd);
+        errnum = errno;
+        (void) close(fd);
+        errno = errnum;
+        return(rc);
+    }
+#endif /* WITH_ZLIB */
+
+    while (length > 0) {
+        n = pread(fd, buf, MIN(length, (off_t) sizeof(buf)), offset);
+        if ((n < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (n <= 0) {
+            rc = (n < 0) ? -1 : 0;
+            break;
+        }
+        if (write_n(sd, buf, n) < 0) {
+            rc = -1;
+            break;
+        }
+        offset += n;
+        length -= n;
+    }
+    errnum = errno;
+    (void) close(fd);
+    errno = errnum;
+    return(rc);
+}
+
+
+#if WITH_ZLIB
+
+static int inflate_logfile_range(int fd, off_t offset, off_t length, int sd)
+{
+/*  Decompresses the gzip frames within the range of 'length' bytes at
+ *    'offset' in the logfile 'fd', sending the data to the socket 'sd'.
+ *    The range may end with a partial frame (ie, the one still being
+ *    written), in which case the data decompressed thus far is sent.
+ *  Returns 0 on success, or -1 on error with errno set.
+ */
+    z_stream z;
+    unsigned char in[MAX_BUF_SIZE];
+    unsigned char out[MAX_BUF_SIZE];
+    ssize_t n;
+    int rc;
+
+    memset(&z, 0, sizeof(z));
+    z.zalloc = Z_NULL;
+    z.zfree = Z_NULL;
+    z.opaque = Z_NULL;
+    if (inflateInit2(&z, 15 + 16) != Z_OK) {
+        errno = ENOMEM;
+        return(-1);
+    }
+    rc = Z_OK;
+    while ((length > 0) || (z.avail_in > 0)) {
+        if (z.avail_in == 0) {
+            n = pread(fd, in, MIN(length, (off_t) sizeof(in)), offset);
+            if ((n < 0) && (errno == EINTR)) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            offset += n;
+            length -= n;
+            z.next_in = in;
+            z.avail_in = n;
+        }
+        z.next_out = out;
+        z.avail_out = sizeof(out);
+        rc = inflate(&z, Z_NO_FLUSH);
+        if ((rc != Z_OK) && (rc != Z_STREAM_END) && (rc != Z_BUF_ERROR)) {
+            break;
+        }
+        n = sizeof(out) - z.avail_out;
+        if ((n > 0) && (write_n(sd, out, n) < 0)) {
+            (void) inflateEnd(&z);
+            return(-1);
+        }
+        /*  Each frame is a separate gzip member.
+         */
+        if (rc == Z_STREAM_END) {
+            (void) inflateReset(&z);
+        }
+        else if ((rc == Z_BUF_ERROR) && (z.avail_in > 0)) {
+            break;
+        }
+    }
+    (void) inflateEnd(&z);
+
+    if ((rc != Z_OK) && (rc != Z_STREAM_END) && (rc != Z_BUF_ERROR)) {
+        errno = EIO;
+        return(-1);
+    }
+    return(0);
+}
+
+
+static void create_logfile_zip(obj_t *logfile)
+{
+/*  Creates the compression state for the 'logfile' obj.
+ */
+    logzip_t *zip;
+    int rc;
+
+    if (!(zip = malloc(sizeof(logzip_t)))) {
+        out_of_memory();
+    }
+    memset(zip, 0, sizeof(*zip));
+    zip->z.zalloc = Z_NULL;
+    zip->z.zfree = Z_NULL;
+    zip->z.opaque = Z_NULL;
+    /*
+     *  A windowBits of 15+16 writes a gzip header & trailer around each frame.
+     */
+    rc = deflateInit2(&zip->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+        15 + 16, 8, Z_DEFAULT_STRATEGY);
+    if (rc == Z_MEM_ERROR) {
+        out_of_memory();
+    }
+    else if (rc != Z_OK) {
+        log_err(0, "Unable to initialize compression for logfile \"%s\"",
+            logfile->name);
+    }
+    logfile->aux.logfile.zip = zip;
+    return;
+}
+
+
+static void destroy_logfile_zip(obj_t *logfile)
+{
+/*  Destroys the compression state of the 'logfile' obj.
+ */
+    logzip_t *zip = logfile->aux.logfile.zip;
+
+    assert(zip != NULL);
+
+    (void) deflateEnd(&zip->z);
+    free(zip);
+    logfile->aux.logfile.zip = NULL;
+    return;
+}
+
+
+static int write_zip_logfile(obj_t *logfile)
+{
+/*  Compresses data from the logfile's circular-buffer into the current
+ *    frame, writing the compressed data out to the file as it is produced.
+ *  Returns 0 on success, or -1 if the obj is ready to be destroyed.
+ *
+ *  Data is consumed from the buffer in the same manner as write_to_obj(),
+ *    except that the count passed to end_write_to_obj() is the number of
+ *    bytes compressed rather than the number written.
+ */
+    logidx_t *idx = logfile->aux.logfile.idx;
+    struct iovec iov[MAX_WRITE_IOVS];
+    int iovcnt;
+    int budget = MAX_WRITE_BUDGET;
+    int avail;
+    int i;
+    int n;
+
+    do {
+        avail = begin_write_to_obj(logfile, iov, &iovcnt);
+        if ((avail > 0) && !idx->gotFrame) {
+            idx->frameOffset = idx->fileLen;
+            idx->frameRawLen = 0;
+            idx->frameTime = time(NULL);
+            idx->gotFrame = 1;
+        }
+        for (i = 0, n = avail; (i < iovcnt) && (n > 0); i++) {
+            if (deflate_logfile(logfile, iov[i].iov_base, iov[i].iov_len,
+                    Z_NO_FLUSH) < 0) {
+                n = -1;
+            }
+        }
+        if (n > 0) {
+            idx->frameRawLen += n;
+        }
+        if (end_write_to_obj(logfile, iov[0].iov_base, n) < 0) {
+            return(-1);
+        }
+        if ((logfile->fd >= 0) && (idx->frameRawLen >= LOG_FRAME_SIZE)) {
+            (void) finish_logfile_frame(logfile);
+        }
+        budget -= avail;
+    } while ((n > 0) && (budget > 0) && (logfile->fd >= 0));
+
+    if ((logfile->fd >= 0) && idx->gotFrame
+            && (time(NULL) - idx->frameTime >= LOG_FRAME_SECS)) {
+        (void) finish_logfile_frame(logfile);
+    }
+    return(0);
+}
+
+
+static int deflate_logfile(obj_t *logfile, const void *src, int len,
+    int flush)
+{
+/*  Compresses the buffer (src) of length (len) into the logfile's current
+ *    frame using the deflate() (flush) mode, writing out the compressed
+ *    data produced.
+ *  Returns 0 on success, or -1 on error (with errno set by the write,
+ *    or set to EIO if deflate() fails).  The caller must then discard
+ *    the frame since its compressed data is incomplete.
+ */
+    logzip_t *zip = logfile->aux.logfile.zip;
+    logidx_t *idx = logfile->aux.logfile.idx;
+    unsigned char buf[MAX_BUF_SIZE];
+    int rc;
+    int n;
+
+    zip->z.next_in = (Bytef *) src;
+    zip->z.avail_in = len;
+    do {
+        zip->z.next_out = buf;
+        zip->z.avail_out = sizeof(buf);
+        rc = deflate(&zip->z, flush);
+        if ((rc != Z_OK) && (rc != Z_STREAM_END) && (rc != Z_BUF_ERROR)) {
+            log_msg(LOG_WARNING, "Unable to compress logfile \"%s\": %s",
+                logfile->name, (zip->z.msg ? zip->z.msg : zError(rc)));
+            errno = EIO;
+            return(-1);
+        }
+        n = sizeof(buf) - zip->z.avail_out;
+        if ((n > 0) && (write_n(logfile->fd, buf, n) < 0)) {
+            return(-1);
+        }
+        idx->fileLen += n;
+    } while (zip->z.avail_out == 0);
+
+    return(0);
+}
+
+#endif /* WITH_ZLIB */
@@ -0,0 +1,784 @@
+/*****************************************************************************
+ *  Written by Chris Dunlap <cdunlap@llnl.gov>.
+ *  Copyright (C) 2007-2013 Lawrence Livermore National Security, LLC.
+ *  Copyright (C) 2001-2007 The Regents of the University of California.
+ *  UCRL-CODE-2002-009.
+ *
+ *  This file is part of ConMan: The Console Manager.
+ *  For details, see <http://conman.googlecode.com/>.
+ *
+ *  ConMan is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  ConMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with ConMan.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+/*  A multiplexed session carries many consoles over a single client
+ *    connection.  Once negotiated (cf, OPTION=MUX in the HELLO exchange),
+ *    all data in both directions following the OK response is framed,
+ *    each frame identifying the stream of the console it pertains to.
+ *
+ *  Console data is copied from each console's ring into a buffer of data
+ *    frames, visiting the streams round-robin so a console with a lot of
+ *    output cannot starve the others.  A stream's data is only sent while
+ *    the client has granted it credit via FLOW frames; a stream left
+ *    without credit falls behind its console's ring and is notified of
+ *    any data lost in the same manner as any other client.
+ *  Informational messages and stream state changes are written as whole
+ *    frames into the client's circular-buffer (cf, write_mux_frame).
+ *
+ *  A sequenced session (cf, OPTION=SEQ in a MONITOR request) is intended
+ *    for shipping the output of many consoles.  Its console data is sent in
+ *    RECORD frames tagged with the sequence number of the record's first
+ *    byte and the time at which it was read.  A stream's position is
+ *    reported by a SEEK frame when it is opened, and the client may send
+ *    a SEEK frame with the epoch and sequence number of the last output it
+ *    has kept in order to resume from there after reconnecting.  Output
+ *    the console's ring no longer holds is taken from its scrollback; output
+ *    no longer held at all is skipped and reported as lagged.
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "list.h"
+#include "log.h"
+#include "server.h"
+#include "tpoll.h"
+#include "util-str.h"
+#include "util.h"
+#include "wrapper.h"
+
+
+static int find_mux_stream(client_mux_t *mux, obj_t *console);
+static int compare_mux_streams(mux_stream_t **s1_p, mux_stream_t **s2_p);
+static void assemble_mux_frames(obj_t *client);
+static int assemble_mux_data(obj_t *client, int id, int *gotMore_p);
+static int assemble_mux_record(obj_t *client, int id, int *gotMore_p);
+static void report_mux_lag(obj_t *client, mux_stream_t *s, uint64_t lag);
+static void write_mux_input(obj_t *client, uint32_t id,
+    const unsigned char *src, int len);
+static void grant_mux_credit(obj_t *client, uint32_t id, uint32_t n);
+static void seek_mux_stream(obj_t *client, uint32_t id,
+    uint64_t epoch, uint64_t seq);
+
+
+void create_client_mux(obj_t *client)
+{
+/*  Creates the multiplexed session state for the (client), assigning a
+ *    stream to each console in its request in the order listed in the
+ *    OK response.  Each stream starts with MUX_INIT_CREDIT bytes of credit.
+ *  The streams of a sequenced session start without credit, so the client
+ *    can seek each stream before its output is sent.  These streams start
+ *    at the console's next byte of output.
+ */
+    client_mux_t *mux;
+    ListIterator i;
+    obj_t *console;
+    int isSeq;
+    int n;
+
+    assert(is_client_obj(client));
+    assert(client->aux.client.mux == NULL);
+
+    if (!(mux = malloc(sizeof(client_mux_t)))) {
+        out_of_memory();
+    }
+    memset(mux, 0, sizeof(*mux));
+    n = list_count(client->aux.client.req->consoles);
+    if (!(mux->streams = malloc(MAX(n, 1) * sizeof(mux_stream_t)))) {
+        out_of_memory();
+    }
+    if (!(mux->byObj = malloc(MAX(n, 1) * sizeof(mux_stream_t *)))) {
+        out_of_memory();
+    }
+    if (!(mux->frames = malloc(MUX_BUF_SIZE))) {
+        out_of_memory();
+    }
+    isSeq = client->aux.client.req->enableSeq;
+    n = 0;
+    i = list_iterator_create(client->aux.client.req->consoles);
+    while ((console = list_next(i))) {
+        assert(is_console_obj(console));
+        mux->streams[n].console = console;
+        mux->streams[n].ring = NULL;
+        mux->streams[n].ringPos = 0;
+        mux->streams[n].credit = isSeq ? 0 : MUX_INIT_CREDIT;
+        mux->streams[n].isOpen = 0;
+        mux->streams[n].gotSeek = 0;
+        if (isSeq) {
+            x_pthread_mutex_lock(&console->ring.lock);
+            mux->streams[n].ringPos = console->ring.numBytes;
+            x_pthread_mutex_unlock(&console->ring.lock);
+        }
+        mux->byObj[n] = &mux->streams[n];
+        n++;
+    }
+    list_iterator_destroy(i);
+    mux->numStreams = n;
+    /*
+     *  The streams are also sorted by console ref so the stream of a console
+     *    can be found without dereferencing the refs of closed streams.
+     */
+    qsort(mux->byObj, n, sizeof(mux_stream_t *),
+        (int (*)(const void *, const void *)) compare_mux_streams);
+    client->aux.client.mux = mux;
+    DPRINTF((10, "Created %d mux streams for [%s].\n", n, client->name));
+    return;
+}
+
+
+void destroy_client_mux(obj_t *client)
+{
+/*  Destroys the multiplexed session state of the (client), if any.
+ */
+    client_mux_t *mux;
+
+    assert(is_client_obj(client));
+
+    if (!(mux = client->aux.client.mux)) {
+        return;
+    }
+    free(mux->streams);
+    free(mux->byObj);
+    free(mux->frames);
+    free(mux);
+    client->aux.client.mux = NULL;
+    return;
+}
+
+
+void open_mux_stream(obj_t *client, obj_t *console)
+{
+/*  Opens the stream of the multiplexed (client) for reading from (console),
+ *    notifying the client with a STATE frame containing the console's name.
+ *  The stream starts reading from the console's next byte of output.
+ *  The console's ring must have already been allocated (cf, attach_ring).
+ *
+ *  The stream of a sequenced session keeps its position (which the client
+ *    may have already sought), and the client is instead notified with a
+ *    SEEK frame in its next batch.  The console names are known from the
+ *    OK response, and a session with many streams could otherwise overrun
+ *    the client's buffer with STATE frames.
+ */
+    client_mux_t *mux = client->aux.client.mux;
+    mux_stream_t *s;
+    int isSeq = client->aux.client.req->enableSeq;
+    int id;
+
+    assert(mux != NULL);
+    assert(is_console_obj(console));
+
+    if ((id = find_mux_stream(mux, console)) < 0) {
+        return;
+    }
+    s = &mux->streams[id];
+
+    x_pthread_mutex_lock(&console->ring.lock);
+    s->ring = &console->ring;
+    if (!isSeq) {
+        s->ringPos = console->ring.numBytes;
+    }
+    x_pthread_mutex_unlock(&console->ring.lock);
+
+    x_pthread_mutex_lock(&client->bufLock);
+    s->isOpen = 1;
+    if (isSeq) {
+        s->gotSeek = 1;
+    }
+    x_pthread_mutex_unlock(&client->bufLock);
+
+    if (isSeq) {
+        notify_mux_data(client);
+        return;
+    }
+    write_mux_frame(client, console, CONMAN_MUX_STATE,
+        console->name, strlen(console->name), 0);
+    return;
+}
+
+
+void close_mux_stream(obj_t *client, obj_t *console)
+{
+/*  Updates the stream of the multiplexed (client) for (console) after
+ *    a link between them has been destroyed.  The stream stops reading
+ *    from the console's ring once the client no longer reads from it,
+ *    and is closed (and the client notified with an empty STATE frame)
+ *    once the client is no longer linked to the console at all.
+ */
+    client_mux_t *mux = client->aux.client.mux;
+    mux_stream_t *s;
+    int id;
+    int wasOpen;
+
+    assert(mux != NULL);
+    assert(is_console_obj(console));
+
+    if ((id = find_mux_stream(mux, console)) < 0) {
+        return;
+    }
+    s = &mux->streams[id];
+
+    if (!list_find_first(client->writers, (ListFindF) find_obj, console)) {
+        x_pthread_mutex_lock(&console->ring.lock);
+        if (s->ring == &console->ring) {
+            s->ring = NULL;
+        }
+        x_pthread_mutex_unlock(&console->ring.lock);
+    }
+    if (list_find_first(client->readers, (ListFindF) find_obj, console)) {
+        return;
+    }
+    x_pthread_mutex_lock(&client->bufLock);
+    wasOpen = s->isOpen;
+    s->isOpen = 0;
+    x_pthread_mutex_unlock(&client->bufLock);
+
+    if (wasOpen) {
+        write_mux_frame(client, console, CONMAN_MUX_STATE, NULL, 0, 0);
+    }
+    return;
+}
+
+
+int write_mux_frame(obj_t *client, obj_t *console, int type,
+    const void *src, int len, int isInfo)
+{
+/*  Writes a frame of the given (type) containing the buffer (src) of
+ *    length (len) into the multiplexed (client)'s circular-buffer.
+ *    The frame belongs to the stream of (console), or to no stream in
+ *    particular if (console) is NULL.  The payload is truncated to MAX_LINE.
+ *  If (isInfo) is true, the frame may be suppressed (cf, write_obj_data).
+ *  Returns the number of bytes written (or 0 if the frame was dropped).
+ */
+    client_mux_t *mux = client->aux.client.mux;
+    unsigned char buf[CONMAN_MUX_HDR_LEN + MAX_LINE];
+    uint32_t id = CONMAN_MUX_ID_NONE;
+    int n;
+
+    assert(mux != NULL);
+
+    if (client->gotEOF || (client->fd < 0)) {
+        return(0);
+    }
+    if (console && ((n = find_mux_stream(mux, console)) >= 0)) {
+        id = (uint32_t) n;
+    }
+    len = (src != NULL) ? MIN(len, MAX_LINE) : 0;
+    pack_mux_hdr(buf, type, id, len);
+    if (len > 0) {
+        memcpy(buf + CONMAN_MUX_HDR_LEN, src, len);
+    }
+    return(write_obj_data(client, buf, CONMAN_MUX_HDR_LEN + len, isInfo));
+}
+
+
+void notify_mux_data(obj_t *client)
+{
+/*  Notifies the multiplexed (client) that a stream may have data ready
+ *    to be written out (eg, its console has new output, or it has been
+ *    granted more credit).
+ */
+    x_pthread_mutex_lock(&client->bufLock);
+    client->aux.client.mux->gotPending = 1;
+    x_pthread_mutex_unlock(&client->bufLock);
+
+    if (client->fd >= 0) {
+        tpoll_set(client->shard->tp, client->fd, POLLOUT);
+    }
+    return;
+}
+
+
+int is_mux_data_pending(obj_t *client)
+{
+/*  Returns true if the multiplexed (client) has data frames yet to be
+ *    written out to its fd, or has streams that may have data ready.
+ */
+    client_mux_t *mux = client->aux.client.mux;
+    int isPending;
+
+    x_pthread_mutex_lock(&client->bufLock);
+    isPending = (mux->framesPos < mux->framesLen) || mux->gotPending;
+    x_pthread_mutex_unlock(&client->bufLock);
+    return(isPending);
+}
+
+
+int get_mux_data(obj_t *client, struct iovec *iov, int *iovcnt_p,
+    int doAssemble)
+{
+/*  Determines the data frames of the multiplexed (client) that have yet to
+ *    be written out to its fd, setting (iov) to this data and (*iovcnt_p)
+ *    to the number of segments.  If no frames remain and (doAssemble) is
+ *    true, a new batch of frames is assembled from the streams' rings.
+ *  Returns the number of bytes to be written.
+ *
+ *  A batch of frames must be completely written out before anything else
+ *    is written to the client (cf, begin_write_to_obj) since the frames of
+ *    the client's circular-buffer cannot be interleaved within it.
+ */
+    client_mux_t *mux = client->aux.client.mux;
+    int avail;
+
+    if ((mux->framesPos >= mux->framesLen) && doAssemble) {
+        assemble_mux_frames(client);
+    }
+    avail = mux->framesLen - mux->framesPos;
+    iov[0].iov_base = mux->frames + mux->framesPos;
+    iov[0].iov_len = avail;
+    *iovcnt_p = (avail > 0) ? 1 : 0;
+    return(avail);
+}
+
+
+int put_mux_data(obj_t *client, unsigned char *ptr, int n)
+{
+/*  Advances the multiplexed (client)'s position within its batch of data
+ *    frames once (n) bytes starting at (ptr) have been written out to its fd.
+ *  Returns true if (ptr) was within the batch; o/w, returns false.
+ */
+    client_mux_t *mux = client->aux.client.mux;
+
+    if (!mux || (ptr != mux->frames + mux->framesPos)) {
+        return(0);
+    }
+    mux->framesPos += MIN(n, mux->framesLen - mux->framesPos);
+    if (mux->framesPos >= mux->framesLen) {
+        mux->framesPos = mux->framesLen = 0;
+    }
+    return(1);
+}
+
+
+int process_mux_frames(obj_t *client, const unsigned char *src, int len)
+{
+/*  Processes the buffer (src) of length (len) read from the multiplexed
+ *    (client).  A frame may span several reads, so the state of the frame
+ *    being read is kept in the session.  DATA frames are written to their
+ *    streams' consoles (if the client may write to them), FLOW frames grant
+ *    credit to their streams (or to all streams if CONMAN_MUX_ID_NONE),
+ *    SEEK frames reposition their streams (in a sequenced session),
+ *    and all other frames are ignored.
+ *  Returns the number of bytes remaining to be written to the client's
+ *    readers (ie, always 0).
+ */
+    client_mux_t *mux = client->aux.client.mux;
+    int m;
+    int i;
+
+    assert(mux != NULL);
+
+    while (len > 0) {
+        if (mux->inHdrLen < CONMAN_MUX_HDR_LEN) {
+            m = MIN(len, CONMAN_MUX_HDR_LEN - mux->inHdrLen);
+            memcpy(mux->inHdr + mux->inHdrLen, src, m);
+            mux->inHdrLen += m;
+            src += m;
+            len -= m;
+            if (mux->inHdrLen < CONMAN_MUX_HDR_LEN) {
+                break;
+            }
+            unpack_mux_hdr(mux->inHdr,
+                &mux->inType, &mux->inId, &mux->inLeft);
+            mux->inCredit = 0;
+            mux->inSeekLen = 0;
+        }
+        m = MIN(len, mux->inLeft);
+        if (mux->inType == CONMAN_MUX_DATA) {
+            write_mux_input(client, mux->inId, src, m);
+        }
+        else if (mux->inType == CONMAN_MUX_FLOW) {
+            for (i = 0; i < m; i++) {
+                mux->inCredit = (mux->inCredit << 8) | src[i];
+            }
+        }
+        else if (mux->inType == CONMAN_MUX_SEEK) {
+            i = MIN(m, CONMAN_MUX_SEQ_LEN - mux->inSeekLen);
+            memcpy(mux->inSeek + mux->inSeekLen, src, i);
+            mux->inSeekLen += i;
+        }
+        src += m;
+        len -= m;
+        mux->inLeft -= m;
+
+        if (mux->inLeft == 0) {
+            if (mux->inType == CONMAN_MUX_FLOW) {
+                grant_mux_credit(client, mux->inId, mux->inCredit);
+            }
+            else if ((mux->inType == CONMAN_MUX_SEEK)
+                    && (mux->inSeekLen == CONMAN_MUX_SEQ_LEN)) {
+                seek_mux_stream(client, mux->inId,
+                    unpack_mux_uint64(mux->inSeek),
+                    unpack_mux_uint64(mux->inSeek + 8));
+            }
+            mux->inHdrLen = 0;
+        }
+    }
+    return(0);
+}
+
+
+static int find_mux_stream(client_mux_t *mux, obj_t *console)
+{
+/*  Finds the stream of (console) in the multiplexed session (mux).
+ *    The console ref is only compared, so it need not still be valid.
+ *  Returns the stream id, or -1 if the console is not in the session.
+ */
+    int lo = 0;
+    int hi = mux->numStreams - 1;
+    int mid;
+    obj_t *obj;
+
+    while (lo <= hi) {
+        mid = lo + ((hi - lo) / 2);
+        obj = mux->byObj[mid]->console;
+        if (obj == console) {
+            return(mux->byObj[mid] - mux->streams);
+        }
+        else if ((uintptr_t) obj < (uintptr_t) console) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    return(-1);
+}
+
+
+static int compare_mux_streams(mux_stream_t **s1_p, mux_stream_t **s2_p)
+{
+/*  Used by qsort() to sort an array of stream ptrs by their console refs.
+ */
+    uintptr_t x1 = (uintptr_t) (*s1_p)->console;
+    uintptr_t x2 = (uintptr_t) (*s2_p)->console;
+
+    return((x1 < x2) ? -1 : (x1 > x2) ? 1 : 0);
+}
+
+
+static void assemble_mux_frames(obj_t *client)
+{
+/*  Assembles a batch of frames for the multiplexed (client) from the rings
+ *    of its open streams.  Streams are visited round-robin starting after
+ *    the last one serviced, each contributing at most MUX_FRAME_SIZE bytes
+ *    of console data (limited by its credit) until the batch of
+ *    MUX_BUF_SIZE is full.  Data is consumed as the batch is assembled.
+ *  A sequenced session is assembled RECORD frames instead of DATA frames.
+ */
+    client_mux_t *mux = client->aux.client.mux;
+    int isSeq = client->aux.client.req->enableSeq;
+    int isPending;
+    int gotMore = 0;
+    int lastId = -1;
+    int id;
+    int k;
+    int m;
+
+    x_pthread_mutex_lock(&client->bufLock);
+    isPending = mux->gotPending;
+    mux->gotPending = 0;
+    x_pthread_mutex_unlock(&client->bufLock);
+
+    mux->framesPos = mux->framesLen = 0;
+    if (!isPending || (mux->numStreams == 0)) {
+        return;
+    }
+    for (k = 0; k < mux->numStreams; k++) {
+
+        if (MUX_BUF_SIZE - mux->framesLen
+                <= CONMAN_MUX_HDR_LEN + CONMAN_MUX_SEQ_LEN) {
+            gotMore = 1;
+            break;
+        }
+        id = (mux->nextStream + k) % mux->numStreams;
+        if (isSeq) {
+            m = assemble_mux_record(client, id, &gotMore);
+        }
+        else {
+            m = assemble_mux_data(client, id, &gotMore);
+        }
+        if (m > 0) {
+            lastId = id;
+        }
+    }
+    if (lastId >= 0) {
+        mux->nextStream = (lastId + 1) % mux->numStreams;
+    }
+    if (gotMore) {
+        x_pthread_mutex_lock(&client->bufLock);
+        mux->gotPending = 1;
+        x_pthread_mutex_unlock(&client->bufLock);
+    }
+    DPRINTF((15, "Assembled %d bytes of mux frames for [%s].\n",
+        mux->framesLen, client->name));
+    return;
+}
+
+
+static int assemble_mux_data(obj_t *client, int id, int *gotMore_p)
+{
+/*  Appends a DATA frame of the console data from the ring of stream (id)
+ *    to the batch of the multiplexed (client).  If the stream has fallen
+ *    so far behind that unsent data has been overwritten in the ring,
+ *    it skips ahead to the oldest data remaining in the ring.
+ *  Sets (*gotMore_p) if the stream has more data ready to be sent.
+ *  Returns the number of bytes of console data appended.
+ */
+    client_mux_t *mux = client->aux.client.mux;
+    mux_stream_t *s = &mux->streams[id];
+    obj_ring_t *ring;
+    unsigned char *p;
+    uint64_t avail;
+    uint64_t lag = 0;
+    int m = 0;
+    int i;
+    int n;
+
+    if (!(ring = s->ring) || (s->credit == 0)) {
+        return(0);
+    }
+    p = mux->frames + mux->framesLen;
+
+    x_pthread_mutex_lock(&ring->lock);
+    if (s->ring == ring) {
+        if (ring->numBytes - s->ringPos > CONSOLE_RING_SIZE) {
+            lag = ring->numBytes - s->ringPos - CONSOLE_RING_SIZE;
+            s->ringPos = ring->numBytes - CONSOLE_RING_SIZE;
+        }
+        avail = ring->numBytes - s->ringPos;
+        m = MIN(MIN(avail, s->credit), MUX_FRAME_SIZE);
+        m = MIN(m, MUX_BUF_SIZE - mux->framesLen - CONMAN_MUX_HDR_LEN);
+        if (m > 0) {
+            i = s->ringPos % CONSOLE_RING_SIZE;
+            n = MIN(m, CONSOLE_RING_SIZE - i);
+            memcpy(p + CONMAN_MUX_HDR_LEN, &ring->buf[i], n);
+            if (m > n) {
+                memcpy(p + CONMAN_MUX_HDR_LEN + n, ring->buf, m - n);
+            }
+            s->ringPos += m;
+            if ((avail > (uint64_t) m) && (s->credit > (uint32_t) m)) {
+                *gotMore_p = 1;
+            }
+        }
+    }
+    x_pthread_mutex_unlock(&ring->lock);
+
+    if (lag > 0) {
+        report_mux_lag(client, s, lag);
+    }
+    if (m <= 0) {
+        return(0);
+    }
+    pack_mux_hdr(p, CONMAN_MUX_DATA, (uint32_t) id, m);
+    mux->framesLen += CONMAN_MUX_HDR_LEN + m;
+    s->credit -= m;
+    return(m);
+}
+
+
+static int assemble_mux_record(obj_t *client, int id, int *gotMore_p)
+{
+/*  Appends the SEEK frame owed to stream (id) of the sequenced (client)
+ *    (if any), followed by a RECORD frame of its console's output starting
+ *    at the stream's sequence number, to the client's batch.
+ *  The output is taken from the console's ring or scrollback, so a stream
+ *    that has fallen behind (or has sought to older output) is sent output
+ *    the ring no longer holds.  If the output is no longer held at all,
+ *    the stream skips ahead to the oldest output held.
+ *  Sets (*gotMore_p) if the stream may have more output ready to be sent.
+ *  Returns the number of bytes of console output appended.
+ */
+    client_mux_t *mux = client->aux.client.mux;
+    mux_stream_t *s = &mux->streams[id];
+    unsigned char *p;
+    uint64_t seq;
+    time_t t;
+    int gotSeek;
+    int m;
+
+    x_pthread_mutex_lock(&client->bufLock);
+    gotSeek = s->gotSeek;
+    s->gotSeek = 0;
+    x_pthread_mutex_unlock(&client->bufLock);
+
+    if (gotSeek) {
+        seq = s->ringPos;
+        (void) get_console_output(s->console, &seq, &t, NULL, 0);
+        if (seq > s->ringPos) {
+            report_mux_lag(client, s, seq - s->ringPos);
+        }
+        s->ringPos = seq;
+        p = mux->frames + mux->framesLen;
+        pack_mux_hdr(p, CONMAN_MUX_SEEK, (uint32_t) id, CONMAN_MUX_SEQ_LEN);
+        pack_mux_uint64(p + CONMAN_MUX_HDR_LEN,
+            client->shard->conf->seqEpoch);
+        pack_mux_uint64(p + CONMAN_MUX_HDR_LEN + 8, seq);
+        mux->framesLen += CONMAN_MUX_HDR_LEN + CONMAN_MUX_SEQ_LEN;
+    }
+    if (!s->ring || (s->credit == 0)) {
+        return(0);
+    }
+    m = MUX_BUF_SIZE - mux->framesLen
+        - (CONMAN_MUX_HDR_LEN + CONMAN_MUX_SEQ_LEN);
+    if (m <= 0) {
+        *gotMore_p = 1;
+        return(0);
+    }
+    m = MIN(MIN(m, s->credit), MUX_FRAME_SIZE);
+    p = mux->frames + mux->framesLen;
+    seq = s->ringPos;
+    m = get_console_output(s->console, &seq, &t,
+        p + CONMAN_MUX_HDR_LEN + CONMAN_MUX_SEQ_LEN, m);
+    if (seq > s->ringPos) {
+        report_mux_lag(client, s, seq - s->ringPos);
+    }
+    s->ringPos = seq;
+    if (m <= 0) {
+        return(0);
+    }
+    pack_mux_hdr(p, CONMAN_MUX_RECORD, (uint32_t) id,
+        CONMAN_MUX_SEQ_LEN + m);
+    pack_mux_uint64(p + CONMAN_MUX_HDR_LEN, seq);
+    pack_mux_uint64(p + CONMAN_MUX_HDR_LEN + 8, (uint64_t) t);
+    mux->framesLen += CONMAN_MUX_HDR_LEN + CONMAN_MUX_SEQ_LEN + m;
+    s->ringPos += m;
+    s->credit -= m;
+    /*
+     *  A record is limited to output read within a single second, so more
+     *    output may be ready even if it was not limited by the credit.
+     */
+    if (s->credit > 0) {
+        *gotMore_p = 1;
+    }
+    return(m);
+}
+
+
+static void report_mux_lag(obj_t *client, mux_stream_t *s, uint64_t lag)
+{
+/*  Reports that stream (s) of the multiplexed (client) has skipped (lag)
+ *    bytes of its console's output, writing a NOTICE frame to the client.
+ */
+    char buf[MAX_LINE];
+
+    log_msg(LOG_NOTICE, "Client [%s] lagged by %llu bytes on console [%s]",
+        client->name, (unsigned long long) lag, s->console->name);
+    snprintf(buf, sizeof(buf), "%sConsole [%s] output lagged by %llu bytes%s",
+        CONMAN_MSG_PREFIX, s->console->name, (unsigned long long) lag,
+        CONMAN_MSG_SUFFIX);
+    strcpy(&buf[sizeof(buf) - 3], "\r\n");
+    write_mux_frame(client, s->console, CONMAN_MUX_NOTICE,
+        buf, strlen(buf), 0);
+    return;
+}
+
+
+static void write_mux_input(obj_t *client, uint32_t id,
+    const unsigned char *src, int len)
+{
+/*  Writes the buffer (src) of length (len) from a DATA frame read from the
+ *    multiplexed (client) to the console of stream (id).  The data is
+ *    discarded if the stream is not open or the client is not permitted
+ *    to write to its console (eg, a MONITOR session).
+ */
+    client_mux_t *mux = client->aux.client.mux;
+    obj_t *console;
+    int isOpen;
+
+    if ((len <= 0) || (id >= (uint32_t) mux->numStreams)) {
+        return;
+    }
+    x_pthread_mutex_lock(&client->bufLock);
+    isOpen = mux->streams[id].isOpen;
+    x_pthread_mutex_unlock(&client->bufLock);
+
+    console = mux->streams[id].console;
+    if (!isOpen
+            || !list_find_first(client->readers, (ListFindF) find_obj,
+                console)) {
+        DPRINTF((10, "Discarded %d bytes from [%s] for stream %u.\n",
+            len, client->name, (unsigned) id));
+        return;
+    }
+    write_obj_data(console, src, len, 0);
+    return;
+}
+
+
+static void grant_mux_credit(obj_t *client, uint32_t id, uint32_t n)
+{
+/*  Grants (n) bytes of credit to stream (id) of the multiplexed (client),
+ *    or to all of its streams if (id) is CONMAN_MUX_ID_NONE.
+ */
+    client_mux_t *mux = client->aux.client.mux;
+    mux_stream_t *s;
+    int lo, hi;
+
+    if (id == CONMAN_MUX_ID_NONE) {
+        lo = 0;
+        hi = mux->numStreams;
+    }
+    else if (id < (uint32_t) mux->numStreams) {
+        lo = id;
+        hi = id + 1;
+    }
+    else {
+        return;
+    }
+    for (s = &mux->streams[lo]; s < &mux->streams[hi]; s++) {
+        s->credit = (n > UINT32_MAX - s->credit) ? UINT32_MAX : s->credit + n;
+    }
+    notify_mux_data(client);
+    return;
+}
+
+
+static void seek_mux_stream(obj_t *client, uint32_t id,
+    uint64_t epoch, uint64_t seq)
+{
+/*  Repositions stream (id) of the sequenced (client) to the console output
+ *    at sequence number (seq).  If (epoch) does not match that of the
+ *    daemon, the sequence number was assigned by a previous instance of
+ *    the daemon; the stream is then repositioned to the oldest output held.
+ *  The client is notified of the resulting position with a SEEK frame.
+ */
+    client_mux_t *mux = client->aux.client.mux;
+
+    if (!client->aux.client.req->enableSeq
+            || (id >= (uint32_t) mux->numStreams)) {
+        return;
+    }
+    if (epoch != client->shard->conf->seqEpoch) {
+        seq = 0;
+    }
+    mux->streams[id].ringPos = seq;
+
+    x_pthread_mutex_lock(&client->bufLock);
+    mux->streams[id].gotSeek = 1;
+    x_pthread_mutex_unlock(&client->bufLock);
+
+    DPRINTF((10, "Seeking stream %u of [%s] to %llu.\n",
+        (unsigned) id, client->name, (unsigned long long) seq));
+    notify_mux_data(client);
+    return;
+}
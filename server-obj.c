@@ -30,15 +30,23 @@
 #  include <ipmiconsole.h>
 #endif /* HAVE_IPMICONSOLE_H */
 
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include "bufpool.h"
 #include "common.h"
 #include "inevent.h"
 #include "list.h"
@@ -52,7 +60,32 @@
 
 static char * sanitize_file_string(char *str);
 static char * find_trailing_int_str(char *str);
+static void index_console_obj(server_conf_t *conf, obj_t *console);
+static void grow_console_hash(console_index_t *idx);
+static unsigned int hash_console_name(const char *name);
+static int compare_console_names(obj_t **obj1_p, obj_t **obj2_p);
+static void set_client_qos(obj_t *client);
+static short int get_obj_events(obj_t *obj);
+#ifdef TCP_CORK
+static void flush_client_obj(obj_t *client);
+#endif /* TCP_CORK */
+static void attach_ring(obj_t *console, obj_t *client);
+static void detach_ring(obj_t *console, obj_t *client);
+static void write_ring_data(obj_t *console, const void *src, int len);
+static time_t find_output_time(obj_ring_t *ring, uint64_t seq,
+    uint64_t *limit_p);
+static void check_ring_lag(obj_t *client);
+static int get_ring_data(obj_t *client, struct iovec *iov, int *iovcnt_p);
+static void write_scrollback_data(obj_t *console, const void *src, int len);
+static void destroy_scrollback(obj_t *console);
+static void begin_replay(obj_t *client, obj_t *console);
+static int get_replay_data(obj_t *client, struct iovec *iov, int *iovcnt_p);
+static int put_replay_data(obj_t *client, unsigned char *ptr, int n);
+static void finish_log_replay(obj_t *client);
+static void put_ring_data(obj_t *client, unsigned char *ptr, int n);
+static void release_obj_buf(obj_t *obj);
 #ifndef NDEBUG
+static int validate_obj_buf(obj_t *obj);
 static int validate_obj_links(obj_t *obj);
 #endif /* !NDEBUG */
 
@@ -71,15 +104,49 @@ obj_t * create_obj(
         out_of_memory();
     obj->name = create_string(name);
     obj->fd = fd;
-    obj->bufInPtr = obj->bufOutPtr = obj->buf;
+    obj->shard = conf->shards[0];
+    /*
+     *  The buf is not allocated from the bufpool until data is first written
+     *    into it (cf, write_obj_data), and it is returned once drained
+     *    (cf, end_write_to_obj).  Console objs may be configured with a
+     *    larger buf (cf, BUFSIZE) by the caller before it is allocated.
+     */
+    obj->buf = obj->bufInPtr = obj->bufOutPtr = NULL;
+    obj->bufSize = MAX_BUF_SIZE;
     x_pthread_mutex_init(&obj->bufLock, NULL);
+    /*
+     *  The ring only applies to "console" objs, and its buf is not allocated
+     *    until a client first reads from the console (cf, attach_ring).
+     *    Its time marks are allocated when the console first has output.
+     */
+    obj->ring.buf = NULL;
+    obj->ring.numBytes = 0;
+    obj->ring.baseBytes = 0;
+    obj->ring.marks = NULL;
+    obj->ring.numMarks = 0;
+    obj->ring.numReaders = 0;
+    obj->ring.gotSeq = 0;
+    obj->ring.gotIdle = 0;
+    x_pthread_mutex_init(&obj->ring.lock, NULL);
+    /*
+     *  The scrollback only applies to "console" objs, and is sized by the
+     *    caller (cf, SCROLLBACK) before any of its chunks are allocated.
+     */
+    obj->scrollback.chunks = NULL;
+    obj->scrollback.numChunks = 0;
+    obj->scrollback.numBytes = 0;
+    x_pthread_mutex_init(&obj->scrollback.lock, NULL);
+    /*
+     *  The trigger state is allocated when output is first scanned for
+     *    triggers (cf, scan_console_triggers).
+     */
+    obj->trig = NULL;
     obj->readers = list_create(NULL);
     obj->writers = list_create(NULL);
     if ((type < 0) || (type >= CONMAN_OBJ_LAST_ENTRY)) {
         log_err(0, "INTERNAL: Unrecognized object [%s] type=%d", name, type);
     }
     obj->type = type;
-    obj->gotBufWrap = 0;
     obj->gotEOF = 0;
     /*
      *  The gotReset flag only applies to "console" objs.
@@ -88,6 +155,9 @@ obj_t * create_obj(
      */
     obj->gotReset = 0;
 
+    if (is_console_obj(obj)) {
+        index_console_obj(conf, obj);
+    }
     DPRINTF((10, "Created object [%s].\n", obj->name));
     return(obj);
 }
@@ -97,10 +167,14 @@ obj_t * create_client_obj(server_conf_t *conf, req_t *req)
 {
 /*  Creates a new client object and adds it to the master objs list.
  *    Note: the socket is open and set for non-blocking I/O.
+ *  The client is muxed by the I/O shard of the first console in its request
+ *    so a R/O or R/W session is serviced by the same thread as its console.
+ *  The caller must hold the conf's objsLock for reading.
  *  Returns the new object.
  */
     char name[MAX_LINE];
     obj_t *client;
+    obj_t *console;
 
     assert(conf != NULL);
     assert(req != NULL);
@@ -115,15 +189,49 @@ obj_t * create_client_obj(server_conf_t *conf, req_t *req)
     name[sizeof(name) - 1] = '\0';
     client = create_obj(conf, name, req->sd, CONMAN_OBJ_CLIENT);
     client->aux.client.req = req;
+    client->aux.client.mux = NULL;
+    client->aux.client.ring = NULL;
+    client->aux.client.ringPos = 0;
+    client->aux.client.replayFd = -1;
+    client->aux.client.replayPos = 0;
+    client->aux.client.replayEnd = 0;
+    client->aux.client.replayMap = NULL;
+    client->aux.client.replayMapPos = 0;
+    client->aux.client.replayMapLen = 0;
     time(&client->aux.client.timeLastRead);
     if (client->aux.client.timeLastRead == (time_t) -1)
         log_err(errno, "time() failed");
+    client->aux.client.timer = -1;
     client->aux.client.gotEscape = 0;
     client->aux.client.gotSuspend = 0;
+    client->aux.client.gotReplay = 0;
+
+    if ((console = list_peek(req->consoles))) {
+        client->shard = console->shard;
+    }
+    set_client_qos(client);
 
-    /*  Add obj to the master conf->objs list.
+    /*  A multiplexed session has a stream for each of its consoles.
+     *    Its state is created before the client is linked to them.
+     */
+    if (req->enableMux) {
+        create_client_mux(client);
+    }
+    /*  A replay requested by a R/O or R/W session is started before the
+     *    client is added to its shard since the replay state is thereafter
+     *    only accessed by the shard muxing the client.
+     */
+    if (console && (req->replayLen > 0) && (list_count(req->consoles) == 1)
+            && !req->enableMux) {
+        replay_console_log(client, console);
+    }
+    /*  Add obj to the master conf->objs list and its shard's objs list.
+     *    The fd is registered with the shard here in order to wake
+     *    the shard to service the new client.
      */
     list_append(conf->objs, client);
+    list_append(client->shard->objs, client);
+    register_obj_fd(client);
 
     DPRINTF((9, "Opened client: fd=%d user=%s tty=%s host=%s port=%d.\n",
         req->sd, req->user, req->tty, req->host, req->port));
@@ -155,10 +263,14 @@ void destroy_obj(obj_t *obj)
             obj->aux.client.req->sd = -1;
             destroy_req(obj->aux.client.req);
         }
+        close_log_replay(obj);
+        destroy_client_mux(obj);
         break;
     case CONMAN_OBJ_LOGFILE:
         if (obj->aux.logfile.fmtName)
             free(obj->aux.logfile.fmtName);
+        if (obj->aux.logfile.idx)
+            destroy_logfile_index(obj);
         break;
     case CONMAN_OBJ_PROCESS:
         for (pp = obj->aux.process.argv; *pp != NULL; pp++) {
@@ -222,7 +334,17 @@ void destroy_obj(obj_t *obj)
         break;
     }
 
+    bufpool_free(obj->buf, obj->bufSize);
     x_pthread_mutex_destroy(&obj->bufLock);
+    if (obj->ring.buf) {
+        free(obj->ring.buf);
+    }
+    if (obj->ring.marks) {
+        free(obj->ring.marks);
+    }
+    x_pthread_mutex_destroy(&obj->ring.lock);
+    destroy_scrollback(obj);
+    destroy_trigger_state(obj->trig);
     if (obj->readers) {
         list_destroy(obj->readers);
     }
@@ -230,6 +352,9 @@ void destroy_obj(obj_t *obj)
         list_destroy(obj->writers);
     }
     if (obj->fd >= 0) {
+        if (!is_logfile_obj(obj)) {
+            unregister_obj_fd(obj);
+        }
         if (close(obj->fd) < 0)
             log_err(errno, "Unable to close object [%s]", obj->name);
         obj->fd = -1;
@@ -484,6 +609,266 @@ int find_obj(obj_t *obj, obj_t *key)
 }
 
 
+obj_t * find_console_obj(server_conf_t *conf, const char *name)
+{
+/*  Finds the console named (name) via the conf's console index.
+ *  Returns the console obj, or NULL if no console has that name.
+ */
+    console_index_t *idx = &conf->consoles;
+    unsigned int mask;
+    unsigned int h;
+    obj_t *obj;
+
+    assert(name != NULL);
+
+    if (idx->hashSize == 0) {
+        return(NULL);
+    }
+    mask = idx->hashSize - 1;
+    for (h = hash_console_name(name) & mask; (obj = idx->hash[h]);
+            h = (h + 1) & mask) {
+        if (!strcmp(obj->name, name)) {
+            return(obj);
+        }
+    }
+    return(NULL);
+}
+
+
+int find_console_objs(server_conf_t *conf, const char *prefix, int len,
+    obj_t ***objs_p)
+{
+/*  Finds the consoles whose names begin with the first (len) chars of
+ *    (prefix) via a binary search of the conf's sorted console index;
+ *    a zero (len) selects every console.
+ *  Sets (*objs_p) to the first such console within the index.
+ *  Returns the number of consecutive consoles matching the prefix.
+ */
+    console_index_t *idx = &conf->consoles;
+    int lo, hi, mid;
+    int n;
+
+    assert(prefix != NULL);
+    assert(len >= 0);
+    assert(objs_p != NULL);
+    assert(idx->isSorted || (idx->numConsoles == 0));
+
+    lo = 0;
+    hi = idx->numConsoles;
+    while (lo < hi) {
+        mid = lo + ((hi - lo) / 2);
+        if (strncmp(idx->byName[mid]->name, prefix, len) < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    *objs_p = idx->byName + lo;
+
+    hi = idx->numConsoles;
+    for (n = lo; n < hi; n++) {
+        if (strncmp(idx->byName[n]->name, prefix, len) != 0) {
+            break;
+        }
+    }
+    return(n - lo);
+}
+
+
+void sort_console_index(server_conf_t *conf)
+{
+/*  Sorts the conf's console index by name once all consoles have been
+ *    created, thereby allowing find_console_objs() to search it.
+ */
+    console_index_t *idx = &conf->consoles;
+
+    if (idx->numConsoles > 0) {
+        qsort(idx->byName, idx->numConsoles, sizeof(obj_t *),
+            (int (*)(const void *, const void *)) compare_console_names);
+    }
+    idx->isSorted = 1;
+    return;
+}
+
+
+void destroy_console_index(server_conf_t *conf)
+{
+/*  Destroys the conf's console index.
+ *  The consoles themselves are destroyed via the conf->objs list.
+ */
+    console_index_t *idx = &conf->consoles;
+
+    if (idx->byName) {
+        free(idx->byName);
+    }
+    if (idx->hash) {
+        free(idx->hash);
+    }
+    memset(idx, 0, sizeof(*idx));
+    return;
+}
+
+
+static void index_console_obj(server_conf_t *conf, obj_t *console)
+{
+/*  Adds the (console) to the conf's console index.
+ *  The sorted array is only re-sorted once all consoles have been created
+ *    (cf, sort_console_index); the hash is kept at most half full.
+ *  The index generation is bumped to invalidate cached query results.
+ */
+    console_index_t *idx = &conf->consoles;
+    unsigned int mask;
+    unsigned int h;
+
+    if (idx->numConsoles >= idx->maxConsoles) {
+        idx->maxConsoles = MAX(idx->maxConsoles * 2, 64);
+        idx->byName = realloc(idx->byName,
+            idx->maxConsoles * sizeof(obj_t *));
+        if (!idx->byName) {
+            out_of_memory();
+        }
+    }
+    idx->byName[idx->numConsoles++] = console;
+    idx->isSorted = 0;
+    idx->generation++;
+
+    if (idx->numConsoles * 2 > idx->hashSize) {
+        grow_console_hash(idx);
+    }
+    mask = idx->hashSize - 1;
+    h = hash_console_name(console->name) & mask;
+    while (idx->hash[h]) {
+        h = (h + 1) & mask;
+    }
+    idx->hash[h] = console;
+    return;
+}
+
+
+static void grow_console_hash(console_index_t *idx)
+{
+/*  Doubles the size of the console index hash, rehashing its consoles.
+ */
+    obj_t **hash;
+    int size;
+    unsigned int mask;
+    unsigned int h;
+    int n;
+
+    size = MAX(idx->hashSize * 2, 128);
+    if (!(hash = calloc(size, sizeof(obj_t *)))) {
+        out_of_memory();
+    }
+    mask = size - 1;
+    for (n = 0; n < idx->hashSize; n++) {
+        if (!idx->hash[n]) {
+            continue;
+        }
+        h = hash_console_name(idx->hash[n]->name) & mask;
+        while (hash[h]) {
+            h = (h + 1) & mask;
+        }
+        hash[h] = idx->hash[n];
+    }
+    if (idx->hash) {
+        free(idx->hash);
+    }
+    idx->hash = hash;
+    idx->hashSize = size;
+    return;
+}
+
+
+static unsigned int hash_console_name(const char *name)
+{
+/*  Returns the FNV-1a hash of the console (name).
+ */
+    unsigned int h = 2166136261U;
+
+    while (*name) {
+        h ^= (unsigned char) *name++;
+        h *= 16777619U;
+    }
+    return(h);
+}
+
+
+static int compare_console_names(obj_t **obj1_p, obj_t **obj2_p)
+{
+/*  Used by qsort() to order the console index by name in strcmp() order,
+ *    so that consoles sharing a name prefix are adjacent.
+ */
+    return(strcmp((*obj1_p)->name, (*obj2_p)->name));
+}
+
+
+static void set_client_qos(obj_t *client)
+{
+/*  Sets the socket options for the QoS requested by the (client).
+ *  An interactive session disables the Nagle algorithm so each write
+ *    (eg, the echo of a keystroke) is sent out immediately.
+ *  A bulk session enlarges its send buffer and corks its socket so console
+ *    output is coalesced into full segments; a partial segment is pushed out
+ *    by flush_client_obj() once the coalescing window elapses.
+ *  The default session leaves the socket options unchanged.
+ */
+    req_t *req = client->aux.client.req;
+    const int on = 1;
+    const int size = CLIENT_BULK_SNDBUF_SIZE;
+
+    if (req->enableInteractive) {
+        if (setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY,
+                (const void *) &on, sizeof(on)) < 0) {
+            log_msg(LOG_WARNING, "Unable to set NODELAY socket option: %s",
+                strerror(errno));
+        }
+    }
+    else if (req->enableBulk) {
+        if (setsockopt(client->fd, SOL_SOCKET, SO_SNDBUF,
+                (const void *) &size, sizeof(size)) < 0) {
+            log_msg(LOG_WARNING, "Unable to set SNDBUF socket option: %s",
+                strerror(errno));
+        }
+#ifdef TCP_CORK
+        if (setsockopt(client->fd, IPPROTO_TCP, TCP_CORK,
+                (const void *) &on, sizeof(on)) < 0) {
+            log_msg(LOG_WARNING, "Unable to set CORK socket option: %s",
+                strerror(errno));
+        }
+#endif /* TCP_CORK */
+    }
+    return;
+}
+
+
+#ifdef TCP_CORK
+static void flush_client_obj(obj_t *client)
+{
+/*  Pushes out the partial segment held by the corked socket of a bulk
+ *    (client) by briefly removing the cork.
+ *  This is invoked via a tpoll timer scheduled by end_write_to_obj().
+ */
+    const int off = 0;
+    const int on = 1;
+
+    client->aux.client.timer = -1;
+
+    if (client->fd < 0) {
+        return;
+    }
+    if ((setsockopt(client->fd, IPPROTO_TCP, TCP_CORK,
+            (const void *) &off, sizeof(off)) < 0)
+      || (setsockopt(client->fd, IPPROTO_TCP, TCP_CORK,
+            (const void *) &on, sizeof(on)) < 0)) {
+        log_msg(LOG_WARNING, "Unable to flush [%s]: %s",
+            client->name, strerror(errno));
+    }
+    return;
+}
+#endif /* TCP_CORK */
+
+
 int write_notify_msg(obj_t *console, int priority, char *fmt, ...)
 {
 /*  Writes a notification message to the daemon logfile and all attached
@@ -534,6 +919,10 @@ void notify_console_objs(obj_t *console, char *msg)
 {
 /*  Notifies all readers & writers of (console) with the informational (msg).
  *  If an obj is both a reader and a writer, it will only be notified once.
+ *  The conf's objsLock must be held for reading when calling this routine
+ *    since a B/C client writer may be owned (and destroyed) by another shard.
+ *    Timer callbacks that can notify (eg, reconnecting a console) take it
+ *    themselves since they are dispatched outside of a mux_io() pass.
  */
     ListIterator i;
     obj_t *obj;
@@ -545,14 +934,14 @@ void notify_console_objs(obj_t *console, char *msg)
     }
     i = list_iterator_create(console->readers);
     while ((obj = list_next(i))) {
-        write_obj_data(obj, msg, strlen(msg), 1);
+        write_console_msg(obj, console, msg, 1);
     }
     list_iterator_destroy(i);
 
     i = list_iterator_create(console->writers);
     while ((obj = list_next(i))) {
         if (!list_find_first(console->readers, (ListFindF) find_obj, obj)) {
-            write_obj_data(obj, msg, strlen(msg), 1);
+            write_console_msg(obj, console, msg, 1);
         }
     }
     list_iterator_destroy(i);
@@ -560,6 +949,23 @@ void notify_console_objs(obj_t *console, char *msg)
 }
 
 
+int write_console_msg(obj_t *obj, obj_t *console, const char *msg,
+    int isInfo)
+{
+/*  Writes the message (msg) regarding (console) to (obj).
+ *    A multiplexed client receives it as a NOTICE frame on the console's
+ *    stream since its data cannot otherwise be written into its buffer.
+ *  If (isInfo) is true, the msg may be suppressed (cf, write_obj_data).
+ *  Returns the number of bytes written.
+ */
+    if (is_client_obj(obj) && obj->aux.client.mux) {
+        return(write_mux_frame(obj, console, CONMAN_MUX_NOTICE,
+            msg, strlen(msg), isInfo));
+    }
+    return(write_obj_data(obj, msg, strlen(msg), isInfo));
+}
+
+
 void link_objs(obj_t *src, obj_t *dst)
 {
 /*  Creates a link so data read from (src) is written to (dst).
@@ -605,18 +1011,25 @@ void link_objs(obj_t *src, obj_t *dst)
                 writer->aux.client.req->user, writer->aux.client.req->host,
                 (tty ? " on " : ""), (tty ? tty : ""), now, CONMAN_MSG_SUFFIX);
             strcpy(&buf[sizeof(buf) - 3], "\r\n");
-            write_obj_data(src, buf, strlen(buf), 1);
+            write_console_msg(src, dst, buf, 1);
         }
         list_iterator_destroy(i);
 
         /*  If the client is forcing the console session,
          *    disconnect existing clients with write-privileges.
+         *  A multiplexed client only loses its stream for this console.
          */
         if (gotStolen) {
             i = list_iterator_create(dst->writers);
             while ((writer = list_next(i))) {
                 assert(is_client_obj(writer));
-                unlink_obj(writer);
+                if (writer->aux.client.mux) {
+                    unlink_objs(writer, dst);
+                    unlink_objs(dst, writer);
+                }
+                else {
+                    unlink_obj(writer);
+                }
             }
             list_iterator_destroy(i);
         }
@@ -631,6 +1044,10 @@ void link_objs(obj_t *src, obj_t *dst)
     assert(!list_find_first(dst->writers, (ListFindF) find_obj, src));
     list_append(dst->writers, src);
 
+    if (is_console_obj(src) && is_client_obj(dst)) {
+        attach_ring(src, dst);
+    }
+
     DPRINTF((10, "Linked [%s] reads to [%s] writes.\n", src->name, dst->name));
     assert(validate_obj_links(src) >= 0);
     assert(validate_obj_links(dst) >= 0);
@@ -648,14 +1065,30 @@ void unlink_objs(obj_t *src, obj_t *dst)
     char *tty;
     char buf[MAX_LINE];
 
-    if (list_delete_all(src->readers, (ListFindF) find_obj, dst)) {
+    if ((n = list_delete_all(src->readers, (ListFindF) find_obj, dst))) {
         DPRINTF((10, "Removing [%s] from [%s] readers.\n",
             dst->name, src->name));
+        /*
+         *  If a client is no longer reading from a console, detach it from
+         *    the console's ring.
+         */
+        if (is_console_obj(src) && is_client_obj(dst)) {
+            detach_ring(src, dst);
+        }
     }
     if ((n = list_delete_all(dst->writers, (ListFindF) find_obj, src))) {
         DPRINTF((10, "Removing [%s] from [%s] writers.\n",
             src->name, dst->name));
     }
+    /*  A multiplexed client's stream for a console is updated separately.
+     */
+    if (is_client_obj(dst) && dst->aux.client.mux && is_console_obj(src)) {
+        close_mux_stream(dst, src);
+    }
+    else if (is_client_obj(src) && src->aux.client.mux
+            && is_console_obj(dst)) {
+        close_mux_stream(src, dst);
+    }
     /*  If a "writable" client is being unlinked from a console ...
      */
     if ((n > 0) && is_client_obj(src) && is_console_obj(dst)) {
@@ -678,16 +1111,20 @@ void unlink_objs(obj_t *src, obj_t *dst)
     /*  If a client obj has become completely unlinked, set its EOF flag.
      *    This will prevent new data from being added to the obj's buffer,
      *    and the obj will be closed once its buffer is empty.
+     *  The client's events are updated here since this may be performed by
+     *    another thread (eg, a client forcing its way onto a console).
      */
     if (is_client_obj(src)
             && list_is_empty(src->readers) && list_is_empty(src->writers)) {
         assert(is_console_obj(dst));
         src->gotEOF = 1;
+        set_obj_events(src);
     }
     else if (is_client_obj(dst)
             && list_is_empty(dst->readers) && list_is_empty(dst->writers)) {
         assert(is_console_obj(src));
         dst->gotEOF = 1;
+        set_obj_events(dst);
     }
 
     DPRINTF((10, "Unlinked [%s] reads from [%s] writes.\n",
@@ -769,7 +1206,13 @@ int shutdown_obj(obj_t *obj)
         return(0);
     }
     /*  Close the existing connection.
+     *    Its fd must be unregistered from the shard beforehand since the
+     *    tpoll set persists across mux_io() loop iterations and the same fd
+     *    may be reused by the next open().  Logfiles are not tpoll()'d.
      */
+    if (!is_logfile_obj(obj)) {
+        unregister_obj_fd(obj);
+    }
     if (close(obj->fd) < 0) {
         log_err(errno, "Unable to close object [%s]", obj->name);
     }
@@ -793,6 +1236,11 @@ int shutdown_obj(obj_t *obj)
      *    and the objs list destructor will destroy the obj.
      */
     if (is_client_obj(obj)) {
+        if (obj->aux.client.timer >= 0) {
+            (void) tpoll_timeout_cancel(obj->shard->tp,
+                obj->aux.client.timer);
+            obj->aux.client.timer = -1;
+        }
         unlink_obj(obj);
         return(-1);
     }
@@ -815,30 +1263,198 @@ int shutdown_obj(obj_t *obj)
 }
 
 
-int read_from_obj(obj_t *obj, tpoll_t tp)
+void register_obj_fd(obj_t *obj)
+{
+/*  Registers the obj's newly-opened fd with the shard muxing it so mux_io()
+ *    can map the fd back to the obj when it becomes ready, and adds the fd
+ *    to the shard's tpoll set with the events of interest for its state.
+ *  This routine must be called once the obj's connection state has been
+ *    updated.  It may be called by any thread, and may be called again
+ *    for an fd that is already registered.
+ */
+    io_shard_t *shard;
+    int fd;
+    int n;
+
+    assert(obj != NULL);
+    assert(!is_logfile_obj(obj));
+
+    shard = obj->shard;
+    if ((fd = obj->fd) < 0) {
+        return;
+    }
+    x_pthread_mutex_lock(&shard->fdLock);
+    if (fd >= shard->numFdObjs) {
+        n = shard->numFdObjs;
+        shard->numFdObjs = MAX(fd + 1, shard->numFdObjs * 2);
+        shard->fdObjs = realloc(shard->fdObjs,
+            shard->numFdObjs * sizeof(obj_t *));
+        if (!shard->fdObjs) {
+            out_of_memory();
+        }
+        memset(&shard->fdObjs[n], 0,
+            (shard->numFdObjs - n) * sizeof(obj_t *));
+    }
+    shard->fdObjs[fd] = obj;
+    x_pthread_mutex_unlock(&shard->fdLock);
+
+    set_obj_events(obj);
+    return;
+}
+
+
+void unregister_obj_fd(obj_t *obj)
+{
+/*  Unregisters the obj's fd from the shard muxing it, clearing the fd
+ *    from the shard's tpoll set.
+ *  This routine must be called before the fd is closed since the same fd
+ *    may be reused by the next open().
+ */
+    io_shard_t *shard;
+    int fd;
+
+    assert(obj != NULL);
+
+    shard = obj->shard;
+    if ((fd = obj->fd) < 0) {
+        return;
+    }
+    tpoll_clear(shard->tp, fd, POLLIN | POLLOUT);
+
+    x_pthread_mutex_lock(&shard->fdLock);
+    if ((fd < shard->numFdObjs) && (shard->fdObjs[fd] == obj)) {
+        shard->fdObjs[fd] = NULL;
+    }
+    x_pthread_mutex_unlock(&shard->fdLock);
+    return;
+}
+
+
+void set_obj_events(obj_t *obj)
+{
+/*  Sets the events of interest for the obj's fd within its shard's tpoll set
+ *    based on the obj's current state, clearing those no longer of interest.
+ *  This routine must be called whenever a change in the obj's state may
+ *    change its events since mux_io() does not otherwise re-examine objs
+ *    that are not ready.
+ *  Other threads may concurrently add events for the obj (eg, POLLOUT when
+ *    writing into its buffer).  Therefore, the events are re-examined after
+ *    clearing those no longer of interest so a concurrent change in state
+ *    is not lost.
+ *  Neither the obj's bufLock nor its ring lock may be held when calling
+ *    this routine.
+ */
+    tpoll_t tp;
+    int fd;
+    short int events;
+
+    assert(obj != NULL);
+    assert(!is_logfile_obj(obj));
+
+    tp = obj->shard->tp;
+    if ((fd = obj->fd) < 0) {
+        return;
+    }
+    events = get_obj_events(obj);
+    tpoll_clear(tp, fd, ~events & (POLLIN | POLLOUT));
+    events |= get_obj_events(obj);
+    tpoll_set(tp, fd, events);
+    return;
+}
+
+
+static short int get_obj_events(obj_t *obj)
+{
+/*  Returns the events of interest for the obj's fd based on its current state.
+ */
+    short int events = 0;
+
+    if ( (
+           ( is_telnet_obj(obj) &&
+             obj->aux.telnet.state == CONMAN_TELNET_UP ) ||
+           ( is_process_obj(obj) &&
+             obj->aux.process.state == CONMAN_PROCESS_UP ) ||
+#if WITH_FREEIPMI
+           ( is_ipmi_obj(obj) &&
+             obj->aux.ipmi.state == CONMAN_IPMI_UP ) ||
+#endif /* WITH_FREEIPMI */
+           ( is_unixsock_obj(obj) &&
+             obj->aux.unixsock.state == CONMAN_UNIXSOCK_UP ) ||
+           is_serial_obj(obj)  ||
+           is_client_obj(obj)
+         )
+         &&
+         ( ! obj->gotEOF )
+         &&
+         ( ! (is_console_obj(obj) && is_logfile_backlogged(obj)) ) )
+    {
+        events |= POLLIN;
+    }
+    if ( ( (obj->bufInPtr != obj->bufOutPtr) ||
+           (obj->gotEOF) ||
+           (is_ring_data_pending(obj)) ||
+           (is_replay_data_pending(obj)) ) &&
+         ( ! (is_telnet_obj(obj) &&
+              obj->aux.telnet.state != CONMAN_TELNET_UP) ) &&
+         ( ! (is_process_obj(obj) &&
+              obj->aux.process.state != CONMAN_PROCESS_UP) ) &&
+#if WITH_FREEIPMI
+         ( ! (is_ipmi_obj(obj) &&
+              obj->aux.ipmi.state != CONMAN_IPMI_UP) ) &&
+#endif /* WITH_FREEIPMI */
+         ( ! (is_unixsock_obj(obj) &&
+              obj->aux.unixsock.state != CONMAN_UNIXSOCK_UP) ) &&
+         ( ! (is_client_obj(obj) &&
+              obj->aux.client.gotSuspend) ) )
+    {
+        events |= POLLOUT;
+    }
+    if (is_telnet_obj(obj) &&
+        obj->aux.telnet.state == CONMAN_TELNET_PENDING)
+    {
+        events |= POLLIN | POLLOUT;
+    }
+    return(events);
+}
+
+
+int read_from_obj(obj_t *obj)
 {
 /*  Reads data from the obj's file descriptor and writes it out
  *    to the circular-buffer of each obj in its "readers" list.
  *  Returns >=0 on success, or -1 if the obj is ready to be destroyed.
  *
- *  The tpoll (tp) ref is an optimization used to "prime" the set for
- *    write_to_obj().  This allows data read to be written out to those objs
- *    not yet traversed during the current list iteration, thereby reducing the
- *    latency.  Without it, these objs would be tpoll()'d on the next list
- *    iteration in mux_io()'s outer-loop.
  *  An obj's circular-buffer is empty when (bufInPtr == bufOutPtr).
- *    Thus, it can hold at most (MAX_BUF_SIZE - 1) bytes of data.
+ *    Thus, it can hold at most (bufSize - 1) bytes of data.
  *  But if the obj is a logfile, its data can grow as a result of the
  *    additional processing.  This routine's internal buffer is reduced
  *    somewhat to reduce the likelihood of log data being dropped.
  */
-    unsigned char buf[(MAX_BUF_SIZE / 2) - 1];
-    int n, m;
-    ListIterator i;
-    obj_t *reader;
+    unsigned char buf[MAX_READ_SIZE];
+    int n;
 
     DPRINTF((20, "Entered read_from_obj: [%s]\n", obj->name));
 
+    if ((n = begin_read_from_obj(obj)) <= 0) {
+        return(n);
+    }
+again:
+    if (((n = read(obj->fd, buf, sizeof(buf))) < 0) && (errno == EINTR)) {
+        goto again;
+    }
+    return(end_read_from_obj(obj, buf, n));
+}
+
+
+int begin_read_from_obj(obj_t *obj)
+{
+/*  Checks whether data should be read from the obj's file descriptor.
+ *  Returns 1 if the read should proceed, 0 if it should be skipped,
+ *    or -1 if the obj is ready to be destroyed.
+ *
+ *  This and end_read_from_obj() allow the read itself to be performed
+ *    elsewhere (eg, batched with those of other objs by server.c:mux_io()).
+ */
     assert(obj->fd >= 0);
 
     if (obj->gotEOF) {
@@ -861,12 +1477,22 @@ int read_from_obj(obj_t *obj, tpoll_t tp)
     if (is_telnet_obj(obj) && obj->aux.telnet.state != CONMAN_TELNET_UP) {
         return(0);
     }
-again:
-    if ((n = read(obj->fd, buf, sizeof(buf))) < 0) {
-        if (errno == EINTR) {
-            goto again;
-        }
-        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+    return(1);
+}
+
+
+int end_read_from_obj(obj_t *obj, unsigned char *buf, int n)
+{
+/*  Processes the result (n) of reading from the obj's file descriptor
+ *    into (buf), writing the data out to the circular-buffer of each obj
+ *    in its "readers" list.  If (n) is -1, errno must be set accordingly.
+ *  Returns >=0 on success, or -1 if the obj is ready to be destroyed.
+ */
+    ListIterator i;
+    obj_t *reader;
+
+    if (n < 0) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
             return(0);
         }
         log_msg(LOG_INFO, "Unable to read from [%s]: %s",
@@ -876,7 +1502,7 @@ again:
     else if (n == 0) {
         DPRINTF((15, "Read EOF from [%s].\n", obj->name));
         obj->gotEOF = 1;
-        tpoll_set(tp, obj->fd, POLLOUT);        /* attempt to flush buffer */
+        set_obj_events(obj);            /* stop reading; flush buffer */
         return(0);
     }
     else {
@@ -888,34 +1514,61 @@ again:
                 log_err(errno, "time() failed");
             }
             x_pthread_mutex_unlock(&obj->bufLock);
-            n = process_client_escapes(obj, buf, n);
+            if (obj->aux.client.mux) {
+                n = process_mux_frames(obj, buf, n);
+            }
+            else {
+                n = process_client_escapes(obj, buf, n);
+            }
         }
         else if (is_telnet_obj(obj)) {
             n = process_telnet_escapes(obj, buf, n);
         }
         /*  Ensure the buffer still contains data
          *    after the escape characters have been processed.
+         *  Data read from a console is written once into its ring, and each
+         *    client reading from the console writes it out to its fd from
+         *    there (cf, get_ring_data); these clients need only be polled
+         *    for POLLOUT.
          */
         if (n > 0) {
+            if (is_console_obj(obj)) {
+                write_ring_data(obj, buf, n);
+                write_scrollback_data(obj, buf, n);
+            }
             i = list_iterator_create(obj->readers);
             while ((reader = list_next(i))) {
                 /*
                  *  If the obj's gotEOF flag is set,
                  *    no more data can be written into its buffer.
                  */
-                if (!reader->gotEOF) {
-                    if (is_logfile_obj(reader)) {
-                        m = write_log_data(reader, buf, n);
-                    }
-                    else {
-                        m = write_obj_data(reader, buf, n, 0);
-                    }
-                    if (m > 0) {
-                        tpoll_set(tp, reader->fd, POLLOUT);
+                if (reader->gotEOF) {
+                    continue;
+                }
+                if (is_logfile_obj(reader)) {
+                    write_log_data(reader, buf, n);
+                }
+                else if (is_client_obj(reader)
+                        && (reader->aux.client.ring == &obj->ring)) {
+                    if (reader->fd >= 0) {
+                        tpoll_set(reader->shard->tp, reader->fd, POLLOUT);
                     }
                 }
+                else if (is_client_obj(reader) && reader->aux.client.mux) {
+                    notify_mux_data(reader);
+                }
+                else {
+                    write_obj_data(reader, buf, n, 0);
+                }
             }
             list_iterator_destroy(i);
+            /*
+             *  Console output is scanned for triggers after it has been
+             *    written to the log so that any log marker follows it.
+             */
+            if (is_console_obj(obj)) {
+                scan_console_triggers(obj, buf, n);
+            }
         }
     }
     return(n);
@@ -929,11 +1582,21 @@ int write_obj_data(obj_t *obj, const void *src, int len, int isInfo)
  *    an informational message which a client may suppress.
  *  Returns the number of bytes written.
  *
- *  Note that this routine can write at most (MAX_BUF_SIZE - 1) bytes
+ *  Note that this routine can write at most (bufSize - 1) bytes
  *    of data into the object's circular-buffer.
+ *  The circular-buffer is allocated from the bufpool if not already present.
+ *
+ *  POLLOUT is added to the events of interest in the tpoll set of the obj's
+ *    shard when its buffer goes from empty to non-empty (or a logfile is
+ *    queued for the logfile writer threads).  Otherwise, the obj's events
+ *    are unchanged: POLLOUT is either already set, or is intentionally
+ *    clear (eg, a suspended client).  The obj may be muxed by a different
+ *    shard (eg, a console written by a B/C client, or a client written by
+ *    the thread processing another client's connection).
  */
     int avail;
     int n, m;
+    int wasEmpty;
 
     DPRINTF((20, "Entered write_obj_data: [%s]\n", obj->name));
 
@@ -945,6 +1608,12 @@ int write_obj_data(obj_t *obj, const void *src, int len, int isInfo)
      */
     if (obj->gotEOF) {
         DPRINTF((1, "Attempted to write to [%s] after EOF.\n", obj->name));
+        /*
+         *  A logfile is only closed by the logfile writer thread writing it.
+         */
+        if (is_logfile_obj(obj)) {
+            return(0);
+        }
         return(shutdown_obj(obj));
     }
     /*  If the obj is a disconnected console connection,
@@ -962,12 +1631,13 @@ int write_obj_data(obj_t *obj, const void *src, int len, int isInfo)
         return(0);
     }
     /*  An obj's circular-buffer is empty when (bufInPtr == bufOutPtr).
-     *    Thus, it can hold at most (MAX_BUF_SIZE - 1) bytes of data.
+     *    Thus, it can hold at most (bufSize - 1) bytes of data.
      */
-    if (len >= MAX_BUF_SIZE) {
-        len = MAX_BUF_SIZE - 1;
+    if (len >= obj->bufSize) {
+        len = obj->bufSize - 1;
     }
     x_pthread_mutex_lock(&obj->bufLock);
+    wasEmpty = (obj->bufInPtr == obj->bufOutPtr);
 
     /*  Do nothing if this is an informational message
      *    and the client has requested not to be bothered.
@@ -978,11 +1648,14 @@ int write_obj_data(obj_t *obj, const void *src, int len, int isInfo)
     }
     /*  Assert the buffer's input and output ptrs are valid upon entry.
      */
-    assert(obj->bufInPtr >= obj->buf);
-    assert(obj->bufInPtr < &obj->buf[MAX_BUF_SIZE]);
-    assert(obj->bufOutPtr >= obj->buf);
-    assert(obj->bufOutPtr < &obj->buf[MAX_BUF_SIZE]);
+    assert(validate_obj_buf(obj));
 
+    if (!obj->buf) {
+        if (!(obj->buf = bufpool_alloc(obj->bufSize))) {
+            out_of_memory();
+        }
+        obj->bufInPtr = obj->bufOutPtr = obj->buf;
+    }
     n = len;
 
     /*  Calculate the number of bytes available before data is overwritten.
@@ -992,18 +1665,26 @@ int write_obj_data(obj_t *obj, const void *src, int len, int isInfo)
      *    subtract one byte from 'avail' to account for this sentinel.
      */
     if (obj->bufOutPtr == obj->bufInPtr) {
-        avail = MAX_BUF_SIZE - 1;
+        avail = obj->bufSize - 1;
     }
     else if (obj->bufOutPtr > obj->bufInPtr) {
         avail = obj->bufOutPtr - obj->bufInPtr - 1;
     }
     else {
-        avail = (&obj->buf[MAX_BUF_SIZE] - obj->bufInPtr) +
+        avail = (&obj->buf[obj->bufSize] - obj->bufInPtr) +
             (obj->bufOutPtr - obj->buf) - 1;
     }
+    /*  A multiplexed client's buffer holds whole frames, so a frame that
+     *    does not fit is dropped instead of overwriting those before it.
+     */
+    if (is_client_obj(obj) && obj->aux.client.mux && (len > avail)) {
+        x_pthread_mutex_unlock(&obj->bufLock);
+        log_msg(LOG_NOTICE, "Dropped %d-byte frame for %s", len, obj->name);
+        return(0);
+    }
     /*  Copy first chunk of data (ie, up to the end of the buffer).
      */
-    m = MIN(len, &obj->buf[MAX_BUF_SIZE] - obj->bufInPtr);
+    m = MIN(len, &obj->buf[obj->bufSize] - obj->bufInPtr);
     if (m > 0) {
         memcpy(obj->bufInPtr, src, m);
         n -= m;
@@ -1012,9 +1693,8 @@ int write_obj_data(obj_t *obj, const void *src, int len, int isInfo)
         /*
          *  Do the hokey-pokey and perform a circular-buffer wrap-around.
          */
-        if (obj->bufInPtr == &obj->buf[MAX_BUF_SIZE]) {
+        if (obj->bufInPtr == &obj->buf[obj->bufSize]) {
             obj->bufInPtr = obj->buf;
-            obj->gotBufWrap = 1;
         }
     }
     /*  Copy second chunk of data (ie, from the beginning of the buffer).
@@ -1031,19 +1711,22 @@ int write_obj_data(obj_t *obj, const void *src, int len, int isInfo)
                 len-avail, obj->name);
         }
         obj->bufOutPtr = obj->bufInPtr + 1;
-        if (obj->bufOutPtr == &obj->buf[MAX_BUF_SIZE]) {
+        if (obj->bufOutPtr == &obj->buf[obj->bufSize]) {
             obj->bufOutPtr = obj->buf;
         }
     }
     /*  Assert the buffer's input and output ptrs are valid upon exit.
      */
-    assert(obj->bufInPtr >= obj->buf);
-    assert(obj->bufInPtr < &obj->buf[MAX_BUF_SIZE]);
-    assert(obj->bufOutPtr >= obj->buf);
-    assert(obj->bufOutPtr < &obj->buf[MAX_BUF_SIZE]);
+    assert(validate_obj_buf(obj));
 
     x_pthread_mutex_unlock(&obj->bufLock);
 
+    if ((obj->fd >= 0) && is_logfile_obj(obj)) {
+        queue_logfile_write(obj, 0);
+    }
+    else if ((obj->fd >= 0) && wasEmpty) {
+        tpoll_set(obj->shard->tp, obj->fd, POLLOUT);
+    }
     /*  If an informational message has been added to the log,
      *    re-initialize the console log's newline state.
      */
@@ -1054,32 +1737,897 @@ int write_obj_data(obj_t *obj, const void *src, int len, int isInfo)
 }
 
 
-int write_to_obj(obj_t *obj)
+int is_ring_data_pending(obj_t *client)
 {
-/*  Writes data from the obj's circular-buffer out to its file descriptor.
- *  Returns 0 on success, or -1 if the obj is ready to be destroyed.
+/*  Returns true if the (client) has data in the ring of the console it is
+ *    reading from that has yet to be written out to its fd.
+ *    For a multiplexed client, this applies to the rings of all its streams.
  */
-    int avail;
-    int n;
-    int isDead = 0;
+    obj_ring_t *ring;
+    int isPending;
+
+    if (is_client_obj(client) && client->aux.client.mux) {
+        return(is_mux_data_pending(client));
+    }
+    if (!is_client_obj(client) || !(ring = client->aux.client.ring)) {
+        return(0);
+    }
+    x_pthread_mutex_lock(&ring->lock);
+    isPending = (ring->numBytes != client->aux.client.ringPos);
+    x_pthread_mutex_unlock(&ring->lock);
+    return(isPending);
+}
+
+
+static void attach_ring(obj_t *console, obj_t *client)
+{
+/*  Attaches the (client) to the ring of the (console) it is reading from,
+ *    allocating the ring's buffer if this is the console's first client.
+ *  The client starts reading from the console's next byte of output.
+ *    A multiplexed client instead attaches the console's stream.
+ */
+    obj_ring_t *ring = &console->ring;
+
+    assert(is_console_obj(console));
+    assert(is_client_obj(client));
+
+    x_pthread_mutex_lock(&ring->lock);
+    if (!ring->buf) {
+        if (!(ring->buf = malloc(CONSOLE_RING_SIZE))) {
+            out_of_memory();
+        }
+        ring->baseBytes = ring->numBytes;
+    }
+    ring->numReaders++;
+    if (client->aux.client.req->enableSeq) {
+        ring->gotSeq = 1;
+    }
+    if (!client->aux.client.mux) {
+        client->aux.client.ring = ring;
+        client->aux.client.ringPos = ring->numBytes;
+    }
+    x_pthread_mutex_unlock(&ring->lock);
+
+    if (client->aux.client.mux) {
+        open_mux_stream(client, console);
+    }
+    return;
+}
+
+
+static void detach_ring(obj_t *console, obj_t *client)
+{
+/*  Detaches the (client) from the ring of the (console) it was reading from.
+ *  Once the console's last client has detached, the console is queued for
+ *    its ring's buffer to be freed by release_idle_rings().  But the buffer
+ *    is retained if a sequenced session has read from the console and the
+ *    console has no scrollback, since the ring then holds the only output
+ *    from which the session can resume after reconnecting.
+ */
+    obj_ring_t *ring = &console->ring;
+    int gotIdle = 0;
+
+    assert(is_console_obj(console));
+    assert(is_client_obj(client));
+
+    x_pthread_mutex_lock(&ring->lock);
+    if (client->aux.client.ring == ring) {
+        client->aux.client.ring = NULL;
+    }
+    assert(ring->numReaders > 0);
+    if ((--ring->numReaders == 0) && ring->buf && !ring->gotIdle
+            && !(ring->gotSeq && (console->scrollback.numChunks <= 0))) {
+        ring->gotIdle = gotIdle = 1;
+    }
+    x_pthread_mutex_unlock(&ring->lock);
+
+    if (gotIdle) {
+        list_append(console->shard->conf->idleRings, console);
+    }
+    return;
+}
+
+
+void release_idle_rings(server_conf_t *conf)
+{
+/*  Frees the buffers of the rings of consoles queued by detach_ring()
+ *    that still have no clients attached.
+ *  The conf's objsLock must be held for writing when calling this routine.
+ *    A client detached from a ring may still be writing out data from the
+ *    ring's buffer during its shard's mux_io() pass (cf, get_ring_data),
+ *    but no pass is in progress while the objsLock is held for writing.
+ */
+    obj_t *console;
+    obj_ring_t *ring;
+
+    while ((console = list_pop(conf->idleRings))) {
+        ring = &console->ring;
+        x_pthread_mutex_lock(&ring->lock);
+        ring->gotIdle = 0;
+        if ((ring->numReaders == 0) && ring->buf) {
+            free(ring->buf);
+            ring->buf = NULL;
+            DPRINTF((10, "Released ring of [%s].\n", console->name));
+        }
+        x_pthread_mutex_unlock(&ring->lock);
+    }
+    return;
+}
+
+
+static void write_ring_data(obj_t *console, const void *src, int len)
+{
+/*  Writes the buffer (src) of length (len) into the (console)'s ring,
+ *    overwriting its oldest data as needed.
+ *  The ring is only written if a client has ever read from the console,
+ *    but the console's output is always counted and time-marked.
+ *
+ *  The ring is indexed by the total number of bytes ever output by the
+ *    console (modulo its size).  Thus, a client reading from the ring has
+ *    fallen behind by the difference between this total and its ring
+ *    position, and has lost data once this difference exceeds the ring's
+ *    size.  This total is also the sequence number of the next byte of
+ *    output (cf, get_console_output).
+ *  A time mark records the sequence number of the first byte read during
+ *    each second in which the console has output.
+ */
+    obj_ring_t *ring = &console->ring;
+    obj_mark_t *mark;
+    time_t now;
+    int i;
+    int m;
+
+    assert(is_console_obj(console));
+
+    if (len <= 0) {
+        return;
+    }
+    if (time(&now) == (time_t) -1) {
+        log_err(errno, "time() failed");
+    }
+    x_pthread_mutex_lock(&ring->lock);
+    if (!ring->marks) {
+        ring->marks = malloc(CONSOLE_TIME_MARKS * sizeof(obj_mark_t));
+        if (!ring->marks) {
+            out_of_memory();
+        }
+    }
+    if ((ring->numMarks == 0) || (ring->marks[(ring->numMarks - 1)
+            % CONSOLE_TIME_MARKS].time != now)) {
+        mark = &ring->marks[ring->numMarks % CONSOLE_TIME_MARKS];
+        mark->seq = ring->numBytes;
+        mark->time = now;
+        ring->numMarks++;
+    }
+    if (!ring->buf) {
+        ring->numBytes += len;
+    }
+    else {
+        if (len > CONSOLE_RING_SIZE) {
+            ring->numBytes += len - CONSOLE_RING_SIZE;
+            src = (unsigned char *) src + len - CONSOLE_RING_SIZE;
+            len = CONSOLE_RING_SIZE;
+        }
+        i = ring->numBytes % CONSOLE_RING_SIZE;
+        m = MIN(len, CONSOLE_RING_SIZE - i);
+        memcpy(&ring->buf[i], src, m);
+        if (len > m) {
+            memcpy(ring->buf, (unsigned char *) src + m, len - m);
+        }
+        ring->numBytes += len;
+    }
+    x_pthread_mutex_unlock(&ring->lock);
+    return;
+}
+
+
+static void check_ring_lag(obj_t *client)
+{
+/*  Checks whether the (client) has fallen so far behind the console it is
+ *    reading from that unsent data has been overwritten in the ring.
+ *  If so, the client skips ahead to the oldest data remaining in the ring,
+ *    and a notice of the number of bytes lost is written to the client.
+ */
+    obj_ring_t *ring = client->aux.client.ring;
+    obj_t *console;
+    uint64_t lag = 0;
+    char buf[MAX_LINE];
+
+    if (!ring) {
+        return;
+    }
+    x_pthread_mutex_lock(&ring->lock);
+    if (ring->numBytes - client->aux.client.ringPos > CONSOLE_RING_SIZE) {
+        lag = ring->numBytes - client->aux.client.ringPos - CONSOLE_RING_SIZE;
+        client->aux.client.ringPos = ring->numBytes - CONSOLE_RING_SIZE;
+    }
+    x_pthread_mutex_unlock(&ring->lock);
+
+    if (lag == 0) {
+        return;
+    }
+    console = list_peek(client->writers);
+    log_msg(LOG_NOTICE, "Client [%s] lagged by %llu bytes on console [%s]",
+        client->name, (unsigned long long) lag,
+        (console ? console->name : "?"));
+    snprintf(buf, sizeof(buf), "%sConsole [%s] output lagged by %llu bytes%s",
+        CONMAN_MSG_PREFIX, (console ? console->name : "?"),
+        (unsigned long long) lag, CONMAN_MSG_SUFFIX);
+    strcpy(&buf[sizeof(buf) - 3], "\r\n");
+    write_obj_data(client, buf, strlen(buf), 0);
+    return;
+}
+
+
+static int get_ring_data(obj_t *client, struct iovec *iov, int *iovcnt_p)
+{
+/*  Determines the data in the ring of the console read by the (client)
+ *    that has yet to be written out to its fd, setting (iov) to the
+ *    one or two segments of this data and (*iovcnt_p) to their number.
+ *    As with the obj's circular-buffer, the second segment holds data
+ *    that has wrapped-around to the start of the ring.
+ *  Returns the number of bytes to be written.
+ */
+    obj_ring_t *ring = client->aux.client.ring;
+    int i;
+    int avail;
+    int m;
+
+    if (!ring) {
+        return(0);
+    }
+    x_pthread_mutex_lock(&ring->lock);
+    i = client->aux.client.ringPos % CONSOLE_RING_SIZE;
+    avail = ring->numBytes - client->aux.client.ringPos;
+    m = MIN(avail, CONSOLE_RING_SIZE - i);
+    iov[0].iov_base = &ring->buf[i];
+    iov[0].iov_len = m;
+    iov[1].iov_base = ring->buf;
+    iov[1].iov_len = avail - m;
+    *iovcnt_p = (avail > m) ? 2 : 1;
+    x_pthread_mutex_unlock(&ring->lock);
+    return(avail);
+}
+
+
+static void put_ring_data(obj_t *client, unsigned char *ptr, int n)
+{
+/*  Advances the (client)'s ring position once (n) bytes starting at (ptr)
+ *    have been written out to its fd.  The position is not advanced if it
+ *    has changed in the interim (eg, the client lagged or was detached).
+ */
+    obj_ring_t *ring = client->aux.client.ring;
+
+    if (!ring) {
+        return;
+    }
+    x_pthread_mutex_lock(&ring->lock);
+    if ((&ring->buf[client->aux.client.ringPos % CONSOLE_RING_SIZE] == ptr)
+            && ((uint64_t) n <= ring->numBytes - client->aux.client.ringPos)) {
+        client->aux.client.ringPos += n;
+    }
+    x_pthread_mutex_unlock(&ring->lock);
+    return;
+}
+
+
+int get_console_output(obj_t *console, uint64_t *seq_p, time_t *time_p,
+    unsigned char *dst, int len)
+{
+/*  Copies up to (len) bytes of the (console)'s output starting at sequence
+ *    number (*seq_p) into the buffer (dst), setting (*time_p) to the time
+ *    at which this output was read (or 0 if no longer known).  The output
+ *    copied is limited to that read within a single second.
+ *  The output is taken from the console's ring if still held there, or
+ *    else from its scrollback.  If (*seq_p) precedes the oldest output held
+ *    by either, it is advanced to the oldest output held; if it is beyond
+ *    the console's output, it is set to the sequence number of the next byte.
+ *  Returns the number of bytes copied.
+ *
+ *  The ring is written before the scrollback (cf, end_read_from_obj), so
+ *    output just written to the ring may not yet be in the scrollback.
+ *    Output not held in the ring is not skipped in this case; it is instead
+ *    copied by a later call once the console's readers have been notified.
+ */
+    obj_ring_t *ring = &console->ring;
+    obj_scrollback_t *sb = &console->scrollback;
+    uint64_t size;
+    uint64_t held;
+    uint64_t oldest;
+    uint64_t limit;
+    int n = 0;
+    int i;
+    int m;
+
+    assert(is_console_obj(console));
+    assert(len >= 0);
+
+    *time_p = 0;
+    for (;;) {
+        x_pthread_mutex_lock(&ring->lock);
+        if (*seq_p > ring->numBytes) {
+            *seq_p = ring->numBytes;
+        }
+        oldest = ring->numBytes;
+        if (ring->buf) {
+            oldest = (oldest > CONSOLE_RING_SIZE)
+                ? oldest - CONSOLE_RING_SIZE : 0;
+            oldest = MAX(oldest, ring->baseBytes);
+        }
+        if (*seq_p >= oldest) {
+            *time_p = find_output_time(ring, *seq_p, &limit);
+            n = MIN(MIN(ring->numBytes, limit) - *seq_p, (uint64_t) len);
+            if (n > 0) {
+                i = *seq_p % CONSOLE_RING_SIZE;
+                m = MIN(n, CONSOLE_RING_SIZE - i);
+                memcpy(dst, &ring->buf[i], m);
+                if (n > m) {
+                    memcpy(dst + m, ring->buf, n - m);
+                }
+            }
+            x_pthread_mutex_unlock(&ring->lock);
+            return(n);
+        }
+        x_pthread_mutex_unlock(&ring->lock);
+        /*
+         *  The output is copied from the scrollback if it holds output
+         *    older than the ring's; o/w, the oldest output in the ring is.
+         */
+        size = (uint64_t) sb->numChunks * SCROLLBACK_CHUNK_SIZE;
+        x_pthread_mutex_lock(&sb->lock);
+        if (sb->chunks && (*seq_p >= sb->numBytes)) {
+            x_pthread_mutex_unlock(&sb->lock);
+            return(0);
+        }
+        held = MIN(sb->numBytes, size);
+        if (sb->chunks && (sb->numBytes - held < oldest)) {
+            break;
+        }
+        x_pthread_mutex_unlock(&sb->lock);
+        *seq_p = oldest;
+    }
+    if (sb->numBytes - *seq_p > size) {
+        *seq_p = sb->numBytes - size;
+    }
+    n = MIN(sb->numBytes - *seq_p, (uint64_t) len);
+    for (m = 0; m < n; m += i) {
+        i = MIN(n - m, SCROLLBACK_CHUNK_SIZE
+            - (int) ((*seq_p + m) % SCROLLBACK_CHUNK_SIZE));
+        memcpy(dst + m, &sb->chunks[((*seq_p + m) / SCROLLBACK_CHUNK_SIZE)
+            % sb->numChunks][(*seq_p + m) % SCROLLBACK_CHUNK_SIZE], i);
+    }
+    x_pthread_mutex_unlock(&sb->lock);
+
+    x_pthread_mutex_lock(&ring->lock);
+    *time_p = find_output_time(ring, *seq_p, &limit);
+    x_pthread_mutex_unlock(&ring->lock);
+    if ((uint64_t) n > limit - *seq_p) {
+        n = limit - *seq_p;
+    }
+    return(n);
+}
+
+
+static time_t find_output_time(obj_ring_t *ring, uint64_t seq,
+    uint64_t *limit_p)
+{
+/*  Finds the time mark of the console output at sequence number (seq),
+ *    setting (*limit_p) to the sequence number of the next time mark
+ *    (or UINT64_MAX if there is none).
+ *  The ring's lock must be held when calling this routine.
+ *  Returns the time at which the output was read, or 0 if its time mark
+ *    has been overwritten.
+ */
+    unsigned long lo;
+    unsigned long hi;
+    unsigned long mid;
+
+    lo = (ring->numMarks > CONSOLE_TIME_MARKS)
+        ? ring->numMarks - CONSOLE_TIME_MARKS : 0;
+    hi = ring->numMarks;
+
+    if ((lo == hi) || (seq < ring->marks[lo % CONSOLE_TIME_MARKS].seq)) {
+        *limit_p = (lo == hi)
+            ? UINT64_MAX : ring->marks[lo % CONSOLE_TIME_MARKS].seq;
+        return(0);
+    }
+    /*  Find the last mark at or before (seq) within [lo,hi).
+     */
+    while (hi - lo > 1) {
+        mid = lo + ((hi - lo) / 2);
+        if (ring->marks[mid % CONSOLE_TIME_MARKS].seq <= seq) {
+            lo = mid;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    *limit_p = (lo + 1 < ring->numMarks)
+        ? ring->marks[(lo + 1) % CONSOLE_TIME_MARKS].seq : UINT64_MAX;
+    return(ring->marks[lo % CONSOLE_TIME_MARKS].time);
+}
+
+
+off_t get_scrollback_len(obj_t *console)
+{
+/*  Returns the number of bytes of output held in the (console)'s scrollback.
+ */
+    obj_scrollback_t *sb = &console->scrollback;
+    uint64_t size;
+    off_t len;
+
+    assert(is_console_obj(console));
+
+    size = (uint64_t) sb->numChunks * SCROLLBACK_CHUNK_SIZE;
+    x_pthread_mutex_lock(&sb->lock);
+    len = MIN(sb->numBytes, size);
+    x_pthread_mutex_unlock(&sb->lock);
+    return(len);
+}
+
+
+static void write_scrollback_data(obj_t *console, const void *src, int len)
+{
+/*  Writes the buffer (src) of length (len) into the (console)'s scrollback,
+ *    overwriting its oldest data as needed.
+ *
+ *  The scrollback is a ring of fixed-size chunks allocated from the bufpool
+ *    as the console's output first reaches them, so idle consoles do not
+ *    pin memory and busy consoles do not require a large contiguous block.
+ *    As with the console's ring, it is indexed by the total number of bytes
+ *    ever written to it (modulo its size).
+ */
+    obj_scrollback_t *sb = &console->scrollback;
+    uint64_t size;
+    int i;
+    int off;
+    int m;
+
+    assert(is_console_obj(console));
+
+    if ((sb->numChunks <= 0) || (len <= 0)) {
+        return;
+    }
+    size = (uint64_t) sb->numChunks * SCROLLBACK_CHUNK_SIZE;
+
+    x_pthread_mutex_lock(&sb->lock);
+    if (!sb->chunks) {
+        if (!(sb->chunks = calloc(sb->numChunks, sizeof(*sb->chunks)))) {
+            out_of_memory();
+        }
+    }
+    if ((uint64_t) len > size) {
+        sb->numBytes += len - size;
+        src = (unsigned char *) src + len - size;
+        len = size;
+    }
+    while (len > 0) {
+        i = (sb->numBytes / SCROLLBACK_CHUNK_SIZE) % sb->numChunks;
+        off = sb->numBytes % SCROLLBACK_CHUNK_SIZE;
+        if (!sb->chunks[i]) {
+            if (!(sb->chunks[i] = bufpool_alloc(SCROLLBACK_CHUNK_SIZE))) {
+                out_of_memory();
+            }
+        }
+        m = MIN(len, SCROLLBACK_CHUNK_SIZE - off);
+        memcpy(&sb->chunks[i][off], src, m);
+        src = (unsigned char *) src + m;
+        len -= m;
+        sb->numBytes += m;
+    }
+    x_pthread_mutex_unlock(&sb->lock);
+    return;
+}
+
+
+static void destroy_scrollback(obj_t *console)
+{
+/*  Returns the chunks of the (console)'s scrollback to the bufpool.
+ */
+    obj_scrollback_t *sb = &console->scrollback;
+    int i;
+
+    if (sb->chunks) {
+        for (i = 0; i < sb->numChunks; i++) {
+            if (sb->chunks[i]) {
+                bufpool_free(sb->chunks[i], SCROLLBACK_CHUNK_SIZE);
+            }
+        }
+        free(sb->chunks);
+        sb->chunks = NULL;
+    }
+    x_pthread_mutex_destroy(&sb->lock);
+    return;
+}
+
+
+static void begin_replay(obj_t *client, obj_t *console)
+{
+/*  Marks the (client) as replaying the (console)'s output,
+ *    writing the "begin" message to the client's buffer.
+ */
+    char buf[MAX_LINE];
+
+    client->aux.client.gotReplay = 1;
+    client->aux.client.replayMap = NULL;
+
+    snprintf(buf, sizeof(buf), "%sBegin log replay of console [%s]%s",
+        CONMAN_MSG_PREFIX, console->name, CONMAN_MSG_SUFFIX);
+    strcpy(&buf[sizeof(buf) - 3], "\r\n");
+    write_obj_data(client, buf, strlen(buf), 0);
+
+    DPRINTF((5, "Replaying %lld bytes of console [%s] %s to [%s].\n",
+        (long long) (client->aux.client.replayEnd
+            - client->aux.client.replayPos), console->name,
+        ((client->aux.client.replayFd >= 0) ? "log" : "scrollback"),
+        client->name));
+    return;
+}
+
+
+int open_scrollback_replay(obj_t *client, obj_t *console, off_t len)
+{
+/*  Starts replaying the last (len) bytes of the (console)'s scrollback
+ *    to the (client), or all of it if (len) is 0.
+ *  The replay is written out by begin_write_to_obj() a chunk at a time as
+ *    the client's fd becomes writable, and console output arriving in the
+ *    interim is held in the console's ring.
+ *  Returns 0 if the replay is started, or -1 if the scrollback is empty.
+ */
+    off_t held;
+
+    assert(is_client_obj(client));
+    assert(is_console_obj(console));
+    assert(!client->aux.client.gotReplay);
+
+    if ((held = get_scrollback_len(console)) <= 0) {
+        return(-1);
+    }
+    if ((len <= 0) || (len > held)) {
+        len = held;
+    }
+    x_pthread_mutex_lock(&console->scrollback.lock);
+    client->aux.client.replayEnd = console->scrollback.numBytes;
+    x_pthread_mutex_unlock(&console->scrollback.lock);
+    client->aux.client.replayPos = client->aux.client.replayEnd - len;
+    client->aux.client.replayFd = -1;
+    begin_replay(client, console);
+    return(0);
+}
+
+
+int open_log_replay(obj_t *client, obj_t *console, off_t len)
+{
+/*  Starts replaying the last (len) bytes of the (console)'s logfile from disk
+ *    to the (client).
+ *  The replay is written out by begin_write_to_obj() a window at a time as
+ *    the client's fd becomes writable, so a large replay neither blocks the
+ *    client's I/O shard nor overwrites data in the client's buffer.
+ *    Console output arriving in the interim is held in the console's ring.
+ *  Returns 0 if the replay is started, or -1 if the logfile cannot be
+ *    replayed from disk (eg, the console is not logged or is compressed).
+ */
+    obj_t *logfile;
+    char *name;
+    int fd;
+    struct stat st;
+
+    assert(is_client_obj(client));
+    assert(is_console_obj(console));
+    assert(!client->aux.client.gotReplay);
+
+    logfile = get_console_logfile_obj(console);
+    if (!logfile || logfile->aux.logfile.opts.enableCompress) {
+        return(-1);
+    }
+    /*  The name is copied while holding the logQueueLock
+     *    since it may be replaced by a logfile writer.
+     */
+    x_pthread_mutex_lock(&logfile->shard->conf->logQueueLock);
+    name = create_string(logfile->name);
+    x_pthread_mutex_unlock(&logfile->shard->conf->logQueueLock);
+
+    if ((fd = open(name, O_RDONLY)) < 0) {
+        log_msg(LOG_WARNING, "Unable to open logfile \"%s\" for replay: %s",
+            name, strerror(errno));
+        free(name);
+        return(-1);
+    }
+    free(name);
+    if ((fstat(fd, &st) < 0) || !S_ISREG(st.st_mode)) {
+        (void) close(fd);
+        return(-1);
+    }
+    set_fd_closed_on_exec(fd);
+
+    client->aux.client.replayFd = fd;
+    client->aux.client.replayEnd = st.st_size;
+    client->aux.client.replayPos = (len < st.st_size) ? st.st_size - len : 0;
+    begin_replay(client, console);
+    return(0);
+}
+
+
+void close_log_replay(obj_t *client)
+{
+/*  Closes the replay to the (client), if any.
+ */
+    assert(is_client_obj(client));
+
+    if (client->aux.client.replayMap) {
+        if (munmap(client->aux.client.replayMap,
+                client->aux.client.replayMapLen) < 0) {
+            log_msg(LOG_WARNING, "Unable to unmap replay for [%s]: %s",
+                client->name, strerror(errno));
+        }
+        client->aux.client.replayMap = NULL;
+    }
+    if (client->aux.client.replayFd >= 0) {
+        if (close(client->aux.client.replayFd) < 0) {
+            log_msg(LOG_WARNING, "Unable to close replay for [%s]: %s",
+                client->name, strerror(errno));
+        }
+        client->aux.client.replayFd = -1;
+    }
+    client->aux.client.gotReplay = 0;
+    return;
+}
+
+
+int is_replay_data_pending(obj_t *client)
+{
+/*  Returns true if the (client) has a replay in progress.
+ */
+    return(is_client_obj(client) && client->aux.client.gotReplay);
+}
+
+
+static void finish_log_replay(obj_t *client)
+{
+/*  Closes the replay to the (client) and writes the "end" message
+ *    to the client's buffer.
+ */
+    obj_t *console;
+    char buf[MAX_LINE];
+
+    close_log_replay(client);
+    console = list_peek(client->writers);
+    snprintf(buf, sizeof(buf), "%sEnd log replay of console [%s]%s",
+        CONMAN_MSG_PREFIX, (console ? console->name : "?"),
+        CONMAN_MSG_SUFFIX);
+    strcpy(&buf[sizeof(buf) - 3], "\r\n");
+    write_obj_data(client, buf, strlen(buf), 0);
+    return;
+}
+
+
+static int get_replay_data(obj_t *client, struct iovec *iov, int *iovcnt_p)
+{
+/*  Determines the data being replayed to the (client) that has yet to be
+ *    written out to its fd, setting (iov) to the next contiguous segment
+ *    of it.  Once the replay is complete, it is finished.
+ *  Returns the number of bytes to be written.
+ *
+ *  A scrollback replay is read from the scrollback of the console in the
+ *    client's writers list; the console cannot be destroyed in the interim
+ *    since the shard holds the objsLock for reading.  If the console's
+ *    output overwrites data not yet replayed, the replay skips past it.
+ *  A logfile replay maps the next window of up to REPLAY_MAP_SIZE bytes
+ *    as needed.  The logfile is only appended to by the daemon (and is
+ *    renamed rather than truncated when rotated), so the window only spans
+ *    data that existed when the replay was started.
+ */
+    obj_t *console;
+    obj_scrollback_t *sb;
+    uint64_t size;
+    long pagesize;
+    off_t pos;
+    size_t len;
+    void *p;
+    int i;
+
+    if (client->aux.client.replayFd < 0) {
+        if (!(console = list_peek(client->writers))) {
+            finish_log_replay(client);
+            return(0);
+        }
+        sb = &console->scrollback;
+        size = (uint64_t) sb->numChunks * SCROLLBACK_CHUNK_SIZE;
+        x_pthread_mutex_lock(&sb->lock);
+        if (sb->numBytes - client->aux.client.replayPos > size) {
+            client->aux.client.replayPos = sb->numBytes - size;
+        }
+        if (client->aux.client.replayPos >= client->aux.client.replayEnd) {
+            x_pthread_mutex_unlock(&sb->lock);
+            finish_log_replay(client);
+            return(0);
+        }
+        i = (client->aux.client.replayPos / SCROLLBACK_CHUNK_SIZE)
+            % sb->numChunks;
+        pos = client->aux.client.replayPos % SCROLLBACK_CHUNK_SIZE;
+        iov[0].iov_base = &sb->chunks[i][pos];
+        iov[0].iov_len = MIN(SCROLLBACK_CHUNK_SIZE - pos,
+            client->aux.client.replayEnd - client->aux.client.replayPos);
+        x_pthread_mutex_unlock(&sb->lock);
+        *iovcnt_p = 1;
+        return(iov[0].iov_len);
+    }
+    if (client->aux.client.replayMap
+            && (client->aux.client.replayPos >= client->aux.client.replayMapPos
+                + (off_t) client->aux.client.replayMapLen)) {
+        (void) munmap(client->aux.client.replayMap,
+            client->aux.client.replayMapLen);
+        client->aux.client.replayMap = NULL;
+    }
+    if (!client->aux.client.replayMap) {
+        if (client->aux.client.replayPos >= client->aux.client.replayEnd) {
+            finish_log_replay(client);
+            return(0);
+        }
+        pagesize = sysconf(_SC_PAGESIZE);
+        pos = client->aux.client.replayPos
+            - (client->aux.client.replayPos % pagesize);
+        len = MIN(client->aux.client.replayEnd - pos, REPLAY_MAP_SIZE);
+        p = mmap(NULL, len, PROT_READ, MAP_SHARED,
+            client->aux.client.replayFd, pos);
+        if (p == MAP_FAILED) {
+            log_msg(LOG_WARNING, "Unable to map replay for [%s]: %s",
+                client->name, strerror(errno));
+            finish_log_replay(client);
+            return(0);
+        }
+        client->aux.client.replayMap = p;
+        client->aux.client.replayMapPos = pos;
+        client->aux.client.replayMapLen = len;
+    }
+    iov[0].iov_base = client->aux.client.replayMap
+        + (client->aux.client.replayPos - client->aux.client.replayMapPos);
+    iov[0].iov_len = client->aux.client.replayMapPos
+        + client->aux.client.replayMapLen - client->aux.client.replayPos;
+    *iovcnt_p = 1;
+    return(iov[0].iov_len);
+}
+
+
+static int put_replay_data(obj_t *client, unsigned char *ptr, int n)
+{
+/*  Advances the (client)'s replay position once (n) bytes starting at (ptr)
+ *    have been written out to its fd.  The position is not advanced if it
+ *    has changed in the interim (eg, the replay skipped overwritten data).
+ *  Returns true if (ptr) was within the data being replayed.
+ */
+    obj_t *console;
+    obj_scrollback_t *sb;
+    unsigned char *p = NULL;
+    int i;
+
+    if (!client->aux.client.gotReplay) {
+        return(0);
+    }
+    if (client->aux.client.replayFd >= 0) {
+        if (client->aux.client.replayMap) {
+            p = client->aux.client.replayMap
+                + (client->aux.client.replayPos
+                    - client->aux.client.replayMapPos);
+        }
+        if (!p || (ptr != p)) {
+            return(0);
+        }
+        client->aux.client.replayPos += n;
+        return(1);
+    }
+    if (!(console = list_peek(client->writers))) {
+        return(0);
+    }
+    sb = &console->scrollback;
+    x_pthread_mutex_lock(&sb->lock);
+    if (sb->chunks) {
+        i = (client->aux.client.replayPos / SCROLLBACK_CHUNK_SIZE)
+            % sb->numChunks;
+        p = sb->chunks[i]
+            + (client->aux.client.replayPos % SCROLLBACK_CHUNK_SIZE);
+    }
+    if (p && (ptr == p) && (sb->numBytes - client->aux.client.replayPos
+            <= (uint64_t) sb->numChunks * SCROLLBACK_CHUNK_SIZE)) {
+        client->aux.client.replayPos += n;
+    }
+    x_pthread_mutex_unlock(&sb->lock);
+    return(p && (ptr == p));
+}
+
+
+int write_to_obj(obj_t *obj)
+{
+/*  Writes data from the obj's circular-buffer out to its file descriptor.
+ *  Returns 0 on success, or -1 if the obj is ready to be destroyed.
+ *
+ *  Client and logfile objs are flushed until either no data remains, the
+ *    write would block, or MAX_WRITE_BUDGET bytes have been written.
+ *    This drains a burst of output (eg, a client's informational messages
+ *    followed by console data from the ring) in a single pass through
+ *    mux_io() instead of waiting on tpoll() between each write.
+ */
+    struct iovec iov[MAX_WRITE_IOVS];
+    int iovcnt;
+    int budget;
+    int avail;
+    int n;
 
     DPRINTF((20, "Entered write_to_obj: [%s]\n", obj->name));
 
+    budget = (is_client_obj(obj) || is_logfile_obj(obj))
+        ? MAX_WRITE_BUDGET : 0;
+    do {
+        n = 0;
+        if ((avail = begin_write_to_obj(obj, iov, &iovcnt)) > 0) {
+again:
+            if (((n = writev(obj->fd, iov, iovcnt)) < 0)
+                    && (errno == EINTR)) {
+                goto again;
+            }
+        }
+        if (end_write_to_obj(obj, iov[0].iov_base, n) < 0) {
+            return(-1);
+        }
+        budget -= n;
+    } while ((n > 0) && (n == avail) && (budget > 0) && (obj->fd >= 0));
+
+    return(0);
+}
+
+
+int begin_write_to_obj(obj_t *obj, struct iovec *iov, int *iovcnt_p)
+{
+/*  Determines the data in the obj's circular-buffer that is to be written
+ *    out to its file descriptor, setting the array (iov) of MAX_WRITE_IOVS
+ *    entries to the segments of this data and (*iovcnt_p) to their number.
+ *    The start of the data (iov[0].iov_base) is always set, even if empty.
+ *  Returns the number of bytes to be written.
+ *
+ *  This and end_write_to_obj() allow the write itself to be performed
+ *    elsewhere (eg, batched with those of other objs by server.c:mux_io()).
+ *    The bufLock is not held in the interim, so the data may be overwritten
+ *    before the write completes.  But that data would have been lost anyway.
+ *  If a client's buffer is empty, data is written from the ring of the
+ *    console it is reading from.  Its buffer takes precedence since it
+ *    holds informational messages (such as the ring's "lagged" notice).
+ *    While a logfile replay is in progress, data is written from the
+ *    replay instead and the ring is held until the replay is finished
+ *    (but a replay started by create_client_obj() waits for the client
+ *    to be linked to its console).
+ *  A multiplexed client is written its batch of data frames from the rings
+ *    of its streams once its buffer is empty; but once a batch has been
+ *    started, it must be finished before the buffer can be written again.
+ */
+    int avail;
+    int isReplayReady;
+    int isRingReady;
+    int isMuxReady;
+
     assert(obj->fd >= 0);
 
+    isMuxReady = is_client_obj(obj) && obj->aux.client.mux
+        && !obj->aux.client.gotSuspend && !obj->gotEOF;
+    if (isMuxReady && ((avail = get_mux_data(obj, iov, iovcnt_p, 0)) > 0)) {
+        return(avail);
+    }
+
+    isReplayReady = is_replay_data_pending(obj)
+        && !list_is_empty(obj->writers)
+        && !obj->aux.client.gotSuspend && !obj->gotEOF;
+    isRingReady = is_client_obj(obj) && obj->aux.client.ring
+        && !obj->aux.client.gotSuspend && !obj->gotEOF && !isReplayReady;
+    if (isRingReady) {
+        check_ring_lag(obj);
+    }
     x_pthread_mutex_lock(&obj->bufLock);
 
     /*  Assert the buffer's input and output ptrs are valid upon entry.
      */
-    assert(obj->bufInPtr >= obj->buf);
-    assert(obj->bufInPtr < &obj->buf[MAX_BUF_SIZE]);
-    assert(obj->bufOutPtr >= obj->buf);
-    assert(obj->bufOutPtr < &obj->buf[MAX_BUF_SIZE]);
-
-    /*  The number of available bytes to write out to the file descriptor
-     *    does not take into account data that has wrapped-around in the
-     *    circular-buffer.  This remaining data will be written on the
-     *    next invocation of this routine.  It's just simpler that way.
+    assert(validate_obj_buf(obj));
+
+    /*  Data that has wrapped-around in the circular-buffer is described by
+     *    a second segment so both can be written out with a single writev().
      *  If a client is suspended, no data is written out to its fd.
      *  If a connection goes down, the buffer is cleared.
      *  Note that if (bufInPtr == bufOutPtr), the obj's buffer is empty.
@@ -1101,32 +2649,110 @@ int write_to_obj(obj_t *obj)
         avail = obj->bufInPtr - obj->bufOutPtr;
     }
     else {
-        avail = &obj->buf[MAX_BUF_SIZE] - obj->bufOutPtr;
+        avail = &obj->buf[obj->bufSize] - obj->bufOutPtr;
     }
-    if (avail > 0) {
-again:
-        if ((n = write(obj->fd, obj->bufOutPtr, avail)) < 0) {
-            if (errno == EINTR) {
-                goto again;
-            }
-            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
-                /*
-                 *  Mark obj for shutdown.
-                 */
-                log_msg(LOG_INFO, "Unable to write to [%s]: %s",
-                    obj->name, strerror(errno));
-                obj->gotEOF = 1;
-                obj->bufInPtr = obj->bufOutPtr = obj->buf;
-            }
+    iov[0].iov_base = obj->bufOutPtr;
+    iov[0].iov_len = avail;
+    *iovcnt_p = (avail > 0) ? 1 : 0;
+
+    if ((avail > 0) && (obj->bufInPtr < obj->bufOutPtr)
+            && (obj->bufInPtr > obj->buf)) {
+        iov[1].iov_base = obj->buf;
+        iov[1].iov_len = obj->bufInPtr - obj->buf;
+        avail += iov[1].iov_len;
+        *iovcnt_p = 2;
+    }
+    x_pthread_mutex_unlock(&obj->bufLock);
+
+    if ((avail == 0) && isMuxReady) {
+        avail = get_mux_data(obj, iov, iovcnt_p, 1);
+    }
+    else if ((avail == 0) && isReplayReady) {
+        avail = get_replay_data(obj, iov, iovcnt_p);
+    }
+    else if ((avail == 0) && isRingReady) {
+        avail = get_ring_data(obj, iov, iovcnt_p);
+    }
+    return(avail);
+}
+
+
+int end_write_to_obj(obj_t *obj, unsigned char *ptr, int n)
+{
+/*  Processes the result (n) of writing data starting at (ptr) from the
+ *    obj's circular-buffer out to its file descriptor, where (ptr) is the
+ *    start of the first segment set by begin_write_to_obj().  If (n) is -1,
+ *    errno must be set accordingly.
+ *  Returns 0 on success, or -1 if the obj is ready to be destroyed.
+ */
+    int avail;
+    int isDead = 0;
+
+#ifdef TCP_CORK
+    /*  Output written to a bulk client is held by its corked socket until
+     *    a full segment accumulates, but for no more than the coalescing
+     *    window of CLIENT_BULK_FLUSH_MSECS.
+     */
+    if ((n > 0) && is_client_obj(obj) && obj->aux.client.req->enableBulk
+            && (obj->aux.client.timer < 0)) {
+        obj->aux.client.timer = tpoll_timeout_relative(obj->shard->tp,
+            (callback_f) flush_client_obj, obj, CLIENT_BULK_FLUSH_MSECS);
+    }
+#endif /* TCP_CORK */
+
+    /*  Data not written from the obj's circular-buffer was written from
+     *    either the data frames of a multiplexed client, the logfile being
+     *    replayed to this client, or the ring of the console read by it.
+     */
+    if ((n > 0) && (!obj->buf
+            || (ptr < obj->buf) || (ptr >= &obj->buf[obj->bufSize]))) {
+        assert(is_client_obj(obj));
+        if (put_mux_data(obj, ptr, n)) {
+            DPRINTF((15, "Wrote %d mux bytes to [%s].\n", n, obj->name));
+        }
+        else if (put_replay_data(obj, ptr, n)) {
+            DPRINTF((15, "Wrote %d replay bytes to [%s].\n", n, obj->name));
         }
-        else if (n > 0) {
-            DPRINTF((15, "Wrote %d bytes to [%s].\n", n, obj->name));
+        else {
+            DPRINTF((15, "Wrote %d ring bytes to [%s].\n", n, obj->name));
+            put_ring_data(obj, ptr, n);
+        }
+        n = 0;
+    }
+    x_pthread_mutex_lock(&obj->bufLock);
+
+    if (n < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+            /*
+             *  Mark obj for shutdown.
+             */
+            log_msg(LOG_INFO, "Unable to write to [%s]: %s",
+                obj->name, strerror(errno));
+            obj->gotEOF = 1;
+            obj->bufInPtr = obj->bufOutPtr = obj->buf;
+        }
+    }
+    else if (n > 0) {
+        DPRINTF((15, "Wrote %d bytes to [%s].\n", n, obj->name));
+        /*
+         *  Only consume the data written if it is still in the buffer
+         *    (ie, it was neither overwritten nor flushed during the write).
+         */
+        if (obj->bufInPtr >= obj->bufOutPtr) {
+            avail = obj->bufInPtr - obj->bufOutPtr;
+        }
+        else {
+            avail = (&obj->buf[obj->bufSize] - obj->bufOutPtr) +
+                (obj->bufInPtr - obj->buf);
+        }
+        if ((obj->bufOutPtr == ptr) && (n <= avail)) {
             obj->bufOutPtr += n;
             /*
-             *  Do the hokey-pokey and perform a circular-buffer wrap-around.
+             *  Do the hokey-pokey and perform a circular-buffer wrap-around
+             *    (the write may have continued into the wrapped segment).
              */
-            if (obj->bufOutPtr == &obj->buf[MAX_BUF_SIZE]) {
-                obj->bufOutPtr = obj->buf;
+            if (obj->bufOutPtr >= &obj->buf[obj->bufSize]) {
+                obj->bufOutPtr -= obj->bufSize;
             }
         }
     }
@@ -1140,14 +2766,52 @@ again:
     if (obj->gotEOF && (obj->bufInPtr == obj->bufOutPtr)) {
         isDead = 1;
     }
+    /*  Once drained, the buffer is returned to the bufpool.
+     */
+    if (obj->bufInPtr == obj->bufOutPtr) {
+        release_obj_buf(obj);
+    }
     /*  Assert the buffer's input and output ptrs are valid upon exit.
      */
-    assert(obj->bufInPtr >= obj->buf);
-    assert(obj->bufInPtr < &obj->buf[MAX_BUF_SIZE]);
-    assert(obj->bufOutPtr >= obj->buf);
-    assert(obj->bufOutPtr < &obj->buf[MAX_BUF_SIZE]);
+    assert(validate_obj_buf(obj));
 
     x_pthread_mutex_unlock(&obj->bufLock);
 
     return(isDead ? shutdown_obj(obj) : 0);
 }
+
+
+static void release_obj_buf(obj_t *obj)
+{
+/*  Returns the obj's drained circular-buffer to the bufpool.
+ *  The caller must hold the obj's bufLock.  And since the buffer may be
+ *    referenced by a pending write, this must only be called by the shard
+ *    muxing the obj once that write has completed.
+ */
+    assert(obj->bufInPtr == obj->bufOutPtr);
+
+    if (!obj->buf) {
+        return;
+    }
+    bufpool_free(obj->buf, obj->bufSize);
+    obj->buf = obj->bufInPtr = obj->bufOutPtr = NULL;
+    return;
+}
+
+
+#ifndef NDEBUG
+static int validate_obj_buf(obj_t *obj)
+{
+/*  Validates the buffer's input and output ptrs are within its bounds,
+ *    or are both NULL if the buffer has not been allocated.
+ *  Returns 1 if the ptrs are good; o/w, returns 0.
+ */
+    if (!obj->buf) {
+        return((obj->bufInPtr == NULL) && (obj->bufOutPtr == NULL));
+    }
+    return((obj->bufInPtr >= obj->buf)
+        && (obj->bufInPtr < &obj->buf[obj->bufSize])
+        && (obj->bufOutPtr >= obj->buf)
+        && (obj->bufOutPtr < &obj->buf[obj->bufSize]));
+}
+#endif /* !NDEBUG */
@@ -44,17 +44,17 @@
 #include "util.h"
 #include "util-file.h"
 #include "util-str.h"
+#include "wrapper.h"
 
 
 static int search_exec_path(const char *path, const char *src,
     char *dst, int dstlen);
 static int  disconnect_process_obj(obj_t *process);
 static int  connect_process_obj(obj_t *process);
+static void retry_process_obj(obj_t *process);
 static int  check_process_prog(obj_t *process);
 static void reset_process_delay(obj_t *process);
 
-extern tpoll_t tp_global;               /* defined in server.c */
-
 
 int is_process_dev(const char *dev, const char *cwd,
     const char *exec_path, char **path_ref)
@@ -153,7 +153,6 @@ obj_t * create_process_obj(server_conf_t *conf, char *name, List args,
  *    by main:open_objs:reopen_obj:open_process_obj().
  *  Returns the new object, or NULL on error.
  */
-    ListIterator   i;
     obj_t         *process;
     process_obj_t *auxp;
     int            num_args;
@@ -166,16 +165,9 @@ obj_t * create_process_obj(server_conf_t *conf, char *name, List args,
 
     /*  Check for duplicate console names.
      */
-    i = list_iterator_create(conf->objs);
-    while ((process = list_next(i))) {
-        if (is_console_obj(process) && !strcmp(process->name, name)) {
-            snprintf(errbuf, errlen,
-                "console [%s] specifies duplicate console name", name);
-            break;
-        }
-    }
-    list_iterator_destroy(i);
-    if (process != NULL) {
+    if (find_console_obj(conf, name)) {
+        snprintf(errbuf, errlen,
+            "console [%s] specifies duplicate console name", name);
         return(NULL);
     }
     process = create_obj(conf, name, -1, CONMAN_OBJ_PROCESS);
@@ -225,7 +217,7 @@ int open_process_obj(obj_t *process)
     auxp = &(process->aux.process);
 
     if (auxp->timer >= 0) {
-        (void) tpoll_timeout_cancel(tp_global, auxp->timer);
+        (void) tpoll_timeout_cancel(process->shard->tp, auxp->timer);
         auxp->timer = -1;
     }
 
@@ -240,8 +232,8 @@ int open_process_obj(obj_t *process)
         DPRINTF((15, "Retrying [%s] connection to prog=\"%s\" in %ds\n",
             process->name, auxp->argv[0], auxp->delay));
 
-        auxp->timer = tpoll_timeout_relative(tp_global,
-            (callback_f) open_process_obj, process, auxp->delay * 1000);
+        auxp->timer = tpoll_timeout_relative(process->shard->tp,
+            (callback_f) retry_process_obj, process, auxp->delay * 1000);
 
         auxp->delay = (auxp->delay == 0)
             ? PROCESS_MIN_TIMEOUT
@@ -251,6 +243,21 @@ int open_process_obj(obj_t *process)
 }
 
 
+static void retry_process_obj(obj_t *process)
+{
+/*  Retries (re)opening the specified 'process' obj.
+ *  This routine is only invoked by a timer outside of a mux_io() pass,
+ *    so it holds the objsLock for reading while notifying linked objs.
+ */
+    pthread_rwlock_t *lockp = &process->shard->conf->objsLock;
+
+    x_pthread_rwlock_rdlock(lockp);
+    (void) open_process_obj(process);
+    x_pthread_rwlock_unlock(lockp);
+    return;
+}
+
+
 static int disconnect_process_obj(obj_t *process)
 {
 /*  Closes the existing connection with the specified 'process' obj.
@@ -269,6 +276,7 @@ static int disconnect_process_obj(obj_t *process)
     auxp = &(process->aux.process);
 
     if (process->fd >= 0) {
+        unregister_obj_fd(process);
         (void) close(process->fd);
         process->fd = -1;
     }
@@ -331,6 +339,7 @@ static int connect_process_obj(obj_t *process)
         goto err;
     }
     else if (pid == 0) {
+        unblock_signals();
         if (close(fd_pair[0]) < 0) {
             log_err(errno, "close() of child fd_pair failed");
         }
@@ -356,11 +365,12 @@ static int connect_process_obj(obj_t *process)
     auxp->pid = pid;
     process->gotEOF = 0;
     auxp->state = CONMAN_PROCESS_UP;
+    register_obj_fd(process);
 
     /*  Require the connection to be up for a minimum length of time before
      *    resetting the reconnect-delay back to zero.
      */
-    auxp->timer = tpoll_timeout_relative(tp_global,
+    auxp->timer = tpoll_timeout_relative(process->shard->tp,
         (callback_f) reset_process_delay, process, PROCESS_MIN_TIMEOUT * 1000);
 
     /*  Notify linked objs when transitioning into an UP state.
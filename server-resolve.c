@@ -0,0 +1,319 @@
+/*****************************************************************************
+ *  Written by Chris Dunlap <cdunlap@llnl.gov>.
+ *  Copyright (C) 2007-2013 Lawrence Livermore National Security, LLC.
+ *  Copyright (C) 2001-2007 The Regents of the University of California.
+ *  UCRL-CODE-2002-009.
+ *
+ *  This file is part of ConMan: The Console Manager.
+ *  For details, see <http://conman.googlecode.com/>.
+ *
+ *  ConMan is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  ConMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with ConMan.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>                  /* include before in.h for bsd */
+#include <netinet/in.h>                 /* include before inet.h for bsd */
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include "common.h"
+#include "list.h"
+#include "log.h"
+#include "server.h"
+#include "util-str.h"
+#include "util.h"
+#include "wrapper.h"
+
+
+static void * resolve_addrs(resolver_t *r);
+static resolve_entry_t * find_resolve_entry(resolver_t *r,
+    const struct in_addr *addr);
+static resolve_entry_t * create_resolve_entry(resolver_t *r,
+    const struct in_addr *addr);
+static void purge_resolve_entries(resolver_t *r, time_t now);
+static unsigned int hash_addr(const struct in_addr *addr);
+
+
+void start_resolver(server_conf_t *conf)
+{
+/*  Creates the reverse DNS resolver and its pool of lookup threads.
+ *  The threads are created with the signals handled by the main thread
+ *    blocked (cf, create_signal_blocked_thread).
+ */
+    resolver_t *r;
+    int n;
+    int rc;
+
+    assert(conf->resolver == NULL);
+
+    if (!(r = malloc(sizeof(resolver_t)))) {
+        out_of_memory();
+    }
+    memset(r, 0, sizeof(*r));
+    r->queue = list_create(NULL);
+    x_pthread_mutex_init(&r->lock, NULL);
+    x_pthread_cond_init(&r->queueCond, NULL);
+    x_pthread_cond_init(&r->doneCond, NULL);
+
+    for (n = 0; n < RESOLVE_THREADS; n++) {
+        if ((rc = create_signal_blocked_thread(&r->tids[n],
+          (PthreadFunc) resolve_addrs, r)) != 0) {
+            log_err(rc, "Unable to create resolver thread");
+        }
+    }
+    conf->resolver = r;
+    DPRINTF((5, "Started %d resolver threads.\n", RESOLVE_THREADS));
+    return;
+}
+
+
+void stop_resolver(server_conf_t *conf)
+{
+/*  Waits for the resolver's lookup threads to exit, and destroys the cache.
+ *  A lookup already in progress is allowed to complete, since the resolver
+ *    library provides no means of cancelling it.
+ */
+    resolver_t *r;
+    resolve_entry_t *entry;
+    int n;
+    int rc;
+
+    if (!(r = conf->resolver)) {
+        return;
+    }
+    x_pthread_mutex_lock(&r->lock);
+    r->gotDone = 1;
+    x_pthread_cond_broadcast(&r->queueCond);
+    x_pthread_cond_broadcast(&r->doneCond);
+    x_pthread_mutex_unlock(&r->lock);
+
+    for (n = 0; n < RESOLVE_THREADS; n++) {
+        if ((rc = pthread_join(r->tids[n], NULL)) != 0) {
+            log_err(rc, "Unable to join resolver thread");
+        }
+    }
+    for (n = 0; n < RESOLVE_HASH_SIZE; n++) {
+        while ((entry = r->hash[n])) {
+            r->hash[n] = entry->next;
+            if (entry->name) {
+                free(entry->name);
+            }
+            free(entry);
+        }
+    }
+    list_destroy(r->queue);
+    x_pthread_mutex_destroy(&r->lock);
+    x_pthread_cond_destroy(&r->queueCond);
+    x_pthread_cond_destroy(&r->doneCond);
+    free(r);
+    conf->resolver = NULL;
+    DPRINTF((5, "Stopped resolver threads.\n"));
+    return;
+}
+
+
+char * lookup_host_name(server_conf_t *conf, const struct in_addr *addr,
+    char *dst, int dstlen, int doWait)
+{
+/*  Looks up the host name of the IPv4 address (addr) in the resolver cache,
+ *    copying it into the buffer (dst) of length (dstlen).
+ *  If the address is not cached (or its entry has gone stale), a lookup is
+ *    queued for the resolver threads.  If (doWait) is true, the caller then
+ *    blocks until it completes; otherwise, the caller proceeds without the
+ *    name, and subsequent connections from that address will find it cached.
+ *  Returns (dst), or NULL if the name is unknown or not yet resolved.
+ */
+    resolver_t *r;
+    resolve_entry_t *entry;
+    time_t now;
+    char *p = NULL;
+
+    assert(addr != NULL);
+    assert(dst != NULL);
+
+    if (!(r = conf->resolver)) {
+        return(NULL);
+    }
+    x_pthread_mutex_lock(&r->lock);
+
+    entry = find_resolve_entry(r, addr);
+    now = time(NULL);
+
+    if (entry && !entry->isPending && (entry->expire <= now)) {
+        entry->isPending = 1;
+        list_enqueue(r->queue, entry);
+        x_pthread_cond_signal(&r->queueCond);
+    }
+    else if (!entry && (entry = create_resolve_entry(r, addr))) {
+        list_enqueue(r->queue, entry);
+        x_pthread_cond_signal(&r->queueCond);
+    }
+    while (doWait && entry && entry->isPending && !r->gotDone) {
+        x_pthread_cond_wait(&r->doneCond, &r->lock);
+    }
+    if (entry && !entry->isPending && entry->name) {
+        if (strlcpy(dst, entry->name, dstlen) < (size_t) dstlen) {
+            p = dst;
+        }
+    }
+    x_pthread_mutex_unlock(&r->lock);
+    return(p);
+}
+
+
+static void * resolve_addrs(resolver_t *r)
+{
+/*  Performs the queued lookups until the resolver is stopped.
+ *  The lookup itself is performed without holding the resolver lock.
+ *    getnameinfo() is used here instead of host_addr4_to_name() since the
+ *    latter serializes every lookup on a single lock.
+ */
+    resolve_entry_t *entry;
+    struct sockaddr_in sin;
+    char buf[NI_MAXHOST];
+    int rc;
+
+    x_pthread_mutex_lock(&r->lock);
+    for (;;) {
+        while (!r->gotDone && list_is_empty(r->queue)) {
+            x_pthread_cond_wait(&r->queueCond, &r->lock);
+        }
+        if (r->gotDone) {
+            break;
+        }
+        entry = list_dequeue(r->queue);
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_addr = entry->addr;
+        x_pthread_mutex_unlock(&r->lock);
+
+        rc = getnameinfo((struct sockaddr *) &sin, sizeof(sin),
+            buf, sizeof(buf), NULL, 0, NI_NAMEREQD);
+
+        x_pthread_mutex_lock(&r->lock);
+        if (entry->name) {
+            free(entry->name);
+            entry->name = NULL;
+        }
+        if (rc == 0) {
+            entry->name = create_string(buf);
+            entry->expire = time(NULL) + RESOLVE_POS_TTL;
+        }
+        else {
+            entry->expire = time(NULL) + RESOLVE_NEG_TTL;
+        }
+        entry->isPending = 0;
+        DPRINTF((10, "Resolved client address: %s.\n",
+            (entry->name ? entry->name : gai_strerror(rc))));
+        x_pthread_cond_broadcast(&r->doneCond);
+    }
+    x_pthread_mutex_unlock(&r->lock);
+    return(NULL);
+}
+
+
+static resolve_entry_t * find_resolve_entry(resolver_t *r,
+    const struct in_addr *addr)
+{
+/*  Finds the cache entry for the IPv4 address (addr).
+ *  The resolver lock must be held when calling this routine.
+ *  Returns the entry, or NULL if the address is not cached.
+ */
+    resolve_entry_t *entry;
+
+    entry = r->hash[hash_addr(addr)];
+    while (entry && (entry->addr.s_addr != addr->s_addr)) {
+        entry = entry->next;
+    }
+    return(entry);
+}
+
+
+static resolve_entry_t * create_resolve_entry(resolver_t *r,
+    const struct in_addr *addr)
+{
+/*  Creates a pending cache entry for the IPv4 address (addr).
+ *  If the cache is full, stale entries are purged to make room.
+ *  The resolver lock must be held when calling this routine.
+ *  Returns the new entry, or NULL if the cache is still full.
+ */
+    resolve_entry_t *entry;
+    unsigned int h;
+
+    if (r->numEntries >= RESOLVE_CACHE_MAX) {
+        purge_resolve_entries(r, time(NULL));
+        if (r->numEntries >= RESOLVE_CACHE_MAX) {
+            return(NULL);
+        }
+    }
+    if (!(entry = malloc(sizeof(resolve_entry_t)))) {
+        out_of_memory();
+    }
+    h = hash_addr(addr);
+    entry->addr = *addr;
+    entry->name = NULL;
+    entry->expire = 0;
+    entry->isPending = 1;
+    entry->next = r->hash[h];
+    r->hash[h] = entry;
+    r->numEntries++;
+    return(entry);
+}
+
+
+static void purge_resolve_entries(resolver_t *r, time_t now)
+{
+/*  Removes all cache entries that have gone stale as of time (now).
+ *  Pending entries are kept since they are still referenced by the queue.
+ *  The resolver lock must be held when calling this routine.
+ */
+    resolve_entry_t **entry_p;
+    resolve_entry_t *entry;
+    int n;
+
+    for (n = 0; n < RESOLVE_HASH_SIZE; n++) {
+        entry_p = &r->hash[n];
+        while ((entry = *entry_p)) {
+            if (!entry->isPending && (entry->expire <= now)) {
+                *entry_p = entry->next;
+                if (entry->name) {
+                    free(entry->name);
+                }
+                free(entry);
+                r->numEntries--;
+            }
+            else {
+                entry_p = &entry->next;
+            }
+        }
+    }
+    return;
+}
+
+
+static unsigned int hash_addr(const struct in_addr *addr)
+{
+/*  Returns the hash table index for the IPv4 address (addr).
+ */
+    return((unsigned int) ntohl(addr->s_addr) % RESOLVE_HASH_SIZE);
+}
@@ -383,6 +383,7 @@ int open_serial_obj(obj_t *serial)
             "Console [%s] disconnected from \"%s\"",
             serial->name, serial->aux.serial.dev);
         set_tty_mode(&serial->aux.serial.tty, serial->fd);
+        unregister_obj_fd(serial);
         if (close(serial->fd) < 0)      /* log err and continue */
             log_msg(LOG_WARNING, "Unable to close [%s] device \"%s\": %s",
                 serial->name, serial->aux.serial.dev, strerror(errno));
@@ -428,6 +429,7 @@ int open_serial_obj(obj_t *serial)
     set_tty_mode(&tty, fd);
     serial->fd = fd;
     serial->gotEOF = 0;
+    register_obj_fd(serial);
     /*
      *  Success!
      */
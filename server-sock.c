@@ -38,6 +38,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 #include "common.h"
@@ -47,6 +48,7 @@
 #include "util-file.h"
 #include "util-net.h"
 #include "util-str.h"
+#include "util.h"
 #include "wrapper.h"
 
 
@@ -66,6 +68,18 @@ int deny_severity = LOG_WARNING;        /* logging level for rejected reqs */
 #endif /* WITH_TCP_WRAPPERS */
 
 
+typedef struct rsp_buf {                /* RESPONSE OUTPUT BUFFER:           */
+    req_t           *req;               /*  request being responded to       */
+    char            *buf;               /*  response data not yet written    */
+    int              len;               /*  num bytes in buf                 */
+    int              size;              /*  num bytes allocated for buf      */
+    int              gotError;          /*  true if a write to client failed */
+} rsp_buf_t;
+
+
+static void * process_clients(server_conf_t *conf);
+static void process_client(client_arg_t *args);
+static void set_req_timeout(int sd, int secs);
 static int resolve_addr(server_conf_t *conf, req_t *req, int sd);
 static int recv_greeting(req_t *req);
 static void parse_greeting(Lex l, req_t *req);
@@ -76,21 +90,192 @@ static int query_consoles_via_globbing(
     server_conf_t *conf, req_t *req, List matches);
 static int query_consoles_via_regex(
     server_conf_t *conf, req_t *req, List matches);
+static void glob_consoles(server_conf_t *conf, List pats,
+    query_entry_t *entry);
+static void regex_consoles(server_conf_t *conf, query_entry_t *entry);
+static query_entry_t * find_query_entry(
+    query_cache_t *qc, const char *key, int isRegex);
+static query_entry_t * create_query_entry(
+    query_cache_t *qc, const char *key, int isRegex);
+static void destroy_query_entry(query_entry_t *entry);
+static void add_query_entry_obj(query_entry_t *entry, obj_t *obj);
+static void sort_query_entry_objs(query_entry_t *entry);
+static int compare_obj_ptrs(obj_t **obj1_p, obj_t **obj2_p);
 static int validate_req(req_t *req);
 static int check_too_many_consoles(req_t *req);
 static int check_busy_consoles(req_t *req);
 static int send_rsp(req_t *req, int errnum, char *errmsg);
+static void init_rsp_buf(rsp_buf_t *rb, req_t *req);
+static void append_rsp_buf(rsp_buf_t *rb, const char *src, int len);
+static int flush_rsp_buf(rsp_buf_t *rb);
+static int finish_rsp_buf(rsp_buf_t *rb);
 static int perform_query_cmd(req_t *req);
 static int perform_monitor_cmd(req_t *req, server_conf_t *conf);
 static int perform_connect_cmd(req_t *req, server_conf_t *conf);
+static int perform_log_cmd(req_t *req, server_conf_t *conf);
 static void check_console_state(obj_t *console, obj_t *client);
 
 
-void process_client(client_arg_t *args)
+void start_client_workers(server_conf_t *conf)
+{
+/*  Creates the pool of threads processing client requests.
+ *  The threads are created with the signals handled by the main thread
+ *    blocked (cf, create_signal_blocked_thread).
+ *  The clientQueueLock is held while the threads are created so each can
+ *    find its thread id in conf->clientTids[] once it acquires the lock.
+ */
+    int n;
+    int rc;
+
+    assert(conf->numClientThreads > 0);
+
+    if (!(conf->clientTids =
+            malloc(conf->numClientThreads * sizeof(pthread_t)))) {
+        out_of_memory();
+    }
+    if (!(conf->clientSds = malloc(conf->numClientThreads * sizeof(int)))) {
+        out_of_memory();
+    }
+    for (n = 0; n < conf->numClientThreads; n++) {
+        conf->clientSds[n] = -1;
+    }
+    x_pthread_mutex_lock(&conf->clientQueueLock);
+    for (n = 0; n < conf->numClientThreads; n++) {
+        if ((rc = create_signal_blocked_thread(&conf->clientTids[n],
+          (PthreadFunc) process_clients, conf)) != 0) {
+            log_err(rc, "Unable to create client worker thread");
+        }
+    }
+    x_pthread_mutex_unlock(&conf->clientQueueLock);
+    DPRINTF((5, "Started %d client worker threads.\n",
+        conf->numClientThreads));
+    return;
+}
+
+
+void stop_client_workers(server_conf_t *conf)
+{
+/*  Waits for the client worker threads to exit.
+ *  Clients still queued are disconnected, and those being processed are
+ *    shut down so their workers are not left waiting on the client.
+ */
+    client_arg_t *args;
+    int n;
+    int rc;
+
+    if (!conf->clientTids) {
+        return;
+    }
+    x_pthread_mutex_lock(&conf->clientQueueLock);
+    conf->gotClientDone = 1;
+    while ((args = list_dequeue(conf->clientQueue))) {
+        (void) close(args->sd);
+        free(args);
+    }
+    for (n = 0; n < conf->numClientThreads; n++) {
+        if (conf->clientSds[n] >= 0) {
+            (void) shutdown(conf->clientSds[n], SHUT_RDWR);
+        }
+    }
+    x_pthread_cond_broadcast(&conf->clientQueueCond);
+    x_pthread_mutex_unlock(&conf->clientQueueLock);
+
+    for (n = 0; n < conf->numClientThreads; n++) {
+        if ((rc = pthread_join(conf->clientTids[n], NULL)) != 0) {
+            log_msg(LOG_WARNING, "Unable to join client worker %d: %s",
+                n, strerror(rc));
+        }
+    }
+    free(conf->clientTids);
+    conf->clientTids = NULL;
+    free(conf->clientSds);
+    conf->clientSds = NULL;
+    return;
+}
+
+
+void queue_client(server_conf_t *conf, int sd)
 {
-/*  The thread responsible for accepting a client connection
- *    and processing the request.
- *  The QUERY cmd is processed entirely by this thread.
+/*  Queues the newly-accepted client connection (sd) for its request to be
+ *    processed by the client worker threads.
+ *  The connection is dropped if CLIENT_QUEUE_MAX requests are already
+ *    pending, thereby bounding the fds held by a connection storm.
+ */
+    client_arg_t *args;
+
+    assert(sd >= 0);
+
+    x_pthread_mutex_lock(&conf->clientQueueLock);
+    if (list_count(conf->clientQueue) >= CLIENT_QUEUE_MAX) {
+        x_pthread_mutex_unlock(&conf->clientQueueLock);
+        log_msg(LOG_WARNING,
+            "Dropped new client: %d client requests already pending",
+            CLIENT_QUEUE_MAX);
+        (void) close(sd);
+        return;
+    }
+    if (!(args = malloc(sizeof(client_arg_t)))) {
+        out_of_memory();
+    }
+    args->sd = sd;
+    args->conf = conf;
+    list_enqueue(conf->clientQueue, args);
+    x_pthread_cond_signal(&conf->clientQueueCond);
+    x_pthread_mutex_unlock(&conf->clientQueueLock);
+    return;
+}
+
+
+static void * process_clients(server_conf_t *conf)
+{
+/*  Thread entry point for processing queued client requests.
+ *
+ *  A client's greeting, request, and response are exchanged via blocking
+ *    I/O by one of a fixed pool of these threads, thereby bounding the
+ *    threads created by a storm of connections (eg, a monitoring system
+ *    issuing queries for thousands of consoles).  Each exchange is limited
+ *    by CLIENT_REQ_TIMEOUT so an unresponsive client cannot hold a worker.
+ *  The MONITOR and CONNECT cmds are then handed off to the I/O shards.
+ */
+    client_arg_t *args;
+    int id;
+
+    x_pthread_mutex_lock(&conf->clientQueueLock);
+    for (id = 0; id < conf->numClientThreads; id++) {
+        if (pthread_equal(conf->clientTids[id], pthread_self())) {
+            break;
+        }
+    }
+    assert(id < conf->numClientThreads);
+    DPRINTF((5, "Started client worker thread %d.\n", id));
+
+    for (;;) {
+        while (list_is_empty(conf->clientQueue) && !conf->gotClientDone) {
+            x_pthread_cond_wait(&conf->clientQueueCond,
+                &conf->clientQueueLock);
+        }
+        if (conf->gotClientDone) {
+            break;
+        }
+        args = list_dequeue(conf->clientQueue);
+        conf->clientSds[id] = args->sd;
+        x_pthread_mutex_unlock(&conf->clientQueueLock);
+
+        process_client(args);
+
+        x_pthread_mutex_lock(&conf->clientQueueLock);
+        conf->clientSds[id] = -1;
+    }
+    x_pthread_mutex_unlock(&conf->clientQueueLock);
+    DPRINTF((5, "Stopped client worker thread %d.\n", id));
+    return(NULL);
+}
+
+
+static void process_client(client_arg_t *args)
+{
+/*  Processes the request of a newly-accepted client connection.
+ *  The QUERY and LOG cmds are processed entirely by this thread.
  *  The MONITOR and CONNECT cmds are setup and then placed
  *    in the conf->objs list to be handled by mux_io().
  */
@@ -98,7 +283,7 @@ void process_client(client_arg_t *args)
     server_conf_t *conf;
     req_t *req;
 
-    /*  Free the tmp struct that was created by accept_client()
+    /*  Free the tmp struct that was created by queue_client()
      *    in order to pass multiple args to this thread.
      */
     assert(args != NULL);
@@ -108,7 +293,7 @@ void process_client(client_arg_t *args)
 
     DPRINTF((5, "Processing new client.\n"));
 
-    x_pthread_detach(pthread_self());
+    set_req_timeout(sd, CLIENT_REQ_TIMEOUT);
 
     req = create_req();
 
@@ -143,6 +328,10 @@ void process_client(client_arg_t *args)
         if (perform_query_cmd(req) < 0)
             goto err;
         break;
+    case CONMAN_CMD_LOG:
+        if (perform_log_cmd(req, conf) < 0)
+            goto err;
+        break;
     default:
         log_msg(LOG_WARNING, "Received invalid command=%d from <%s@%s:%d>",
             req->command, req->user, req->fqdn, req->port);
@@ -156,6 +345,31 @@ err:
 }
 
 
+static void set_req_timeout(int sd, int secs)
+{
+/*  Sets the timeout for each blocking read from or write to the client
+ *    socket (sd) to (secs) seconds; a timed-out operation fails with
+ *    EAGAIN.  This only applies while the request is processed by a client
+ *    worker, since the socket is non-blocking once handed off for muxing.
+ */
+    struct timeval tv;
+
+    tv.tv_sec = secs;
+    tv.tv_usec = 0;
+    if (setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO,
+            (const void *) &tv, sizeof(tv)) < 0) {
+        log_msg(LOG_WARNING, "Unable to set RCVTIMEO socket option: %s",
+            strerror(errno));
+    }
+    if (setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO,
+            (const void *) &tv, sizeof(tv)) < 0) {
+        log_msg(LOG_WARNING, "Unable to set SNDTIMEO socket option: %s",
+            strerror(errno));
+    }
+    return;
+}
+
+
 static int resolve_addr(server_conf_t *conf, req_t *req, int sd)
 {
 /*  Resolves the network information associated with the
@@ -167,6 +381,7 @@ static int resolve_addr(server_conf_t *conf, req_t *req, int sd)
     char buf[MAX_LINE];
     char *p;
     int gotHostName = 0;
+    int doWait = 0;
 
     assert(sd >= 0);
 
@@ -182,8 +397,16 @@ static int resolve_addr(server_conf_t *conf, req_t *req, int sd)
      *    host string; if it fails, buf is unchanged with IP addr string.
      *    Either way, copy buf to prevent having to code everything as
      *    (req->host ? req->host : req->ip).
+     *  The name is taken from the resolver cache so a slow DNS server does
+     *    not stall the connection.  On a cache miss, the client proceeds with
+     *    its IP address while the lookup completes in the background --
+     *    unless TCP-Wrappers needs the name to check the connection.
      */
-    if ((host_addr4_to_name(&addr.sin_addr, buf, sizeof(buf)))) {
+#if WITH_TCP_WRAPPERS
+    doWait = conf->enableTCPWrap;
+#endif /* WITH_TCP_WRAPPERS */
+
+    if ((lookup_host_name(conf, &addr.sin_addr, buf, sizeof(buf), doWait))) {
         gotHostName = 1;
         req->fqdn = create_string(buf);
         if ((p = strchr(buf, '.')))
@@ -229,7 +452,7 @@ static int recv_greeting(req_t *req)
 
     assert(req->sd >= 0);
 
-    if ((n = read_line(req->sd, buf, sizeof(buf))) < 0) {
+    if ((n = read_sock_line(req->sd, buf, sizeof(buf))) < 0) {
         log_msg(LOG_NOTICE, "Unable to read greeting from <%s:%d>: %s",
             req->fqdn, req->port, strerror(errno));
         return(-1);
@@ -277,7 +500,9 @@ static int recv_greeting(req_t *req)
 static void parse_greeting(Lex l, req_t *req)
 {
 /*  Parses the "HELLO" command from the client:
- *    HELLO USER='<str>' TTY='<str>'
+ *    HELLO USER='<str>' TTY='<str>' [OPTION=MUX]
+ *  The MUX option requests a multiplexed session (cf, server-mux.c);
+ *    the server acknowledges it in its response to the greeting.
  */
     int done = 0;
     int tok;
@@ -301,6 +526,10 @@ static void parse_greeting(Lex l, req_t *req)
                 req->tty = lex_decode(create_string(lex_text(l)));
             }
             break;
+        case CONMAN_TOK_OPTION:
+            if ((lex_next(l) == '=') && (lex_next(l) == CONMAN_TOK_MUX))
+                req->enableMux = 1;
+            break;
         case LEX_EOF:
         case LEX_EOL:
             done = 1;
@@ -326,7 +555,7 @@ static int recv_req(req_t *req)
 
     assert(req->sd >= 0);
 
-    if ((n = read_line(req->sd, buf, sizeof(buf))) < 0) {
+    if ((n = read_sock_line(req->sd, buf, sizeof(buf))) < 0) {
         log_msg(LOG_NOTICE, "Unable to read request from <%s:%d>: %s",
             req->fqdn, req->port, strerror(errno));
         return(-1);
@@ -355,6 +584,10 @@ static int recv_req(req_t *req)
             req->command = CONMAN_CMD_QUERY;
             parse_cmd_opts(l, req);
             break;
+        case CONMAN_TOK_LOG:
+            req->command = CONMAN_CMD_LOG;
+            parse_cmd_opts(l, req);
+            break;
         case LEX_EOF:
         case LEX_EOL:
             done = 1;
@@ -372,6 +605,8 @@ static int recv_req(req_t *req)
 static void parse_cmd_opts(Lex l, req_t *req)
 {
 /*  Parses the command options for the given request.
+ *  The BULK and INTERACTIVE options select the client's QoS and are
+ *    mutually exclusive; the last one specified takes effect.
  */
     int done = 0;
     int tok;
@@ -391,16 +626,40 @@ static void parse_cmd_opts(Lex l, req_t *req)
             if (lex_next(l) == '=') {
                 if (lex_next(l) == CONMAN_TOK_BROADCAST)
                     req->enableBroadcast = 1;
+                else if (lex_prev(l) == CONMAN_TOK_BULK) {
+                    req->enableBulk = 1;
+                    req->enableInteractive = 0;
+                }
                 else if (lex_prev(l) == CONMAN_TOK_FORCE)
                     req->enableForce = 1;
+                else if (lex_prev(l) == CONMAN_TOK_INTERACTIVE) {
+                    req->enableInteractive = 1;
+                    req->enableBulk = 0;
+                }
                 else if (lex_prev(l) == CONMAN_TOK_JOIN)
                     req->enableJoin = 1;
+                else if (lex_prev(l) == CONMAN_TOK_MORE)
+                    req->enableMore = 1;
                 else if (lex_prev(l) == CONMAN_TOK_QUIET)
                     req->enableQuiet = 1;
                 else if (lex_prev(l) == CONMAN_TOK_REGEX)
                     req->enableRegex = 1;
+                else if (lex_prev(l) == CONMAN_TOK_SEQ)
+                    req->enableSeq = 1;
             }
             break;
+        case CONMAN_TOK_REPLAY:
+            if ((lex_next(l) == '=') && (lex_next(l) == LEX_INT))
+                req->replayLen = (off_t) strtoll(lex_text(l), NULL, 10);
+            break;
+        case CONMAN_TOK_START:
+            if ((lex_next(l) == '=') && (lex_next(l) == LEX_INT))
+                req->tStart = (time_t) strtol(lex_text(l), NULL, 10);
+            break;
+        case CONMAN_TOK_STOP:
+            if ((lex_next(l) == '=') && (lex_next(l) == LEX_INT))
+                req->tStop = (time_t) strtol(lex_text(l), NULL, 10);
+            break;
         case LEX_EOF:
         case LEX_EOL:
             done = 1;
@@ -424,7 +683,8 @@ static int query_consoles(server_conf_t *conf, req_t *req)
     List matches;
     int rc;
 
-    if (list_is_empty(req->consoles) && (req->command != CONMAN_CMD_QUERY))
+    if (list_is_empty(req->consoles) && (req->command != CONMAN_CMD_QUERY)
+      && !req->enableSeq)
         return(0);
 
     /*  The NULL destructor is used for 'matches' because the matches list
@@ -459,38 +719,51 @@ static int query_consoles_via_globbing(
     server_conf_t *conf, req_t *req, List matches)
 {
 /*  Match request patterns against console names using shell-style globbing.
- *  This is less efficient than matching via regular expressions
- *    since the console list must be traversed for each pattern, and the
- *    matches list must be traversed for each match to prevent duplicates.
+ *  Results are cached by the set of patterns (cf, find_query_entry).
  */
     char *p;
-    ListIterator i, j;
-    char *pat;
-    obj_t *obj;
+    ListIterator i;
+    char key[MAX_SOCK_LINE];
+    query_cache_t *qc = &conf->queryCache;
+    query_entry_t *entry;
+    int n;
 
-    /*  An empty list for the QUERY command matches all consoles.
+    /*  An empty list for the QUERY command (or for a sequenced session)
+     *    matches all consoles.
      */
     if (list_is_empty(req->consoles)) {
         p = create_string("*");
         list_append(req->consoles, p);
     }
 
-    /*  Search objs for console names matching console patterns in the request.
+    /*  Combine console patterns to create the cache key.
      */
     i = list_iterator_create(req->consoles);
-    j = list_iterator_create(conf->objs);
-    while ((pat = list_next(i))) {
-        list_iterator_reset(j);
-        while ((obj = list_next(j))) {
-            if (!is_console_obj(obj))
-                continue;
-            if (!fnmatch(pat, obj->name, 0)
-              && !list_find_first(matches, (ListFindF) find_obj, obj))
-                list_append(matches, obj);
-        }
+    strlcpy(key, list_next(i), sizeof(key));
+    while ((p = list_next(i))) {
+        strlcat(key, "\n", sizeof(key));
+        strlcat(key, p, sizeof(key));
     }
     list_iterator_destroy(i);
-    list_iterator_destroy(j);
+
+    x_pthread_mutex_lock(&qc->lock);
+    x_pthread_rwlock_rdlock(&conf->objsLock);
+
+    if (!(entry = find_query_entry(qc, key, 0))) {
+        entry = create_query_entry(qc, key, 0);
+    }
+    if (entry->generation != conf->consoles.generation) {
+        qc->numMisses++;
+        glob_consoles(conf, req->consoles, entry);
+    }
+    else {
+        qc->numHits++;
+    }
+    for (n = 0; n < entry->numObjs; n++) {
+        list_append(matches, entry->objs[n]);
+    }
+    x_pthread_rwlock_unlock(&conf->objsLock);
+    x_pthread_mutex_unlock(&qc->lock);
     return(0);
 }
 
@@ -499,16 +772,20 @@ static int query_consoles_via_regex(
     server_conf_t *conf, req_t *req, List matches)
 {
 /*  Match request patterns against console names using regular expressions.
+ *  Compiled regexs and their results are cached by the combined regex
+ *    (cf, find_query_entry).
  */
     char *p;
     ListIterator i;
     char buf[MAX_SOCK_LINE];
     int rc;
     regex_t rex;
-    regmatch_t match;
-    obj_t *obj;
+    query_cache_t *qc = &conf->queryCache;
+    query_entry_t *entry;
+    int n;
 
-    /*  An empty list for the QUERY command matches all consoles.
+    /*  An empty list for the QUERY command (or for a sequenced session)
+     *    matches all consoles.
      */
     if (list_is_empty(req->consoles)) {
         p = create_string(".*");
@@ -525,34 +802,294 @@ static int query_consoles_via_regex(
     }
     list_iterator_destroy(i);
 
-    /*  Initialize 'rex' to silence "uninitialized use" warnings.
+    x_pthread_mutex_lock(&qc->lock);
+
+    if (!(entry = find_query_entry(qc, buf, 1))) {
+        /*
+         *  Initialize 'rex' to silence "uninitialized use" warnings.
+         */
+        memset(&rex, 0, sizeof(rex));
+
+        /*  Compile regex for searching server's console objs.
+         */
+        rc = regcomp(&rex, buf, REG_EXTENDED | REG_ICASE);
+        if (rc != 0) {
+            x_pthread_mutex_unlock(&qc->lock);
+            if (regerror(rc, &rex, buf, sizeof(buf)) > sizeof(buf))
+                log_msg(LOG_WARNING, "Got regerror() buffer overrun");
+            regfree(&rex);
+            send_rsp(req, CONMAN_ERR_BAD_REGEX, buf);
+            return(-1);
+        }
+        entry = create_query_entry(qc, buf, 1);
+        entry->rex = rex;
+    }
+    x_pthread_rwlock_rdlock(&conf->objsLock);
+
+    if (entry->generation != conf->consoles.generation) {
+        qc->numMisses++;
+        regex_consoles(conf, entry);
+    }
+    else {
+        qc->numHits++;
+    }
+    for (n = 0; n < entry->numObjs; n++) {
+        list_append(matches, entry->objs[n]);
+    }
+    x_pthread_rwlock_unlock(&conf->objsLock);
+    x_pthread_mutex_unlock(&qc->lock);
+    return(0);
+}
+
+
+static void glob_consoles(server_conf_t *conf, List pats, query_entry_t *entry)
+{
+/*  Resolves the cache (entry) by matching the shell-style globbing patterns
+ *    in the (pats) list against console names.
+ *  A pattern without wildcards is looked up directly in the console index
+ *    hash.  Otherwise, only the consoles sharing the pattern's literal prefix
+ *    (eg, "node" for "node[0-9]*") are matched against it via a binary search
+ *    of the sorted console index.
+ *  The conf's objsLock must be held for reading when calling this routine.
+ */
+    ListIterator i;
+    char *pat;
+    obj_t *obj;
+    obj_t **objs;
+    int len;
+    int n, m;
+
+    entry->numObjs = 0;
+    i = list_iterator_create(pats);
+    while ((pat = list_next(i))) {
+        len = strcspn(pat, "*?[\\");
+        if (pat[len] == '\0') {
+            if ((obj = find_console_obj(conf, pat))) {
+                n = 1;
+                objs = &obj;
+            }
+            else {
+                n = 0;
+                objs = NULL;
+            }
+        }
+        else {
+            n = find_console_objs(conf, pat, len, &objs);
+        }
+        for (m = 0; m < n; m++) {
+            if ((pat[len] == '\0') || !fnmatch(pat, objs[m]->name, 0))
+                add_query_entry_obj(entry, objs[m]);
+        }
+    }
+    list_iterator_destroy(i);
+    sort_query_entry_objs(entry);
+    entry->generation = conf->consoles.generation;
+    return;
+}
+
+
+static void regex_consoles(server_conf_t *conf, query_entry_t *entry)
+{
+/*  Resolves the cache (entry) by matching its compiled regex against
+ *    console names.  The regex must match the entire name.
+ *  Since the regex is case-insensitive and may contain alternations, the
+ *    index cannot be pruned by prefix; but traversing it skips the logfile
+ *    and client objs in the conf->objs list.
+ *  The conf's objsLock must be held for reading when calling this routine.
+ */
+    obj_t **objs;
+    regmatch_t match;
+    int n, m;
+
+    entry->numObjs = 0;
+    n = find_console_objs(conf, "", 0, &objs);
+    for (m = 0; m < n; m++) {
+        if (!regexec(&entry->rex, objs[m]->name, 1, &match, 0)
+          && (match.rm_so == 0) && (match.rm_eo == strlen(objs[m]->name)))
+            add_query_entry_obj(entry, objs[m]);
+    }
+    sort_query_entry_objs(entry);
+    entry->generation = conf->consoles.generation;
+    return;
+}
+
+
+void log_query_cache_stats(server_conf_t *conf)
+{
+/*  Logs the hit and miss counts of the console query cache.
+ */
+    query_cache_t *qc = &conf->queryCache;
+    unsigned long numHits;
+    unsigned long numMisses;
+    int numEntries;
+
+    x_pthread_mutex_lock(&qc->lock);
+    numHits = qc->numHits;
+    numMisses = qc->numMisses;
+    numEntries = qc->numEntries;
+    x_pthread_mutex_unlock(&qc->lock);
+
+    log_msg(LOG_INFO,
+        "Console query cache has %d entr%s: %lu hit%s, %lu miss%s",
+        numEntries, (numEntries == 1 ? "y" : "ies"),
+        numHits, (numHits == 1 ? "" : "s"),
+        numMisses, (numMisses == 1 ? "" : "es"));
+    return;
+}
+
+
+void destroy_query_cache(server_conf_t *conf)
+{
+/*  Destroys the entries of the console query cache.
+ */
+    query_cache_t *qc = &conf->queryCache;
+    query_entry_t *entry;
+
+    while ((entry = qc->head)) {
+        qc->head = entry->next;
+        destroy_query_entry(entry);
+    }
+    qc->tail = NULL;
+    qc->numEntries = 0;
+    x_pthread_mutex_destroy(&qc->lock);
+    return;
+}
+
+
+static query_entry_t * find_query_entry(
+    query_cache_t *qc, const char *key, int isRegex)
+{
+/*  Finds the cache entry for the request patterns (key) of the given type,
+ *    moving it to the head of the LRU list.
+ *  An entry is kept across changes to the set of consoles, since a
+ *    compiled regex remains valid; but its objs must be resolved again once
+ *    its generation no longer matches that of the console index.
+ *  The cache lock must be held when calling this routine.
+ *  Returns the entry, or NULL if the patterns are not cached.
+ */
+    query_entry_t *entry;
+
+    for (entry = qc->head; entry; entry = entry->next) {
+        if ((entry->isRegex == !!isRegex) && !strcmp(entry->key, key))
+            break;
+    }
+    if (!entry || (entry == qc->head))
+        return(entry);
+
+    /*  Unlink the entry and reinsert it at the head.
      */
-    memset(&rex, 0, sizeof(rex));
+    entry->prev->next = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        qc->tail = entry->prev;
+    entry->prev = NULL;
+    entry->next = qc->head;
+    qc->head->prev = entry;
+    qc->head = entry;
+    return(entry);
+}
 
-    /*  Compile regex for searching server's console objs.
+
+static query_entry_t * create_query_entry(
+    query_cache_t *qc, const char *key, int isRegex)
+{
+/*  Creates an unresolved cache entry for the request patterns (key) at the
+ *    head of the LRU list, evicting the least recently used entry if the
+ *    cache is full.  A regex entry's regex must be set by the caller.
+ *  The cache lock must be held when calling this routine.
+ *  Returns the new entry.
+ */
+    query_entry_t *entry;
+
+    if (qc->numEntries >= QUERY_CACHE_SIZE) {
+        entry = qc->tail;
+        qc->tail = entry->prev;
+        qc->tail->next = NULL;
+        destroy_query_entry(entry);
+        qc->numEntries--;
+    }
+    if (!(entry = malloc(sizeof(query_entry_t))))
+        out_of_memory();
+    memset(entry, 0, sizeof(*entry));
+    entry->key = create_string(key);
+    entry->isRegex = !!isRegex;
+    /*
+     *  The index generation starts at 0 and is bumped before any query can
+     *    be made, so a new entry will be resolved upon its first use.
      */
-    rc = regcomp(&rex, buf, REG_EXTENDED | REG_ICASE);
-    if (rc != 0) {
-        if (regerror(rc, &rex, buf, sizeof(buf)) > sizeof(buf))
-            log_msg(LOG_WARNING, "Got regerror() buffer overrun");
-        regfree(&rex);
-        send_rsp(req, CONMAN_ERR_BAD_REGEX, buf);
-        return(-1);
+    entry->generation = 0;
+    entry->prev = NULL;
+    entry->next = qc->head;
+    if (qc->head)
+        qc->head->prev = entry;
+    else
+        qc->tail = entry;
+    qc->head = entry;
+    qc->numEntries++;
+    return(entry);
+}
+
+
+static void destroy_query_entry(query_entry_t *entry)
+{
+/*  Destroys the cache (entry).
+ */
+    if (entry->isRegex)
+        regfree(&entry->rex);
+    if (entry->objs)
+        free(entry->objs);
+    destroy_string(entry->key);
+    free(entry);
+    return;
+}
+
+
+static void add_query_entry_obj(query_entry_t *entry, obj_t *obj)
+{
+/*  Adds the console (obj) to the cache (entry)'s resolved objs.
+ *  The objs array grows in powers of two, so its allocated size is derived
+ *    from the number of objs it holds.
+ */
+    int n = entry->numObjs;
+
+    if ((n == 0) || ((n >= 64) && !(n & (n - 1)))) {
+        entry->objs = realloc(entry->objs, MAX(n * 2, 64) * sizeof(obj_t *));
+        if (!entry->objs)
+            out_of_memory();
     }
+    entry->objs[entry->numObjs++] = obj;
+    return;
+}
 
-    /*  Search objs for console names matching console patterns in the request.
-     */
-    i = list_iterator_create(conf->objs);
-    while ((obj = list_next(i))) {
-        if (!is_console_obj(obj))
-            continue;
-        if (!regexec(&rex, obj->name, 1, &match, 0)
-          && (match.rm_so == 0) && (match.rm_eo == strlen(obj->name)))
-            list_append(matches, obj);
+
+static void sort_query_entry_objs(query_entry_t *entry)
+{
+/*  Sorts the cache (entry)'s resolved objs (cf, compare_objs), removing
+ *    duplicates arising from overlapping patterns.  Since console names are
+ *    unique, duplicates are adjacent once sorted.  The sorted order also
+ *    allows the list_sort() in query_consoles() to complete in linear time.
+ */
+    int n, m;
+
+    if (entry->numObjs < 2)
+        return;
+    qsort(entry->objs, entry->numObjs, sizeof(obj_t *),
+        (int (*)(const void *, const void *)) compare_obj_ptrs);
+    for (n = 1, m = 1; n < entry->numObjs; n++) {
+        if (entry->objs[n] != entry->objs[m - 1])
+            entry->objs[m++] = entry->objs[n];
     }
-    list_iterator_destroy(i);
-    regfree(&rex);
-    return(0);
+    entry->numObjs = m;
+    return;
+}
+
+
+static int compare_obj_ptrs(obj_t **obj1_p, obj_t **obj2_p)
+{
+/*  Used by qsort() to order an array of objs by name (cf, compare_objs).
+ */
+    return(compare_objs(*obj1_p, *obj2_p));
 }
 
 
@@ -561,6 +1098,12 @@ static int validate_req(req_t *req)
 /*  Validates the given request.
  *  Returns 0 if the request is valid, or -1 on error.
  */
+    if (req->enableSeq
+      && (!req->enableMux || (req->command != CONMAN_CMD_MONITOR))) {
+        send_rsp(req, CONMAN_ERR_BAD_REQUEST,
+            "Sequenced output requires a multiplexed monitor session");
+        return(-1);
+    }
     if (list_is_empty(req->consoles)) {
         send_rsp(req, CONMAN_ERR_NO_CONSOLES, "Found no matching consoles");
         return(-1);
@@ -578,13 +1121,15 @@ static int check_too_many_consoles(req_t *req)
 {
 /*  Checks to see if the request matches too many consoles
  *    for the given command.
- *  A MONITOR command can only affect a single console, as can a
- *    CONNECT command unless the broadcast option is enabled.
+ *  A MONITOR or LOG command can only affect a single console, as can a
+ *    CONNECT command unless the broadcast option is enabled.  But a
+ *    multiplexed session can MONITOR or CONNECT to any number of consoles.
  *  Returns 0 if the request is valid, or -1 on error.
  */
     ListIterator i;
     obj_t *obj;
     char buf[MAX_SOCK_LINE];
+    rsp_buf_t rb;
 
     assert(!list_is_empty(req->consoles));
 
@@ -594,24 +1139,21 @@ static int check_too_many_consoles(req_t *req)
         return(0);
     if ((req->command == CONMAN_CMD_CONNECT) && (req->enableBroadcast))
         return(0);
+    if ((req->enableMux) && (req->command != CONMAN_CMD_LOG))
+        return(0);
 
     snprintf(buf, sizeof(buf), "Found %d matching consoles",
         list_count(req->consoles));
     send_rsp(req, CONMAN_ERR_TOO_MANY_CONSOLES, buf);
 
-    /*  FIXME? Replace with single write_n()?
-     */
+    init_rsp_buf(&rb, req);
     i = list_iterator_create(req->consoles);
-    while ((obj = list_next(i))) {
-        strlcpy(buf, obj->name, sizeof(buf));
-        strlcat(buf, "\n", sizeof(buf));
-        if (write_n(req->sd, buf, strlen(buf)) < 0) {
-            log_msg(LOG_NOTICE, "Unable to write to <%s:%d>: %s",
-                req->fqdn, req->port, strerror(errno));
-            break;
-        }
+    while ((obj = list_next(i)) && !rb.gotError) {
+        append_rsp_buf(&rb, obj->name, strlen(obj->name));
+        append_rsp_buf(&rb, "\n", 1);
     }
     list_iterator_destroy(i);
+    (void) finish_rsp_buf(&rb);
     return(-1);
 }
 
@@ -631,11 +1173,13 @@ static int check_busy_consoles(req_t *req)
     time_t t;
     char *delta;
     char buf[MAX_LINE];
+    rsp_buf_t rb;
 
     assert(!list_is_empty(req->consoles));
 
     if ((req->command == CONMAN_CMD_QUERY)
-      || (req->command == CONMAN_CMD_MONITOR))
+      || (req->command == CONMAN_CMD_MONITOR)
+      || (req->command == CONMAN_CMD_LOG))
         return(0);
     if (req->enableForce || req->enableJoin)
         return(0);
@@ -666,7 +1210,8 @@ static int check_busy_consoles(req_t *req)
     /*  Note: the "busy" list contains object references,
      *    so they DO NOT get destroyed here when removed from the list.
      */
-    while ((console = list_pop(busy))) {
+    init_rsp_buf(&rb, req);
+    while ((console = list_pop(busy)) && !rb.gotError) {
 
         i = list_iterator_create(console->writers);
         while ((writer = list_next(i))) {
@@ -689,14 +1234,11 @@ static int check_busy_consoles(req_t *req)
             buf[sizeof(buf) - 1] = '\0';
             if (delta)
                 free(delta);
-            if (write_n(req->sd, buf, strlen(buf)) < 0) {
-                log_msg(LOG_NOTICE, "Unable to write to <%s:%d>: %s",
-                    req->fqdn, req->port, strerror(errno));
-                break;
-            }
+            append_rsp_buf(&rb, buf, strlen(buf));
         }
         list_iterator_destroy(i);
     }
+    (void) finish_rsp_buf(&rb);
     list_destroy(busy);
     return(-1);
 }
@@ -709,74 +1251,188 @@ static int send_rsp(req_t *req, int errnum, char *errmsg)
  *    errnum = CONMAN_ERR_NONE and an "OK" response is sent.
  *  Otherwise, (errnum) identifies the err_type enumeration (in common.h)
  *    and (errmsg) is a string describing the error in more detail.
+ *  An "OK" response listing more consoles than fit within a single line
+ *    is split across multiple "OK" lines, each but the last ending with
+ *    a "MORE" token, if the client has indicated it supports this;
+ *    these lines are written via a response buffer in large batches.
  *  Returns 0 if the response is sent OK, or -1 on error.
  */
-    char buf[MAX_SOCK_LINE] = "";       /* init buf for appending with NUL */
-    char tmp[MAX_LINE];                 /* tmp buffer for lex-encoding strs */
+    char buf[MAX_SOCK_LINE];            /* current line of response          */
+    char tmp[MAX_LINE];                 /* tmp buffer for lex-encoding strs  */
+    int len;                            /* num bytes in current line         */
+    int moreLen;                        /* num bytes to terminate with MORE  */
     int n;
     ListIterator i;
     obj_t *console;
+    rsp_buf_t rb;
 
     assert(req->sd >= 0);
     assert(errnum >= 0);
 
-    if (errnum == CONMAN_ERR_NONE) {
+    if (errnum != CONMAN_ERR_NONE) {
+        strlcpy(tmp, (errmsg ? errmsg : "unspecified error"), sizeof(tmp));
+        n = snprintf(buf, sizeof(buf), "%s %s=%d %s='%s'\n",
+            proto_strs[LEX_UNTOK(CONMAN_TOK_ERROR)],
+            proto_strs[LEX_UNTOK(CONMAN_TOK_CODE)], errnum,
+            proto_strs[LEX_UNTOK(CONMAN_TOK_MESSAGE)], lex_encode(tmp));
+        log_msg(LOG_NOTICE, "Client <%s@%s:%d> request failed: %s",
+            req->user, req->fqdn, req->port, errmsg);
+        if ((n < 0) || (n >= sizeof(buf))) {
+            log_msg(LOG_WARNING,
+                "Client <%s@%s:%d> request terminated by buffer overrun",
+                req->user, req->fqdn, req->port);
+            return(-1);
+        }
+        if (write_n(req->sd, buf, n) < 0) {
+            log_msg(LOG_NOTICE, "Unable to write to <%s:%d>: %s",
+                req->fqdn, req->port, strerror(errno));
+            return(-1);
+        }
+        DPRINTF((5, "Sent response: %s", buf));
+        return(0);
+    }
 
-        n = append_format_string(buf, sizeof(buf), "%s",
-            proto_strs[LEX_UNTOK(CONMAN_TOK_OK)]);
+    init_rsp_buf(&rb, req);
+    moreLen = strlen(proto_strs[LEX_UNTOK(CONMAN_TOK_MORE)]) + 2;
 
-        /*  If consoles have been defined by this point, the "response"
-         *    is to the request as opposed to the greeting.
-         *  Yeah, it's a bit of a kludge.
-         */
-        if (list_count(req->consoles) > 0) {
+    len = snprintf(buf, sizeof(buf), "%s",
+        proto_strs[LEX_UNTOK(CONMAN_TOK_OK)]);
 
-            if (req->enableReset) {
-                n = append_format_string(buf, sizeof(buf), " %s=%s",
-                    proto_strs[LEX_UNTOK(CONMAN_TOK_OPTION)],
-                    proto_strs[LEX_UNTOK(CONMAN_TOK_RESET)]);
+    /*  If consoles have been defined by this point, the "response"
+     *    is to the request as opposed to the greeting.
+     *  Yeah, it's a bit of a kludge.
+     */
+    if ((list_count(req->consoles) == 0) && req->enableMux) {
+        len += snprintf(buf + len, sizeof(buf) - len, " %s=%s",
+            proto_strs[LEX_UNTOK(CONMAN_TOK_OPTION)],
+            proto_strs[LEX_UNTOK(CONMAN_TOK_MUX)]);
+    }
+    if (list_count(req->consoles) > 0) {
+
+        if (req->enableReset) {
+            len += snprintf(buf + len, sizeof(buf) - len, " %s=%s",
+                proto_strs[LEX_UNTOK(CONMAN_TOK_OPTION)],
+                proto_strs[LEX_UNTOK(CONMAN_TOK_RESET)]);
+        }
+        if (req->enableSeq) {
+            len += snprintf(buf + len, sizeof(buf) - len, " %s=%s",
+                proto_strs[LEX_UNTOK(CONMAN_TOK_OPTION)],
+                proto_strs[LEX_UNTOK(CONMAN_TOK_SEQ)]);
+        }
+        i = list_iterator_create(req->consoles);
+        while ((console = list_next(i)) && !rb.gotError) {
+            strlcpy(tmp, console->name, sizeof(tmp));
+            n = snprintf(buf + len, sizeof(buf) - len, " %s='%s'",
+                proto_strs[LEX_UNTOK(CONMAN_TOK_CONSOLE)], lex_encode(tmp));
+            /*
+             *  Leave room to terminate the line with either a newline,
+             *    or with the MORE token and a newline.
+             */
+            if ((n >= 0) && (len + n + moreLen < sizeof(buf))) {
+                len += n;
+                continue;
             }
-            i = list_iterator_create(req->consoles);
-            while ((console = list_next(i))) {
-                n = strlcpy(tmp, console->name, sizeof(tmp));
-                n = append_format_string(buf, sizeof(buf), " %s='%s'",
-                    proto_strs[LEX_UNTOK(CONMAN_TOK_CONSOLE)],
-                    lex_encode(tmp));
+            if (!req->enableMore) {
+                list_iterator_destroy(i);
+                (void) finish_rsp_buf(&rb);
+                log_msg(LOG_WARNING,
+                    "Client <%s@%s:%d> request terminated by buffer overrun",
+                    req->user, req->fqdn, req->port);
+                return(-1);
             }
-            list_iterator_destroy(i);
+            len += snprintf(buf + len, sizeof(buf) - len, " %s\n",
+                proto_strs[LEX_UNTOK(CONMAN_TOK_MORE)]);
+            append_rsp_buf(&rb, buf, len);
+
+            len = snprintf(buf, sizeof(buf), "%s",
+                proto_strs[LEX_UNTOK(CONMAN_TOK_OK)]);
+            len += snprintf(buf + len, sizeof(buf) - len, " %s='%s'",
+                proto_strs[LEX_UNTOK(CONMAN_TOK_CONSOLE)], tmp);
         }
+        list_iterator_destroy(i);
+    }
+    buf[len++] = '\n';
+    append_rsp_buf(&rb, buf, len);
+
+    DPRINTF((5, "Sent response: %.*s", len, buf));
+    return(finish_rsp_buf(&rb));
+}
+
+
+static void init_rsp_buf(rsp_buf_t *rb, req_t *req)
+{
+/*  Initializes the response buffer (rb) for writing to the client of the
+ *    request (req).  Its memory is not allocated until data is appended.
+ */
+    rb->req = req;
+    rb->buf = NULL;
+    rb->len = 0;
+    rb->size = 0;
+    rb->gotError = 0;
+    return;
+}
+
 
-        n = append_format_string(buf, sizeof(buf), "\n");
+static void append_rsp_buf(rsp_buf_t *rb, const char *src, int len)
+{
+/*  Appends (len) bytes of (src) to the response buffer (rb), growing it as
+ *    needed.  The buffer is written to the client once it holds at least
+ *    RSP_FLUSH_SIZE bytes.  Once a write has failed, data is discarded.
+ */
+    if (rb->gotError) {
+        return;
     }
-    else {
-        n = strlcpy(tmp, (errmsg ? errmsg : "unspecified error"), sizeof(tmp));
-        n = snprintf(buf, sizeof(buf), "%s %s=%d %s='%s'\n",
-            proto_strs[LEX_UNTOK(CONMAN_TOK_ERROR)],
-            proto_strs[LEX_UNTOK(CONMAN_TOK_CODE)], errnum,
-            proto_strs[LEX_UNTOK(CONMAN_TOK_MESSAGE)], lex_encode(tmp));
-        log_msg(LOG_NOTICE, "Client <%s@%s:%d> request failed: %s",
-            req->user, req->fqdn, req->port, errmsg);
+    if (rb->len + len > rb->size) {
+        rb->size = MAX(rb->size * 2, MAX(rb->len + len, RSP_FLUSH_SIZE));
+        if (!(rb->buf = realloc(rb->buf, rb->size))) {
+            out_of_memory();
+        }
     }
+    memcpy(rb->buf + rb->len, src, len);
+    rb->len += len;
 
-    /*  FIXME: Gracefully handle buffer overruns.
-     */
-    if ((n < 0) || (n >= sizeof(buf))) {
-        log_msg(LOG_WARNING,
-            "Client <%s@%s:%d> request terminated by buffer overrun",
-            req->user, req->fqdn, req->port);
-        return(-1);
+    if (rb->len >= RSP_FLUSH_SIZE) {
+        (void) flush_rsp_buf(rb);
     }
+    return;
+}
 
-    /*  Write response to client.
-     */
-    if (write_n(req->sd, buf, strlen(buf)) < 0) {
-        log_msg(LOG_NOTICE, "Unable to write to <%s:%d>: %s",
-            req->fqdn, req->port, strerror(errno));
+
+static int flush_rsp_buf(rsp_buf_t *rb)
+{
+/*  Writes the data in the response buffer (rb) to the client.
+ *  Returns 0 on success, or -1 on error.
+ */
+    if (rb->gotError) {
         return(-1);
     }
+    if (rb->len > 0) {
+        if (write_n(rb->req->sd, rb->buf, rb->len) < 0) {
+            log_msg(LOG_NOTICE, "Unable to write to <%s:%d>: %s",
+                rb->req->fqdn, rb->req->port, strerror(errno));
+            rb->gotError = 1;
+        }
+        rb->len = 0;
+    }
+    return(rb->gotError ? -1 : 0);
+}
 
-    DPRINTF((5, "Sent response: %s", buf));
-    return(0);
+
+static int finish_rsp_buf(rsp_buf_t *rb)
+{
+/*  Writes any data remaining in the response buffer (rb) to the client,
+ *    and releases the buffer.
+ *  Returns 0 if all data was written, or -1 on error.
+ */
+    int rc;
+
+    rc = flush_rsp_buf(rb);
+    if (rb->buf) {
+        free(rb->buf);
+        rb->buf = NULL;
+    }
+    rb->size = 0;
+    return(rc);
 }
 
 
@@ -805,26 +1461,36 @@ static int perform_query_cmd(req_t *req)
 static int perform_monitor_cmd(req_t *req, server_conf_t *conf)
 {
 /*  Performs the MONITOR command, placing the client in a
- *    "read-only" session with a single console.
+ *    "read-only" session with a single console (or with each of its
+ *    consoles if the session is multiplexed).
+ *  A sequenced session is only sent the consoles' output, so the state of
+ *    each console is not reported.
  *  Returns 0 if the command succeeds, or -1 on error.
  */
     obj_t *client;
     obj_t *console;
+    ListIterator i;
 
     assert(req->sd >= 0);
     assert(req->command == CONMAN_CMD_MONITOR);
-    assert(list_count(req->consoles) == 1);
+    assert((list_count(req->consoles) == 1) || req->enableMux);
 
     log_msg(LOG_INFO, "Client <%s@%s:%d> issued monitor command",
         req->user, req->fqdn, req->port);
 
     if (send_rsp(req, CONMAN_ERR_NONE, NULL) < 0)
         return(-1);
+    x_pthread_rwlock_rdlock(&conf->objsLock);
     client = create_client_obj(conf, req);
-    console = list_peek(req->consoles);
-    assert(is_console_obj(console));
-    link_objs(console, client);
-    check_console_state(console, client);
+    i = list_iterator_create(req->consoles);
+    while ((console = list_next(i))) {
+        assert(is_console_obj(console));
+        link_objs(console, client);
+        if (!req->enableSeq)
+            check_console_state(console, client);
+    }
+    list_iterator_destroy(i);
+    x_pthread_rwlock_unlock(&conf->objsLock);
     return(0);
 }
 
@@ -834,7 +1500,8 @@ static int perform_connect_cmd(req_t *req, server_conf_t *conf)
 /*  Performs the CONNECT command.  If a single console is specified,
  *    the client is placed in a "read-write" session with that console.
  *    Otherwise, the client is placed in a "write-only" broadcast session
- *    affecting multiple consoles.
+ *    affecting multiple consoles (or in a "read-write" session with each
+ *    of them if the session is multiplexed).
  *  Returns 0 if the command succeeds, or -1 on error.
  */
     obj_t *client;
@@ -849,6 +1516,10 @@ static int perform_connect_cmd(req_t *req, server_conf_t *conf)
 
     if (send_rsp(req, CONMAN_ERR_NONE, NULL) < 0)
         return(-1);
+    /*  The objsLock is held for reading while linking the new client since
+     *    the objs it references may be muxed by other I/O shards.
+     */
+    x_pthread_rwlock_rdlock(&conf->objsLock);
     client = create_client_obj(conf, req);
 
     if (list_count(req->consoles) == 1) {
@@ -861,6 +1532,19 @@ static int perform_connect_cmd(req_t *req, server_conf_t *conf)
         link_objs(console, client);
         check_console_state(console, client);
     }
+    else if (req->enableMux) {
+        /*
+         *  Multiplexed connection (R/W on each stream).
+         */
+        i = list_iterator_create(req->consoles);
+        while ((console = list_next(i))) {
+            assert(is_console_obj(console));
+            link_objs(client, console);
+            link_objs(console, client);
+            check_console_state(console, client);
+        }
+        list_iterator_destroy(i);
+    }
     else {
         /*
          *  Broadcast connection (W/O).
@@ -873,6 +1557,88 @@ static int perform_connect_cmd(req_t *req, server_conf_t *conf)
         }
         list_iterator_destroy(i);
     }
+    x_pthread_rwlock_unlock(&conf->objsLock);
+    return(0);
+}
+
+
+static int perform_log_cmd(req_t *req, server_conf_t *conf)
+{
+/*  Performs the LOG command, sending the data written to a single console's
+ *    logfile between the request's START and STOP times.  The logfile's
+ *    index sidecar is searched for the range, which is then read straight
+ *    from disk; the data is sent at the granularity of the indexed frames.
+ *  Returns 0 if the command succeeds, or -1 on error.
+ *  Since this cmd is processed entirely by this thread,
+ *    the client socket connection is closed once it is finished.
+ */
+    obj_t *console;
+    obj_t *logfile;
+    char *name = NULL;
+    int isIndexed = 0;
+    int isCompressed = 0;
+    off_t offset;
+    off_t length;
+    char buf[MAX_LINE];
+
+    assert(req->sd >= 0);
+    assert(req->command == CONMAN_CMD_LOG);
+    assert(list_count(req->consoles) == 1);
+
+    log_msg(LOG_INFO, "Client <%s@%s:%d> issued log command",
+        req->user, req->fqdn, req->port);
+
+    /*  The logfile's name is copied while holding the logQueueLock since it
+     *    may be re-expanded by a logfile writer thread when (re)opened.
+     */
+    x_pthread_rwlock_rdlock(&conf->objsLock);
+    console = list_peek(req->consoles);
+    assert(is_console_obj(console));
+    if ((logfile = get_console_logfile_obj(console))) {
+        x_pthread_mutex_lock(&conf->logQueueLock);
+        name = create_string(logfile->name);
+        x_pthread_mutex_unlock(&conf->logQueueLock);
+        isIndexed = (logfile->aux.logfile.idx != NULL);
+        isCompressed = (logfile->aux.logfile.zip != NULL);
+    }
+    x_pthread_rwlock_unlock(&conf->objsLock);
+
+    if (!name) {
+        snprintf(buf, sizeof(buf), "Console [%s] is not being logged",
+            console->name);
+        send_rsp(req, CONMAN_ERR_NO_LOGFILE, buf);
+        return(-1);
+    }
+    if (!isIndexed) {
+        snprintf(buf, sizeof(buf), "Console [%s] log is not indexed",
+            console->name);
+        send_rsp(req, CONMAN_ERR_NO_LOGFILE, buf);
+        free(name);
+        return(-1);
+    }
+    if ((req->tStop > 0) && (req->tStop < req->tStart)) {
+        send_rsp(req, CONMAN_ERR_BAD_REQUEST, "Invalid log time range");
+        free(name);
+        return(-1);
+    }
+    if (find_logfile_range(name, req->tStart, req->tStop,
+            &offset, &length) < 0) {
+        snprintf(buf, sizeof(buf), "Unable to search console [%s] log: %s",
+            console->name, strerror(errno));
+        send_rsp(req, CONMAN_ERR_NO_LOGFILE, buf);
+        free(name);
+        return(-1);
+    }
+    if (send_rsp(req, CONMAN_ERR_NONE, NULL) < 0) {
+        free(name);
+        return(-1);
+    }
+    if (send_logfile_range(name, offset, length, isCompressed, req->sd) < 0) {
+        log_msg(LOG_NOTICE, "Unable to send log \"%s\" to <%s:%d>: %s",
+            name, req->fqdn, req->port, strerror(errno));
+    }
+    free(name);
+    destroy_req(req);
     return(0);
 }
 
@@ -894,7 +1660,7 @@ static void check_console_state(obj_t *console, obj_t *client)
             CONMAN_MSG_PREFIX, console->name, console->aux.process.prog,
             CONMAN_MSG_SUFFIX);
         strcpy(&buf[sizeof(buf) - 3], "\r\n");
-        write_obj_data(client, buf, strlen(buf), 1);
+        write_console_msg(client, console, buf, 1);
         open_process_obj(console);
     }
     else if (is_serial_obj(console) && (console->fd < 0)) {
@@ -903,7 +1669,7 @@ static void check_console_state(obj_t *console, obj_t *client)
             CONMAN_MSG_PREFIX, console->name, console->aux.serial.dev,
             CONMAN_MSG_SUFFIX);
         strcpy(&buf[sizeof(buf) - 3], "\r\n");
-        write_obj_data(client, buf, strlen(buf), 1);
+        write_console_msg(client, console, buf, 1);
         open_serial_obj(console);
     }
     else if (is_telnet_obj(console)
@@ -913,7 +1679,7 @@ static void check_console_state(obj_t *console, obj_t *client)
             CONMAN_MSG_PREFIX, console->name, console->aux.telnet.host,
             console->aux.telnet.port, CONMAN_MSG_SUFFIX);
         strcpy(&buf[sizeof(buf) - 3], "\r\n");
-        write_obj_data(client, buf, strlen(buf), 1);
+        write_console_msg(client, console, buf, 1);
         console->aux.telnet.delay = TELNET_MIN_TIMEOUT;
         /*
          *  Do not call connect_telnet_obj() while in the PENDING state since
@@ -931,7 +1697,7 @@ static void check_console_state(obj_t *console, obj_t *client)
             CONMAN_MSG_PREFIX, console->name, console->aux.unixsock.dev,
             CONMAN_MSG_SUFFIX);
         strcpy(&buf[sizeof(buf) - 3], "\r\n");
-        write_obj_data(client, buf, strlen(buf), 1);
+        write_console_msg(client, console, buf, 1);
         open_unixsock_obj(console);
     }
 #if WITH_FREEIPMI
@@ -942,7 +1708,7 @@ static void check_console_state(obj_t *console, obj_t *client)
             CONMAN_MSG_PREFIX, console->name, console->aux.ipmi.host,
             CONMAN_MSG_SUFFIX);
         strcpy(&buf[sizeof(buf) - 3], "\r\n");
-        write_obj_data(client, buf, strlen(buf), 1);
+        write_console_msg(client, console, buf, 1);
         if (console->aux.ipmi.state == CONMAN_IPMI_DOWN) {
             open_ipmi_obj(console);
         }
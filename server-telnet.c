@@ -47,18 +47,18 @@
 #include "util-net.h"
 #include "util-str.h"
 #include "util.h"
+#include "wrapper.h"
 
 #define OPTBUFLEN 8                     /* "OPT:nnn" + \0 */
 
 
 static int connect_telnet_obj(obj_t *telnet);
+static void retry_telnet_obj(obj_t *telnet);
 static void disconnect_telnet_obj(obj_t *telnet);
 static void reset_telnet_delay(obj_t *telnet);
 static int process_telnet_cmd(obj_t *telnet, int cmd, int opt);
 static char * opt2str(int opt, char *buf, int buflen);
 
-extern tpoll_t tp_global;               /* defined in server.c */
-
 
 int is_telnet_dev(const char *dev, char **host_ref, int *port_ref)
 {
@@ -99,7 +99,6 @@ obj_t * create_telnet_obj(server_conf_t *conf, char *name,
  *    by main:open_objs:reopen_obj:open_telnet_obj:connect_telnet_obj().
  *  Returns the new object, or NULL on error.
  */
-    ListIterator i;
     obj_t *telnet;
 
     assert(conf != NULL);
@@ -113,16 +112,9 @@ obj_t * create_telnet_obj(server_conf_t *conf, char *name,
     }
     /*  Check for duplicate console names.
      */
-    i = list_iterator_create(conf->objs);
-    while ((telnet = list_next(i))) {
-        if (is_console_obj(telnet) && !strcmp(telnet->name, name)) {
-            snprintf(errbuf, errlen,
-                "console [%s] specifies duplicate console name", name);
-            break;
-        }
-    }
-    list_iterator_destroy(i);
-    if (telnet != NULL) {
+    if (find_console_obj(conf, name)) {
+        snprintf(errbuf, errlen,
+            "console [%s] specifies duplicate console name", name);
         return(NULL);
     }
     telnet = create_obj(conf, name, -1, CONMAN_OBJ_TELNET);
@@ -181,7 +173,8 @@ static int connect_telnet_obj(obj_t *telnet)
     assert(telnet->aux.telnet.state != CONMAN_TELNET_UP);
 
     if (telnet->aux.telnet.timer >= 0) {
-        (void) tpoll_timeout_cancel(tp_global, telnet->aux.telnet.timer);
+        (void) tpoll_timeout_cancel(telnet->shard->tp,
+            telnet->aux.telnet.timer);
         telnet->aux.telnet.timer = -1;
     }
     if (telnet->aux.telnet.state == CONMAN_TELNET_DOWN) {
@@ -194,8 +187,8 @@ static int connect_telnet_obj(obj_t *telnet)
         if (host_name_to_addr4(telnet->aux.telnet.host, &saddr.sin_addr) < 0) {
             log_msg(LOG_WARNING, "Unable to resolve hostname \"%s\" for [%s]",
                 telnet->aux.telnet.host, telnet->name);
-            telnet->aux.telnet.timer = tpoll_timeout_relative(tp_global,
-                (callback_f) connect_telnet_obj, telnet,
+            telnet->aux.telnet.timer = tpoll_timeout_relative(
+                telnet->shard->tp, (callback_f) retry_telnet_obj, telnet,
                 RESOLVE_RETRY_TIMEOUT * 1000);
             return(-1);
         }
@@ -222,6 +215,7 @@ static int connect_telnet_obj(obj_t *telnet)
                 (struct sockaddr *) &saddr, sizeof(saddr)) < 0) {
             if (errno == EINPROGRESS) {
                 telnet->aux.telnet.state = CONMAN_TELNET_PENDING;
+                register_obj_fd(telnet);
             }
             else {
                 disconnect_telnet_obj(telnet);
@@ -253,6 +247,7 @@ static int connect_telnet_obj(obj_t *telnet)
              *    that failed to connect() will return with an error of
              *    "invalid argument".  So close & ignore the return code here.
              */
+            unregister_obj_fd(telnet);
             (void) close(telnet->fd);
             telnet->fd = -1;
             disconnect_telnet_obj(telnet);
@@ -265,6 +260,7 @@ static int connect_telnet_obj(obj_t *telnet)
     }
     telnet->gotEOF = 0;
     telnet->aux.telnet.state = CONMAN_TELNET_UP;
+    register_obj_fd(telnet);
 
     /*  Notify linked objs when transitioning into an UP state.
      */
@@ -279,7 +275,7 @@ static int connect_telnet_obj(obj_t *telnet)
      *    disconnect_telnet_obj() will cancel the timer and the
      *    exponential backoff will continue.
      */
-    telnet->aux.telnet.timer = tpoll_timeout_relative(tp_global,
+    telnet->aux.telnet.timer = tpoll_timeout_relative(telnet->shard->tp,
         (callback_f) reset_telnet_delay, telnet, TELNET_MIN_TIMEOUT * 1000);
 
     send_telnet_cmd(telnet, DO, TELOPT_BINARY);
@@ -292,6 +288,21 @@ static int connect_telnet_obj(obj_t *telnet)
 }
 
 
+static void retry_telnet_obj(obj_t *telnet)
+{
+/*  Retries establishing a connection with the specified (telnet) obj.
+ *  This routine is only invoked by a timer outside of a mux_io() pass,
+ *    so it holds the objsLock for reading while notifying linked objs.
+ */
+    pthread_rwlock_t *lockp = &telnet->shard->conf->objsLock;
+
+    x_pthread_rwlock_rdlock(lockp);
+    (void) connect_telnet_obj(telnet);
+    x_pthread_rwlock_unlock(lockp);
+    return;
+}
+
+
 static void disconnect_telnet_obj(obj_t *telnet)
 {
 /*  Closes the existing connection with the specified (telnet) obj
@@ -301,10 +312,12 @@ static void disconnect_telnet_obj(obj_t *telnet)
         telnet->aux.telnet.host, telnet->aux.telnet.port, telnet->name));
 
     if (telnet->aux.telnet.timer >= 0) {
-        (void) tpoll_timeout_cancel(tp_global, telnet->aux.telnet.timer);
+        (void) tpoll_timeout_cancel(telnet->shard->tp,
+            telnet->aux.telnet.timer);
         telnet->aux.telnet.timer = -1;
     }
     if (telnet->fd >= 0) {
+        unregister_obj_fd(telnet);
         if (close(telnet->fd) < 0)
             log_msg(LOG_ERR,
                 "Unable to close connection to <%s:%d> for [%s]: %s",
@@ -323,8 +336,8 @@ static void disconnect_telnet_obj(obj_t *telnet)
     /*
      *  Set timer for establishing new connection using exponential backoff.
      */
-    telnet->aux.telnet.timer = tpoll_timeout_relative(tp_global,
-        (callback_f) connect_telnet_obj, telnet,
+    telnet->aux.telnet.timer = tpoll_timeout_relative(telnet->shard->tp,
+        (callback_f) retry_telnet_obj, telnet,
         telnet->aux.telnet.delay * 1000);
     if (telnet->aux.telnet.delay == 0) {
         telnet->aux.telnet.delay = TELNET_MIN_TIMEOUT;
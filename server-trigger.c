@@ -0,0 +1,816 @@
+/*****************************************************************************
+ *  Written by Chris Dunlap <cdunlap@llnl.gov>.
+ *  Copyright (C) 2007-2013 Lawrence Livermore National Security, LLC.
+ *  Copyright (C) 2001-2007 The Regents of the University of California.
+ *  UCRL-CODE-2002-009.
+ *
+ *  This file is part of ConMan: The Console Manager.
+ *  For details, see <http://conman.googlecode.com/>.
+ *
+ *  ConMan is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  ConMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with ConMan.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <regex.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "common.h"
+#include "list.h"
+#include "log.h"
+#include "server.h"
+#include "tpoll.h"
+#include "util-file.h"
+#include "util-str.h"
+#include "util.h"
+#include "wrapper.h"
+
+
+extern char **environ;
+
+static int get_regex_literal(const char *regex, char *buf, int buflen);
+
+static void add_pending_triggers(trigger_set_t *set, trigstate_t *ts, int s);
+
+static void fire_console_triggers(obj_t *console);
+
+static void mark_console_log(obj_t *console, trigger_t *trig);
+
+static void notify_trigger(obj_t *console, trigger_t *trig,
+    const char *line, time_t now);
+
+static void exec_trigger(obj_t *console, trigger_t *trig,
+    const char *line, time_t now);
+
+static int is_trigger_exec_allowed(trigger_set_t *set, time_t now);
+
+static void kill_trigger_exec(pid_t *arg);
+
+
+trigger_t * create_trigger(char *name, char *match, char *regex,
+    char *cmd, char *notify, int holdoff, int enableLog,
+    char *errbuf, int errlen)
+{
+/*  Creates a trigger fired by console output containing the literal string
+ *    (match).  If (regex) is also specified, the line containing (match)
+ *    must also match this extended regular expression.  If (match) is not
+ *    specified, the longest literal required by (regex) is used instead.
+ *  When fired, the trigger is reported by (name) (or by its pattern if NULL),
+ *    the console log is marked if (enableLog) is true, a datagram is sent
+ *    to the unix domain socket (notify), and (cmd) is invoked in a subshell.
+ *    It will not fire again for the same console within (holdoff) seconds.
+ *  Returns the new trigger, or NULL on error (writing a message to errbuf).
+ */
+    trigger_t *trig;
+    struct sockaddr_un saddr;
+    char buf[MAX_LINE];
+    int rc;
+
+    assert(match || regex);
+
+    if (match && is_empty_string(match)) {
+        snprintf(errbuf, errlen, "empty match string");
+        return(NULL);
+    }
+    if (notify && (strlen(notify) >= sizeof(saddr.sun_path))) {
+        snprintf(errbuf, errlen, "notify socket \"%s\" exceeds max length",
+            notify);
+        return(NULL);
+    }
+    if (!(trig = malloc(sizeof(trigger_t)))) {
+        out_of_memory();
+    }
+    if (regex) {
+        rc = regcomp(&trig->regex, regex, REG_EXTENDED | REG_NOSUB);
+        if (rc != 0) {
+            regerror(rc, &trig->regex, buf, sizeof(buf));
+            snprintf(errbuf, errlen, "invalid regex \"%s\": %s", regex, buf);
+            free(trig);
+            return(NULL);
+        }
+    }
+    if (!match) {
+        if (get_regex_literal(regex, buf, sizeof(buf)) <= 0) {
+            snprintf(errbuf, errlen,
+                "regex \"%s\" requires no literal string: specify MATCH",
+                regex);
+            regfree(&trig->regex);
+            free(trig);
+            return(NULL);
+        }
+        match = buf;
+    }
+    trig->match = create_string(match);
+    trig->name = create_string(name ? name : (regex ? regex : match));
+    trig->regexStr = regex ? create_string(regex) : NULL;
+    trig->execCmd = cmd ? create_string(cmd) : NULL;
+    trig->notifyPath = notify ? create_string(notify) : NULL;
+    trig->holdoff = holdoff;
+    trig->next = -1;
+    trig->enableLog = enableLog ? 1 : 0;
+
+    DPRINTF((10, "Created trigger [%s]: match=\"%s\".\n",
+        trig->name, trig->match));
+    return(trig);
+}
+
+
+void destroy_trigger(trigger_t *trig)
+{
+    if (!trig) {
+        return;
+    }
+    if (trig->regexStr) {
+        regfree(&trig->regex);
+    }
+    destroy_string(trig->name);
+    destroy_string(trig->match);
+    destroy_string(trig->regexStr);
+    destroy_string(trig->execCmd);
+    destroy_string(trig->notifyPath);
+    free(trig);
+    return;
+}
+
+
+trigger_set_t * create_trigger_set(List triggers)
+{
+/*  Compiles the list of (triggers) into an Aho-Corasick automaton that finds
+ *    the literals of all triggers in a single pass over the console output.
+ *  The goto and failure functions are folded into a complete transition
+ *    table (ie, a DFA) so each byte costs exactly one lookup regardless of
+ *    the number of triggers.  The table's alphabet is reduced to the classes
+ *    of bytes occurring in the literals (with class 0 for all other bytes)
+ *    to keep it compact.
+ *  Returns the new trigger set.
+ */
+    trigger_set_t *set;
+    ListIterator i;
+    trigger_t *trig;
+    const unsigned char *p;
+    int maxStates;
+    int *queue;
+    int head, tail;
+    int nc;
+    int s, t, f, c, k;
+
+    assert(triggers != NULL);
+    assert(!list_is_empty(triggers));
+
+    if (!(set = malloc(sizeof(trigger_set_t)))) {
+        out_of_memory();
+    }
+    set->numTriggers = list_count(triggers);
+    if (!(set->triggers = malloc(set->numTriggers * sizeof(trigger_t *)))) {
+        out_of_memory();
+    }
+    memset(set->classes, 0, sizeof(set->classes));
+    set->numClasses = 1;
+    set->sd = -1;
+    maxStates = 1;
+    k = 0;
+
+    i = list_iterator_create(triggers);
+    while ((trig = list_next(i))) {
+        for (p = (unsigned char *) trig->match; *p; p++) {
+            if (!set->classes[*p]) {
+                set->classes[*p] = set->numClasses++;
+            }
+        }
+        maxStates += strlen(trig->match);
+        if (trig->notifyPath && (set->sd < 0)) {
+            if ((set->sd = socket(PF_UNIX, SOCK_DGRAM, 0)) < 0) {
+                log_err(errno, "Unable to create trigger notify socket");
+            }
+            set_fd_nonblocking(set->sd);
+            set_fd_closed_on_exec(set->sd);
+        }
+        set->triggers[k++] = trig;
+    }
+    list_iterator_destroy(i);
+
+    nc = set->numClasses;
+    if (maxStates > INT_MAX / nc / (int) sizeof(int)) {
+        log_err(0, "Unable to compile %d triggers: too many states",
+            set->numTriggers);
+    }
+    if (!(set->delta = malloc(maxStates * nc * sizeof(int)))) {
+        out_of_memory();
+    }
+    memset(set->delta, -1, maxStates * nc * sizeof(int));
+    if (!(set->fail = malloc(maxStates * sizeof(int)))) {
+        out_of_memory();
+    }
+    if (!(set->match = malloc(maxStates * sizeof(int)))) {
+        out_of_memory();
+    }
+    if (!(set->out = malloc(maxStates * sizeof(int)))) {
+        out_of_memory();
+    }
+    /*  Build the trie of literals.  Triggers sharing a literal are chained
+     *    from the state at which it ends.
+     */
+    set->numStates = 1;
+    set->match[0] = -1;
+    for (k = 0; k < set->numTriggers; k++) {
+        trig = set->triggers[k];
+        s = 0;
+        for (p = (unsigned char *) trig->match; *p; p++) {
+            t = s * nc + set->classes[*p];
+            if (set->delta[t] < 0) {
+                set->match[set->numStates] = -1;
+                set->delta[t] = set->numStates++;
+            }
+            s = set->delta[t];
+        }
+        trig->next = set->match[s];
+        set->match[s] = k;
+    }
+    /*  Compute the failure states breadth-first, completing the transitions
+     *    of each state from those of its failure state (which is shallower
+     *    and thus already complete).
+     */
+    if (!(queue = malloc(set->numStates * sizeof(int)))) {
+        out_of_memory();
+    }
+    head = tail = 0;
+    set->fail[0] = 0;
+    set->out[0] = -1;
+    for (c = 0; c < nc; c++) {
+        if ((t = set->delta[c]) < 0) {
+            set->delta[c] = 0;
+        }
+        else {
+            set->fail[t] = 0;
+            queue[tail++] = t;
+        }
+    }
+    while (head < tail) {
+        s = queue[head++];
+        set->out[s] = (set->match[s] >= 0) ? s : set->out[set->fail[s]];
+        for (c = 0; c < nc; c++) {
+            t = set->delta[s * nc + c];
+            f = set->delta[set->fail[s] * nc + c];
+            if (t < 0) {
+                set->delta[s * nc + c] = f;
+            }
+            else {
+                set->fail[t] = f;
+                queue[tail++] = t;
+            }
+        }
+    }
+    free(queue);
+
+    if (set->numStates < maxStates) {
+        set->delta = realloc(set->delta, set->numStates * nc * sizeof(int));
+        if (!set->delta) {
+            out_of_memory();
+        }
+    }
+    set->execTokens = TRIGGER_EXEC_BURST;
+    set->execDropped = 0;
+    set->execTime = time(NULL);
+    x_pthread_mutex_init(&set->execLock, NULL);
+
+    DPRINTF((5, "Compiled %d triggers into %d states of %d byte classes.\n",
+        set->numTriggers, set->numStates, nc));
+    return(set);
+}
+
+
+void destroy_trigger_set(trigger_set_t *set)
+{
+/*  Destroys the trigger set (set).
+ *  The triggers themselves are owned by the server conf's list of triggers.
+ */
+    if (!set) {
+        return;
+    }
+    if ((set->sd >= 0) && (close(set->sd) < 0)) {
+        log_msg(LOG_ERR, "Unable to close trigger notify socket: %s",
+            strerror(errno));
+    }
+    x_pthread_mutex_destroy(&set->execLock);
+    free(set->triggers);
+    free(set->delta);
+    free(set->fail);
+    free(set->match);
+    free(set->out);
+    free(set);
+    return;
+}
+
+
+void scan_console_triggers(obj_t *console, const unsigned char *buf, int len)
+{
+/*  Scans (len) bytes of output read from (console) in (buf) for the literals
+ *    of the server's triggers.
+ *  The automaton state and the current line are retained across calls, so
+ *    literals spanning reads are found.  Triggers whose literals are found
+ *    within a line are fired once that line is complete, since any regex
+ *    must be matched against the entire line.  A line exceeding the line
+ *    buffer is treated as complete once the buffer is full.
+ */
+    trigger_set_t *set = console->shard->conf->trigSet;
+    trigstate_t *ts;
+    const unsigned char *p, *q;
+    int s;
+
+    assert(is_console_obj(console));
+
+    if (!set) {
+        return;
+    }
+    if (!(ts = console->trig)) {
+        if (!(ts = malloc(sizeof(trigstate_t)))) {
+            out_of_memory();
+        }
+        ts->state = 0;
+        ts->lineLen = 0;
+        ts->numPending = 0;
+        ts->timeFired = NULL;
+        console->trig = ts;
+    }
+    s = ts->state;
+
+    for (p = buf, q = buf + len; p < q; p++) {
+        s = set->delta[s * set->numClasses + set->classes[*p]];
+
+        if ((*p == '\n') || (*p == '\r')) {
+            if (ts->numPending > 0) {
+                fire_console_triggers(console);
+            }
+            ts->lineLen = 0;
+            continue;
+        }
+        if (ts->lineLen >= (int) sizeof(ts->line) - 1) {
+            if (ts->numPending > 0) {
+                fire_console_triggers(console);
+            }
+            ts->lineLen = 0;
+        }
+        ts->line[ts->lineLen++] = *p;
+
+        if (set->out[s] >= 0) {
+            add_pending_triggers(set, ts, s);
+        }
+    }
+    ts->state = s;
+    return;
+}
+
+
+void destroy_trigger_state(trigstate_t *ts)
+{
+    if (!ts) {
+        return;
+    }
+    if (ts->timeFired) {
+        free(ts->timeFired);
+    }
+    free(ts);
+    return;
+}
+
+
+static int get_regex_literal(const char *regex, char *buf, int buflen)
+{
+/*  Finds the longest run of literal characters that must appear in any
+ *    string matched by the extended regular expression (regex), copying
+ *    it into (buf) of length (buflen).
+ *  This is conservative: only runs outside parenthesized subexpressions
+ *    are considered, a character followed by an optional quantifier ends
+ *    the run before it, and nothing is found if (regex) contains an
+ *    alternation at its top level.
+ *  Returns the length of the literal, or 0 if none was found.
+ */
+    const char *p;
+    char run[MAX_LINE];
+    int runLen = 0;
+    int maxLen = 0;
+    int depth = 0;
+    int isLastLiteral = 0;
+    int c;
+
+    assert(regex != NULL);
+    assert(buf != NULL);
+    assert(buflen > 0);
+
+    buf[0] = '\0';
+    for (p = regex; ; p++) {
+        c = -1;
+        switch (*p) {
+        case '\0':
+            break;
+        case '\\':
+            if (ispunct((unsigned char) p[1]) && !strchr("<>`'", p[1])) {
+                c = *++p;
+            }
+            else if (p[1]) {
+                p++;                    /* eg, \w or \< */
+            }
+            break;
+        case '[':
+            if (*++p == '^') {
+                p++;
+            }
+            if (*p == ']') {            /* a leading ']' is in the list */
+                p++;
+            }
+            while (*p != ']') {
+                if ((*p == '[') && p[1] && strchr(":.=", p[1])) {
+                    p = strchr(p + 2, ']');     /* eg, [:alpha:] */
+                }
+                if (!p || !*p) {
+                    return(0);
+                }
+                p++;
+            }
+            break;
+        case '(':
+            depth++;
+            break;
+        case ')':
+            if (depth > 0) {
+                depth--;
+            }
+            break;
+        case '|':
+            if (depth == 0) {
+                buf[0] = '\0';
+                return(0);
+            }
+            break;
+        case '*':
+        case '?':
+        case '{':
+            if (isLastLiteral) {
+                runLen--;               /* preceding char is optional */
+            }
+            if ((*p == '{') && !(p = strchr(p, '}'))) {
+                return(0);
+            }
+            break;
+        case '.':
+        case '^':
+        case '$':
+        case '+':
+            break;
+        default:
+            c = *p;
+            break;
+        }
+        if ((c >= 0) && (depth == 0)) {
+            if (runLen < (int) sizeof(run)) {
+                run[runLen++] = c;
+            }
+            isLastLiteral = 1;
+            continue;
+        }
+        if (runLen > maxLen) {
+            maxLen = MIN(runLen, buflen - 1);
+            memcpy(buf, run, maxLen);
+            buf[maxLen] = '\0';
+        }
+        /*  A char repeated by '+' must appear at least once, so it also
+         *    begins the run following it.
+         */
+        if ((*p == '+') && isLastLiteral) {
+            run[0] = run[runLen - 1];
+            runLen = 1;
+        }
+        else {
+            runLen = 0;
+        }
+        isLastLiteral = 0;
+
+        if (*p == '\0') {
+            break;
+        }
+    }
+    return(maxLen);
+}
+
+
+static void add_pending_triggers(trigger_set_t *set, trigstate_t *ts, int s)
+{
+/*  Adds the triggers whose literals end at state (s) of the automaton
+ *    (including those of its failure states) to the triggers pending
+ *    within the current line of console trigger state (ts).
+ */
+    int t, k, j;
+
+    for (t = set->out[s]; t >= 0; t = set->out[set->fail[t]]) {
+        for (k = set->match[t]; k >= 0; k = set->triggers[k]->next) {
+            for (j = 0; j < ts->numPending; j++) {
+                if (ts->pending[j] == k) {
+                    break;
+                }
+            }
+            if (j < ts->numPending) {
+                continue;
+            }
+            if (ts->numPending >= TRIGGER_MAX_PENDING) {
+                DPRINTF((5, "Exceeded %d triggers pending within line.\n",
+                    TRIGGER_MAX_PENDING));
+                return;
+            }
+            ts->pending[ts->numPending++] = k;
+        }
+    }
+    return;
+}
+
+
+static void fire_console_triggers(obj_t *console)
+{
+/*  Fires the triggers pending within the line of output just completed
+ *    by (console), provided the line matches any regex and the trigger
+ *    has not already fired for this console within its holdoff period.
+ */
+    trigger_set_t *set = console->shard->conf->trigSet;
+    trigstate_t *ts = console->trig;
+    trigger_t *trig;
+    time_t now;
+    int j, k;
+
+    assert(set != NULL);
+    assert(ts != NULL);
+
+    ts->line[ts->lineLen] = '\0';
+    if (time(&now) == (time_t) -1) {
+        log_err(errno, "time() failed");
+    }
+    for (j = 0; j < ts->numPending; j++) {
+        k = ts->pending[j];
+        trig = set->triggers[k];
+
+        if (trig->regexStr
+                && (regexec(&trig->regex, ts->line, 0, NULL, 0) != 0)) {
+            continue;
+        }
+        if (!ts->timeFired) {
+            ts->timeFired = calloc(set->numTriggers, sizeof(time_t));
+            if (!ts->timeFired) {
+                out_of_memory();
+            }
+        }
+        if ((ts->timeFired[k] > 0)
+                && (now - ts->timeFired[k] < trig->holdoff)) {
+            continue;
+        }
+        ts->timeFired[k] = now;
+
+        log_msg(LOG_NOTICE, "Console [%s] fired trigger [%s]",
+            console->name, trig->name);
+        if (trig->enableLog) {
+            mark_console_log(console, trig);
+        }
+        if (trig->notifyPath) {
+            notify_trigger(console, trig, ts->line, now);
+        }
+        if (trig->execCmd) {
+            exec_trigger(console, trig, ts->line, now);
+        }
+    }
+    ts->numPending = 0;
+    return;
+}
+
+
+static void mark_console_log(obj_t *console, trigger_t *trig)
+{
+/*  Writes a marker for trigger (trig) into the logfile of (console).
+ */
+    obj_t *logfile;
+    char buf[MAX_LINE];
+    char *now;
+
+    if (!(logfile = get_console_logfile_obj(console))) {
+        return;
+    }
+    now = create_short_time_string(0);
+    snprintf(buf, sizeof(buf), "%sConsole [%s] fired trigger [%s] at %s%s",
+        CONMAN_MSG_PREFIX, console->name, trig->name, now, CONMAN_MSG_SUFFIX);
+    free(now);
+    strcpy(&buf[sizeof(buf) - 3], "\r\n");
+    write_obj_data(logfile, buf, strlen(buf), 1);
+    return;
+}
+
+
+static void notify_trigger(obj_t *console, trigger_t *trig,
+    const char *line, time_t now)
+{
+/*  Sends a datagram for trigger (trig) firing on (console) to the trigger's
+ *    unix domain socket.  It consists of a single newline-terminated line of
+ *    tab-separated fields: the time (in seconds since the Epoch), console
+ *    name, trigger name, and the line of console output.
+ *  The datagram is dropped if it cannot be sent without blocking.
+ */
+    struct sockaddr_un saddr;
+    char buf[MAX_LINE + TRIGGER_LINE_SIZE];
+    int n;
+
+    assert(trig->notifyPath != NULL);
+    assert(console->shard->conf->trigSet->sd >= 0);
+
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sun_family = AF_UNIX;
+    strlcpy(saddr.sun_path, trig->notifyPath, sizeof(saddr.sun_path));
+
+    n = snprintf(buf, sizeof(buf), "%ld\t%s\t%s\t%s\n",
+        (long) now, console->name, trig->name, line);
+    if ((n < 0) || (n >= (int) sizeof(buf))) {
+        n = sizeof(buf) - 1;
+        buf[n - 1] = '\n';
+    }
+    if (sendto(console->shard->conf->trigSet->sd, buf, n, 0,
+            (struct sockaddr *) &saddr, sizeof(saddr)) < 0) {
+        log_msg(LOG_NOTICE,
+            "Unable to notify \"%s\" of console [%s] trigger [%s]: %s",
+            trig->notifyPath, console->name, trig->name, strerror(errno));
+    }
+    return;
+}
+
+
+static void exec_trigger(obj_t *console, trigger_t *trig,
+    const char *line, time_t now)
+{
+/*  Invokes the command of trigger (trig) firing on (console) in a subshell,
+ *    subject to the rate limit on trigger commands.
+ *  The command undergoes conversion specifier expansion, and the console
+ *    name, trigger name, and line of console output are passed via the
+ *    CONMAN_CONSOLE, CONMAN_TRIGGER, and CONMAN_LINE environment variables
+ *    (ie, not via the command line, since console output is untrusted).
+ *  The command is killed if it exceeds TRIGGER_EXEC_TIMEOUT seconds.
+ */
+    char cmd[MAX_LINE];
+    char **env;
+    int n, i;
+    pid_t pid;
+    pid_t *arg;
+
+    assert(trig->execCmd != NULL);
+
+    if (!is_trigger_exec_allowed(console->shard->conf->trigSet, now)) {
+        return;
+    }
+    if (format_obj_string(cmd, sizeof(cmd), console, trig->execCmd) < 0) {
+        log_msg(LOG_NOTICE,
+            "Unable to exec console [%s] trigger [%s]: command too long",
+            console->name, trig->name);
+        return;
+    }
+    /*  The environment is created before forking since the child of
+     *    a multithreaded process must not allocate memory before exec().
+     */
+    for (n = 0; environ[n]; n++) {;}
+    if (!(env = malloc((n + 4) * sizeof(char *)))) {
+        out_of_memory();
+    }
+    memcpy(env, environ, n * sizeof(char *));
+    env[n] = create_format_string("CONMAN_CONSOLE=%s", console->name);
+    env[n + 1] = create_format_string("CONMAN_TRIGGER=%s", trig->name);
+    env[n + 2] = create_format_string("CONMAN_LINE=%s", line);
+    env[n + 3] = NULL;
+
+    if ((pid = fork()) < 0) {
+        log_msg(LOG_NOTICE, "Unable to exec console [%s] trigger [%s]: %s",
+            console->name, trig->name, strerror(errno));
+    }
+    else if (pid == 0) {
+        unblock_signals();
+        setpgid(pid, 0);
+        close(STDIN_FILENO);            /* ignore errors on close() */
+        close(STDOUT_FILENO);
+        close(STDERR_FILENO);
+        execle("/bin/sh", "sh", "-c", cmd, (char *) NULL, env);
+        _exit(127);                     /* execle() error */
+    }
+    for (i = n; i < n + 3; i++) {
+        destroy_string(env[i]);
+    }
+    free(env);
+
+    if (pid < 0) {
+        return;
+    }
+    /*  Both parent and child call setpgid() to make the child a process
+     *    group leader (cf, server-esc.c:reset_console()).
+     */
+    setpgid(pid, 0);
+
+    log_msg(LOG_INFO, "Exec'd console [%s] trigger [%s] (pid %d)",
+        console->name, trig->name, (int) pid);
+
+    if (!(arg = malloc(sizeof *arg))) {
+        out_of_memory();
+    }
+    *arg = pid;
+
+    if (tpoll_timeout_relative(console->shard->tp,
+            (callback_f) kill_trigger_exec, arg,
+            TRIGGER_EXEC_TIMEOUT * 1000) < 0) {
+        log_msg(LOG_ERR,
+            "Unable to create timer for console [%s] trigger [%s]",
+            console->name, trig->name);
+        free(arg);
+    }
+    return;
+}
+
+
+static int is_trigger_exec_allowed(trigger_set_t *set, time_t now)
+{
+/*  Applies a token-bucket rate limit to the commands exec'd by triggers
+ *    across all consoles: up to TRIGGER_EXEC_BURST commands at once,
+ *    with the bucket refilled at TRIGGER_EXEC_RATE commands per second.
+ *  Returns 1 if a command can be exec'd at time (now), or 0 if not.
+ */
+    int isAllowed;
+    int numDropped = 0;
+
+    x_pthread_mutex_lock(&set->execLock);
+
+    if (now > set->execTime) {
+        if (now - set->execTime >= TRIGGER_EXEC_BURST) {
+            set->execTokens = TRIGGER_EXEC_BURST;
+        }
+        else {
+            set->execTokens = MIN(TRIGGER_EXEC_BURST, set->execTokens
+                + (int) (now - set->execTime) * TRIGGER_EXEC_RATE);
+        }
+        set->execTime = now;
+    }
+    if (set->execTokens > 0) {
+        set->execTokens--;
+        numDropped = set->execDropped;
+        set->execDropped = 0;
+        isAllowed = 1;
+    }
+    else {
+        set->execDropped++;
+        isAllowed = 0;
+    }
+    x_pthread_mutex_unlock(&set->execLock);
+
+    if (numDropped > 0) {
+        log_msg(LOG_NOTICE,
+            "Dropped %d trigger command%s exceeding rate limit",
+            numDropped, (numDropped == 1) ? "" : "s");
+    }
+    return(isAllowed);
+}
+
+
+static void kill_trigger_exec(pid_t *arg)
+{
+/*  Terminates the trigger command process associated with 'arg' if it has
+ *    exceeded its time limit.
+ *  Memory allocated to 'arg' will be free()'d by this routine.
+ */
+    pid_t pid;
+
+    assert(arg != NULL);
+    pid = *arg;
+    assert(pid > 0);
+    free(arg);
+
+    if (kill(pid, 0) < 0) {             /* process is no longer running */
+        return;
+    }
+    if (kill(-pid, SIGKILL) == 0) {     /* kill entire process group */
+        log_msg(LOG_NOTICE, "Trigger process pid=%d exceeded %ds time limit",
+            (int) pid, TRIGGER_EXEC_TIMEOUT);
+    }
+    return;
+}
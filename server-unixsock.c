@@ -42,15 +42,15 @@
 #include "util.h"
 #include "util-file.h"
 #include "util-str.h"
+#include "wrapper.h"
 
 
 static int max_unixsock_dev_strlen(void);
 static int connect_unixsock_obj(obj_t *unixsock);
+static void retry_unixsock_obj(obj_t *unixsock);
 static int disconnect_unixsock_obj(obj_t *unixsock);
 static void reset_unixsock_delay(obj_t *unixsock);
 
-extern tpoll_t tp_global;               /* defined in server.c */
-
 
 int is_unixsock_dev(const char *dev, const char *cwd, char **path_ref)
 {
@@ -202,7 +202,7 @@ static int connect_unixsock_obj(obj_t *unixsock)
     auxp = &(unixsock->aux.unixsock);
 
     if (auxp->timer >= 0) {
-        (void) tpoll_timeout_cancel(tp_global, auxp->timer);
+        (void) tpoll_timeout_cancel(unixsock->shard->tp, auxp->timer);
         auxp->timer = -1;
     }
 
@@ -256,11 +256,12 @@ static int connect_unixsock_obj(obj_t *unixsock)
      */
     unixsock->gotEOF = 0;
     auxp->state = CONMAN_UNIXSOCK_UP;
+    register_obj_fd(unixsock);
 
     /*  Require the connection to be up for a minimum length of time before
      *    resetting the reconnect-delay back to the minimum.
      */
-    auxp->timer = tpoll_timeout_relative(tp_global,
+    auxp->timer = tpoll_timeout_relative(unixsock->shard->tp,
         (callback_f) reset_unixsock_delay, unixsock, MIN_CONNECT_SECS * 1000);
 
     /*  Notify linked objs when transitioning into an UP state.
@@ -274,6 +275,21 @@ static int connect_unixsock_obj(obj_t *unixsock)
 }
 
 
+static void retry_unixsock_obj(obj_t *unixsock)
+{
+/*  Retries opening a connection to the specified (unixsock) obj.
+ *  This routine is only invoked by a timer outside of a mux_io() pass,
+ *    so it holds the objsLock for reading while notifying linked objs.
+ */
+    pthread_rwlock_t *lockp = &unixsock->shard->conf->objsLock;
+
+    x_pthread_rwlock_rdlock(lockp);
+    (void) connect_unixsock_obj(unixsock);
+    x_pthread_rwlock_unlock(lockp);
+    return;
+}
+
+
 static int disconnect_unixsock_obj(obj_t *unixsock)
 {
 /*  Closes the existing connection with the specified (unixsock) obj
@@ -288,10 +304,11 @@ static int disconnect_unixsock_obj(obj_t *unixsock)
     auxp = &(unixsock->aux.unixsock);
 
     if (auxp->timer >= 0) {
-        (void) tpoll_timeout_cancel(tp_global, auxp->timer);
+        (void) tpoll_timeout_cancel(unixsock->shard->tp, auxp->timer);
         auxp->timer = -1;
     }
     if (unixsock->fd >= 0) {
+        unregister_obj_fd(unixsock);
         if (close(unixsock->fd) < 0) {
             log_msg(LOG_ERR,
                 "Unable to close console [%s] socket \"%s\": %s",
@@ -309,8 +326,8 @@ static int disconnect_unixsock_obj(obj_t *unixsock)
     }
     /*  Set timer for establishing new connection.
      */
-    auxp->timer = tpoll_timeout_relative(tp_global,
-        (callback_f) connect_unixsock_obj, unixsock,
+    auxp->timer = tpoll_timeout_relative(unixsock->shard->tp,
+        (callback_f) retry_unixsock_obj, unixsock,
         auxp->delay * 1000);
 
     if (auxp->delay < UNIXSOCK_MAX_TIMEOUT) {
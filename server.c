@@ -48,15 +48,22 @@
 #include "log.h"
 #include "server.h"
 #include "tpoll.h"
+#include "uring.h"
 #include "util-file.h"
 #include "util-str.h"
 #include "util.h"
+#include "wrapper.h"
+
+#if HAVE_SYS_SIGNALFD_H
+#  include <sys/signalfd.h>
+#endif /* HAVE_SYS_SIGNALFD_H */
 
 
 static void begin_daemonize(int *fd_ptr, pid_t *pgid_ptr);
 static void end_daemonize(int fd);
 static void setup_coredump(server_conf_t *conf);
 static void setup_signals(server_conf_t *conf);
+static void process_signals(void);
 static void sig_chld_handler(int signum);
 static void sig_hup_handler(int signum);
 static void exit_handler(int signum);
@@ -68,25 +75,27 @@ static void timestamp_logfiles(server_conf_t *conf);
 static void create_listen_socket(server_conf_t *conf);
 static void setup_nofile_limit(server_conf_t *conf);
 static void open_objs(server_conf_t *conf);
-static void mux_io(server_conf_t *conf);
+static void start_io_threads(server_conf_t *conf);
+static void stop_io_threads(server_conf_t *conf);
+static void * mux_io_thread(io_shard_t *shard);
+static void mux_io(server_conf_t *conf, io_shard_t *shard);
+static int prioritize_ready_fds(int *fds, obj_t **objs, int n);
+static void queue_obj_io(io_shard_t *shard, obj_t *obj, List dead);
+static void flush_obj_io(io_shard_t *shard, List dead);
+static void destroy_dead_objs(server_conf_t *conf, io_shard_t *shard,
+    List dead);
 static void open_daemon_logfile(server_conf_t *conf);
-static void reopen_logfiles(server_conf_t *conf);
+static void reopen_logfiles(io_shard_t *shard);
 static void accept_client(server_conf_t *conf);
-static void reset_console(obj_t *console, const char *cmd);
-static void kill_console_reset(pid_t *arg);
 
 /*  Signal handler flags and whatnot.
  */
 static volatile sig_atomic_t done = 0;
 static volatile sig_atomic_t reconfig = 0;
+static int signal_fd = -1;
 static int coredump = 0;
 static char coredumpdir[PATH_MAX];
 
-/*  The 'tp_global' var is to allow timers to be set or canceled
- *    without having to pass the conf's tp var through the call stack.
- */
-tpoll_t tp_global = NULL;
-
 extern char ** environ;
 
 
@@ -103,7 +112,6 @@ int main(int argc, char *argv[])
     log_set_file(stderr, log_priority, 0);
 
     conf = create_server_conf();
-    tp_global = conf->tp;
 
     process_cmdline(conf, argc, argv);
     if (!conf->enableForeground) {
@@ -150,7 +158,15 @@ int main(int argc, char *argv[])
 
     setup_nofile_limit(conf);
     open_objs(conf);
-    mux_io(conf);
+    start_io_threads(conf);
+    start_logfile_writers(conf);
+    start_resolver(conf);
+    start_client_workers(conf);
+    mux_io(conf, conf->shards[0]);
+    stop_client_workers(conf);
+    stop_resolver(conf);
+    stop_io_threads(conf);
+    stop_logfile_writers(conf);
 
 #if WITH_FREEIPMI
     ipmi_fini();
@@ -345,11 +361,49 @@ static void setup_coredump(server_conf_t *conf)
 
 static void setup_signals(server_conf_t *conf)
 {
-    posix_signal(SIGCHLD, sig_chld_handler);
-    posix_signal(SIGHUP, sig_hup_handler);
-    posix_signal(SIGINT, exit_handler);
+/*  Sets up the signal dispositions.
+ *
+ *  If supported, SIGCHLD, SIGHUP, SIGINT & SIGTERM are blocked and received
+ *    via a signalfd muxed by the main thread (cf, process_signals), thereby
+ *    allowing mux_io() to block indefinitely in tpoll().  This is done before
+ *    any threads are created so they all inherit the signal mask.  Child
+ *    processes must unblock these signals before calling exec().
+ *  O/w, these signals are caught by handlers, and the main thread's mux_io()
+ *    will periodically wake to check the flags set by them.
+ */
+#if HAVE_SYS_SIGNALFD_H
+    sigset_t sigset;
+    int rc;
+
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGCHLD);
+    sigaddset(&sigset, SIGHUP);
+    sigaddset(&sigset, SIGINT);
+    sigaddset(&sigset, SIGTERM);
+
+    if ((rc = pthread_sigmask(SIG_BLOCK, &sigset, NULL)) != 0) {
+        log_err(rc, "Unable to block signals");
+    }
+    if ((signal_fd = signalfd(-1, &sigset, 0)) < 0) {
+        log_msg(LOG_WARNING, "Unable to create signalfd: %s",
+            strerror(errno));
+        if ((rc = pthread_sigmask(SIG_UNBLOCK, &sigset, NULL)) != 0) {
+            log_err(rc, "Unable to unblock signals");
+        }
+    }
+    else {
+        set_fd_nonblocking(signal_fd);
+        set_fd_closed_on_exec(signal_fd);
+    }
+#endif /* HAVE_SYS_SIGNALFD_H */
+
+    if (signal_fd < 0) {
+        posix_signal(SIGCHLD, sig_chld_handler);
+        posix_signal(SIGHUP, sig_hup_handler);
+        posix_signal(SIGINT, exit_handler);
+        posix_signal(SIGTERM, exit_handler);
+    }
     posix_signal(SIGPIPE, SIG_IGN);
-    posix_signal(SIGTERM, exit_handler);
 
     /*  These signals have a default action of terminate+core according to SUS.
      */
@@ -363,6 +417,49 @@ static void setup_signals(server_conf_t *conf)
 }
 
 
+static void process_signals(void)
+{
+/*  Reads the signals pending on the signalfd, and performs the action
+ *    of the handler for each as if it had been caught.
+ */
+#if HAVE_SYS_SIGNALFD_H
+    struct signalfd_siginfo si;
+    int n;
+
+    assert(signal_fd >= 0);
+
+    for (;;) {
+        if ((n = read(signal_fd, &si, sizeof(si))) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                break;
+            }
+            log_err(errno, "Unable to read from signalfd");
+        }
+        if (n != sizeof(si)) {
+            log_err(0, "Read unexpected %d bytes from signalfd", n);
+        }
+        DPRINTF((5, "Received signal=%d.\n", (int) si.ssi_signo));
+
+        switch (si.ssi_signo) {
+        case SIGCHLD:
+            sig_chld_handler(si.ssi_signo);
+            break;
+        case SIGHUP:
+            sig_hup_handler(si.ssi_signo);
+            break;
+        default:
+            exit_handler(si.ssi_signo);
+            break;
+        }
+    }
+#endif /* HAVE_SYS_SIGNALFD_H */
+    return;
+}
+
+
 static void sig_chld_handler(int signum)
 {
     pid_t pid;
@@ -505,6 +602,14 @@ static void display_configuration(server_conf_t *conf)
         fprintf(stderr, " CoreDump");
         gotOptions++;
     }
+    if (conf->numClientThreads != DEFAULT_CLIENT_THREADS) {
+        fprintf(stderr, " ClientThreads=%d", conf->numClientThreads);
+        gotOptions++;
+    }
+    if (conf->numIoThreads > 1) {
+        fprintf(stderr, " IOThreads=%d", conf->numIoThreads);
+        gotOptions++;
+    }
     if (conf->enableKeepAlive) {
         fprintf(stderr, " KeepAlive");
         gotOptions++;
@@ -513,6 +618,10 @@ static void display_configuration(server_conf_t *conf)
         fprintf(stderr, " LogFile");
         gotOptions++;
     }
+    if (conf->numLogThreads != DEFAULT_LOG_THREADS) {
+        fprintf(stderr, " LogThreads=%d", conf->numLogThreads);
+        gotOptions++;
+    }
     if (conf->enableLoopBack) {
         fprintf(stderr, " LoopBack");
         gotOptions++;
@@ -533,6 +642,10 @@ static void display_configuration(server_conf_t *conf)
         fprintf(stderr, " TimeStamp=%dm", conf->tStampMinutes);
         gotOptions++;
     }
+    if (conf->trigSet) {
+        fprintf(stderr, " Triggers=%d", conf->trigSet->numTriggers);
+        gotOptions++;
+    }
     if (conf->enableZeroLogs) {
         fprintf(stderr, " ZeroLogs");
         gotOptions++;
@@ -585,7 +698,7 @@ static void schedule_timestamp(server_conf_t *conf)
 
     /*  The timer id is not saved because this timer will never be canceled.
      */
-    if (tpoll_timeout_absolute (tp_global,
+    if (tpoll_timeout_absolute (conf->tp,
             (callback_f) timestamp_logfiles, conf, &tv) < 0) {
         log_err(0, "Unable to create timer for timestamping logfiles");
     }
@@ -596,6 +709,8 @@ static void schedule_timestamp(server_conf_t *conf)
 static void timestamp_logfiles(server_conf_t *conf)
 {
 /*  Writes a timestamp message into all of the console logfiles.
+ *  The objsLock is held for reading since these logfiles may be muxed
+ *    by other I/O shards.
  */
     char *now;
     ListIterator i;
@@ -604,6 +719,7 @@ static void timestamp_logfiles(server_conf_t *conf)
     int gotLogs = 0;
 
     now = create_long_time_string(0);
+    x_pthread_rwlock_rdlock(&conf->objsLock);
     i = list_iterator_create(conf->objs);
     while ((logfile = list_next(i))) {
         if (!is_logfile_obj(logfile)) {
@@ -617,6 +733,7 @@ static void timestamp_logfiles(server_conf_t *conf)
         gotLogs = 1;
     }
     list_iterator_destroy(i);
+    x_pthread_rwlock_unlock(&conf->objsLock);
     free(now);
 
     /*  If any logfile objs exist, schedule a timer for the next timestamp.
@@ -704,112 +821,180 @@ static void setup_nofile_limit(server_conf_t *conf)
 static void open_objs(server_conf_t *conf)
 {
 /*  Initially opens everything in the 'objs' list.
+ *  Each console is first assigned to an I/O shard in a round-robin manner;
+ *    its logfile (if any) is assigned to the same shard.
+ *  The objsLock is held for reading while opening since consoles notify
+ *    their linked objs (cf, notify_console_objs).
  */
     ListIterator i;
     obj_t *obj;
+    int n = 0;
 
     i = list_iterator_create(conf->objs);
     while ((obj = list_next(i))) {
+        if (is_console_obj(obj)) {
+            obj->shard = conf->shards[n++ % conf->numIoThreads];
+        }
+    }
+    list_iterator_reset(i);
+    x_pthread_rwlock_rdlock(&conf->objsLock);
+    while ((obj = list_next(i))) {
+        if (is_logfile_obj(obj)) {
+            assert(obj->aux.logfile.console != NULL);
+            obj->shard = obj->aux.logfile.console->shard;
+        }
+        list_append(obj->shard->objs, obj);
         reopen_obj(obj);
     }
+    x_pthread_rwlock_unlock(&conf->objsLock);
     list_iterator_destroy(i);
     return;
 }
 
 
-static void mux_io(server_conf_t *conf)
+static void start_io_threads(server_conf_t *conf)
 {
-/*  Multiplexes I/O between all of the objs in the configuration.
- *  This routine is the heart of ConMan.
+/*  Creates a thread to multiplex the I/O of each additional shard.
+ *  Shard 0 is multiplexed by the main thread, which is left to handle signals.
  */
-    ListIterator i;
     int n;
-    obj_t *obj;
-    int inevent_fd;
+    int rc;
 
-    assert(conf->tp != NULL);
-    assert(!list_is_empty(conf->objs));
+    if (conf->numIoThreads <= 1) {
+        return;
+    }
+    for (n = 1; n < conf->numIoThreads; n++) {
+        if ((rc = create_signal_blocked_thread(&conf->shards[n]->tid,
+          (PthreadFunc) mux_io_thread, conf->shards[n])) != 0) {
+            log_err(rc, "Unable to create I/O thread");
+        }
+    }
+    log_msg(LOG_INFO, "Multiplexing I/O with %d threads", conf->numIoThreads);
+    return;
+}
+
+
+static void stop_io_threads(server_conf_t *conf)
+{
+/*  Waits for the I/O threads to exit once the 'done' flag has been set.
+ *    Each thread is woken first since it may be blocked in tpoll().
+ */
+    int n;
+    int rc;
+
+    for (n = 1; n < conf->numIoThreads; n++) {
+        tpoll_wake(conf->shards[n]->tp);
+    }
+    for (n = 1; n < conf->numIoThreads; n++) {
+        if ((rc = pthread_join(conf->shards[n]->tid, NULL)) != 0) {
+            log_msg(LOG_WARNING, "Unable to join I/O thread %d: %s",
+                n, strerror(rc));
+        }
+    }
+    return;
+}
 
-    i = list_iterator_create(conf->objs);
 
+static void * mux_io_thread(io_shard_t *shard)
+{
+/*  Thread entry point for multiplexing the I/O of an additional shard.
+ */
+    DPRINTF((5, "Started I/O thread for shard %d.\n", shard->id));
+    mux_io(shard->conf, shard);
+    return(NULL);
+}
+
+
+static void mux_io(server_conf_t *conf, io_shard_t *shard)
+{
+/*  Multiplexes I/O between all of the objs in the (shard).
+ *  This routine is the heart of ConMan.
+ *
+ *  Shard 0 is muxed by the main thread and additionally handles the
+ *    listening socket, inotify events, and signals; the remaining shards
+ *    are each muxed by their own thread.
+ *  tpoll() blocks indefinitely until an fd is ready, a timer has been
+ *    dispatched, or the shard is woken by another thread via tpoll_wake()
+ *    (eg, the main thread upon a reconfig or exit).  But if signals are not
+ *    received via a signalfd, shard 0 wakes every second to check for them.
+ *  The conf's objsLock is held for reading while processing objs (but not
+ *    while blocked in tpoll()) since objs owned by one shard can be written
+ *    by another (eg, a B/C client writing to consoles across shards).
+ *    An obj is only destroyed while holding the objsLock for writing.
+ */
+    tpoll_t tp;
+    List dead;
+    int n;
+    int j;
+    int fd;
+    obj_t *obj;
+    int ld = -1;
+    int inevent_fd = -1;
+    int sfd = -1;
+    int ms = -1;
+    int *fds = NULL;
+    obj_t **objs = NULL;
+    int numFds = 0;
+
+    assert(shard != NULL);
+    assert(shard->tp != NULL);
+    assert((shard->id != 0) || !list_is_empty(shard->objs));
+
+    tp = shard->tp;
+    dead = list_create(NULL);
+
+    /*  The tpoll set persists across loop iterations.  The listening socket
+     *    and inotify fd are set once here; each obj's fd is registered when
+     *    opened and only modified in the set when its state changes
+     *    (cf, register_obj_fd, set_obj_events).
+     */
+    if (shard->id == 0) {
+        ld = conf->ld;
+        tpoll_set(tp, ld, POLLIN);
+
+        inevent_fd = inevent_get_fd();
+        if (inevent_fd >= 0) {
+            tpoll_set(tp, inevent_fd, POLLIN);
+        }
+        sfd = signal_fd;
+        if (sfd >= 0) {
+            tpoll_set(tp, sfd, POLLIN);
+        }
+        else {
+            ms = 1000;
+        }
+    }
     while (!done) {
 
-        if (reconfig) {
+        if ((shard->id == 0) && reconfig) {
             /*
              *  FIXME: A reconfig should pro'ly resurrect "downed" serial objs
              *    and reset reconnect timers of "downed" telnet objs.
              */
             log_msg(LOG_NOTICE, "Performing reconfig on signal=%d", reconfig);
-            reopen_logfiles(conf);
+            x_pthread_rwlock_wrlock(&conf->objsLock);
+            conf->numReconfigs++;
+            conf->consoles.generation++;
+            x_pthread_rwlock_unlock(&conf->objsLock);
+            log_query_cache_stats(conf);
+            for (j = 1; j < conf->numIoThreads; j++) {
+                tpoll_wake(conf->shards[j]->tp);
+            }
+            if (conf->logFileName && !conf->enableForeground) {
+                open_daemon_logfile(conf);
+            }
             reconfig = 0;
         }
+        x_pthread_rwlock_rdlock(&conf->objsLock);
 
-        /*  FIXME: Switch from recomputing the tpoll set on each loop iteration
-         *    to modifying it based on events.  This will eliminate the 1sec
-         *    tpoll() sleep timeout and greatly reduce cpu utilization.
-         *    It will also eliminate the maze of twisty conditions below.
-         */
-        DPRINTF((25, "Recomputing tpoll fd set\n"));
-        (void) tpoll_zero(conf->tp, TPOLL_ZERO_FDS);
-        tpoll_set(conf->tp, conf->ld, POLLIN);
-
-        inevent_fd = inevent_get_fd();
-        if (inevent_fd >= 0) {
-            tpoll_set(conf->tp, inevent_get_fd(), POLLIN);
+        if (shard->numReconfigs != conf->numReconfigs) {
+            reopen_logfiles(shard);
+            shard->numReconfigs = conf->numReconfigs;
         }
-        list_iterator_reset(i);
-        while ((obj = list_next(i))) {
+        x_pthread_rwlock_unlock(&conf->objsLock);
 
-            if (obj->gotReset) {
-                reset_console(obj, conf->resetCmd);
-            }
-            if (obj->fd < 0) {
-                continue;
-            }
-            if ( (
-                   ( is_telnet_obj(obj) &&
-                     obj->aux.telnet.state == CONMAN_TELNET_UP ) ||
-                   ( is_process_obj(obj) &&
-                     obj->aux.process.state == CONMAN_PROCESS_UP ) ||
-#if WITH_FREEIPMI
-                   ( is_ipmi_obj(obj) &&
-                     obj->aux.ipmi.state == CONMAN_IPMI_UP ) ||
-#endif /* WITH_FREEIPMI */
-                   ( is_unixsock_obj(obj) &&
-                     obj->aux.unixsock.state == CONMAN_UNIXSOCK_UP ) ||
-                   is_serial_obj(obj)  ||
-                   is_client_obj(obj)
-                 )
-                 &&
-                 ( ! obj->gotEOF ) )
-            {
-                tpoll_set(conf->tp, obj->fd, POLLIN);
-            }
-            if ( ( (obj->bufInPtr != obj->bufOutPtr) ||
-                   (obj->gotEOF) ) &&
-                 ( ! (is_telnet_obj(obj) &&
-                      obj->aux.telnet.state != CONMAN_TELNET_UP) ) &&
-                 ( ! (is_process_obj(obj) &&
-                      obj->aux.process.state != CONMAN_PROCESS_UP) ) &&
-#if WITH_FREEIPMI
-                 ( ! (is_ipmi_obj(obj) &&
-                      obj->aux.ipmi.state != CONMAN_IPMI_UP) ) &&
-#endif /* WITH_FREEIPMI */
-                 ( ! (is_unixsock_obj(obj) &&
-                      obj->aux.unixsock.state != CONMAN_UNIXSOCK_UP) ) &&
-                 ( ! (is_client_obj(obj) &&
-                      obj->aux.client.gotSuspend) ) )
-            {
-                tpoll_set(conf->tp, obj->fd, POLLOUT);
-            }
-            if (is_telnet_obj(obj) &&
-                obj->aux.telnet.state == CONMAN_TELNET_PENDING)
-            {
-                tpoll_set(conf->tp, obj->fd, POLLIN | POLLOUT);
-            }
-        }
-        DPRINTF((25, "Calling tpoll\n"));
-        while ((n = tpoll(conf->tp, 1000)) < 0) {
+        DPRINTF((25, "Calling tpoll for shard %d\n", shard->id));
+        while ((n = tpoll(tp, ms)) < 0) {
             if (errno != EINTR) {
                 log_err(errno, "Unable to multiplex I/O");
             }
@@ -820,51 +1005,284 @@ static void mux_io(server_conf_t *conf)
         if (n <= 0) {
             continue;
         }
-        if (tpoll_is_set(conf->tp, conf->ld, POLLIN)) {
-            accept_client(conf);
-        }
-        if ((inevent_fd >= 0) && tpoll_is_set(conf->tp, inevent_fd, POLLIN)) {
-            inevent_process();
+        if (n > numFds) {
+            numFds = n;
+            if (!(fds = realloc(fds, numFds * sizeof(int)))) {
+                out_of_memory();
+            }
+            if (!(objs = realloc(objs, numFds * sizeof(obj_t *)))) {
+                out_of_memory();
+            }
         }
-        /*  If read_from_obj() or write_to_obj() returns -1,
+        n = tpoll_get_ready(tp, fds, n);
+
+        /*  Only the fds that are ready are examined.
+         *  If read_from_obj() or write_to_obj() returns -1,
          *    the obj's buffer has been flushed.  If it is a telnet obj,
          *    retain it and attempt to re-establish the connection;
-         *    o/w, give up and remove it from the master objs list.
+         *    o/w, give up and remove it from the master objs list
+         *    once the objsLock can be obtained for writing.
+         *  An obj whose fd has changed since it was registered
+         *    (eg, closed while processing another obj) is skipped.
+         */
+        x_pthread_rwlock_rdlock(&conf->objsLock);
+
+        x_pthread_mutex_lock(&shard->fdLock);
+        for (j = 0; j < n; j++) {
+            fd = fds[j];
+            objs[j] = (fd < shard->numFdObjs) ? shard->fdObjs[fd] : NULL;
+        }
+        x_pthread_mutex_unlock(&shard->fdLock);
+
+        /*  When more fds are ready than can be serviced in a single batch,
+         *    interactive clients are serviced first so their keystroke
+         *    echoes are not queued behind bulk output.
          */
-        list_iterator_reset(i);
-        while ((obj = list_next(i))) {
+        if (n > IO_BATCH_SIZE) {
+            (void) prioritize_ready_fds(fds, objs, n);
+        }
+        for (j = 0; j < n; j++) {
 
-            if (obj->fd < 0) {
+            fd = fds[j];
+
+            if (fd == ld) {
+                accept_client(conf);
+                continue;
+            }
+            if (fd == inevent_fd) {
+                inevent_process();
+                continue;
+            }
+            if (fd == sfd) {
+                process_signals();
+                continue;
+            }
+            if (!(obj = objs[j])) {
+                /*
+                 *  The fd is no longer registered (eg, its events were set
+                 *    by another thread as the obj was being closed).
+                 */
+                tpoll_clear(tp, fd, POLLIN | POLLOUT);
+                continue;
+            }
+            if (obj->fd != fd) {
+                objs[j] = NULL;
                 continue;
             }
             if (is_telnet_obj(obj)
-              && tpoll_is_set(conf->tp, obj->fd, POLLIN | POLLOUT)
+              && tpoll_is_set(tp, fd, POLLIN | POLLOUT)
               && (obj->aux.telnet.state == CONMAN_TELNET_PENDING)) {
                 open_telnet_obj(obj);
                 continue;
             }
-            if (tpoll_is_set(conf->tp, obj->fd, POLLIN | POLLHUP | POLLERR)) {
-                if (read_from_obj(obj, conf->tp) < 0) {
-                    list_delete(i);
+            if (shard->ur) {
+                queue_obj_io(shard, obj, dead);
+                continue;
+            }
+            if (tpoll_is_set(tp, fd, POLLIN | POLLHUP | POLLERR)) {
+                if (read_from_obj(obj) < 0) {
+                    list_append(dead, obj);
                     continue;
                 }
-                if (obj->fd < 0) {
+                if (obj->fd != fd) {
                     continue;
                 }
             }
-            if (tpoll_is_set(conf->tp, obj->fd, POLLOUT)) {
+            if (tpoll_is_set(tp, fd, POLLOUT)) {
                 if (write_to_obj(obj) < 0) {
-                    list_delete(i);
-                    continue;
-                }
-                if (obj->fd < 0) {
+                    list_append(dead, obj);
                     continue;
                 }
             }
         }
+        if (shard->ur) {
+            flush_obj_io(shard, dead);
+        }
+        /*  Servicing an obj may have changed its events of interest
+         *    (eg, its buffer has drained or it has reached EOF).
+         *    Objs that have been closed or shut down in the interim
+         *    have been unregistered and are skipped.
+         */
+        for (j = 0; j < n; j++) {
+            if ((obj = objs[j]) && (obj->fd == fds[j])) {
+                set_obj_events(obj);
+            }
+        }
+        x_pthread_rwlock_unlock(&conf->objsLock);
+
+        if (!list_is_empty(dead)) {
+            destroy_dead_objs(conf, shard, dead);
+        }
     }
-    log_msg(LOG_NOTICE, "Exiting on signal=%d", done);
-    list_iterator_destroy(i);
+    if (shard->id == 0) {
+        log_msg(LOG_NOTICE, "Exiting on signal=%d", done);
+    }
+    list_destroy(dead);
+    free(fds);
+    free(objs);
+    return;
+}
+
+
+static int prioritize_ready_fds(int *fds, obj_t **objs, int n)
+{
+/*  Reorders the arrays (fds) of (n) ready fds and their corresponding (objs)
+ *    so the fds of interactive clients precede all others.  The order among
+ *    the fds of interactive clients (and among the others) is not preserved.
+ *  The conf's objsLock must be held for reading when calling this routine.
+ *  Returns the number of interactive client fds.
+ */
+    obj_t *obj;
+    int fd;
+    int i;
+    int k;
+
+    for (i = k = 0; i < n; i++) {
+        fd = fds[i];
+        if (!(obj = objs[i]) || (obj->fd != fd) || !is_client_obj(obj)
+                || !obj->aux.client.req->enableInteractive) {
+            continue;
+        }
+        fds[i] = fds[k];
+        objs[i] = objs[k];
+        fds[k] = fd;
+        objs[k++] = obj;
+    }
+    if (k > 0) {
+        DPRINTF((20, "Prioritized %d of %d ready fds.\n", k, n));
+    }
+    return(k);
+}
+
+
+static void queue_obj_io(io_shard_t *shard, obj_t *obj, List dead)
+{
+/*  Queues the reads & writes for the ready obj's fd in the shard's io_uring.
+ *    These are performed in a single system call by flush_obj_io().
+ *  Objs that are ready to be destroyed are appended to the (dead) list.
+ *
+ *  The queue is flushed beforehand if it cannot hold both a read & write.
+ *    This may close the obj's fd (eg, by shutting down a console when
+ *    the read of its telnet connection fails).
+ */
+    int fd = obj->fd;
+    io_op_t *op;
+    int iovcnt;
+    int n;
+
+    if (shard->numOps > IO_BATCH_SIZE - 2) {
+        flush_obj_io(shard, dead);
+        if (obj->fd != fd) {
+            return;
+        }
+    }
+    if (tpoll_is_set(shard->tp, fd, POLLIN | POLLHUP | POLLERR)) {
+        if ((n = begin_read_from_obj(obj)) < 0) {
+            list_append(dead, obj);
+            return;
+        }
+        if (obj->fd != fd) {
+            return;
+        }
+        if (n > 0) {
+            if (uring_read(shard->ur, fd, shard->numOps, MAX_READ_SIZE,
+                    shard->numOps) < 0) {
+                log_err(errno, "Unable to queue read from [%s]", obj->name);
+            }
+            shard->ops[shard->numOps].obj = obj;
+            shard->ops[shard->numOps].fd = fd;
+            shard->ops[shard->numOps].ptr = NULL;
+            shard->numOps++;
+        }
+    }
+    if (tpoll_is_set(shard->tp, fd, POLLOUT)) {
+        op = &shard->ops[shard->numOps];
+        if (begin_write_to_obj(obj, op->iov, &iovcnt) > 0) {
+            if (uring_writev(shard->ur, fd, op->iov, iovcnt,
+                    shard->numOps) < 0) {
+                log_err(errno, "Unable to queue write to [%s]", obj->name);
+            }
+            op->obj = obj;
+            op->fd = fd;
+            op->ptr = op->iov[0].iov_base;
+            shard->numOps++;
+        }
+        else if (end_write_to_obj(obj, op->iov[0].iov_base, 0) < 0) {
+            list_append(dead, obj);
+        }
+    }
+    return;
+}
+
+
+static void flush_obj_io(io_shard_t *shard, List dead)
+{
+/*  Submits the reads & writes queued in the shard's io_uring, waits for
+ *    them to complete, and then processes each result in turn.
+ *  Objs that are ready to be destroyed are appended to the (dead) list;
+ *    their fds have already been unregistered by shutdown_obj().
+ *
+ *  Since an obj's reads & writes are only queued by the shard muxing it,
+ *    and dead objs are only destroyed after the queue has been flushed,
+ *    each op's obj remains valid until its result is processed.  But if
+ *    the obj's fd has changed in the interim (eg, a console was shut down
+ *    by processing an earlier result), the result is discarded.
+ */
+    io_op_t *op;
+    int id;
+    int n;
+
+    if (shard->numOps == 0) {
+        return;
+    }
+    if (uring_submit(shard->ur) < 0) {
+        log_err(errno, "Unable to submit I/O for shard %d", shard->id);
+    }
+    while (uring_reap(shard->ur, &id, &n) > 0) {
+
+        assert((id >= 0) && (id < shard->numOps));
+        op = &shard->ops[id];
+
+        if (op->obj->fd != op->fd) {
+            continue;
+        }
+        if (n < 0) {
+            errno = -n;
+            n = -1;
+        }
+        if (!op->ptr) {
+            n = end_read_from_obj(op->obj, uring_get_buf(shard->ur, id), n);
+        }
+        else {
+            n = end_write_to_obj(op->obj, op->ptr, n);
+        }
+        if (n < 0) {
+            list_append(dead, op->obj);
+        }
+    }
+    shard->numOps = 0;
+    return;
+}
+
+
+static void destroy_dead_objs(server_conf_t *conf, io_shard_t *shard,
+    List dead)
+{
+/*  Removes the objs in the (dead) list from the (shard) and master objs lists,
+ *    thereby destroying them via the master list's destructor.
+ *  The objsLock must be held for writing since other shards may hold refs
+ *    to these objs while processing their own.  The rings of consoles left
+ *    without clients are also freed here for the same reason.
+ */
+    obj_t *obj;
+
+    x_pthread_rwlock_wrlock(&conf->objsLock);
+    while ((obj = list_pop(dead))) {
+        list_delete_all(shard->objs, (ListFindF) find_obj, obj);
+        list_delete_all(conf->objs, (ListFindF) find_obj, obj);
+    }
+    release_idle_rings(conf);
+    x_pthread_rwlock_unlock(&conf->objsLock);
     return;
 }
 
@@ -973,47 +1391,37 @@ err:
 }
 
 
-static void reopen_logfiles(server_conf_t *conf)
+static void reopen_logfiles(io_shard_t *shard)
 {
-/*  Reopens the daemon logfile and all of the logfiles in the 'objs' list.
+/*  Reopens all of the logfiles in the shard's 'objs' list.
+ *  Each logfile is reopened by the logfile writer thread dequeuing it
+ *    so its fd is never closed while being written.
  */
     ListIterator i;
     obj_t *logfile;
 
-    i = list_iterator_create(conf->objs);
+    i = list_iterator_create(shard->objs);
     while ((logfile = list_next(i))) {
         if (!is_logfile_obj(logfile)) {
             continue;
         }
-        open_logfile_obj(logfile);
+        queue_logfile_write(logfile, 1);
     }
     list_iterator_destroy(i);
-
-    if (conf->logFileName && !conf->enableForeground) {
-        open_daemon_logfile(conf);
-    }
     return;
 }
 
 
 static void accept_client(server_conf_t *conf)
 {
-/*  Accepts a new client connection on the listening socket.
+/*  Accepts a new client connection on the listening socket,
+ *    and queues it for its request to be processed by a client worker.
  *  The new socket connection must be accept()'d within the poll() loop.
- *    O/w, the following scenario could occur:  Read activity would be
- *    poll()'d on the listen socket.  A new thread would be created to
- *    process this request.  Before this new thread is scheduled and the
- *    socket connection is accept()'d, the poll() loop begins its next
- *    iteration.  It notices read activity on the listen socket from the
- *    client that has not yet been accepted, so a new thread is created.
- *    Since the listen socket is set non-blocking, this new thread would
- *    receive an EAGAIN/EWOULDBLOCK on the accept() and terminate, but still...
+ *    O/w, the listen socket would remain readable until a worker got around
+ *    to accepting the connection, and the poll() loop would spin meanwhile.
  */
     int sd;
     const int on = 1;
-    client_arg_t *args;
-    int rc;
-    pthread_t tid;
 
     while ((sd = accept(conf->ld, NULL, NULL)) < 0) {
         if (errno == EINTR) {
@@ -1031,7 +1439,7 @@ static void accept_client(server_conf_t *conf)
 
     /*  While the listen fd is non-blocking, new fds that are accept()d from
      *    it can be either blocking or non-blocking depending on the platform.
-     *  The current model spawns a thread to handle a new client with
+     *  The current model has a client worker thread handle a new client with
      *    blocking I/O.  Once the client request has been processed,
      *    this fd is set non-blocking and moved to the main fd set.
      *  Consequently, we force the new fd to be blocking here for portability.
@@ -1044,112 +1452,6 @@ static void accept_client(server_conf_t *conf)
             log_err(errno, "Unable to set KEEPALIVE socket option");
         }
     }
-    /*  Create a tmp struct to hold two args to pass to the thread.
-     *  Note that the thread is responsible for freeing this memory.
-     */
-    if (!(args = malloc(sizeof(client_arg_t)))) {
-        out_of_memory();
-    }
-    args->sd = sd;
-    args->conf = conf;
-
-    if ((rc = pthread_create(&tid, NULL,
-      (PthreadFunc) process_client, args)) != 0) {
-        log_err(rc, "Unable to create new thread");
-    }
-    return;
-}
-
-
-static void reset_console(obj_t *console, const char *cmd)
-{
-/*  Resets the 'console' obj by performing the reset 'cmd' in a subshell.
- */
-    char buf[MAX_LINE];
-    pid_t pid;
-    pid_t *arg;
-
-    assert(is_console_obj(console));
-    assert(console->gotReset);
-    assert(cmd != NULL);
-
-    console->gotReset = 0;
-
-    if (format_obj_string(buf, sizeof(buf), console, cmd) < 0) {
-        log_msg(LOG_NOTICE, "Unable to reset console [%s]: command too long",
-            console->name);
-        return;
-    }
-    if ((pid = fork()) < 0) {
-        log_msg(LOG_NOTICE, "Unable to reset console [%s]: %s",
-            console->name, strerror(errno));
-        return;
-    }
-    else if (pid == 0) {
-        setpgid(pid, 0);
-        close(STDIN_FILENO);            /* ignore errors on close() */
-        close(STDOUT_FILENO);
-        close(STDERR_FILENO);
-        execl("/bin/sh", "sh", "-c", buf, (char *) NULL);
-        _exit(127);                     /* execl() error */
-    }
-    /*  Both parent and child call setpgid() to make the child a process
-     *    group leader.  One of these calls is redundant, but by doing
-     *    both we avoid a race condition.  (cf. APUE 9.4 p244)
-     */
-    setpgid(pid, 0);
-
-    /*  FIXME: Have perform_reset() store the client info instead of a bool
-     *    for gotReset.  Then remove the notify_objs msg from perform_reset()
-     *    and replace it with the following:
-     */
-    log_msg(LOG_INFO, "Reset console [%s] (pid %d)", console->name, pid);
-#if 0
-    snprintf(buf, sizeof(buf), "%sConsole [%s] reset (pid %d)%s",
-        CONMAN_MSG_PREFIX, console->name, (int) pid, CONMAN_MSG_SUFFIX);
-    strcpy(&buf[sizeof(buf) - 3], "\r\n");
-    notify_console_objs(console, buf);
-#endif
-
-    /*  Set a timer to ensure the reset cmd does not exceed its time limit.
-     *  The callback function's arg must be allocated on the heap since
-     *    local vars on the stack will be lost once this routine returns.
-     */
-    if (!(arg = malloc(sizeof *arg))) {
-        out_of_memory();
-    }
-    *arg = pid;
-
-    if (tpoll_timeout_relative (tp_global,
-            (callback_f) kill_console_reset, arg,
-            RESET_CMD_TIMEOUT * 1000) < 0) {
-        log_msg(LOG_ERR,
-            "Unable to create timer for resetting console [%s]",
-            console->name);
-    }
-    return;
-}
-
-
-static void kill_console_reset(pid_t *arg)
-{
-/*  Terminates the "ResetCmd" process associated with 'arg' if it has
- *    exceeded its time limit.
- *  Memory allocated to 'arg' will be free()'d by this routine.
- */
-    pid_t pid;
-
-    assert(arg != NULL);
-    pid = *arg;
-    assert(pid > 0);
-    free(arg);
-
-    if (kill(pid, 0) < 0) {             /* process is no longer running */
-        return;
-    }
-    if (kill(-pid, SIGKILL) == 0) {     /* kill entire process group */
-        log_msg(LOG_NOTICE, "ResetCmd process pid=%d exceeded %ds time limit",
-            (int) pid, RESET_CMD_TIMEOUT);
-    }
+    queue_client(conf, sd);
     return;
 }
@@ -33,27 +33,107 @@
 #  include <ipmiconsole.h>
 #endif /* HAVE_IPMICONSOLE_H */
 
+#if WITH_ZLIB
+#  include <zlib.h>
+#endif /* WITH_ZLIB */
+
 #include <sys/types.h>                  /* include before in.h for bsd */
+#include <sys/uio.h>                    /* for struct iovec                  */
 #include <netinet/in.h>                 /* for struct sockaddr_in            */
 #include <pthread.h>
+#include <regex.h>                      /* for regex_t                       */
+#include <stdint.h>                     /* for uint64_t                      */
 #include <termios.h>                    /* for struct termios, speed_t       */
 #include <time.h>                       /* for time_t                        */
 #include "common.h"
 #include "list.h"
 #include "tpoll.h"
+#include "uring.h"
+
+
+#define CLIENT_BULK_FLUSH_MSECS         20
+
+#define CLIENT_BULK_SNDBUF_SIZE         (MAX_BUF_SIZE * 32)
+
+#define CLIENT_QUEUE_MAX                4096
+
+#define CLIENT_REQ_TIMEOUT              30
+
+#define CONSOLE_RING_SIZE               (MAX_BUF_SIZE * 8)
 
+#define CONSOLE_TIME_MARKS              256
 
 #define DEFAULT_LOGOPT_LOCK             1
 #define DEFAULT_LOGOPT_SANITIZE         0
 #define DEFAULT_LOGOPT_TIMESTAMP        0
+#define DEFAULT_LOGOPT_TIMESTAMP_FMT    TIME_FMT_SEC
+#define DEFAULT_LOGOPT_COMPRESS         0
+#define DEFAULT_LOGOPT_INDEX            0
+#define DEFAULT_LOGOPT_ROTATE_SIZE      0
+#define DEFAULT_LOGOPT_ROTATE_AGE       0
+#define DEFAULT_LOGOPT_ROTATE_KEEP      5
+
+#define DEFAULT_SCROLLBACK_SIZE         MAX_BUF_SIZE
 
 #define DEFAULT_SEROPT_BPS              B9600
 #define DEFAULT_SEROPT_DATABITS         8
 #define DEFAULT_SEROPT_PARITY           0
 #define DEFAULT_SEROPT_STOPBITS         1
 
+#define IO_BATCH_SIZE                   64
+
+#define MAX_READ_SIZE                   ((MAX_BUF_SIZE / 2) - 1)
+
+#define MAX_WRITE_BUDGET                (MAX_BUF_SIZE * 8)
+
+#define MAX_WRITE_IOVS                  2
+
+#define MUX_BUF_SIZE                    (MAX_BUF_SIZE * 4)
+
+#define MUX_FRAME_SIZE                  4096
+
+#define MUX_INIT_CREDIT                 CONSOLE_RING_SIZE
+
+#define DEFAULT_CLIENT_THREADS          4
+
+#define DEFAULT_LOG_THREADS             2
+
+#define LOG_STALL_MSECS                 1000
+
+#define LOG_FRAME_SIZE                  (256*1024)
+
+#define LOG_FRAME_SECS                  5
+
+#define LOG_INDEX_SUFFIX                ".idx"
+
+#define LOG_SCAN_SECS                   5
+
+#define LOG_ROTATE_STAGGER              4
+
+#define LOG_ROTATE_MAX_KEEP             999
+
 #define MIN_CONNECT_SECS                60
 
+#define QUERY_CACHE_SIZE                64
+
+#define REPLAY_MAP_SIZE                 (1024*1024)
+
+#define RSP_FLUSH_SIZE                  (64*1024)
+
+#define RESOLVE_CACHE_MAX               4096
+
+#define RESOLVE_HASH_SIZE               1021
+
+#define RESOLVE_NEG_TTL                 300
+
+#define RESOLVE_POS_TTL                 3600
+
+#define RESOLVE_THREADS                 2
+
+#define SCROLLBACK_CHUNK_SIZE           4096
+
+#define SCROLLBACK_MAX_SIZE             (64*1024*1024)
+
 #if WITH_FREEIPMI
 #define IPMI_ENGINE_CONSOLES_PER_THREAD 128
 #define IPMI_MAX_USER_LEN               IPMI_MAX_USER_NAME_LENGTH
@@ -71,6 +151,16 @@
 
 #define RESOLVE_RETRY_TIMEOUT           1800
 
+#define TRIGGER_EXEC_BURST              8
+#define TRIGGER_EXEC_RATE               1
+#define TRIGGER_EXEC_TIMEOUT            60
+
+#define TRIGGER_HOLDOFF                 60
+
+#define TRIGGER_LINE_SIZE               1024
+
+#define TRIGGER_MAX_PENDING             16
+
 #define TELNET_MAX_TIMEOUT              1800
 #define TELNET_MIN_TIMEOUT              15
 
@@ -89,17 +179,143 @@ enum obj_type {                         /* type of auxiliary obj (3 bits)    */
     CONMAN_OBJ_LAST_ENTRY
 };
 
+typedef struct obj_mark {               /* CONSOLE OUTPUT TIME MARK:         */
+    uint64_t         seq;               /*  seq num of 1st byte read at time */
+    time_t           time;              /*  time at which output was read    */
+} obj_mark_t;
+
+typedef struct obj_ring {               /* SHARED CONSOLE RING:              */
+    unsigned char   *buf;               /*  circular-buf of console output   */
+    uint64_t         numBytes;          /*  num bytes ever output by console */
+    uint64_t         baseBytes;         /*  numBytes when buf was allocated  */
+    obj_mark_t      *marks;             /*  circular-buf of time marks, or 0 */
+    unsigned long    numMarks;          /*  num marks ever written to marks  */
+    int              numReaders;        /*  num clients attached to the ring */
+    unsigned         gotSeq:1;          /*  true if read by a seq'd session  */
+    unsigned         gotIdle:1;         /*  true if queued on conf idleRings */
+    pthread_mutex_t  lock;              /*  lock protecting access to ring   */
+} obj_ring_t;
+
+typedef struct obj_scrollback {         /* CONSOLE SCROLLBACK:               */
+    unsigned char  **chunks;            /*  ary of ptrs to chunks (or NULL)  */
+    int              numChunks;         /*  num of chunks in scrollback      */
+    uint64_t         numBytes;          /*  num bytes ever written into it   */
+    pthread_mutex_t  lock;              /*  lock protecting access to chunks */
+} obj_scrollback_t;
+
+typedef struct trigger {                /* CONSOLE OUTPUT TRIGGER:           */
+    char            *name;              /*  name reported when it fires      */
+    char            *match;             /*  literal located by automaton     */
+    char            *regexStr;          /*  regex line must match (or NULL)  */
+    regex_t          regex;             /*  compiled regexStr                */
+    char            *execCmd;           /*  cmd exec'd when fired (or NULL)  */
+    char            *notifyPath;        /*  unix dgram sock notified, or NULL*/
+    int              holdoff;           /*  min secs 'tween firings/console  */
+    int              next;              /*  next trigger w/ same match, or -1*/
+    unsigned         enableLog:1;       /*  true if marking console log      */
+} trigger_t;
+
+typedef struct trigger_set {            /* COMPILED TRIGGER AUTOMATON:       */
+    trigger_t      **triggers;          /*  ary of ptrs to triggers          */
+    int              numTriggers;       /*  num of triggers in ary           */
+    int              numStates;         /*  num of automaton states          */
+    int              numClasses;        /*  num of byte classes              */
+    unsigned char    classes[256];      /*  byte-to-class map (0 if unused)  */
+    int             *delta;             /*  state x class transition table   */
+    int             *fail;              /*  failure state of each state      */
+    int             *match;             /*  1st trigger matched at state, -1 */
+    int             *out;               /*  nearest state w/ matches, or -1  */
+    int              sd;                /*  dgram socket for notify, or -1   */
+    int              execTokens;        /*  cmds exec'able under rate limit  */
+    int              execDropped;       /*  cmds dropped since last exec     */
+    time_t           execTime;          /*  time execTokens last refilled    */
+    pthread_mutex_t  execLock;          /*  lock protecting exec* fields     */
+} trigger_set_t;
+
+typedef struct trigger_state {          /* CONSOLE TRIGGER STATE:            */
+    int              state;             /*  automaton state after last byte  */
+    int              lineLen;           /*  num bytes in line buf            */
+    int              numPending;        /*  num triggers matched within line */
+    int              pending[TRIGGER_MAX_PENDING]; /* to fire at EOL */
+    time_t          *timeFired;         /*  time each trigger last fired     */
+    char             line[TRIGGER_LINE_SIZE]; /* current line of output      */
+} trigstate_t;
+
+typedef struct resolve_entry {         /* REVERSE DNS CACHE ENTRY:          */
+    struct in_addr   addr;              /*  address being resolved           */
+    char            *name;              /*  host name, or NULL if unknown    */
+    time_t           expire;            /*  time at which entry goes stale   */
+    int              isPending;         /*  true if lookup queued or running */
+    struct resolve_entry *next;         /*  next entry in hash chain         */
+} resolve_entry_t;
+
+typedef struct resolver {               /* ASYNC REVERSE DNS RESOLVER:       */
+    resolve_entry_t *hash[RESOLVE_HASH_SIZE]; /* cache entries by address    */
+    int              numEntries;        /*  num entries in hash table        */
+    List             queue;             /*  pending entries for lookup thds  */
+    pthread_t        tids[RESOLVE_THREADS]; /* thread ids of lookup threads  */
+    pthread_mutex_t  lock;              /*  lock protecting all fields       */
+    pthread_cond_t   queueCond;         /*  cond signalled when lookups qd   */
+    pthread_cond_t   doneCond;          /*  cond signalled when lookups done */
+    int              gotDone;           /*  true if lookup thds are to exit  */
+} resolver_t;
+
+typedef struct mux_stream {             /* MULTIPLEXED CLIENT STREAM:        */
+    struct base_obj *console;           /*  console obj ref (key if closed)  */
+    obj_ring_t      *ring;              /*  ring of console being read, or 0 */
+    uint64_t         ringPos;           /*  ring offset of next byte to send */
+    uint32_t         credit;            /*  num data bytes client will take  */
+    unsigned         isOpen:1;          /*  true if linked with its console  */
+    unsigned         gotSeek:1;         /*  true if SEEK frame owed to client*/
+} mux_stream_t;
+
+typedef struct client_mux {             /* MULTIPLEXED CLIENT SESSION:       */
+    mux_stream_t    *streams;           /*  ary of streams indexed by id     */
+    mux_stream_t   **byObj;             /*  ary of streams sorted by console */
+    int              numStreams;        /*  num of streams in session        */
+    int              nextStream;        /*  id of next stream to be serviced */
+    unsigned char   *frames;            /*  buf of data frames being written */
+    int              framesLen;         /*  num bytes of frames in buf       */
+    int              framesPos;         /*  offset of next byte to write     */
+    unsigned char    inHdr[CONMAN_MUX_HDR_LEN]; /* hdr of frame being read  */
+    int              inHdrLen;          /*  num bytes of hdr read so far     */
+    int              inType;            /*  type of frame being read         */
+    uint32_t         inId;              /*  stream id of frame being read    */
+    int              inLeft;            /*  num payload bytes left to read   */
+    uint32_t         inCredit;          /*  credit grant being read          */
+    unsigned char    inSeek[CONMAN_MUX_SEQ_LEN]; /* SEEK payload being read */
+    int              inSeekLen;         /*  num bytes of inSeek read so far  */
+    unsigned         gotPending:1;      /*  true if stream data may be ready */
+} client_mux_t;
+
 typedef struct client_obj {             /* CLIENT AUX OBJ DATA:              */
     req_t           *req;               /*  client request info              */
+    client_mux_t    *mux;               /*  multiplexed session state, or 0  */
+    obj_ring_t      *ring;              /*  ring of console being read, or 0 */
+    uint64_t         ringPos;           /*  ring offset of next byte to send */
+    int              replayFd;          /*  fd of log being replayed, or -1  */
+    off_t            replayPos;         /*  log offset of next byte to send  */
+    off_t            replayEnd;         /*  log offset at which replay ends  */
+    unsigned char   *replayMap;         /*  mmap'd window of log (or NULL)   */
+    off_t            replayMapPos;      /*  log offset of mmap'd window      */
+    size_t           replayMapLen;      /*  length of mmap'd window          */
     time_t           timeLastRead;      /*  time last data was read from fd  */
+    int              timer;             /*  timer id for bulk output flush   */
     unsigned         gotEscape:1;       /*  true if last char rcvd was esc   */
     unsigned         gotSuspend:1;      /*  true if suspending client output */
+    unsigned         gotReplay:1;       /*  true if replaying console output */
 } client_obj_t;
 
 typedef struct logfile_opt {            /* LOGFILE OBJ OPTIONS:              */
     unsigned         enableLock:1;      /*  true if logfile being locked     */
     unsigned         enableSanitize:1;  /*  true if logfile being sanitized  */
     unsigned         enableTimestamp:1; /*  true if timestamping each line   */
+    unsigned         timestampFormat:2; /*  TIME_FMT_* format of timestamps  */
+    unsigned         enableCompress:1;  /*  true if logfile being compressed */
+    unsigned         enableIndex:1;     /*  true if logfile being indexed    */
+    int              rotateKeep;        /*  num of rotated logfiles to keep  */
+    int              rotateMinutes;     /*  minutes 'tween rotations (or 0)  */
+    off_t            rotateSize;        /*  bytes at which rotated (or 0)    */
 } logopt_t;
 
 typedef enum logfile_line_state {       /* log CR/LF newline state (2 bits)  */
@@ -109,10 +325,45 @@ typedef enum logfile_line_state {       /* log CR/LF newline state (2 bits)  */
     CONMAN_LOG_LINE_LF
 } log_line_state_t;
 
+typedef enum logfile_write_state {      /* log writer state                  */
+    CONMAN_LOG_WRITE_IDLE,
+    CONMAN_LOG_WRITE_QUEUED,
+    CONMAN_LOG_WRITE_BUSY
+} log_write_state_t;
+
+typedef struct logfile_index {          /* LOGFILE INDEX STATE:              */
+    int              fd;                /*  fd of the frame index sidecar    */
+    off_t            fileLen;           /*  length of (compressed) logfile   */
+    off_t            frameOffset;       /*  file offset of current frame     */
+    uint64_t         frameRawLen;       /*  uncompressed bytes in frame      */
+    time_t           frameTime;         /*  time current frame was started   */
+    unsigned         gotFrame:1;        /*  true if a frame is in progress   */
+} logidx_t;
+
+typedef struct logfile_index_entry {    /* LOGFILE INDEX SIDECAR ENTRY:      */
+    off_t            offset;            /*  file offset of frame             */
+    off_t            length;            /*  (compressed) length of frame     */
+    uint64_t         rawLength;         /*  uncompressed length of frame     */
+    time_t           time;              /*  time frame was started           */
+} logidx_entry_t;
+
+#if WITH_ZLIB
+typedef struct logfile_zip {            /* LOGFILE COMPRESSION STATE:        */
+    z_stream         z;                 /*  gzip stream of current frame     */
+} logzip_t;
+#endif /* WITH_ZLIB */
+
 typedef struct logfile_obj {            /* LOGFILE AUX OBJ DATA:             */
     struct base_obj *console;           /*  con obj ref for name expansion   */
     char            *fmtName;           /*  name with conversion specifiers  */
     logopt_t         opts;              /*  local options                    */
+    log_write_state_t writeState;       /*  writer state (conf logQueueLock) */
+    int              gotReopen;         /*  true if writer is to reopen file */
+    int              gotStall;          /*  true if last write was too slow  */
+    int              gotBacklog;        /*  true if console reads deferred   */
+    struct logfile_index *idx;          /*  frame index state (or NULL)      */
+    struct logfile_zip *zip;            /*  compression state (or NULL)      */
+    time_t           rotateTime;        /*  time of next age-based rotation  */
     unsigned         gotProcessing:1;   /*  true if input processing req'd   */
     unsigned         gotTruncate:1;     /*  true if ZeroLogs is enabled      */
     unsigned         lineState:2;       /*  log_line_state_t CR/LF state     */
@@ -224,22 +475,78 @@ typedef union aux_obj {
 #endif /* WITH_FREEIPMI */
 } aux_obj_t;
 
+typedef struct io_op {                  /* I/O OPERATION:                    */
+    struct base_obj *obj;               /*  obj whose fd is read or written  */
+    int              fd;                /*  obj's fd when op was queued      */
+    unsigned char   *ptr;               /*  obj buf being written, or NULL   */
+    struct iovec     iov[MAX_WRITE_IOVS]; /* segments of ptr being written */
+} io_op_t;
+
+typedef struct io_shard {               /* I/O SHARD:                        */
+    struct server_conf *conf;           /*  server's configuration           */
+    tpoll_t          tp;                /*  tpoll obj for this shard's objs  */
+    uring_t          ur;                /*  io_uring obj for batching i/o    */
+    io_op_t         *ops;               /*  array of i/o ops queued in ur    */
+    int              numOps;            /*  num of i/o ops queued in ur      */
+    List             objs;              /*  list of objs muxed by this shard */
+    struct base_obj **fdObjs;           /*  objs muxed indexed by fd, or 0   */
+    int              numFdObjs;         /*  num of entries in fdObjs array   */
+    pthread_mutex_t  fdLock;            /*  lock protecting fdObjs array     */
+    pthread_t        tid;               /*  thread id (unused for shard 0)   */
+    int              id;                /*  index into conf->shards[]        */
+    int              numReconfigs;      /*  reconfigs performed by shard     */
+} io_shard_t;
+
 typedef struct base_obj {               /* BASE OBJ:                         */
     char            *name;              /*  obj name                         */
     int              fd;                /*  file descriptor                  */
-    unsigned char    buf[MAX_BUF_SIZE]; /*  circular-buf to be written to fd */
+    io_shard_t      *shard;             /*  i/o shard muxing this obj's fd   */
+    unsigned char   *buf;               /*  circular-buf to be written to fd */
+    int              bufSize;           /*  size of buf (from the bufpool)   */
     unsigned char   *bufInPtr;          /*  ptr for data written in to buf   */
     unsigned char   *bufOutPtr;         /*  ptr for data written out to fd   */
     pthread_mutex_t  bufLock;           /*  lock protecting access to buf    */
+    obj_ring_t       ring;              /*  ring shared by console's clients */
+    obj_scrollback_t scrollback;        /*  console output for replay        */
+    trigstate_t     *trig;              /*  console trigger state (or NULL)  */
     List             readers;           /*  list of objs that read from me   */
     List             writers;           /*  list of objs that write to me    */
     unsigned         type:3;            /*  enum obj_type of auxiliary obj   */
-    unsigned         gotBufWrap:1;      /*  true if circular-buf has wrapped */
     unsigned         gotEOF:1;          /*  true if obj got EOF on last read */
     unsigned         gotReset:1;        /*  true if resetting a console obj  */
     aux_obj_t        aux;               /*  auxiliary obj data union         */
 } obj_t;
 
+typedef struct console_index {          /* CONSOLE NAME INDEX:               */
+    obj_t          **byName;            /*  consoles sorted by name (strcmp) */
+    int              numConsoles;       /*  num consoles in index            */
+    int              maxConsoles;       /*  num slots allocated in byName    */
+    obj_t          **hash;              /*  consoles hashed by name          */
+    int              hashSize;          /*  num slots in hash (power of 2)   */
+    unsigned long    generation;        /*  bumped when console set changes  */
+    unsigned         isSorted:1;        /*  true if byName is sorted         */
+} console_index_t;
+
+typedef struct query_entry {            /* CONSOLE QUERY CACHE ENTRY:        */
+    char            *key;               /*  request patterns ('\n'-separated)*/
+    regex_t          rex;               /*  compiled regex (if isRegex)      */
+    obj_t          **objs;              /*  matching consoles sorted by name */
+    int              numObjs;           /*  num consoles in objs             */
+    unsigned long    generation;        /*  index generation objs valid for  */
+    struct query_entry *prev;           /*  more recently used entry         */
+    struct query_entry *next;           /*  less recently used entry         */
+    unsigned         isRegex:1;         /*  true if patterns are regexs      */
+} query_entry_t;
+
+typedef struct query_cache {            /* CONSOLE QUERY CACHE (LRU):        */
+    query_entry_t   *head;              /*  most recently used entry         */
+    query_entry_t   *tail;              /*  least recently used entry        */
+    int              numEntries;        /*  num entries in cache             */
+    unsigned long    numHits;           /*  num queries resolved from cache  */
+    unsigned long    numMisses;         /*  num queries resolved via index   */
+    pthread_mutex_t  lock;              /*  lock protecting all fields       */
+} query_cache_t;
+
 typedef struct server_conf {
     char            *confFileName;      /* configuration file name           */
     char            *coreDumpDir;       /* dir where core dumps are written  */
@@ -256,15 +563,43 @@ typedef struct server_conf {
     int              syslogFacility;    /* syslog facility or -1 if disabled */
     int              throwSignal;       /* signal num to send running daemon */
     int              tStampMinutes;     /* minutes 'tween logfile timestamps */
+    uint64_t         seqEpoch;          /* epoch of console output seq nums  */
     time_t           tStampNext;        /* time next stamp written to logs   */
     int              fd;                /* configuration file descriptor     */
     int              port;              /* port number on which to listen    */
     int              ld;                /* listening socket descriptor       */
     List             objs;              /* list of all server obj_t's        */
+    List             idleRings;         /* consoles whose rings may be freed */
+    console_index_t  consoles;          /* index of console objs by name     */
+    query_cache_t    queryCache;        /* cache of resolved console queries */
+    pthread_rwlock_t objsLock;          /* lock protecting objs from destroy */
     tpoll_t          tp;                /* tpoll obj for muxing i/o & timers */
+    io_shard_t     **shards;            /* array of i/o shards (0 is main)   */
+    int              numIoThreads;      /* number of i/o shards/threads      */
+    int              numClientThreads;  /* number of client request workers  */
+    pthread_t       *clientTids;        /* thread ids of client workers      */
+    int             *clientSds;         /* sd being processed by each worker */
+    List             clientQueue;       /* client args queued for workers    */
+    pthread_mutex_t  clientQueueLock;   /* lock protecting clientQueue       */
+    pthread_cond_t   clientQueueCond;   /* cond signalled when clients queued*/
+    int              gotClientDone;     /* true if workers are to exit       */
+    int              numLogThreads;     /* number of logfile writer threads  */
+    pthread_t       *logTids;           /* thread ids of logfile writers     */
+    List             logQueue;          /* logfile objs queued for writers   */
+    pthread_mutex_t  logQueueLock;      /* lock protecting logQueue          */
+    pthread_cond_t   logQueueCond;      /* cond signalled when logs queued   */
+    int              gotLogDone;        /* true if writers are to exit       */
+    int              numIndexLogs;      /* number of indexed logfiles        */
+    int              numAgedLogs;       /* number of logfiles rotated by age */
+    int              numReconfigs;      /* number of reconfigs requested     */
+    int              globalBufSize;     /* global buf size for console objs  */
+    int              globalScrollback;  /* global scrollback size (bytes)    */
     char            *globalLogName;     /* global log name (must contain &)  */
     logopt_t         globalLogOpts;     /* global opts for logfile objects   */
     seropt_t         globalSerOpts;     /* global opts for serial objects    */
+    List             triggers;          /* list of trigger_t's from config   */
+    trigger_set_t   *trigSet;           /* triggers compiled (or NULL)       */
+    resolver_t      *resolver;          /* reverse DNS resolver (or NULL)    */
 #if WITH_FREEIPMI
     ipmiopt_t        globalIpmiOpts;    /* global opts for ipmi objects      */
     int              numIpmiObjs;       /* number of ipmi consoles in config */
@@ -353,6 +688,8 @@ void process_config(server_conf_t *conf);
  */
 int process_client_escapes(obj_t *client, void *src, int len);
 
+void replay_console_log(obj_t *client, obj_t *console);
+
 
 /* server-ipmi.c
  */
@@ -393,6 +730,47 @@ obj_t * get_console_logfile_obj(obj_t *console);
 
 int write_log_data(obj_t *log, const void *src, int len);
 
+void start_logfile_writers(server_conf_t *conf);
+
+void stop_logfile_writers(server_conf_t *conf);
+
+void queue_logfile_write(obj_t *logfile, int gotReopen);
+
+int is_logfile_backlogged(obj_t *console);
+
+void destroy_logfile_index(obj_t *logfile);
+
+int find_logfile_range(const char *name, time_t t0, time_t t1,
+    off_t *offsetPtr, off_t *lengthPtr);
+
+int send_logfile_range(const char *name, off_t offset, off_t length,
+    int isCompressed, int sd);
+
+
+/*  server-mux.c
+ */
+void create_client_mux(obj_t *client);
+
+void destroy_client_mux(obj_t *client);
+
+void open_mux_stream(obj_t *client, obj_t *console);
+
+void close_mux_stream(obj_t *client, obj_t *console);
+
+int write_mux_frame(obj_t *client, obj_t *console, int type,
+    const void *src, int len, int isInfo);
+
+void notify_mux_data(obj_t *client);
+
+int is_mux_data_pending(obj_t *client);
+
+int get_mux_data(obj_t *client, struct iovec *iov, int *iovcnt_p,
+    int doAssemble);
+
+int put_mux_data(obj_t *client, unsigned char *ptr, int n);
+
+int process_mux_frames(obj_t *client, const unsigned char *src, int len);
+
 
 /*  server-obj.c
  */
@@ -405,16 +783,30 @@ void destroy_obj(obj_t *obj);
 
 void reopen_obj(obj_t *obj);
 
+void release_idle_rings(server_conf_t *conf);
+
 int format_obj_string(char *buf, int buflen, obj_t *obj, const char *fmt);
 
 int compare_objs(obj_t *obj1, obj_t *obj2);
 
 int find_obj(obj_t *obj, obj_t *key);
 
+obj_t * find_console_obj(server_conf_t *conf, const char *name);
+
+int find_console_objs(server_conf_t *conf, const char *prefix, int len,
+    obj_t ***objs_p);
+
+void sort_console_index(server_conf_t *conf);
+
+void destroy_console_index(server_conf_t *conf);
+
 int write_notify_msg(obj_t *console, int priority, char *fmt, ...);
 
 void notify_console_objs(obj_t *console, char *msg);
 
+int write_console_msg(obj_t *obj, obj_t *console, const char *msg,
+    int isInfo);
+
 void link_objs(obj_t *src, obj_t *dst);
 
 void unlink_objs(obj_t *src, obj_t *dst);
@@ -423,12 +815,41 @@ void unlink_obj(obj_t *obj);
 
 int shutdown_obj(obj_t *obj);
 
-int read_from_obj(obj_t *obj, tpoll_t tp);
+void register_obj_fd(obj_t *obj);
+
+void unregister_obj_fd(obj_t *obj);
+
+void set_obj_events(obj_t *obj);
+
+int read_from_obj(obj_t *obj);
+
+int begin_read_from_obj(obj_t *obj);
+
+int end_read_from_obj(obj_t *obj, unsigned char *buf, int n);
 
 int write_obj_data(obj_t *obj, const void *src, int len, int isInfo);
 
+int is_ring_data_pending(obj_t *client);
+
+int get_console_output(obj_t *console, uint64_t *seq_p, time_t *time_p,
+    unsigned char *dst, int len);
+
+off_t get_scrollback_len(obj_t *console);
+
+int open_scrollback_replay(obj_t *client, obj_t *console, off_t len);
+
+int open_log_replay(obj_t *client, obj_t *console, off_t len);
+
+void close_log_replay(obj_t *client);
+
+int is_replay_data_pending(obj_t *client);
+
 int write_to_obj(obj_t *obj);
 
+int begin_write_to_obj(obj_t *obj, struct iovec *iov, int *iovcnt_p);
+
+int end_write_to_obj(obj_t *obj, unsigned char *ptr, int n);
+
 
 /*  server-process.c
  */
@@ -441,6 +862,16 @@ obj_t * create_process_obj(server_conf_t *conf, char *name, List args,
 int open_process_obj(obj_t *process);
 
 
+/*  server-resolve.c
+ */
+void start_resolver(server_conf_t *conf);
+
+void stop_resolver(server_conf_t *conf);
+
+char * lookup_host_name(server_conf_t *conf, const struct in_addr *addr,
+    char *dst, int dstlen, int doWait);
+
+
 /*  server-serial.c
  */
 int is_serial_dev(const char *dev, const char *cwd, char **path_ref);
@@ -458,7 +889,15 @@ int open_serial_obj(obj_t *serial);
 
 /*  server-sock.c
  */
-void process_client(client_arg_t *args);
+void start_client_workers(server_conf_t *conf);
+
+void stop_client_workers(server_conf_t *conf);
+
+void queue_client(server_conf_t *conf, int sd);
+
+void log_query_cache_stats(server_conf_t *conf);
+
+void destroy_query_cache(server_conf_t *conf);
 
 
 /*  server-telnet.c
@@ -475,6 +914,23 @@ int process_telnet_escapes(obj_t *telnet, void *src, int len);
 int send_telnet_cmd(obj_t *telnet, int cmd, int opt);
 
 
+/*  server-trigger.c
+ */
+trigger_t * create_trigger(char *name, char *match, char *regex,
+    char *cmd, char *notify, int holdoff, int enableLog,
+    char *errbuf, int errlen);
+
+void destroy_trigger(trigger_t *trig);
+
+trigger_set_t * create_trigger_set(List triggers);
+
+void destroy_trigger_set(trigger_set_t *set);
+
+void scan_console_triggers(obj_t *console, const unsigned char *buf, int len);
+
+void destroy_trigger_state(trigstate_t *ts);
+
+
 /*  server-unixsock.c
  */
 int is_unixsock_dev(const char *dev, const char *cwd, char **path_ref);
@@ -40,6 +40,14 @@
 #include "log.h"
 #include "tpoll.h"
 
+#if HAVE_SYS_EPOLL_H
+#  include <sys/epoll.h>
+#endif /* HAVE_SYS_EPOLL_H */
+
+#if HAVE_SYS_EVENTFD_H
+#  include <sys/eventfd.h>
+#endif /* HAVE_SYS_EVENTFD_H */
+
 
 /*****************************************************************************
  *  Notes
@@ -57,15 +65,35 @@
  *  descriptors to the first empty slot in fd_array[], and maintaining a hash
  *  to map file descriptors onto the corresponding fd_array[] index.
  *
- *  This implementation assumes the number of concurrent active timers is
- *  moderate; as such, active timers are stored in a linked-list in order of
- *  increasing timevals (ie, the head of the list (timers_active) is the next
- *  timer to expire).  It does not scale well to a large number of timers
- *  because insertion and deletion are O(n), although dispatching is O(1).
- *  Other possible implementations are heaps [Sedgewick 1998] which are
- *  O(log n) for insertion, deletion, and dispatch; or hashed timing wheels
- *  [Varghese and Lauck 1996] which can be as efficient as O(1) for insertion,
- *  deletion, and dispatch.
+ *  When <sys/epoll.h> is available, the fd_array[] serves only as the record
+ *  of the events of interest for each file descriptor; the kernel maintains
+ *  the actual interest set, and it is only modified (via epoll_ctl()) when
+ *  tpoll_set() or tpoll_clear() changes the events for a file descriptor.
+ *  The cost of tpoll() is then proportional to the number of file descriptors
+ *  that are ready rather than to the number being polled.  The file
+ *  descriptors returned by the last tpoll() are recorded in fd_ready[] so
+ *  callers can walk them via tpoll_get_ready().  Since epoll does not support
+ *  regular files (which poll() always reports as ready), these are kept in
+ *  the fd_noep[] array and returned as ready whenever they are set.
+ *  Note that a file descriptor is implicitly removed from the kernel's
+ *  interest set when it is closed, so it must be cleared from the tpoll
+ *  object beforehand in case the same file descriptor is later reused.
+ *
+ *  Active timers are stored in a binary min-heap [Sedgewick 1998] ordered by
+ *  increasing timevals (ie, the root of the heap (timers_heap[0]) is the next
+ *  timer to expire), with ties broken by timer ID so timers expiring at the
+ *  same time are dispatched in the order in which they were set.  Each timer
+ *  records its index within the heap, and timers are hashed by ID so that
+ *  tpoll_timeout_cancel() can locate them without searching the heap.  As
+ *  such, insertion, deletion, and dispatch are all O(log n).  Hashed timing
+ *  wheels [Varghese and Lauck 1996] can be as efficient as O(1), but their
+ *  granularity would need to be tuned to the range of timeouts in use.
+ *
+ *  When <sys/eventfd.h> is available, the "signaling pipe" used to unblock
+ *  poll() is an eventfd; both ends of fd_pipe[] then refer to the same fd.
+ *  Since tpoll() returns once timers have been dispatched or tpoll_wake() has
+ *  been called, the caller can block indefinitely (ie, [ms] of -1) and still
+ *  re-examine any state changed by a timer callback or another thread.
  */
 
 
@@ -75,6 +103,12 @@
 
 #define TPOLL_ALLOC     256
 
+#define TPOLL_TIMERS_ALLOC      64
+
+#if HAVE_SYS_EPOLL_H
+#  define TPOLL_EPOLL_EVENTS    256
+#endif /* HAVE_SYS_EPOLL_H */
+
 
 /*****************************************************************************
  *  Internal Data Types
@@ -82,17 +116,36 @@
 
 typedef struct tpoll_timer * _tpoll_timer_t;
 
+#if HAVE_SYS_EVENTFD_H
+typedef eventfd_t _tpoll_signal_t;      /* eventfd counters are 8 bytes      */
+#else  /* !HAVE_SYS_EVENTFD_H */
+typedef unsigned char _tpoll_signal_t;
+#endif /* !HAVE_SYS_EVENTFD_H */
+
 struct tpoll {
     struct pollfd   *fd_array;          /* poll fd array                     */
     int              fd_pipe[ 2 ];      /* signal pipe for unblocking poll() */
     int              num_fds_alloc;     /* num pollfd structs allocated      */
     int              num_fds_used;      /* num pollfd structs in use         */
     int              max_fd;            /* max fd in array in use            */
-    _tpoll_timer_t   timers_active;     /* sorted list of active timers      */
+    int             *fd_ready;          /* fds w/ events from last tpoll()   */
+    int              num_fds_ready;     /* num fd_ready ints in use          */
+#if HAVE_SYS_EPOLL_H
+    int              ep_fd;             /* epoll instance fd                 */
+    struct epoll_event *ep_events;      /* epoll_wait() event array          */
+    int             *fd_noep;           /* fds not supported by epoll        */
+    int             *fd_noep_idx;       /* fd_noep[] index per fd, or -1     */
+    int              num_fds_noep;      /* num fd_noep ints in use           */
+#endif /* HAVE_SYS_EPOLL_H */
+    _tpoll_timer_t  *timers_heap;       /* min-heap of active timers         */
+    _tpoll_timer_t  *timers_hash;       /* active timers hashed by id        */
+    int              num_timers_alloc;  /* num heap & hash slots allocated   */
+    int              num_timers_used;   /* num active timers                 */
     int              timers_next_id;    /* next id to be assigned to a timer */
     pthread_mutex_t  mutex;             /* locking primitive                 */
     bool             is_blocked;        /* flag set when blocking on poll()  */
     bool             is_signaled;       /* flag set when fd_pipe is signaled */
+    bool             is_woken;          /* flag set by tpoll_wake()          */
     bool             is_mutex_inited;   /* flag set when mutex initialized   */
 };
 
@@ -101,7 +154,8 @@ struct tpoll_timer {
     callback_f       fnc;               /* callback function                 */
     void            *arg;               /* callback function arg             */
     struct timeval   tv;                /* expiration time                   */
-    _tpoll_timer_t   next;              /* next timer in list                */
+    int              heap_idx;          /* index into timers_heap[]          */
+    _tpoll_timer_t   hash_next;         /* next timer in hash chain          */
 };
 
 
@@ -117,6 +171,33 @@ static void _tpoll_signal_recv (tpoll_t tp);
 
 static int _tpoll_grow (tpoll_t tp, int num_fds_req);
 
+static void _tpoll_clear_ready (tpoll_t tp);
+
+#if HAVE_SYS_EPOLL_H
+static int _tpoll_epoll_ctl (tpoll_t tp, int fd, short int events_old,
+    short int events_new);
+
+static int _tpoll_epoll_ready (tpoll_t tp, int n);
+
+#else  /* !HAVE_SYS_EPOLL_H */
+static int _tpoll_poll_ready (tpoll_t tp, int n);
+
+#endif /* !HAVE_SYS_EPOLL_H */
+
+static int _tpoll_timers_grow (tpoll_t tp);
+
+static void _tpoll_timers_insert (tpoll_t tp, _tpoll_timer_t t);
+
+static void _tpoll_timers_remove (tpoll_t tp, _tpoll_timer_t t);
+
+static _tpoll_timer_t _tpoll_timers_find (tpoll_t tp, int id);
+
+static bool _tpoll_timers_less (_tpoll_timer_t t1, _tpoll_timer_t t2);
+
+static void _tpoll_timers_sift_up (tpoll_t tp, int i);
+
+static void _tpoll_timers_sift_down (tpoll_t tp, int i);
+
 static void _tpoll_get_timeval (struct timeval *tvp, int ms);
 
 static int _tpoll_diff_timeval (struct timeval *tvp1, struct timeval *tvp0);
@@ -147,19 +228,59 @@ tpoll_create (int n)
         goto err;
     }
     tp->fd_pipe[ 0 ] = tp->fd_pipe[ 1 ] = -1;
-    tp->timers_active = NULL;
+    tp->fd_array = NULL;
+    tp->fd_ready = NULL;
+    tp->max_fd = -1;
+    tp->timers_heap = NULL;
+    tp->timers_hash = NULL;
+    tp->num_timers_alloc = 0;
+    tp->num_timers_used = 0;
     tp->is_blocked = false;
     tp->is_signaled = false;
+    tp->is_woken = false;
     tp->is_mutex_inited = false;
+#if HAVE_SYS_EPOLL_H
+    tp->ep_fd = -1;
+    tp->ep_events = NULL;
+    tp->fd_noep = NULL;
+    tp->fd_noep_idx = NULL;
+    tp->num_fds_noep = 0;
+#endif /* HAVE_SYS_EPOLL_H */
 
     if (!(tp->fd_array = malloc (n * sizeof (struct pollfd)))) {
         goto err;
     }
+    if (!(tp->fd_ready = malloc (n * sizeof (int)))) {
+        goto err;
+    }
+#if HAVE_SYS_EPOLL_H
+    if (!(tp->fd_noep = malloc (n * sizeof (int)))) {
+        goto err;
+    }
+    if (!(tp->fd_noep_idx = malloc (n * sizeof (int)))) {
+        goto err;
+    }
+    for (i = 0; i < n; i++) {
+        tp->fd_noep_idx[ i ] = -1;
+    }
+    if (!(tp->ep_events =
+            malloc (TPOLL_EPOLL_EVENTS * sizeof (struct epoll_event)))) {
+        goto err;
+    }
+#endif /* HAVE_SYS_EPOLL_H */
     tp->num_fds_alloc = n;
 
+#if HAVE_SYS_EVENTFD_H
+    tp->fd_pipe[ 0 ] = eventfd (0, 0);
+    tp->fd_pipe[ 1 ] = tp->fd_pipe[ 0 ];
+    if (tp->fd_pipe[ 0 ] < 0) {
+        goto err;
+    }
+#else  /* !HAVE_SYS_EVENTFD_H */
     if (pipe (tp->fd_pipe) < 0) {
         goto err;
     }
+#endif /* !HAVE_SYS_EVENTFD_H */
     for (i = 0; i < 2; i++) {
         if ((fval = fcntl (tp->fd_pipe[ i ], F_GETFL, 0)) < 0) {
             goto err;
@@ -171,6 +292,20 @@ tpoll_create (int n)
             goto err;
         }
     }
+#if HAVE_SYS_EPOLL_H
+    /*  The signaling pipe is registered with epoll once here.
+     *    It is skipped when _tpoll_init() removes the other fds.
+     */
+    if ((tp->ep_fd = epoll_create (n)) < 0) {
+        goto err;
+    }
+    if (fcntl (tp->ep_fd, F_SETFD, FD_CLOEXEC) < 0) {
+        goto err;
+    }
+    if (_tpoll_epoll_ctl (tp, tp->fd_pipe[ 0 ], 0, POLLIN) < 0) {
+        goto err;
+    }
+#endif /* HAVE_SYS_EPOLL_H */
     if ((e = pthread_mutex_init (&tp->mutex, NULL)) != 0) {
         errno = e;
         goto err;
@@ -195,7 +330,6 @@ tpoll_destroy (tpoll_t tp)
 /*  Destroys the tpoll object [tp] and cancels all of its associated timers.
  */
     int            i;
-    _tpoll_timer_t t;
     int            e;
 
     if (!tp) {
@@ -210,16 +344,48 @@ tpoll_destroy (tpoll_t tp)
         free (tp->fd_array);
         tp->fd_array = NULL;
     }
+    if (tp->fd_ready) {
+        free (tp->fd_ready);
+        tp->fd_ready = NULL;
+    }
+#if HAVE_SYS_EPOLL_H
+    if (tp->ep_fd > -1) {
+        (void) close (tp->ep_fd);
+        tp->ep_fd = -1;
+    }
+    if (tp->ep_events) {
+        free (tp->ep_events);
+        tp->ep_events = NULL;
+    }
+    if (tp->fd_noep) {
+        free (tp->fd_noep);
+        tp->fd_noep = NULL;
+    }
+    if (tp->fd_noep_idx) {
+        free (tp->fd_noep_idx);
+        tp->fd_noep_idx = NULL;
+    }
+#endif /* HAVE_SYS_EPOLL_H */
+    if (tp->fd_pipe[ 1 ] == tp->fd_pipe[ 0 ]) {
+        tp->fd_pipe[ 1 ] = -1;          /* eventfd is only closed once */
+    }
     for (i = 0; i < 2; i++) {
         if (tp->fd_pipe[ i ] > -1) {
             (void) close (tp->fd_pipe[ i ]);
             tp->fd_pipe[ i ] = -1;
         }
     }
-    while (tp->timers_active) {
-        t = tp->timers_active;
-        tp->timers_active = t->next;
-        free (t);
+    for (i = 0; i < tp->num_timers_used; i++) {
+        free (tp->timers_heap[ i ]);
+    }
+    tp->num_timers_used = 0;
+    if (tp->timers_heap) {
+        free (tp->timers_heap);
+        tp->timers_heap = NULL;
+    }
+    if (tp->timers_hash) {
+        free (tp->timers_hash);
+        tp->timers_hash = NULL;
     }
     if (tp->is_mutex_inited) {
         if ((e = pthread_mutex_unlock (&tp->mutex)) != 0) {
@@ -298,7 +464,13 @@ tpoll_clear (tpoll_t tp, int fd, short int events)
         assert (tp->fd_array[ fd ].fd == fd);
         events_new = tp->fd_array[ fd ].events & ~events;
         if (tp->fd_array[ fd ].events != events_new) {
-
+#if HAVE_SYS_EPOLL_H
+            /*  An error here is ignored since the fd may have already been
+             *    closed, in which case the kernel has removed it anyways.
+             */
+            (void) _tpoll_epoll_ctl (tp, fd,
+                tp->fd_array[ fd ].events, events_new);
+#endif /* HAVE_SYS_EPOLL_H */
             tp->fd_array[ fd ].events = events_new;
 
             if (events_new == 0) {
@@ -315,7 +487,9 @@ tpoll_clear (tpoll_t tp, int fd, short int events)
                     tp->max_fd = i;
                 }
             }
+#if ! HAVE_SYS_EPOLL_H
             _tpoll_signal_send (tp);
+#endif /* !HAVE_SYS_EPOLL_H */
         }
     }
     if ((e = pthread_mutex_unlock (&tp->mutex)) != 0) {
@@ -364,6 +538,40 @@ tpoll_is_set (tpoll_t tp, int fd, short int events)
 }
 
 
+int
+tpoll_get_ready (tpoll_t tp, int *fds, int n)
+{
+/*  Copies up to [n] of the file descriptors for which events were returned
+ *    by the last call to tpoll() on the tpoll object [tp] into the array
+ *    [fds].  This allows the caller to examine only those file descriptors
+ *    that are ready instead of testing each one via tpoll_is_set().
+ *  Returns the number of file descriptors copied into [fds], or -1 on error.
+ */
+    int e;
+
+    if (!tp) {
+        errno = EINVAL;
+        return (-1);
+    }
+    if (!fds || (n < 0)) {
+        errno = EINVAL;
+        return (-1);
+    }
+    if ((e = pthread_mutex_lock (&tp->mutex)) != 0) {
+        log_err (errno = e, "Unable to lock tpoll mutex");
+    }
+    if (n > tp->num_fds_ready) {
+        n = tp->num_fds_ready;
+    }
+    memcpy (fds, tp->fd_ready, n * sizeof (int));
+
+    if ((e = pthread_mutex_unlock (&tp->mutex)) != 0) {
+        log_err (errno = e, "Unable to unlock tpoll mutex");
+    }
+    return (n);
+}
+
+
 int
 tpoll_set (tpoll_t tp, int fd, short int events)
 {
@@ -373,6 +581,7 @@ tpoll_set (tpoll_t tp, int fd, short int events)
  *  Returns 0 on success, or -1 on error.
  */
     int       rc;
+    short int events_old;
     short int events_new;
     int       e;
 
@@ -397,23 +606,33 @@ tpoll_set (tpoll_t tp, int fd, short int events)
         if (tp->fd_array[ fd ].fd < 0) {
             assert (tp->fd_array[ fd ].events == 0);
             assert (tp->fd_array[ fd ].revents == 0);
-            tp->fd_array[ fd ].fd = fd;
-            tp->num_fds_used++;
-            events_new = events;
+            events_old = 0;
         }
         else {
-            events_new = tp->fd_array[ fd ].events | events;
+            events_old = tp->fd_array[ fd ].events;
         }
-        if (tp->fd_array[ fd ].events != events_new) {
+        events_new = events_old | events;
+        rc = 0;
+#if HAVE_SYS_EPOLL_H
+        if (events_old != events_new) {
+            rc = _tpoll_epoll_ctl (tp, fd, events_old, events_new);
+        }
+#endif /* HAVE_SYS_EPOLL_H */
+        if ((events_old != events_new) && (rc == 0)) {
 
+            if (events_old == 0) {
+                tp->fd_array[ fd ].fd = fd;
+                tp->num_fds_used++;
+            }
             tp->fd_array[ fd ].events = events_new;
 
             if (fd > tp->max_fd) {
                 tp->max_fd = fd;
             }
+#if ! HAVE_SYS_EPOLL_H
             _tpoll_signal_send (tp);
+#endif /* !HAVE_SYS_EPOLL_H */
         }
-        rc = 0;
     }
     if ((e = pthread_mutex_unlock (&tp->mutex)) != 0) {
         log_err (errno = e, "Unable to unlock tpoll mutex");
@@ -432,7 +651,6 @@ tpoll_timeout_absolute (tpoll_t tp, callback_f cb, void *arg,
  *  Returns a timer ID > 0 for use with tpoll_timeout_cancel(), or -1 on error.
  */
     _tpoll_timer_t  t;
-    _tpoll_timer_t *t_ptr;
     int             rc;
     int             e;
 
@@ -458,19 +676,22 @@ tpoll_timeout_absolute (tpoll_t tp, callback_f cb, void *arg,
     if ((e = pthread_mutex_lock (&tp->mutex)) != 0) {
         log_err (errno = e, "Unable to lock tpoll mutex");
     }
-    rc = t->id = tp->timers_next_id++;
-    if (tp->timers_next_id <= 0) {
-        tp->timers_next_id = 1;
-    }
-    t_ptr = &tp->timers_active;
-    while (*t_ptr && !timercmp (tvp, &(*t_ptr)->tv, <)) {
-        t_ptr = &((*t_ptr)->next);
+    if ((tp->num_timers_used >= tp->num_timers_alloc)
+            && (_tpoll_timers_grow (tp) < 0)) {
+        free (t);
+        rc = -1;
     }
-    if (*t_ptr == tp->timers_active) {
-        _tpoll_signal_send (tp);
+    else {
+        rc = t->id = tp->timers_next_id++;
+        if (tp->timers_next_id <= 0) {
+            tp->timers_next_id = 1;
+        }
+        _tpoll_timers_insert (tp, t);
+
+        if (tp->timers_heap[ 0 ] == t) {
+            _tpoll_signal_send (tp);
+        }
     }
-    t->next = *t_ptr;
-    *t_ptr = t;
 
     if ((e = pthread_mutex_unlock (&tp->mutex)) != 0) {
         log_err (errno = e, "Unable to unlock tpoll mutex");
@@ -502,7 +723,6 @@ tpoll_timeout_cancel (tpoll_t tp, int id)
  *    or -1 on error.
  */
     _tpoll_timer_t  t;
-    _tpoll_timer_t *t_ptr;
     int             rc;
     int             e;
 
@@ -517,19 +737,14 @@ tpoll_timeout_cancel (tpoll_t tp, int id)
     if ((e = pthread_mutex_lock (&tp->mutex)) != 0) {
         log_err (errno = e, "Unable to lock tpoll mutex");
     }
-    t_ptr = &tp->timers_active;
-    while (*t_ptr && (id != (*t_ptr)->id)) {
-        t_ptr = &((*t_ptr)->next);
-    }
-    if (!*t_ptr) {
+    if (!(t = _tpoll_timers_find (tp, id))) {
         rc = 0;
     }
     else {
-        if (*t_ptr == tp->timers_active) {
+        if (t->heap_idx == 0) {
             _tpoll_signal_send (tp);
         }
-        t = *t_ptr;
-        *t_ptr = t->next;
+        _tpoll_timers_remove (tp, t);
         free (t);
         rc = 1;
     }
@@ -540,6 +755,33 @@ tpoll_timeout_cancel (tpoll_t tp, int id)
 }
 
 
+int
+tpoll_wake (tpoll_t tp)
+{
+/*  Wakes the tpoll object [tp], causing the current (or next) call to
+ *    tpoll() to return 0 so the caller can re-examine its state.
+ *  This is intended to be called by another thread.
+ *  Returns 0 on success, or -1 on error.
+ */
+    int e;
+
+    if (!tp) {
+        errno = EINVAL;
+        return (-1);
+    }
+    if ((e = pthread_mutex_lock (&tp->mutex)) != 0) {
+        log_err (errno = e, "Unable to lock tpoll mutex");
+    }
+    tp->is_woken = true;
+    _tpoll_signal_send (tp);
+
+    if ((e = pthread_mutex_unlock (&tp->mutex)) != 0) {
+        log_err (errno = e, "Unable to unlock tpoll mutex");
+    }
+    return (0);
+}
+
+
 int
 tpoll (tpoll_t tp, int ms)
 {
@@ -553,15 +795,20 @@ tpoll (tpoll_t tp, int ms)
  *    once they expire.
  *  Returns immediately if the [ms] timeout is 0, or if no I/O events are
  *    specified and no timers remain and [ms] is -1.
+ *  Returns early (with 0) once expired timers have been dispatched or
+ *    tpoll_wake() has been called.
  *  Returns the number of file descriptors with I/O ready, 0 on timeout,
  *    or -1 or error.
  */
     struct timeval  tv_timeout;
     struct timeval  tv_now;
     _tpoll_timer_t  t;
+    bool            is_dispatched = false;
     int             timeout;
     int             ms_diff;
+#if ! HAVE_SYS_EPOLL_H
     struct pollfd  *fd_array_bak;
+#endif /* !HAVE_SYS_EPOLL_H */
     int             n;
     int             e;
 
@@ -575,17 +822,18 @@ tpoll (tpoll_t tp, int ms)
     if ((e = pthread_mutex_lock (&tp->mutex)) != 0) {
         log_err (errno = e, "Unable to lock tpoll mutex");
     }
+    _tpoll_clear_ready (tp);
     _tpoll_get_timeval (&tv_now, 0);
 
     for (;;) {
         /*
          *  Dispatch timer events that have expired.
          */
-        while (tp->timers_active
-                && !timercmp (&tp->timers_active->tv, &tv_now, >)) {
+        while ((tp->num_timers_used > 0)
+                && !timercmp (&tp->timers_heap[ 0 ]->tv, &tv_now, >)) {
 
-            t = tp->timers_active;
-            tp->timers_active = t->next;
+            t = tp->timers_heap[ 0 ];
+            _tpoll_timers_remove (tp, t);
             /*
              *  Release the mutex while performing the callback function
              *    in case the callback wants to set/cancel another timer.
@@ -595,17 +843,27 @@ tpoll (tpoll_t tp, int ms)
             }
             t->fnc (t->arg);
             free (t);
+            is_dispatched = true;
 
             if ((e = pthread_mutex_lock (&tp->mutex)) != 0) {
                 log_err (errno = e, "Unable to lock tpoll mutex");
             }
         }
+        /*  Return to the caller if any timer callbacks have been performed
+         *    or a wakeup has been requested, since either may have changed
+         *    the state of the caller's file descriptors.
+         */
+        if (is_dispatched || tp->is_woken) {
+            tp->is_woken = false;
+            n = 0;
+            break;
+        }
         /*  Compute timeout for poll().
          */
         if (ms == 0) {
             timeout = 0;
         }
-        else if ((ms < 0) && !tp->timers_active) {
+        else if ((ms < 0) && !tp->num_timers_used) {
             if (tp->num_fds_used > 0) {
                 timeout = -1;           /* fd events but no more timers */
             }
@@ -617,19 +875,19 @@ tpoll (tpoll_t tp, int ms)
             _tpoll_get_timeval (&tv_now, 0);
 
             if (ms < 0) {
-                assert (tp->timers_active != NULL);
+                assert (tp->num_timers_used > 0);
                 ms_diff =
-                    _tpoll_diff_timeval (&tp->timers_active->tv, &tv_now);
+                    _tpoll_diff_timeval (&tp->timers_heap[ 0 ]->tv, &tv_now);
             }
-            else if (!tp->timers_active) {
+            else if (!tp->num_timers_used) {
                 assert (ms > 0);
                 ms_diff =
                     _tpoll_diff_timeval (&tv_timeout, &tv_now);
             }
-            else if (!timercmp (&tp->timers_active->tv, &tv_timeout, >)) {
+            else if (!timercmp (&tp->timers_heap[ 0 ]->tv, &tv_timeout, >)) {
                 assert (ms > 0);
                 ms_diff =
-                    _tpoll_diff_timeval (&tp->timers_active->tv, &tv_now);
+                    _tpoll_diff_timeval (&tp->timers_heap[ 0 ]->tv, &tv_now);
             }
             else {
                 assert (ms > 0);
@@ -638,6 +896,33 @@ tpoll (tpoll_t tp, int ms)
             }
             timeout = (ms_diff > 0) ? ms_diff : 0;
         }
+#if HAVE_SYS_EPOLL_H
+        /*  Wait for events, discarding any on the "signaling pipe".
+         *    The ep_events array is never reallocated, so it remains valid
+         *    while the mutex is released.  Fds not supported by epoll are
+         *    always ready, so don't block if any of those are set.
+         */
+        if (tp->num_fds_noep > 0) {
+            timeout = 0;
+        }
+        tp->is_blocked = true;
+
+        if ((e = pthread_mutex_unlock (&tp->mutex)) != 0) {
+            log_err (errno = e, "Unable to unlock tpoll mutex");
+        }
+        n = epoll_wait (tp->ep_fd, tp->ep_events, TPOLL_EPOLL_EVENTS, timeout);
+
+        if ((e = pthread_mutex_lock (&tp->mutex)) != 0) {
+            log_err (errno = e, "Unable to lock tpoll mutex");
+        }
+        tp->is_blocked = false;
+
+        if (n < 0) {
+            break;
+        }
+        n = _tpoll_epoll_ready (tp, n);
+
+#else  /* !HAVE_SYS_EPOLL_H */
         /*  Poll for events, discarding any on the "signaling pipe".
          *    A copy of the fd_array ptr is made before calling poll() in order
          *    to check if _tpoll_grow()'s realloc has changed the memory
@@ -668,12 +953,15 @@ tpoll (tpoll_t tp, int ms)
             _tpoll_signal_recv (tp);
             n--;
         }
+        n = _tpoll_poll_ready (tp, n);
+
+#endif /* !HAVE_SYS_EPOLL_H */
         if (n > 0) {
             assert (tp->num_fds_used > 0);
             break;
         }
         if ((ms == 0)
-                || ((ms < 0) && !tp->num_fds_used && !tp->timers_active)) {
+                || ((ms < 0) && !tp->num_fds_used && !tp->num_timers_used)) {
             break;
         }
         _tpoll_get_timeval (&tv_now, 0);
@@ -699,7 +987,6 @@ _tpoll_init (tpoll_t tp, tpoll_zero_t how)
  *  This routine assumes the [tp] mutex is already locked.
  */
     int            i;
-    _tpoll_timer_t t;
 
     assert (tp != NULL);
     assert (tp->fd_pipe[ 0 ] > -1);
@@ -707,6 +994,14 @@ _tpoll_init (tpoll_t tp, tpoll_zero_t how)
     assert ((how & ~TPOLL_ZERO_ALL) == 0);
 
     if (how & TPOLL_ZERO_FDS) {
+#if HAVE_SYS_EPOLL_H
+        for (i = 0; i <= tp->max_fd; i++) {
+            if ((tp->fd_array[ i ].fd > -1) && (i != tp->fd_pipe[ 0 ])) {
+                (void) _tpoll_epoll_ctl (tp, i, tp->fd_array[ i ].events, 0);
+            }
+        }
+        assert (tp->num_fds_noep == 0);
+#endif /* HAVE_SYS_EPOLL_H */
         memset (tp->fd_array, 0, tp->num_fds_alloc * sizeof (struct pollfd));
         for (i = 0; i < tp->num_fds_alloc; i++) {
             tp->fd_array[ i ].fd = -1;
@@ -715,12 +1010,16 @@ _tpoll_init (tpoll_t tp, tpoll_zero_t how)
         tp->fd_array[ tp->fd_pipe[ 0 ] ].events = POLLIN;
         tp->max_fd = tp->fd_pipe[ 0 ];
         tp->num_fds_used = 0;
+        tp->num_fds_ready = 0;
     }
     if (how & TPOLL_ZERO_TIMERS) {
-        while (tp->timers_active) {
-            t = tp->timers_active;
-            tp->timers_active = t->next;
-            free (t);
+        for (i = 0; i < tp->num_timers_used; i++) {
+            free (tp->timers_heap[ i ]);
+        }
+        tp->num_timers_used = 0;
+        if (tp->timers_hash) {
+            memset (tp->timers_hash, 0,
+                tp->num_timers_alloc * sizeof (_tpoll_timer_t));
         }
         tp->timers_next_id = 1;
     }
@@ -735,8 +1034,8 @@ _tpoll_signal_send (tpoll_t tp)
  *    and poll() needs to unblock and re-examine its state.
  *  This routine assumes the [tp] mutex is already locked.
  */
-    int           n;
-    unsigned char c = 0;
+    int             n;
+    _tpoll_signal_t c = 1;
 
     assert (tp != NULL);
     assert (tp->fd_pipe[ 1 ] > -1);
@@ -745,7 +1044,7 @@ _tpoll_signal_send (tpoll_t tp)
         return;
     }
     for (;;) {
-        n = write (tp->fd_pipe[ 1 ], &c, 1);
+        n = write (tp->fd_pipe[ 1 ], &c, sizeof (c));
         if (n < 0) {
             if (errno == EINTR) {
                 continue;
@@ -771,8 +1070,8 @@ _tpoll_signal_recv (tpoll_t tp)
 /*  Drains all signals sent to the tpoll object [tp].
  *  This routine assumes the [tp] mutex is already locked.
  */
-    int           n;
-    unsigned char c[ 2 ];
+    int             n;
+    _tpoll_signal_t c[ 2 ];
 
     assert (tp != NULL);
     assert (tp->fd_pipe[ 0 ] > -1);
@@ -815,6 +1114,7 @@ _tpoll_grow (tpoll_t tp, int num_fds_req)
  */
     struct pollfd *fd_array_tmp;
     struct pollfd *fd_array_new;
+    int           *fd_tmp;
     int            num_fds_tmp;
     int            num_fds_new;
     int            i;
@@ -848,11 +1148,407 @@ _tpoll_grow (tpoll_t tp, int num_fds_req)
         fd_array_tmp[ i ].fd = -1;
     }
     tp->fd_array = fd_array_tmp;
+    /*
+     *  The remaining arrays are indexed up to num_fds_alloc, so an array
+     *    that grows before a subsequent realloc fails is simply oversized.
+     */
+    if (!(fd_tmp = realloc (tp->fd_ready, num_fds_tmp * sizeof (int)))) {
+        return (-1);
+    }
+    tp->fd_ready = fd_tmp;
+#if HAVE_SYS_EPOLL_H
+    if (!(fd_tmp = realloc (tp->fd_noep, num_fds_tmp * sizeof (int)))) {
+        return (-1);
+    }
+    tp->fd_noep = fd_tmp;
+    if (!(fd_tmp = realloc (tp->fd_noep_idx, num_fds_tmp * sizeof (int)))) {
+        return (-1);
+    }
+    for (i = tp->num_fds_alloc; i < num_fds_tmp; i++) {
+        fd_tmp[ i ] = -1;
+    }
+    tp->fd_noep_idx = fd_tmp;
+#endif /* HAVE_SYS_EPOLL_H */
     tp->num_fds_alloc = num_fds_tmp;
     return (0);
 }
 
 
+static void
+_tpoll_clear_ready (tpoll_t tp)
+{
+/*  Clears the events returned by the last tpoll() for the [tp] object.
+ *  This routine assumes the [tp] mutex is already locked.
+ */
+    int i;
+    int fd;
+
+    assert (tp != NULL);
+
+    for (i = 0; i < tp->num_fds_ready; i++) {
+        fd = tp->fd_ready[ i ];
+        assert ((fd >= 0) && (fd < tp->num_fds_alloc));
+        tp->fd_array[ fd ].revents = 0;
+    }
+    tp->num_fds_ready = 0;
+    return;
+}
+
+
+#if HAVE_SYS_EPOLL_H
+
+static int
+_tpoll_epoll_ctl (tpoll_t tp, int fd, short int events_old,
+    short int events_new)
+{
+/*  Changes the kernel's interest set for file descriptor [fd] within the
+ *    tpoll object [tp] from [events_old] to [events_new].  An fd is added
+ *    if [events_old] is 0, and removed if [events_new] is 0.
+ *  Fds not supported by epoll (eg, regular files) are tracked in fd_noep[].
+ *  Returns 0 on success, or -1 on error.
+ *  This routine assumes the [tp] mutex is already locked.
+ */
+    struct epoll_event ev;
+    int                op;
+    int                i;
+    int                fd_last;
+
+    assert (tp != NULL);
+    assert (tp->ep_fd > -1);
+    assert ((fd >= 0) && (fd < tp->num_fds_alloc));
+    assert (events_old != events_new);
+
+    if (tp->fd_noep_idx[ fd ] > -1) {
+        if (events_new != 0) {
+            return (0);
+        }
+        i = tp->fd_noep_idx[ fd ];
+        fd_last = tp->fd_noep[ --tp->num_fds_noep ];
+        tp->fd_noep[ i ] = fd_last;
+        tp->fd_noep_idx[ fd_last ] = i;
+        tp->fd_noep_idx[ fd ] = -1;
+        return (0);
+    }
+    if (events_old == 0) {
+        op = EPOLL_CTL_ADD;
+    }
+    else if (events_new == 0) {
+        op = EPOLL_CTL_DEL;
+    }
+    else {
+        op = EPOLL_CTL_MOD;
+    }
+    /*  The epoll event bits match their poll() counterparts on Linux.
+     */
+    memset (&ev, 0, sizeof (ev));
+    ev.events = (unsigned short int) events_new;
+    ev.data.fd = fd;
+
+    if (epoll_ctl (tp->ep_fd, op, fd, &ev) == 0) {
+        return (0);
+    }
+    /*  If the fd was closed and reopened without first being cleared,
+     *    the kernel will have already removed it from the interest set.
+     */
+    if ((op == EPOLL_CTL_MOD) && (errno == ENOENT)) {
+        op = EPOLL_CTL_ADD;
+        if (epoll_ctl (tp->ep_fd, op, fd, &ev) == 0) {
+            return (0);
+        }
+    }
+    if ((op == EPOLL_CTL_ADD) && (errno == EPERM)) {
+        tp->fd_noep_idx[ fd ] = tp->num_fds_noep;
+        tp->fd_noep[ tp->num_fds_noep++ ] = fd;
+        /*
+         *  Force a blocked tpoll() to recompute its timeout.
+         */
+        _tpoll_signal_send (tp);
+        return (0);
+    }
+    return (-1);
+}
+
+
+static int
+_tpoll_epoll_ready (tpoll_t tp, int n)
+{
+/*  Records the [n] events returned by epoll_wait() for the [tp] object,
+ *    draining any signals sent to the "signaling pipe".  Fds not supported
+ *    by epoll are always ready.
+ *  Returns the number of file descriptors with events.
+ *  This routine assumes the [tp] mutex is already locked.
+ */
+    int       i;
+    int       fd;
+    short int revents;
+
+    assert (tp != NULL);
+    assert (tp->num_fds_ready == 0);
+
+    for (i = 0; i < n; i++) {
+        fd = tp->ep_events[ i ].data.fd;
+        if (fd == tp->fd_pipe[ 0 ]) {
+            _tpoll_signal_recv (tp);
+            continue;
+        }
+        /*  Ignore events for an fd that was cleared while blocked.
+         */
+        if ((fd > tp->max_fd) || (tp->fd_array[ fd ].fd < 0)) {
+            continue;
+        }
+        revents = tp->ep_events[ i ].events
+            & (tp->fd_array[ fd ].events | POLLERR | POLLHUP);
+        if (revents == 0) {
+            continue;
+        }
+        tp->fd_array[ fd ].revents = revents;
+        tp->fd_ready[ tp->num_fds_ready++ ] = fd;
+    }
+    for (i = 0; i < tp->num_fds_noep; i++) {
+        fd = tp->fd_noep[ i ];
+        revents = tp->fd_array[ fd ].events & (POLLIN | POLLOUT);
+        if (revents == 0) {
+            continue;
+        }
+        tp->fd_array[ fd ].revents = revents;
+        tp->fd_ready[ tp->num_fds_ready++ ] = fd;
+    }
+    return (tp->num_fds_ready);
+}
+
+#else  /* !HAVE_SYS_EPOLL_H */
+
+static int
+_tpoll_poll_ready (tpoll_t tp, int n)
+{
+/*  Records the file descriptors for which events were returned by poll()
+ *    for the [tp] object, where [n] is the number of such descriptors
+ *    (not including the "signaling pipe").
+ *  Returns [n].
+ *  This routine assumes the [tp] mutex is already locked.
+ */
+    int fd;
+
+    assert (tp != NULL);
+    assert (tp->num_fds_ready == 0);
+
+    for (fd = 0; (fd <= tp->max_fd) && (tp->num_fds_ready < n); fd++) {
+        if ((fd != tp->fd_pipe[ 0 ]) && (tp->fd_array[ fd ].fd > -1)
+                && (tp->fd_array[ fd ].revents != 0)) {
+            tp->fd_ready[ tp->num_fds_ready++ ] = fd;
+        }
+    }
+    return (n);
+}
+
+#endif /* !HAVE_SYS_EPOLL_H */
+
+
+static int
+_tpoll_timers_grow (tpoll_t tp)
+{
+/*  Doubles the number of timer slots allocated for [tp]'s heap and hash
+ *    table, rehashing the active timers into the new hash table.
+ *  Returns 0 if the request is successful, -1 if not.
+ *  This routine assumes the [tp] mutex is already locked.
+ */
+    _tpoll_timer_t *heap_tmp;
+    _tpoll_timer_t *hash_tmp;
+    int             num_tmp;
+    int             i;
+    _tpoll_timer_t  t;
+
+    assert (tp != NULL);
+
+    num_tmp = (tp->num_timers_alloc > 0)
+        ? tp->num_timers_alloc * 2 : TPOLL_TIMERS_ALLOC;
+    if (num_tmp <= tp->num_timers_alloc) {
+        errno = ENOMEM;
+        return (-1);
+    }
+    if (!(hash_tmp = calloc (num_tmp, sizeof (_tpoll_timer_t)))) {
+        return (-1);
+    }
+    if (!(heap_tmp =
+            realloc (tp->timers_heap, num_tmp * sizeof (_tpoll_timer_t)))) {
+        free (hash_tmp);
+        return (-1);
+    }
+    tp->timers_heap = heap_tmp;
+
+    if (tp->timers_hash) {
+        free (tp->timers_hash);
+    }
+    tp->timers_hash = hash_tmp;
+    tp->num_timers_alloc = num_tmp;
+
+    for (i = 0; i < tp->num_timers_used; i++) {
+        t = tp->timers_heap[ i ];
+        t->hash_next = tp->timers_hash[ t->id & (num_tmp - 1) ];
+        tp->timers_hash[ t->id & (num_tmp - 1) ] = t;
+    }
+    return (0);
+}
+
+
+static void
+_tpoll_timers_insert (tpoll_t tp, _tpoll_timer_t t)
+{
+/*  Inserts the timer [t] into [tp]'s heap and hash table.
+ *  This routine assumes the [tp] mutex is already locked, and that a slot
+ *    has already been allocated for the new timer.
+ */
+    int n;
+
+    assert (tp != NULL);
+    assert (t != NULL);
+    assert (tp->num_timers_used < tp->num_timers_alloc);
+
+    n = t->id & (tp->num_timers_alloc - 1);
+    t->hash_next = tp->timers_hash[ n ];
+    tp->timers_hash[ n ] = t;
+
+    t->heap_idx = tp->num_timers_used++;
+    tp->timers_heap[ t->heap_idx ] = t;
+    _tpoll_timers_sift_up (tp, t->heap_idx);
+    return;
+}
+
+
+static void
+_tpoll_timers_remove (tpoll_t tp, _tpoll_timer_t t)
+{
+/*  Removes the timer [t] from [tp]'s heap and hash table.
+ *    The timer itself is not freed.
+ *  This routine assumes the [tp] mutex is already locked.
+ */
+    _tpoll_timer_t *t_ptr;
+    _tpoll_timer_t  t_last;
+    int             i;
+
+    assert (tp != NULL);
+    assert (t != NULL);
+    assert (t->heap_idx < tp->num_timers_used);
+    assert (tp->timers_heap[ t->heap_idx ] == t);
+
+    t_ptr = &tp->timers_hash[ t->id & (tp->num_timers_alloc - 1) ];
+    while (*t_ptr != t) {
+        assert (*t_ptr != NULL);
+        t_ptr = &((*t_ptr)->hash_next);
+    }
+    *t_ptr = t->hash_next;
+
+    i = t->heap_idx;
+    t_last = tp->timers_heap[ --tp->num_timers_used ];
+    if (t_last != t) {
+        tp->timers_heap[ i ] = t_last;
+        t_last->heap_idx = i;
+        if ((i > 0)
+                && _tpoll_timers_less (t_last, tp->timers_heap[ (i-1) / 2 ])) {
+            _tpoll_timers_sift_up (tp, i);
+        }
+        else {
+            _tpoll_timers_sift_down (tp, i);
+        }
+    }
+    return;
+}
+
+
+static _tpoll_timer_t
+_tpoll_timers_find (tpoll_t tp, int id)
+{
+/*  Returns the active timer [id] within [tp], or NULL if not found.
+ *  This routine assumes the [tp] mutex is already locked.
+ */
+    _tpoll_timer_t t;
+
+    assert (tp != NULL);
+
+    if (tp->num_timers_alloc == 0) {
+        return (NULL);
+    }
+    t = tp->timers_hash[ id & (tp->num_timers_alloc - 1) ];
+    while (t && (t->id != id)) {
+        t = t->hash_next;
+    }
+    return (t);
+}
+
+
+static bool
+_tpoll_timers_less (_tpoll_timer_t t1, _tpoll_timer_t t2)
+{
+/*  Returns true if timer [t1] expires before timer [t2].
+ *  Timers with the same expiration time are ordered by ID.
+ */
+    if (timercmp (&t1->tv, &t2->tv, !=)) {
+        return (timercmp (&t1->tv, &t2->tv, <));
+    }
+    return (t1->id < t2->id);
+}
+
+
+static void
+_tpoll_timers_sift_up (tpoll_t tp, int i)
+{
+/*  Restores the heap property by moving the timer at index [i] of [tp]'s
+ *    heap up towards the root.
+ *  This routine assumes the [tp] mutex is already locked.
+ */
+    _tpoll_timer_t t;
+    int            parent;
+
+    t = tp->timers_heap[ i ];
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!_tpoll_timers_less (t, tp->timers_heap[ parent ])) {
+            break;
+        }
+        tp->timers_heap[ i ] = tp->timers_heap[ parent ];
+        tp->timers_heap[ i ]->heap_idx = i;
+        i = parent;
+    }
+    tp->timers_heap[ i ] = t;
+    t->heap_idx = i;
+    return;
+}
+
+
+static void
+_tpoll_timers_sift_down (tpoll_t tp, int i)
+{
+/*  Restores the heap property by moving the timer at index [i] of [tp]'s
+ *    heap down towards the leaves.
+ *  This routine assumes the [tp] mutex is already locked.
+ */
+    _tpoll_timer_t t;
+    int            child;
+
+    t = tp->timers_heap[ i ];
+    for (;;) {
+        child = (2 * i) + 1;
+        if (child >= tp->num_timers_used) {
+            break;
+        }
+        if ((child + 1 < tp->num_timers_used)
+                && _tpoll_timers_less (tp->timers_heap[ child + 1 ],
+                    tp->timers_heap[ child ])) {
+            child++;
+        }
+        if (!_tpoll_timers_less (tp->timers_heap[ child ], t)) {
+            break;
+        }
+        tp->timers_heap[ i ] = tp->timers_heap[ child ];
+        tp->timers_heap[ i ]->heap_idx = i;
+        i = child;
+    }
+    tp->timers_heap[ i ] = t;
+    t->heap_idx = i;
+    return;
+}
+
+
 static void
 _tpoll_get_timeval (struct timeval *tvp, int ms)
 {
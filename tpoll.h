@@ -67,6 +67,8 @@ int tpoll_clear (tpoll_t tp, int fd, short int events);
 
 int tpoll_is_set (tpoll_t tp, int fd, short int events);
 
+int tpoll_get_ready (tpoll_t tp, int *fds, int n);
+
 int tpoll_set (tpoll_t tp, int fd, short int events);
 
 int tpoll_timeout_absolute (tpoll_t tp, callback_f cb, void *arg,
@@ -76,6 +78,8 @@ int tpoll_timeout_relative (tpoll_t tp, callback_f cb, void *arg, int ms);
 
 int tpoll_timeout_cancel (tpoll_t tp, int id);
 
+int tpoll_wake (tpoll_t tp);
+
 int tpoll (tpoll_t tp, int ms);
 
 
@@ -0,0 +1,490 @@
+/*****************************************************************************
+ *  Written by Chris Dunlap <cdunlap@llnl.gov>.
+ *  Copyright (C) 2007-2013 Lawrence Livermore National Security, LLC.
+ *  Copyright (C) 2001-2007 The Regents of the University of California.
+ *  UCRL-CODE-2002-009.
+ *
+ *  This file is part of ConMan: The Console Manager.
+ *  For details, see <http://conman.googlecode.com/>.
+ *
+ *  ConMan is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  ConMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with ConMan.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "bool.h"
+#include "uring.h"
+
+#if HAVE_LINUX_IO_URING_H
+#  include <linux/io_uring.h>
+#endif /* HAVE_LINUX_IO_URING_H */
+
+
+/*****************************************************************************
+ *  Notes
+ *****************************************************************************
+ *  This is a minimal wrapper around the Linux io_uring interface for issuing
+ *  a batch of read() and writev() requests with a single system call.  It
+ *  uses the raw system calls so as not to require liburing.
+ *
+ *  A batch is queued via uring_read() and uring_writev(), submitted via
+ *  uring_submit() (which waits for every request in the batch to complete),
+ *  and its completions are then retrieved via uring_reap().  The file
+ *  descriptors are expected to be non-blocking and ready for I/O (eg, as
+ *  reported by tpoll), so a batch completes without waiting on a device.
+ *
+ *  One read buffer of [buf_len] bytes is allocated for each submission queue
+ *  entry.  These are registered with the kernel (if permitted) in order to
+ *  avoid mapping the user pages on every read.
+ *
+ *  If io_uring is not supported at compile-time or run-time, uring_create()
+ *  returns NULL and the caller is expected to fall back to read()/writev().
+ *
+ *  This implementation is NOT thread-safe.  Each uring object is intended
+ *  to be used by a single I/O thread.
+ */
+
+
+/*****************************************************************************
+ *  Internal Data Types
+ *****************************************************************************/
+
+#if HAVE_LINUX_IO_URING_H && defined(__NR_io_uring_setup)
+
+struct uring {
+    int                  fd;            /* io_uring file descriptor          */
+    unsigned int         num_entries;   /* num entries in submission queue   */
+    unsigned int         num_queued;    /* num requests not yet submitted    */
+    unsigned int         num_inflight;  /* num requests not yet reaped       */
+    void                *sq_ptr;        /* mmap'd submission queue ring      */
+    size_t               sq_len;        /* length of sq_ptr mapping          */
+    void                *cq_ptr;        /* mmap'd completion queue ring      */
+    size_t               cq_len;        /* length of cq_ptr mapping          */
+    struct io_uring_sqe *sqes;          /* mmap'd submission queue entries   */
+    size_t               sqes_len;      /* length of sqes mapping            */
+    unsigned int        *sq_head;       /* submission queue head (kernel)    */
+    unsigned int        *sq_tail;       /* submission queue tail (user)      */
+    unsigned int        *sq_mask;       /* submission queue index mask       */
+    unsigned int        *sq_array;      /* submission queue sqe indices      */
+    unsigned int        *cq_head;       /* completion queue head (user)      */
+    unsigned int        *cq_tail;       /* completion queue tail (kernel)    */
+    unsigned int        *cq_mask;       /* completion queue index mask       */
+    struct io_uring_cqe *cqes;          /* completion queue entries          */
+    unsigned char       *bufs;          /* read bufs (one per sqe)           */
+    int                  buf_len;       /* length of each read buf           */
+    bool                 got_fixed;     /* true if bufs registered w/ kernel */
+};
+
+
+/*****************************************************************************
+ *  Internal Prototypes
+ *****************************************************************************/
+
+static struct io_uring_sqe * _uring_get_sqe (uring_t ur);
+
+static int _uring_enter (uring_t ur, unsigned int to_submit,
+    unsigned int min_complete);
+
+
+/*****************************************************************************
+ *  Functions
+ *****************************************************************************/
+
+uring_t
+uring_create (int n, int buf_len)
+{
+/*  Creates a new uring object with at least [n] submission queue entries
+ *    and a read buffer of [buf_len] bytes for each of them.
+ *  Returns the new uring object, or NULL on error (with errno set).
+ */
+    struct io_uring_params  p;
+    uring_t                 ur;
+    struct iovec           *iov;
+    unsigned int            i;
+    int                     e;
+
+    if ((n <= 0) || (buf_len <= 0)) {
+        errno = EINVAL;
+        return (NULL);
+    }
+    if (!(ur = malloc (sizeof (*ur)))) {
+        errno = ENOMEM;
+        return (NULL);
+    }
+    memset (ur, 0, sizeof (*ur));
+    ur->sq_ptr = ur->cq_ptr = ur->sqes = MAP_FAILED;
+
+    memset (&p, 0, sizeof (p));
+    if ((ur->fd = syscall (__NR_io_uring_setup, n, &p)) < 0) {
+        goto err;
+    }
+    ur->num_entries = p.sq_entries;
+    ur->sq_len = p.sq_off.array + (p.sq_entries * sizeof (unsigned int));
+    ur->cq_len = p.cq_off.cqes + (p.cq_entries * sizeof (struct io_uring_cqe));
+
+    /*  Map the submission and completion queue rings.
+     *  If supported, both rings are mapped via a single mmap().
+     */
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ur->cq_len > ur->sq_len) {
+            ur->sq_len = ur->cq_len;
+        }
+        ur->cq_len = 0;
+    }
+    ur->sq_ptr = mmap (NULL, ur->sq_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+    if (ur->sq_ptr == MAP_FAILED) {
+        goto err;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ur->cq_ptr = ur->sq_ptr;
+    }
+    else {
+        ur->cq_ptr = mmap (NULL, ur->cq_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING);
+        if (ur->cq_ptr == MAP_FAILED) {
+            goto err;
+        }
+    }
+    ur->sqes_len = p.sq_entries * sizeof (struct io_uring_sqe);
+    ur->sqes = mmap (NULL, ur->sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+    if (ur->sqes == MAP_FAILED) {
+        goto err;
+    }
+    ur->sq_head  = (unsigned int *) ((char *) ur->sq_ptr + p.sq_off.head);
+    ur->sq_tail  = (unsigned int *) ((char *) ur->sq_ptr + p.sq_off.tail);
+    ur->sq_mask  = (unsigned int *) ((char *) ur->sq_ptr + p.sq_off.ring_mask);
+    ur->sq_array = (unsigned int *) ((char *) ur->sq_ptr + p.sq_off.array);
+    ur->cq_head  = (unsigned int *) ((char *) ur->cq_ptr + p.cq_off.head);
+    ur->cq_tail  = (unsigned int *) ((char *) ur->cq_ptr + p.cq_off.tail);
+    ur->cq_mask  = (unsigned int *) ((char *) ur->cq_ptr + p.cq_off.ring_mask);
+    ur->cqes = (struct io_uring_cqe *) ((char *) ur->cq_ptr + p.cq_off.cqes);
+
+    /*  Allocate and register the read buffers.
+     *  Registration can fail if the buffers would exceed RLIMIT_MEMLOCK;
+     *    in that case, the buffers are used unregistered.
+     */
+    ur->buf_len = buf_len;
+    if (!(ur->bufs = malloc (ur->num_entries * buf_len))) {
+        errno = ENOMEM;
+        goto err;
+    }
+    if ((iov = malloc (ur->num_entries * sizeof (struct iovec)))) {
+        for (i = 0; i < ur->num_entries; i++) {
+            iov[ i ].iov_base = ur->bufs + (i * buf_len);
+            iov[ i ].iov_len = buf_len;
+        }
+        ur->got_fixed = (syscall (__NR_io_uring_register, ur->fd,
+            IORING_REGISTER_BUFFERS, iov, ur->num_entries) == 0);
+        free (iov);
+    }
+    return (ur);
+
+err:
+    e = errno;
+    uring_destroy (ur);
+    errno = e;
+    return (NULL);
+}
+
+
+void
+uring_destroy (uring_t ur)
+{
+/*  Destroys the uring object [ur].
+ */
+    if (!ur) {
+        return;
+    }
+    if (ur->sqes != MAP_FAILED) {
+        (void) munmap (ur->sqes, ur->sqes_len);
+    }
+    if ((ur->cq_ptr != MAP_FAILED) && (ur->cq_ptr != ur->sq_ptr)) {
+        (void) munmap (ur->cq_ptr, ur->cq_len);
+    }
+    if (ur->sq_ptr != MAP_FAILED) {
+        (void) munmap (ur->sq_ptr, ur->sq_len);
+    }
+    if (ur->fd >= 0) {
+        (void) close (ur->fd);
+    }
+    free (ur->bufs);
+    free (ur);
+    return;
+}
+
+
+void *
+uring_get_buf (uring_t ur, int idx)
+{
+/*  Returns a ptr to the read buffer [idx] of the uring object [ur],
+ *    or NULL on error.
+ */
+    if (!ur || (idx < 0) || (idx >= (int) ur->num_entries)) {
+        errno = EINVAL;
+        return (NULL);
+    }
+    return (ur->bufs + (idx * ur->buf_len));
+}
+
+
+int
+uring_read (uring_t ur, int fd, int idx, int len, int id)
+{
+/*  Queues a read of up to [len] bytes from [fd] into the read buffer [idx]
+ *    of the uring object [ur].  The request is identified by [id] upon
+ *    completion.
+ *  Returns 0 on success, or -1 on error (with errno set to EBUSY if the
+ *    submission queue is full).
+ */
+    struct io_uring_sqe *sqe;
+
+    if (!ur || (fd < 0) || (idx < 0) || (idx >= (int) ur->num_entries)
+            || (len < 0) || (len > ur->buf_len)) {
+        errno = EINVAL;
+        return (-1);
+    }
+    if (!(sqe = _uring_get_sqe (ur))) {
+        return (-1);
+    }
+    sqe->opcode = ur->got_fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) (ur->bufs + (idx * ur->buf_len));
+    sqe->len = len;
+    sqe->buf_index = ur->got_fixed ? idx : 0;
+    sqe->user_data = id;
+    return (0);
+}
+
+
+int
+uring_writev (uring_t ur, int fd, const struct iovec *iov, int iovcnt, int id)
+{
+/*  Queues a write of the [iovcnt] buffers described by [iov] to [fd]
+ *    for the uring object [ur].  The request is identified by [id]
+ *    upon completion.
+ *  The caller must not modify [iov] or its buffers until the request has
+ *    completed.
+ *  Returns 0 on success, or -1 on error (with errno set to EBUSY if the
+ *    submission queue is full).
+ */
+    struct io_uring_sqe *sqe;
+
+    if (!ur || (fd < 0) || !iov || (iovcnt <= 0)) {
+        errno = EINVAL;
+        return (-1);
+    }
+    if (!(sqe = _uring_get_sqe (ur))) {
+        return (-1);
+    }
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) iov;
+    sqe->len = iovcnt;
+    sqe->user_data = id;
+    return (0);
+}
+
+
+int
+uring_submit (uring_t ur)
+{
+/*  Submits all queued requests of the uring object [ur], and waits for
+ *    every outstanding request to complete.
+ *  In the common case, this requires a single system call.
+ *  Returns the number of completions ready to be reaped, or -1 on error.
+ */
+    unsigned int to_submit;
+    unsigned int num_ready;
+    int          n;
+
+    if (!ur) {
+        errno = EINVAL;
+        return (-1);
+    }
+    while (ur->num_queued > 0) {
+        to_submit = ur->num_queued;
+        n = _uring_enter (ur, to_submit, ur->num_inflight + to_submit);
+        if (n < 0) {
+            if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) {
+                continue;
+            }
+            return (-1);
+        }
+        ur->num_queued -= n;
+        ur->num_inflight += n;
+    }
+    for (;;) {
+        num_ready = __atomic_load_n (ur->cq_tail, __ATOMIC_ACQUIRE)
+            - *ur->cq_head;
+        if (num_ready >= ur->num_inflight) {
+            break;
+        }
+        n = _uring_enter (ur, 0, ur->num_inflight - num_ready);
+        if ((n < 0) && (errno != EINTR) && (errno != EAGAIN)) {
+            return (-1);
+        }
+    }
+    return (num_ready);
+}
+
+
+int
+uring_reap (uring_t ur, int *id_ptr, int *res_ptr)
+{
+/*  Retrieves the next completion from the uring object [ur], setting [id_ptr]
+ *    to the request's id and [res_ptr] to its result (ie, the return value
+ *    of the corresponding read() or write(), or -errno on error).
+ *  Returns 1 if a completion was retrieved, 0 if none remain,
+ *    or -1 on error.
+ */
+    unsigned int         head;
+    struct io_uring_cqe *cqe;
+
+    if (!ur || !id_ptr || !res_ptr) {
+        errno = EINVAL;
+        return (-1);
+    }
+    head = *ur->cq_head;
+    if (head == __atomic_load_n (ur->cq_tail, __ATOMIC_ACQUIRE)) {
+        return (0);
+    }
+    cqe = &ur->cqes[ head & *ur->cq_mask ];
+    *id_ptr = (int) cqe->user_data;
+    *res_ptr = cqe->res;
+    __atomic_store_n (ur->cq_head, head + 1, __ATOMIC_RELEASE);
+    if (ur->num_inflight > 0) {
+        ur->num_inflight--;
+    }
+    return (1);
+}
+
+
+/*****************************************************************************
+ *  Internal Functions
+ *****************************************************************************/
+
+static struct io_uring_sqe *
+_uring_get_sqe (uring_t ur)
+{
+/*  Returns a zeroed submission queue entry that has been added to the tail
+ *    of the submission queue, or NULL if the queue is full.
+ */
+    unsigned int         head;
+    unsigned int         tail;
+    unsigned int         idx;
+    struct io_uring_sqe *sqe;
+
+    head = __atomic_load_n (ur->sq_head, __ATOMIC_ACQUIRE);
+    tail = *ur->sq_tail;
+    if ((tail - head >= ur->num_entries)
+            || (ur->num_queued + ur->num_inflight >= ur->num_entries)) {
+        errno = EBUSY;
+        return (NULL);
+    }
+    idx = tail & *ur->sq_mask;
+    sqe = &ur->sqes[ idx ];
+    memset (sqe, 0, sizeof (*sqe));
+    ur->sq_array[ idx ] = idx;
+    __atomic_store_n (ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ur->num_queued++;
+    return (sqe);
+}
+
+
+static int
+_uring_enter (uring_t ur, unsigned int to_submit, unsigned int min_complete)
+{
+/*  Submits up to [to_submit] requests and waits for at least [min_complete]
+ *    completions to be available.
+ *  Returns the number of requests submitted, or -1 on error.
+ */
+    unsigned int flags = (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0;
+
+    return (syscall (__NR_io_uring_enter, ur->fd, to_submit, min_complete,
+        flags, NULL, 0));
+}
+
+
+#else /* !HAVE_LINUX_IO_URING_H */
+
+/*  Stubs for when io_uring is not available.
+ */
+
+uring_t
+uring_create (int n, int buf_len)
+{
+    errno = ENOSYS;
+    return (NULL);
+}
+
+
+void
+uring_destroy (uring_t ur)
+{
+    return;
+}
+
+
+void *
+uring_get_buf (uring_t ur, int idx)
+{
+    errno = ENOSYS;
+    return (NULL);
+}
+
+
+int
+uring_read (uring_t ur, int fd, int idx, int len, int id)
+{
+    errno = ENOSYS;
+    return (-1);
+}
+
+
+int
+uring_writev (uring_t ur, int fd, const struct iovec *iov, int iovcnt, int id)
+{
+    errno = ENOSYS;
+    return (-1);
+}
+
+
+int
+uring_submit (uring_t ur)
+{
+    errno = ENOSYS;
+    return (-1);
+}
+
+
+int
+uring_reap (uring_t ur, int *id_ptr, int *res_ptr)
+{
+    errno = ENOSYS;
+    return (-1);
+}
+
+#endif /* !HAVE_LINUX_IO_URING_H */
@@ -0,0 +1,65 @@
+/*****************************************************************************
+ *  Written by Chris Dunlap <cdunlap@llnl.gov>.
+ *  Copyright (C) 2007-2013 Lawrence Livermore National Security, LLC.
+ *  Copyright (C) 2001-2007 The Regents of the University of California.
+ *  UCRL-CODE-2002-009.
+ *
+ *  This file is part of ConMan: The Console Manager.
+ *  For details, see <http://conman.googlecode.com/>.
+ *
+ *  ConMan is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  ConMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with ConMan.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#ifndef _URING_H
+#define _URING_H
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/uio.h>
+
+
+/*****************************************************************************
+ *  Data Types
+ *****************************************************************************/
+
+typedef struct uring * uring_t;
+/*
+ *  Opaque data pointer for a uring object.
+ */
+
+
+/*****************************************************************************
+ *  Functions
+ *****************************************************************************/
+
+uring_t uring_create (int n, int buf_len);
+
+void uring_destroy (uring_t ur);
+
+void * uring_get_buf (uring_t ur, int idx);
+
+int uring_read (uring_t ur, int fd, int idx, int len, int id);
+
+int uring_writev (uring_t ur, int fd, const struct iovec *iov, int iovcnt,
+    int id);
+
+int uring_submit (uring_t ur);
+
+int uring_reap (uring_t ur, int *id_ptr, int *res_ptr);
+
+
+#endif /* !_URING_H */
@@ -195,6 +195,44 @@ char * host_name_to_cname(const char *src, char *dst, int dstlen)
 }
 
 
+ssize_t read_sock_line(int sd, void *buf, size_t maxlen)
+{
+    ssize_t n, rc;
+    unsigned char *p;
+    unsigned char *q;
+
+    n = 0;
+    p = buf;
+    while (n < maxlen - 1) {            /* reserve space for NUL-termination */
+
+        rc = recv(sd, p + n, maxlen - 1 - n, MSG_PEEK);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            return(-1);
+        }
+        else if (rc == 0) {
+            break;                      /* EOF */
+        }
+        /*  Only consume the peeked data up to (and including) the newline.
+         */
+        if ((q = memchr(p + n, '\n', rc)))
+            rc = q - (p + n) + 1;
+
+        if ((rc = recv(sd, p + n, rc, 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return(-1);
+        }
+        n += rc;
+        if (q)
+            break;                      /* store newline, like fgets() */
+    }
+    p[n] = '\0';                        /* NUL-terminate, like fgets() */
+    return(n);
+}
+
+
 static int copy_hostent(const struct hostent *src, char *buf, int len)
 {
 /*  Copies the (src) hostent struct (and all of its associated data)
@@ -87,6 +87,14 @@ char * host_name_to_cname(const char *src, char *dst, int dstlen);
  *    or NULL on error.
  *  Note that this routine is thread-safe.
  */
+ssize_t read_sock_line(int sd, void *buf, size_t maxlen);
+/*
+ *  Reads a line from the stream socket (sd) into the buffer (buf) of length
+ *    (maxlen), in the same manner as read_line().  But rather than reading a
+ *    byte at a time, data is peeked in order to read the line in as few
+ *    calls as possible without consuming any data that follows it.
+ *  Returns the number of bytes read, 0 on EOF, or -1 on error.
+ */
 
 #if ! HAVE_INET_PTON
 int inet_pton(int family, const char *str, void *addr);
@@ -36,6 +36,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 #include <time.h>
 #include "log.h"
 #include "util-str.h"
@@ -45,6 +46,13 @@
 #define MAX_STR_SIZE 1024
 
 
+/*  Cache of the time string most recently written by write_time_string().
+ */
+static pthread_mutex_t time_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static time_t          time_cache_t = 0;
+static char            time_cache_str[21];
+
+
 char * create_string(const char *str)
 {
     char *p;
@@ -346,13 +354,77 @@ int write_time_string(time_t t, char *dst, size_t dstlen)
     if (dstlen <= 20) {                 /* "YYYY-MM-DD HH:MM:SS " + NUL */
         return(0);
     }
-    get_localtime(&t, &tm);
+    if (t == 0) {
+        if (time(&t) == (time_t) -1) {
+            log_err(errno, "time() failed");
+        }
+    }
+    x_pthread_mutex_lock(&time_cache_lock);
+    if ((t != time_cache_t) || (time_cache_str[0] == '\0')) {
+        get_localtime(&t, &tm);
+        n = strftime(time_cache_str, sizeof(time_cache_str),
+            "%Y-%m-%d %H:%M:%S ", &tm);
+        if (n == 0) {
+            time_cache_str[0] = '\0';
+        }
+        assert((n == 0) || (n == 20));
+        time_cache_t = t;
+    }
+    n = strlen(time_cache_str);
+    memcpy(dst, time_cache_str, n + 1);
+    x_pthread_mutex_unlock(&time_cache_lock);
+    return(n);
+}
+
+
+int write_fmt_time_string(int fmt, char *dst, size_t dstlen)
+{
+    struct timeval tv;
+    struct timespec ts;
+    int n;
+    long frac;
+    int digits;
+    char *p;
 
-    if (!(n = strftime(dst, dstlen, "%Y-%m-%d %H:%M:%S ", &tm))) {
+    if (dstlen <= MAX_TIME_STRING_LEN) {
         return(0);
     }
-    assert(n == 20);
-    return(n);
+    if (fmt == TIME_FMT_MONO) {
+        if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+            log_err(errno, "clock_gettime() failed");
+        }
+        n = snprintf(dst, dstlen, "[%5ld.%06ld] ",
+            (long) ts.tv_sec, (long) ts.tv_nsec / 1000);
+        return(((n < 0) || (n >= dstlen)) ? 0 : n);
+    }
+    if ((fmt != TIME_FMT_MSEC) && (fmt != TIME_FMT_USEC)) {
+        return(write_time_string(0, dst, dstlen));
+    }
+    if (gettimeofday(&tv, NULL) < 0) {
+        log_err(errno, "gettimeofday() failed");
+    }
+    if ((n = write_time_string(tv.tv_sec, dst, dstlen)) == 0) {
+        return(0);
+    }
+    /*  Replace the trailing space with the fractional seconds.
+     */
+    if (fmt == TIME_FMT_MSEC) {
+        frac = tv.tv_usec / 1000;
+        digits = 3;
+    }
+    else {
+        frac = tv.tv_usec;
+        digits = 6;
+    }
+    p = &dst[n - 1];
+    *p++ = '.';
+    p[digits] = ' ';
+    p[digits + 1] = '\0';
+    for (n = digits - 1; n >= 0; n--) {
+        p[n] = '0' + (frac % 10);
+        frac /= 10;
+    }
+    return(p + digits + 1 - dst);
 }
 
 
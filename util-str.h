@@ -33,6 +33,16 @@
 #include <unistd.h>
 
 
+/*  Formats of the time string written by write_fmt_time_string().
+ */
+#define TIME_FMT_SEC            0       /* "YYYY-MM-DD HH:MM:SS "            */
+#define TIME_FMT_MSEC           1       /* "YYYY-MM-DD HH:MM:SS.mmm "        */
+#define TIME_FMT_USEC           2       /* "YYYY-MM-DD HH:MM:SS.uuuuuu "     */
+#define TIME_FMT_MONO           3       /* "[sssss.uuuuuu] " since boot      */
+
+#define MAX_TIME_STRING_LEN     27      /* longest time str (excluding NUL)  */
+
+
 char * create_string(const char *str);
 /*
  *  Duplicates string (str) and returns a new string
@@ -132,6 +142,17 @@ int write_time_string(time_t t, char *dst, size_t dstlen);
  *  Writes the time string "YYYY-MM-DD HH:MM:SS " specified by (t)
  *    into the buffer (dst) of size (dstlen).
  *  If no time is given (t=0), the current date & time is used.
+ *  The most recent string is cached so the local time is only converted
+ *    once per second by callers writing the current time.
+ *  Returns the number of characters written (not including the NUL).
+ */
+
+int write_fmt_time_string(int fmt, char *dst, size_t dstlen);
+/*
+ *  Writes the current time string in the format (fmt) into the buffer (dst)
+ *    of size (dstlen), which must exceed MAX_TIME_STRING_LEN.
+ *  The TIME_FMT_MONO format is the time elapsed on the monotonic clock
+ *    (ie, since boot on Linux) in the same manner as kernel messages.
  *  Returns the number of characters written (not including the NUL).
  */
 
@@ -74,3 +74,45 @@ SigFunc * posix_signal(int signum, SigFunc *f)
         log_err(errno, "signal(%d) failed", signum);
     return(act0.sa_handler);
 }
+
+
+void unblock_signals(void)
+{
+/*  Unblocks all signals for the calling process.
+ */
+    sigset_t sigset;
+
+    sigemptyset(&sigset);
+    if (sigprocmask(SIG_SETMASK, &sigset, NULL) < 0)
+        log_err(errno, "sigprocmask() failed");
+    return;
+}
+
+
+int create_signal_blocked_thread(pthread_t *tid, PthreadFunc f, void *arg)
+{
+/*  Creates a thread running (f) on (arg) that inherits a signal mask blocking
+ *    the signals handled by the calling thread.
+ *  Returns 0 on success, or an error number on failure.
+ */
+    sigset_t sigset;
+    sigset_t sigsetOld;
+    int rc;
+    int e;
+
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGCHLD);
+    sigaddset(&sigset, SIGHUP);
+    sigaddset(&sigset, SIGINT);
+    sigaddset(&sigset, SIGTERM);
+
+    if ((e = pthread_sigmask(SIG_BLOCK, &sigset, &sigsetOld)) != 0) {
+        log_err(e, "Unable to block signals for new thread");
+    }
+    rc = pthread_create(tid, NULL, f, arg);
+
+    if ((e = pthread_sigmask(SIG_SETMASK, &sigsetOld, NULL)) != 0) {
+        log_err(e, "Unable to restore signal mask");
+    }
+    return(rc);
+}
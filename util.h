@@ -30,6 +30,9 @@
 #endif /* HAVE_CONFIG_H */
 
 
+#include <pthread.h>
+
+
 typedef void * (*PthreadFunc)(void *);
 
 typedef void SigFunc(int);
@@ -49,5 +52,19 @@ SigFunc * posix_signal(int signum, SigFunc *f);
  *  A wrapper for the historical signal() function to do things the Posix way.
  */
 
+void unblock_signals(void);
+/*
+ *  Unblocks all signals for the calling process (eg, a forked child that
+ *    inherited its parent's signal mask before calling exec()).
+ */
+
+int create_signal_blocked_thread(pthread_t *tid, PthreadFunc f, void *arg);
+/*
+ *  Creates a thread running (f) on (arg) with SIGCHLD, SIGHUP, SIGINT, and
+ *    SIGTERM blocked so these are left to be handled by the calling thread.
+ *    The calling thread's signal mask is restored before returning.
+ *  Returns 0 on success, or an error number if the thread was not created.
+ */
+
 
 #endif /* !_UTIL_H */
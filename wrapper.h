@@ -59,6 +59,66 @@
              log_err(errno, "pthread_mutex_destroy() failed");                \
      } while (0)
 
+#  define x_pthread_rwlock_init(RWLOCK,ATTR)                                  \
+     do {                                                                     \
+         if ((errno = pthread_rwlock_init((RWLOCK), (ATTR))) != 0)            \
+             log_err(errno, "pthread_rwlock_init() failed");                  \
+     } while (0)
+
+#  define x_pthread_rwlock_rdlock(RWLOCK)                                     \
+     do {                                                                     \
+         if ((errno = pthread_rwlock_rdlock(RWLOCK)) != 0)                    \
+             log_err(errno, "pthread_rwlock_rdlock() failed");                \
+     } while (0)
+
+#  define x_pthread_rwlock_wrlock(RWLOCK)                                     \
+     do {                                                                     \
+         if ((errno = pthread_rwlock_wrlock(RWLOCK)) != 0)                    \
+             log_err(errno, "pthread_rwlock_wrlock() failed");                \
+     } while (0)
+
+#  define x_pthread_rwlock_unlock(RWLOCK)                                     \
+     do {                                                                     \
+         if ((errno = pthread_rwlock_unlock(RWLOCK)) != 0)                    \
+             log_err(errno, "pthread_rwlock_unlock() failed");                \
+     } while (0)
+
+#  define x_pthread_rwlock_destroy(RWLOCK)                                    \
+     do {                                                                     \
+         if ((errno = pthread_rwlock_destroy(RWLOCK)) != 0)                   \
+             log_err(errno, "pthread_rwlock_destroy() failed");               \
+     } while (0)
+
+#  define x_pthread_cond_init(COND,ATTR)                                      \
+     do {                                                                     \
+         if ((errno = pthread_cond_init((COND), (ATTR))) != 0)                \
+             log_err(errno, "pthread_cond_init() failed");                    \
+     } while (0)
+
+#  define x_pthread_cond_wait(COND,MUTEX)                                     \
+     do {                                                                     \
+         if ((errno = pthread_cond_wait((COND), (MUTEX))) != 0)               \
+             log_err(errno, "pthread_cond_wait() failed");                    \
+     } while (0)
+
+#  define x_pthread_cond_signal(COND)                                         \
+     do {                                                                     \
+         if ((errno = pthread_cond_signal(COND)) != 0)                        \
+             log_err(errno, "pthread_cond_signal() failed");                  \
+     } while (0)
+
+#  define x_pthread_cond_broadcast(COND)                                      \
+     do {                                                                     \
+         if ((errno = pthread_cond_broadcast(COND)) != 0)                     \
+             log_err(errno, "pthread_cond_broadcast() failed");               \
+     } while (0)
+
+#  define x_pthread_cond_destroy(COND)                                        \
+     do {                                                                     \
+         if ((errno = pthread_cond_destroy(COND)) != 0)                       \
+             log_err(errno, "pthread_cond_destroy() failed");                 \
+     } while (0)
+
 #  define x_pthread_detach(THREAD)                                            \
      do {                                                                     \
          if ((errno = pthread_detach(THREAD)) != 0)                           \
@@ -71,6 +131,16 @@
 #  define x_pthread_mutex_lock(MUTEX)
 #  define x_pthread_mutex_unlock(MUTEX)
 #  define x_pthread_mutex_destroy(MUTEX)
+#  define x_pthread_rwlock_init(RWLOCK,ATTR)
+#  define x_pthread_rwlock_rdlock(RWLOCK)
+#  define x_pthread_rwlock_wrlock(RWLOCK)
+#  define x_pthread_rwlock_unlock(RWLOCK)
+#  define x_pthread_rwlock_destroy(RWLOCK)
+#  define x_pthread_cond_init(COND,ATTR)
+#  define x_pthread_cond_wait(COND,MUTEX)
+#  define x_pthread_cond_signal(COND)
+#  define x_pthread_cond_broadcast(COND)
+#  define x_pthread_cond_destroy(COND)
 #  define x_pthread_detach(THREAD)
 
 #endif /* WITH_PTHREADS */